@@ -161,19 +161,23 @@ static void i2s_set_filter(struct i2s_device *i2s_dev, int mode, uint32_t channe
 		case AFMT_U8:
 			if (channels == 1) {
 				dp->filter = convert_8bits_stereo2mono_signed2unsigned;
+				dp->filter_copy = convert_8bits_stereo2mono_signed2unsigned_copy;
 				snd_debug_print("dp->filter convert_8bits_stereo2mono_signed2unsigned .\n");
 			} else {
 				//dp->filter = convert_8bits_signed2unsigned;
 				dp->filter = NULL; //hardware convert
+				dp->filter_copy = NULL;
 				snd_debug_print("dp->filter convert_8bits_signed2unsigned.\n");
 			}
 			break;
 		case AFMT_S8:
 			if (channels == 1) {
 				dp->filter = convert_8bits_stereo2mono;
+				dp->filter_copy = convert_8bits_stereo2mono_copy;
 				snd_debug_print("dp->filter convert_8bits_stereo2mono\n");
 			} else {
 				dp->filter = NULL;
+				dp->filter_copy = NULL;
 				snd_debug_print("dp->filter null\n");
 			}
 			break;
@@ -183,17 +187,21 @@ static void i2s_set_filter(struct i2s_device *i2s_dev, int mode, uint32_t channe
 #if defined(CONFIG_SOC_T10) || defined(CONFIG_SOC_T20) || defined(CONFIG_SOC_T30) || \
     defined(CONFIG_SOC_T21) || defined(CONFIG_SOC_T31) || defined(CONFIG_SOC_C100)
 				dp->filter = convert_16bits_stereo2mono_inno;
+				dp->filter_copy = convert_16bits_stereo2mono_inno_copy;
 #else
 				dp->filter = convert_16bits_stereo2mono;
+				dp->filter_copy = convert_16bits_stereo2mono_copy;
 #endif
 				snd_debug_print("dp->filter convert_16bits_stereo2mono\n");
 			} else {
 				dp->filter = NULL;
+				dp->filter_copy = NULL;
 				snd_debug_print("dp->filter null\n");
 			}
 			break;
 		default :
 			dp->filter = NULL;
+			dp->filter_copy = NULL;
 			snd_error_print("AUDIO DEVICE :filter set error.\n");
 	}
 }
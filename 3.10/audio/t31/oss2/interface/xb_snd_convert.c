@@ -0,0 +1,244 @@
+/**
+ * xb_snd_convert.c
+ *
+ * Sample format and channel converters of the dsp interface.
+ *
+ * Every converter has a fused form, convert_*_copy(dst, src, ...), that
+ * reads each sample once and writes the result straight to dst, and an
+ * in-place form, convert_*(buff, ...), kept for dp->filter. The aligned
+ * part is processed a 32-bit word at a time (SWAR): output word i only
+ * depends on input words 2i and 2i+1, which are loaded before it is
+ * stored, so dst == src is safe. Results are bit-exact with the former
+ * per-sample loops, which still handle unaligned buffers and the tail.
+ */
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <asm/byteorder.h>
+#include "xb_snd_dsp.h"
+
+#ifdef __LITTLE_ENDIAN
+/* first sample of a word sits in its low half */
+#define SWAR_LO16(w)		((w) & 0xffff)
+#define SWAR_PACK16(a, b)	((a) | ((b) << 16))
+#define SWAR_EVEN8(w)		(((w) & 0xff) | (((w) >> 8) & 0xff00))
+#else
+#define SWAR_LO16(w)		((w) >> 16)
+#define SWAR_PACK16(a, b)	(((a) << 16) | (b))
+#define SWAR_EVEN8(w)		((((w) >> 16) & 0xff00) | (((w) >> 8) & 0xff))
+#endif
+/* 16-bit wrap-around sum of the two samples of a word */
+#define SWAR_SUM16(w)		(((w) + ((w) >> 16)) & 0xffff)
+/* flipping the top bit is adding 0x80 modulo 256 */
+#define SWAR_SIGN8		0x80808080
+
+static inline bool words_aligned(const void *dst, const void *src)
+{
+	return !(((unsigned long)dst | (unsigned long)src) & 0x3);
+}
+
+/********************************************************\
+ * 8 bits
+\********************************************************/
+int convert_8bits_signed2unsigned_copy(void *dst, const void *src, int *counter, int needed_size)
+{
+	const unsigned char *ucsrc = src;
+	unsigned char *ucdst = dst;
+	int i = 0;
+
+	if (needed_size < (*counter)) {
+		*counter = needed_size;
+	}
+
+	if (words_aligned(dst, src)) {
+		const u32 *wsrc = src;
+		const u32 *wend = wsrc + ((*counter) >> 2);
+		u32 *wdst = dst;
+
+		for (; wsrc != wend; wsrc++, wdst++)
+			*wdst = *wsrc ^ SWAR_SIGN8;
+		i = (*counter) & ~0x3;
+	}
+
+	for (; i < *counter; i++) {
+		ucdst[i] = ucsrc[i] + 0x80;
+	}
+
+	return *counter;
+}
+
+static inline int stereo2mono_8bits(void *dst, const void *src, int *data_len,
+				    int needed_size, u32 sign)
+{
+	const unsigned char *uc_src = src;
+	unsigned char *uc_dst = dst;
+	int mono_cur = 0, stereo_cur = 0;
+
+	if ((*data_len) > needed_size*2)
+		*data_len = needed_size*2;
+
+	*data_len = (*data_len) & (~0x1);
+
+	if (words_aligned(dst, src)) {
+		const u32 *wsrc = src;
+		const u32 *wend = wsrc + ((*data_len) >> 3) * 2;
+		u32 *wdst = dst;
+		u32 w0, w1;
+
+		/* 8 stereo bytes in, 4 mono bytes out */
+		for (; wsrc != wend; wsrc += 2, wdst++) {
+			w0 = wsrc[0];
+			w1 = wsrc[1];
+			*wdst = SWAR_PACK16(SWAR_EVEN8(w0), SWAR_EVEN8(w1)) ^ sign;
+		}
+		stereo_cur = (*data_len) & ~0x7;
+		mono_cur = stereo_cur >> 1;
+	}
+
+	/* remaining data */
+	for (; stereo_cur < (*data_len); stereo_cur += 2, mono_cur++) {
+		uc_dst[mono_cur] = uc_src[stereo_cur] ^ (sign & 0xff);
+	}
+
+	return ((*data_len) >> 1);
+}
+
+int convert_8bits_stereo2mono_copy(void *dst, const void *src, int *data_len, int needed_size)
+{
+	return stereo2mono_8bits(dst, src, data_len, needed_size, 0);
+}
+
+int convert_8bits_stereo2mono_signed2unsigned_copy(void *dst, const void *src, int *data_len, int needed_size)
+{
+	return stereo2mono_8bits(dst, src, data_len, needed_size, SWAR_SIGN8);
+}
+
+/********************************************************\
+ * 16 bits
+\********************************************************/
+/* mix: keep the left sample, or sum both with 16-bit wrap-around */
+static inline int stereo2mono_16bits(void *dst, const void *src, int *data_len,
+				     int needed_size, bool mix)
+{
+	const unsigned short *us_src = src;
+	unsigned short *us_dst = dst;
+	int mono_cur = 0, stereo_cur = 0;
+	int samples = 0;
+
+	if ((*data_len) > needed_size*2)
+		*data_len = needed_size*2;
+
+	/*when 16bit format one sample has four bytes
+	 *so we can not operat the singular byte*/
+	*data_len = (*data_len) & (~0x3);
+	samples = (*data_len) >> 1;
+
+	if (words_aligned(dst, src)) {
+		const u32 *wsrc = src;
+		const u32 *wend = wsrc + (samples >> 2) * 2;
+		u32 *wdst = dst;
+		u32 w0, w1;
+
+		/* two stereo frames in, two mono samples out */
+		for (; wsrc != wend; wsrc += 2, wdst++) {
+			w0 = wsrc[0];
+			w1 = wsrc[1];
+			if (mix)
+				*wdst = SWAR_PACK16(SWAR_SUM16(w0), SWAR_SUM16(w1));
+			else
+				*wdst = SWAR_PACK16(SWAR_LO16(w0), SWAR_LO16(w1));
+		}
+		stereo_cur = samples & ~0x3;
+		mono_cur = stereo_cur >> 1;
+	}
+
+	/* remaining data */
+	for (; stereo_cur < samples; stereo_cur += 2, mono_cur++) {
+		if (mix)
+			us_dst[mono_cur] = us_src[stereo_cur] + us_src[stereo_cur + 1];
+		else
+			us_dst[mono_cur] = us_src[stereo_cur];
+	}
+
+	return ((*data_len) >> 1);
+}
+
+int convert_16bits_stereo2mono_copy(void *dst, const void *src, int *data_len, int needed_size)
+{
+	return stereo2mono_16bits(dst, src, data_len, needed_size, false);
+}
+
+int convert_16bits_stereo2mono_inno_copy(void *dst, const void *src, int *data_len, int needed_size)
+{
+	return stereo2mono_16bits(dst, src, data_len, needed_size, true);
+}
+
+/* same bits as the inno variant: short + short truncated back to short */
+int convert_16bits_stereomix2mono_copy(void *dst, const void *src, int *data_len, int needed_size)
+{
+	return stereo2mono_16bits(dst, src, data_len, needed_size, true);
+}
+
+/********************************************************\
+ * in-place filters
+\********************************************************/
+/*
+ * Convert signed byte to unsiged byte
+ *
+ * Mapping:
+ * 	signed		unsigned
+ *	0x00 (0)	0x80 (128)
+ *	0x01 (1)	0x81 (129)
+ *	......		......
+ *	0x7f (127)	0xff (255)
+ *	0x80 (-128)	0x00 (0)
+ *	0x81 (-127)	0x01 (1)
+ *	......		......
+ *	0xff (-1)	0x7f (127)
+ */
+int convert_8bits_signed2unsigned(void *buffer, int *counter,int needed_size)
+{
+	return convert_8bits_signed2unsigned_copy(buffer, buffer, counter, needed_size);
+}
+
+/*
+ * Convert stereo data to mono data, data width: 8 bits/channel
+ *
+ * buff:	buffer address
+ * data_len:	data length in kernel space, the length of stereo data
+ *		calculated by "node->end - node->start"
+ */
+int convert_8bits_stereo2mono(void *buff, int *data_len,int needed_size)
+{
+	return convert_8bits_stereo2mono_copy(buff, buff, data_len, needed_size);
+}
+
+/*
+ * Convert stereo data to mono data, and convert signed byte to unsigned byte.
+ *
+ * data width: 8 bits/channel
+ */
+int convert_8bits_stereo2mono_signed2unsigned(void *buff, int *data_len,int needed_size)
+{
+	return convert_8bits_stereo2mono_signed2unsigned_copy(buff, buff, data_len, needed_size);
+}
+
+/*
+ * Convert stereo data to mono data, data width: 16 bits/channel
+ */
+int convert_16bits_stereo2mono(void *buff, int *data_len, int needed_size)
+{
+	return convert_16bits_stereo2mono_copy(buff, buff, data_len, needed_size);
+}
+
+int convert_16bits_stereo2mono_inno(void *buff, int *data_len, int needed_size)
+{
+	return convert_16bits_stereo2mono_inno_copy(buff, buff, data_len, needed_size);
+}
+
+/*
+ * convert normal 16bit stereo data to mono data
+ */
+int convert_16bits_stereomix2mono(void *buff, int *data_len,int needed_size)
+{
+	return convert_16bits_stereomix2mono_copy(buff, buff, data_len, needed_size);
+}
@@ -16,6 +16,9 @@
 #include <linux/delay.h>
 #include <linux/slab.h>
 #include <linux/interrupt.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <audio_ring.h>
 #include "xb_snd_dsp.h"
 #include <asm/mipsregs.h>
 #include <asm/io.h>
@@ -33,6 +36,10 @@ static int dmic_amic_sync = 0;
 module_param(dmic_amic_sync, int, S_IRUGO);
 MODULE_PARM_DESC(dmic_amic_sync, "sync flag of amic and dmic");
 
+static int dma_period_irq = 1;
+module_param(dma_period_irq, int, S_IRUGO);
+MODULE_PARM_DESC(dma_period_irq, "advance pointers from dma period interrupts, 0 polls with the hrtimer");
+
 #ifdef CONFIG_JZ_TS_DMIC
 extern struct mic_dev *g_mic_dev;
 #endif
@@ -138,306 +145,71 @@ static void snd_release_dma(struct dsp_pipe *dp, struct device *dev)
 	}
 }
 
-#if 0
+/* called by the dma driver each time a fragment is done */
 static void snd_dma_callback(void *arg)
 {
 	struct dsp_pipe *dp = (struct dsp_pipe *)arg;
-	complete(&dp->dma_completion);
-	return;
-}
-#endif
-/********************************************************\
- * filter
-\********************************************************/
-/*
- * Convert signed byte to unsiged byte
- *
- * Mapping:
- * 	signed		unsigned
- *	0x00 (0)	0x80 (128)
- *	0x01 (1)	0x81 (129)
- *	......		......
- *	0x7f (127)	0xff (255)
- *	0x80 (-128)	0x00 (0)
- *	0x81 (-127)	0x01 (1)
- *	......		......
- *	0xff (-1)	0x7f (127)
- */
-int convert_8bits_signed2unsigned(void *buffer, int *counter,int needed_size)
-{
-	int i;
-	int counter_8align = 0;
-	unsigned char *ucsrc	= buffer;
-	unsigned char *ucdst	= buffer;
-
-	if (needed_size < (*counter)) {
-		*counter = needed_size;
-	}
-	counter_8align = (*counter) & ~0x7;
-
-	for (i = 0; i < counter_8align; i+=8) {
-		*(ucdst + i + 0) = *(ucsrc + i + 0) + 0x80;
-		*(ucdst + i + 1) = *(ucsrc + i + 1) + 0x80;
-		*(ucdst + i + 2) = *(ucsrc + i + 2) + 0x80;
-		*(ucdst + i + 3) = *(ucsrc + i + 3) + 0x80;
-		*(ucdst + i + 4) = *(ucsrc + i + 4) + 0x80;
-		*(ucdst + i + 5) = *(ucsrc + i + 5) + 0x80;
-		*(ucdst + i + 6) = *(ucsrc + i + 6) + 0x80;
-		*(ucdst + i + 7) = *(ucsrc + i + 7) + 0x80;
-	}
-
-	BUG_ON(i != counter_8align);
-
-	for (i = counter_8align; i < *counter; i++) {
-		*(ucdst + i) = *(ucsrc + i) + 0x80;
-	}
-
-	return *counter;
+	u64 now = ktime_to_ns(ktime_get());
+	u64 delta = now - dp->period_last_ns;
+	u64 jitter = 0;
+
+	if(dp->period_irqs && delta < NSEC_PER_SEC){
+		/* jitter against a running average of the period */
+		if(!dp->period_avg_ns)
+			dp->period_avg_ns = delta;
+		jitter = delta > dp->period_avg_ns ? delta - dp->period_avg_ns : dp->period_avg_ns - delta;
+		dp->period_avg_ns = (dp->period_avg_ns * 7 + delta) >> 3;
+		dp->jitter_sum_ns += jitter;
+		if(jitter > dp->jitter_max_ns)
+			dp->jitter_max_ns = jitter;
+	}
+	dp->period_last_ns = now;
+	dp->period_irqs++;
+
+	if(dp->dsp)
+		schedule_work(&dp->dsp->workqueue);
 }
 
-/*
- * Convert stereo data to mono data, data width: 8 bits/channel
- *
- * buff:	buffer address
- * data_len:	data length in kernel space, the length of stereo data
- *		calculated by "node->end - node->start"
- */
-int convert_8bits_stereo2mono(void *buff, int *data_len,int needed_size)
+/* true if a running pipe has not seen a period interrupt since the last tick */
+static bool snd_dma_period_stalled(struct dsp_pipe *dp)
 {
-	/* stride = 16 bytes = 2 channels * 1 byte * 8 pipelines */
-	int data_len_16aligned = 0;
-	int mono_cur, stereo_cur;
-	unsigned char *uc_buff = buff;
-
-	if ((*data_len) > needed_size*2)
-		*data_len = needed_size*2;
-
-	*data_len = (*data_len) & (~0x1);
-
-	data_len_16aligned = (*data_len)& ~0xf;
-
-	/* copy 8 times each loop */
-	for (stereo_cur = mono_cur = 0;
-	     stereo_cur < data_len_16aligned;
-	     stereo_cur += 16, mono_cur += 8) {
-
-		uc_buff[mono_cur + 0] = uc_buff[stereo_cur + 0];
-		uc_buff[mono_cur + 1] = uc_buff[stereo_cur + 2];
-		uc_buff[mono_cur + 2] = uc_buff[stereo_cur + 4];
-		uc_buff[mono_cur + 3] = uc_buff[stereo_cur + 6];
-		uc_buff[mono_cur + 4] = uc_buff[stereo_cur + 8];
-		uc_buff[mono_cur + 5] = uc_buff[stereo_cur + 10];
-		uc_buff[mono_cur + 6] = uc_buff[stereo_cur + 12];
-		uc_buff[mono_cur + 7] = uc_buff[stereo_cur + 14];
-	}
-
-	BUG_ON(stereo_cur != data_len_16aligned);
-
-	/* remaining data */
-	for (; stereo_cur < (*data_len); stereo_cur += 2, mono_cur++) {
-		uc_buff[mono_cur] = uc_buff[stereo_cur];
-	}
-
-	return ((*data_len) >> 1);
-}
-
-/*
- * Convert stereo data to mono data, and convert signed byte to unsigned byte.
- *
- * data width: 8 bits/channel
- *
- * buff:	buffer address
- * data_len:	data length in kernel space, the length of stereo data
- *		calculated by "node->end - node->start"
- */
-int convert_8bits_stereo2mono_signed2unsigned(void *buff, int *data_len,int needed_size)
-{
-	/* stride = 16 bytes = 2 channels * 1 byte * 8 pipelines */
-	int data_len_16aligned = 0;
-	int mono_cur, stereo_cur;
-	unsigned char *uc_buff = buff;
-
-	if ((*data_len) > needed_size*2)
-		*data_len = needed_size*2;
-
-	*data_len = (*data_len) & (~0x1);
-
-	data_len_16aligned = (*data_len) & ~0xf;
-
-	/* copy 8 times each loop */
-	for (stereo_cur = mono_cur = 0;
-	     stereo_cur < data_len_16aligned;
-	     stereo_cur += 16, mono_cur += 8) {
-
-		uc_buff[mono_cur + 0] = uc_buff[stereo_cur + 0] + 0x80;
-		uc_buff[mono_cur + 1] = uc_buff[stereo_cur + 2] + 0x80;
-		uc_buff[mono_cur + 2] = uc_buff[stereo_cur + 4] + 0x80;
-		uc_buff[mono_cur + 3] = uc_buff[stereo_cur + 6] + 0x80;
-		uc_buff[mono_cur + 4] = uc_buff[stereo_cur + 8] + 0x80;
-		uc_buff[mono_cur + 5] = uc_buff[stereo_cur + 10] + 0x80;
-		uc_buff[mono_cur + 6] = uc_buff[stereo_cur + 12] + 0x80;
-		uc_buff[mono_cur + 7] = uc_buff[stereo_cur + 14] + 0x80;
-	}
-
-	BUG_ON(stereo_cur != data_len_16aligned);
+	bool stalled = false;
 
-	/* remaining data */
-	for (; stereo_cur < (*data_len); stereo_cur += 2, mono_cur++) {
-		uc_buff[mono_cur] = uc_buff[stereo_cur] + 0x80;
-	}
-
-	return ((*data_len) >> 1);
+	if(dp == NULL || !dp->is_trans)
+		return false;
+	stalled = dp->period_irqs == dp->period_irqs_seen;
+	dp->period_irqs_seen = dp->period_irqs;
+	return stalled;
 }
 
-/*
- * Convert stereo data to mono data, data width: 16 bits/channel
- *
- * buff:	buffer address
- * data_len:	data length in kernel space, the length of stereo data
- *		calculated by "node->end - node->start"
- */
-int convert_16bits_stereo2mono(void *buff, int *data_len, int needed_size)
+/* fragment the dma of dp is in, its last known one when the address is off the ring */
+static inline unsigned int snd_dma_fragment(struct dsp_pipe *dp, dma_addr_t addr)
 {
-	/* stride = 32 bytes = 2 channels * 2 byte * 8 pipelines */
-	int data_len_32aligned = 0;
-	int data_cnt_ushort = 0;
-	int mono_cur, stereo_cur;
-	unsigned short *ushort_buff = (unsigned short *)buff;
-
-	if ((*data_len) > needed_size*2)
-		*data_len = needed_size*2;
-
-	/*when 16bit format one sample has four bytes
-	 *so we can not operat the singular byte*/
-	*data_len = (*data_len) & (~0x3);
-
-	data_len_32aligned = (*data_len) & ~0x1f;
-	data_cnt_ushort = data_len_32aligned >> 1;
-
-	/* copy 8 times each loop */
-	for (stereo_cur = mono_cur = 0;
-	     stereo_cur < data_cnt_ushort;
-	     stereo_cur += 16, mono_cur += 8) {
-
-		ushort_buff[mono_cur + 0] = ushort_buff[stereo_cur + 0];
-		ushort_buff[mono_cur + 1] = ushort_buff[stereo_cur + 2];
-		ushort_buff[mono_cur + 2] = ushort_buff[stereo_cur + 4];
-		ushort_buff[mono_cur + 3] = ushort_buff[stereo_cur + 6];
-		ushort_buff[mono_cur + 4] = ushort_buff[stereo_cur + 8];
-		ushort_buff[mono_cur + 5] = ushort_buff[stereo_cur + 10];
-		ushort_buff[mono_cur + 6] = ushort_buff[stereo_cur + 12];
-		ushort_buff[mono_cur + 7] = ushort_buff[stereo_cur + 14];
-	}
-
-	BUG_ON(stereo_cur != data_cnt_ushort);
-
-	/* remaining data */
-	for (; stereo_cur < ((*data_len) >> 1); stereo_cur += 2, mono_cur++) {
-		ushort_buff[mono_cur] = ushort_buff[stereo_cur];
-	}
-
-	return ((*data_len) >> 1);
+	unsigned int offset = 0;
+	unsigned int index = audio_ring_fragment(addr, dp->paddr, dp->fragment_size, dp->fragment_cnt, &offset);
+
+	if(index >= dp->fragment_cnt)
+		return dp->dma_tracer;
+	dp->dma_seen = index;
+	dp->dma_seen_ns = audio_ring_tstamp(ktime_to_ns(ktime_get()), offset, dp->fragment_size, dp->fragment_ns);
+	return index;
 }
 
-int convert_16bits_stereo2mono_inno(void *buff, int *data_len, int needed_size)
+/* how long until the dma plays the io fragment, or since it recorded it */
+static s64 snd_io_latency_us(struct dsp_pipe *dp, bool replay)
 {
-	/* stride = 32 bytes = 2 channels * 2 byte * 8 pipelines */
-	int data_len_32aligned = 0;
-	int data_cnt_ushort = 0;
-	int mono_cur, stereo_cur;
-	unsigned short *ushort_buff = (unsigned short *)buff;
-
-	if ((*data_len) > needed_size*2)
-		*data_len = needed_size*2;
-
-	/*when 16bit format one sample has four bytes
-	 *so we can not operat the singular byte*/
-	*data_len = (*data_len) & (~0x3);
-
-	data_len_32aligned = (*data_len) & ~0x1f;
-	data_cnt_ushort = data_len_32aligned >> 1;
+	u64 now = ktime_to_ns(ktime_get());
+	u64 tstamp = 0;
 
-	/* copy 8 times each loop */
-	for (stereo_cur = mono_cur = 0;
-	     stereo_cur < data_cnt_ushort;
-	     stereo_cur += 16, mono_cur += 8) {
-
- 		 ushort_buff[mono_cur + 0] = ushort_buff[stereo_cur + 0] + ushort_buff[stereo_cur + 1];
-		 ushort_buff[mono_cur + 1] = ushort_buff[stereo_cur + 2] + ushort_buff[stereo_cur + 3];
-		 ushort_buff[mono_cur + 2] = ushort_buff[stereo_cur + 4] + ushort_buff[stereo_cur + 5];
-		 ushort_buff[mono_cur + 3] = ushort_buff[stereo_cur + 6] + ushort_buff[stereo_cur + 7];
-		 ushort_buff[mono_cur + 4] = ushort_buff[stereo_cur + 8] + ushort_buff[stereo_cur + 9];
-		 ushort_buff[mono_cur + 5] = ushort_buff[stereo_cur + 10] + ushort_buff[stereo_cur + 11];
-		 ushort_buff[mono_cur + 6] = ushort_buff[stereo_cur + 12] + ushort_buff[stereo_cur + 13];
-		 ushort_buff[mono_cur + 7] = ushort_buff[stereo_cur + 14] + ushort_buff[stereo_cur + 15];
-	}
-
-	BUG_ON(stereo_cur != data_cnt_ushort);
-
-	/* remaining data */
-	for (; stereo_cur < ((*data_len) >> 1); stereo_cur += 2, mono_cur++) {
-		ushort_buff[mono_cur] = ushort_buff[stereo_cur] + ushort_buff[stereo_cur +1];
+	if(!dp->fragment_cnt)
+		return 0;
+	if(replay){
+		tstamp = audio_ring_tstamp_ahead(dp->dma_seen_ns, dp->dma_seen, dp->io_tracer, dp->fragment_ns, dp->fragment_cnt);
+		return div_s64((s64)(tstamp - now), NSEC_PER_USEC);
 	}
-
-	return ((*data_len) >> 1);
+	tstamp = audio_ring_tstamp_done(dp->dma_seen_ns, dp->dma_seen, dp->io_tracer, dp->fragment_ns, dp->fragment_cnt);
+	return div_s64((s64)(now - tstamp), NSEC_PER_USEC);
 }
-
-/*
- * convert normal 16bit stereo data to mono data
- *
- * buff:	buffer address
- * data_len:	data length in kernel space, the length of stereo data
- *
- */
-int convert_16bits_stereomix2mono(void *buff, int *data_len,int needed_size)
-{
-	/* stride = 32 bytes = 2 channels * 2 byte * 8 pipelines */
-	int data_len_32aligned = 0;
-	int data_cnt_ushort = 0;
-	int left_cur, right_cur, mono_cur;
-	short *ushort_buff = (short *)buff;
-	/*init*/
-	left_cur = 0;
-	right_cur = left_cur + 1;
-	mono_cur = 0;
-
-
-	if ( (*data_len) > needed_size*2)
-		*data_len = needed_size*2;
-
-	/*when 16bit format one sample has four bytes
-	 *so we can not operat the singular byte*/
-	*data_len = (*data_len) & (~0x3);
-
-	data_len_32aligned = (*data_len) & (~0x1f);
-	data_cnt_ushort = data_len_32aligned >> 1;
-
-	/*because the buff's size is always 4096 bytes,so it will not lost data*/
-	while (left_cur < data_cnt_ushort)
-	{
-		ushort_buff[mono_cur + 0] = ((ushort_buff[left_cur + 0]) + (ushort_buff[right_cur + 0]));
-		ushort_buff[mono_cur + 1] = ((ushort_buff[left_cur + 2]) + (ushort_buff[right_cur + 2]));
-		ushort_buff[mono_cur + 2] = ((ushort_buff[left_cur + 4]) + (ushort_buff[right_cur + 4]));
-		ushort_buff[mono_cur + 3] = ((ushort_buff[left_cur + 6]) + (ushort_buff[right_cur + 6]));
-		ushort_buff[mono_cur + 4] = ((ushort_buff[left_cur + 8]) + (ushort_buff[right_cur + 8]));
-		ushort_buff[mono_cur + 5] = ((ushort_buff[left_cur + 10]) + (ushort_buff[right_cur + 10]));
-		ushort_buff[mono_cur + 6] = ((ushort_buff[left_cur + 12]) + (ushort_buff[right_cur + 12]));
-		ushort_buff[mono_cur + 7] = ((ushort_buff[left_cur + 14]) + (ushort_buff[right_cur + 14]));
-
-		left_cur += 16;
-		right_cur += 16;
-		mono_cur += 8;
-	}
-
-	BUG_ON(left_cur != data_cnt_ushort);
-
-	/* remaining data */
-	for (;right_cur < ((*data_len) >> 1); left_cur += 2, right_cur += 2)
-		ushort_buff[mono_cur++] = ushort_buff[left_cur] + ushort_buff[right_cur];
-
-	return ((*data_len) >> 1);
-}
-
 /********************************************************\
  * others
 \********************************************************/
@@ -786,7 +558,7 @@ static int jz_asoc_dma_stop_and_reset(struct dsp_pipe *dp)
 	return 0;
 }
 
-static int jz_asoc_dma_prepare_and_submit(struct dsp_pipe *dp)
+static int jz_asoc_dma_prepare_and_submit(struct dsp_pipe *dp, unsigned int rate)
 {
 	struct dma_async_tx_descriptor *desc;
 	unsigned long flags = DMA_CTRL_ACK;
@@ -817,10 +589,11 @@ static int jz_asoc_dma_prepare_and_submit(struct dsp_pipe *dp)
 	dma_sync_single_for_device(NULL, dp->paddr, dp->buffersize, DMA_TO_DEVICE);
 	dmaengine_slave_config(dp->dma_chan,&dp->dma_config);
 
+	/* one period per fragment, so the dma driver calls back at each fragment */
 	desc = dp->dma_chan->device->device_prep_dma_cyclic(dp->dma_chan,
 			dp->paddr,
 			dp->buffersize,
-			dp->buffersize,
+			dma_period_irq ? dp->fragment_size : dp->buffersize,
 			dp->dma_config.direction,
 			flags,
 			NULL);
@@ -828,11 +601,18 @@ static int jz_asoc_dma_prepare_and_submit(struct dsp_pipe *dp)
 		dev_err(NULL, "cannot prepare slave dma\n");
 		return -EINVAL;
 	}
-#if 0
-	/* set desc callback */
-	desc->callback = snd_dma_callback;
-	desc->callback_param = (void *)dp;
-#endif
+	dp->period_irqs = 0;
+	dp->period_irqs_seen = 0;
+	dp->period_avg_ns = 0;
+	dp->fragment_ns = audio_ring_fragment_ns(SND_DSP_FRAGMENT_FRAMES(rate), rate);
+	dp->dma_seen = 0;
+	dp->dma_seen_ns = ktime_to_ns(ktime_get());
+	audio_ring_xrun_reset(&dp->xrun);
+	if(dma_period_irq){
+		/* set desc callback */
+		desc->callback = snd_dma_callback;
+		desc->callback_param = (void *)dp;
+	}
 	dmaengine_submit(desc);
 	return 0;
 }
@@ -920,7 +700,7 @@ static inline long dsp_ioctl_enable_dmic_stream(struct file *file)
 	attr->channel = object->channel;
 
 	/* */
-	ret = jz_asoc_dma_prepare_and_submit(dp->dp_dmic);
+	ret = jz_asoc_dma_prepare_and_submit(dp->dp_dmic, object->rate);
 	if (ret != 0) {
 		snd_error_print("Failed to init dmic dma\n");
 		goto exit;
@@ -1033,11 +813,11 @@ static inline long dsp_ioctl_enable_stream(struct file *file)
 		attr->channel = object->channel;
 
 		/* */
-		ret = jz_asoc_dma_prepare_and_submit(dp);
+		ret = jz_asoc_dma_prepare_and_submit(dp, object->rate);
 
 #if (defined(CONFIG_SOC_T21) || defined(CONFIG_SOC_T31) || defined(CONFIG_SOC_C100))
 		if(dp->dp_aec) {
-			ret = jz_asoc_dma_prepare_and_submit(dp->dp_aec);
+			ret = jz_asoc_dma_prepare_and_submit(dp->dp_aec, object->rate);
 		}
 #endif
 		snd_debug_print("fragemen_size = %d\n",dp->fragment_size);
@@ -1560,7 +1340,7 @@ static inline long dsp_ioctl_sync_ao_stream(struct file *file)
 	dma_tracer = dp->dma_tracer;
 	mutex_unlock(&dp->mutex);
 
-	time = io_tracer < dma_tracer ? io_tracer + dp->fragment_cnt - dma_tracer: io_tracer - dma_tracer;
+	time = audio_ring_distance(dma_tracer, io_tracer, dp->fragment_cnt);
 	msleep((time + 1)*10);
 	return 0;
 }
@@ -2154,14 +1934,10 @@ static inline void ao_dmaaddr_sync_ioaddr(struct dsp_pipe *dp, unsigned int dma_
 	struct dsp_data_fragment *tmp_frag = NULL;
 	struct list_head *list = NULL;
 	unsigned int tmp_io = dp->io_tracer;
-	if(dp->dma_tracer > tmp_io)
-		tmp_io += dp->fragment_cnt;
-	if(dp->dma_tracer > dma_current)
-		dma_current += dp->fragment_cnt;
-	if(tmp_io < dma_current + SND_DSP_PIPE_DAM2IO_CNT)
-		tmp_io = (dma_current + SND_DSP_PIPE_DAM2IO_CNT);
-
-	tmp_io = tmp_io % dp->fragment_cnt;
+
+	/* keep io SND_DSP_PIPE_DAM2IO_CNT fragments clear of the dma */
+	if(audio_ring_resync(dp->dma_tracer, dma_current, &tmp_io, SND_DSP_PIPE_DAM2IO_CNT - 1, dp->fragment_cnt))
+		audio_ring_xrun(&dp->xrun, false);
 	tmp_frag = &dp->fragments[tmp_io];
 	ao_sync_loop = 0;
 	while(io_frag != tmp_frag){
@@ -2180,26 +1956,14 @@ static inline void ao_dmaaddr_sync_ioaddr(struct dsp_pipe *dp, unsigned int dma_
 
 static inline void ai_dmaaddr_sync_ioaddr(struct dsp_pipe *dp, unsigned int dma_current)
 {
-	unsigned int tmp_io = dp->io_tracer;
-	if(dp->dma_tracer > tmp_io)
-		tmp_io += dp->fragment_cnt;
-	if(dp->dma_tracer > dma_current)
-		dma_current += dp->fragment_cnt;
-	if(tmp_io < dma_current + SND_DSP_PIPE_DAM2IO_CNT)
-		tmp_io = dma_current + SND_DSP_PIPE_DAM2IO_CNT;
-	dp->io_tracer = tmp_io % dp->fragment_cnt;
+	if(audio_ring_resync(dp->dma_tracer, dma_current, &dp->io_tracer, SND_DSP_PIPE_DAM2IO_CNT - 1, dp->fragment_cnt))
+		audio_ring_xrun(&dp->xrun, false);
 }
 
 static inline void dmic_dmaaddr_sync_ioaddr(struct dsp_pipe *dp, unsigned int dma_current)  //add by sxzhang:2018.04.04
 {
-	unsigned int tmp_io = dp->io_tracer;
-	if(dp->dma_tracer > tmp_io)
-		tmp_io += dp->fragment_cnt;
-	if(dp->dma_tracer > dma_current)
-		dma_current += dp->fragment_cnt;
-	if(tmp_io < dma_current + SND_DSP_PIPE_DAM2IO_CNT)
-		tmp_io = dma_current + SND_DSP_PIPE_DAM2IO_CNT;
-	dp->io_tracer = tmp_io % dp->fragment_cnt;
+	if(audio_ring_resync(dp->dma_tracer, dma_current, &dp->io_tracer, SND_DSP_PIPE_DAM2IO_CNT - 1, dp->fragment_cnt))
+		audio_ring_xrun(&dp->xrun, false);
 }
 
 static int ao_copy_loop = 0;
@@ -2212,6 +1976,8 @@ static inline int ao_copy_from_user(struct dsp_pipe *dp, struct task_node *node)
 	struct dsp_data_fragment *dma_frag = &dp->fragments[dp->dma_tracer];
 	struct list_head *list = NULL;
 
+	/* the application keeps up again, an xrun episode ends here */
+	audio_ring_xrun_transfer(&dp->xrun);
 	for(i = 0; i < cnt; i++){
 		if(io_frag == dma_frag)
 			break;
@@ -2255,14 +2021,23 @@ static inline int ai_copy_to_user(struct dsp_pipe *dp, struct task_node *node)
 	struct dsp_data_fragment *aec_dma_frag = &dp->dp_aec->fragments[dp->dp_aec->dma_tracer];
 #endif
 
+	/* the application keeps up again, an xrun episode ends here */
+	audio_ring_xrun_transfer(&dp->xrun);
 	for(i = 0; i < cnt; i++){
 		if(io_frag == dma_frag)
 			break;
 		dma_sync_single_for_device(NULL, (dma_addr_t)(io_frag->paddr), io_frag->size, DMA_FROM_DEVICE);
 #if (!defined(CONFIG_SOC_T21) && !defined(CONFIG_SOC_T31) && !defined(CONFIG_SOC_C100))
-		dp->filter(io_frag->vaddr, &size, size_inno);
-#endif
+		/* convert straight into the task buffer, each sample is touched once */
+		if(dp->filter_copy){
+			dp->filter_copy(node->data, io_frag->vaddr, &size, size_inno);
+		}else{
+			dp->filter(io_frag->vaddr, &size, size_inno);
+			memcpy(node->data, io_frag->vaddr, size_inno);
+		}
+#else
 		memcpy(node->data, io_frag->vaddr, size_inno);
+#endif
 		node->data += size_inno;
 		memset(io_frag->vaddr, 0, io_frag->size);
 		dma_sync_single_for_device(NULL, (dma_addr_t)(io_frag->paddr), io_frag->size, DMA_TO_DEVICE);
@@ -2328,6 +2103,8 @@ static inline int dmic_copy_to_user(struct dsp_pipe *dp, struct task_node *node)
 	dmic_dma_frag = &dp_dmic->fragments[dp_dmic->dma_tracer];
 	dmic_cnt = node->dmic_size/size_dmic;
 
+	/* the application keeps up again, an xrun episode ends here */
+	audio_ring_xrun_transfer(&dp_dmic->xrun);
 	for(i = 0; i < dmic_cnt; i++)  {
 		if(dmic_io_frag == dmic_dma_frag)
 			break;
@@ -2398,7 +2175,7 @@ static void dsp_workqueue_handle(struct work_struct *work)
 		dma_chan = dpi->dma_chan;
 		dpi_currentaddr = dma_chan->device->get_current_trans_addr(dma_chan, NULL, NULL,
 				dpi->dma_config.direction);
-		ai_current_index = ((dpi_currentaddr - dpi->paddr) / dpi->fragment_size) % dpi->fragment_cnt;
+		ai_current_index = snd_dma_fragment(dpi, dpi_currentaddr);
 
 #if defined(CONFIG_SOC_T21) || defined(CONFIG_SOC_T31) || defined(CONFIG_SOC_C100)
 		node = list_first_entry(&dpi->tasklist, typeof(*node), list);
@@ -2406,7 +2183,7 @@ static void dsp_workqueue_handle(struct work_struct *work)
 			dma_chan = dpi->dp_aec->dma_chan;
 			aec_currentaddr = dma_chan->device->get_current_trans_addr(dma_chan, NULL, NULL,
 					dp_aec->dma_config.direction);
-			aec_current_index = ((aec_currentaddr - dp_aec->paddr) / dp_aec->fragment_size) % dp_aec->fragment_cnt;
+			aec_current_index = snd_dma_fragment(dp_aec, aec_currentaddr);
 
 			/* sync the pointers of ai and aec */
 			if(ai_current_index < aec_current_index){
@@ -2422,7 +2199,7 @@ static void dsp_workqueue_handle(struct work_struct *work)
 		dma_chan = dpo->dma_chan;
 		dpo_currentaddr = dma_chan->device->get_current_trans_addr(dma_chan, NULL, NULL,
 				dpo->dma_config.direction);
-		ao_current_index = ((dpo_currentaddr - dpo->paddr) / dpo->fragment_size) % dpo->fragment_cnt;
+		ao_current_index = snd_dma_fragment(dpo, dpo_currentaddr);
 	}
 
 	spin_unlock_irqrestore(&dpi->pipe_lock, lock_flags);
@@ -2614,7 +2391,7 @@ static void dsp_dmic_workqueue_handle(struct work_struct *work)
 		dma_chan = dpi->dma_chan;
 		dpi_currentaddr = dma_chan->device->get_current_trans_addr(dma_chan, NULL, NULL,
 				dpi->dma_config.direction);
-		ai_current_index = ((dpi_currentaddr - dpi->paddr) / dpi->fragment_size) % dpi->fragment_cnt;
+		ai_current_index = snd_dma_fragment(dpi, dpi_currentaddr);
 
 #if defined(CONFIG_SOC_T21) || defined(CONFIG_SOC_T31) || defined(CONFIG_SOC_C100)
 		node = list_first_entry(&dpi->tasklist, typeof(*node), list);
@@ -2622,7 +2399,7 @@ static void dsp_dmic_workqueue_handle(struct work_struct *work)
 			dma_chan = dpi->dp_aec->dma_chan;
 			aec_currentaddr = dma_chan->device->get_current_trans_addr(dma_chan, NULL, NULL,
 					dp_aec->dma_config.direction);
-			aec_current_index = ((aec_currentaddr - dp_aec->paddr) / dp_aec->fragment_size) % dp_aec->fragment_cnt;
+			aec_current_index = snd_dma_fragment(dp_aec, aec_currentaddr);
 
 			/* sync the pointers of ai and aec */
 			if(ai_current_index < aec_current_index){
@@ -2643,14 +2420,14 @@ static void dsp_dmic_workqueue_handle(struct work_struct *work)
 			dma_chan = dp_dmic->dma_chan;
 			dmic_currentaddr = dma_chan->device->get_current_trans_addr(dma_chan, NULL, NULL,
 				dp_dmic->dma_config.direction);
-			dmic_current_index = ((dmic_currentaddr - dp_dmic->paddr) / dp_dmic->fragment_size) % dp_dmic->fragment_cnt;
+			dmic_current_index = snd_dma_fragment(dp_dmic, dmic_currentaddr);
 		}
 	}
 	if(dpo && dpo->is_trans){
 		dma_chan = dpo->dma_chan;
 		dpo_currentaddr = dma_chan->device->get_current_trans_addr(dma_chan, NULL, NULL,
 				dpo->dma_config.direction);
-		ao_current_index = ((dpo_currentaddr - dpo->paddr) / dpo->fragment_size) % dpo->fragment_cnt;
+		ao_current_index = snd_dma_fragment(dpo, dpo_currentaddr);
 	}
 	spin_unlock_irqrestore(&dp_dmic->pipe_lock, lock_flags);
 
@@ -2953,7 +2730,16 @@ static enum hrtimer_restart jz_asoc_hrtimer_callback(struct hrtimer *hr_timer) {
 		}
 	}
 
-	schedule_work(&endpoints->workqueue);
+	/*
+	 * With period interrupts the work is scheduled from snd_dma_callback(),
+	 * the timer only starts pipes and covers for a channel that stays silent.
+	 */
+	endpoints->timer_ticks++;
+	if(!dma_period_irq || snd_dma_period_stalled(dpi) | snd_dma_period_stalled(dpo) |
+			snd_dma_period_stalled(dp_dmic)){
+		endpoints->timer_polls++;
+		schedule_work(&endpoints->workqueue);
+	}
 out:
 	return HRTIMER_NORESTART;
 }
@@ -2973,6 +2759,8 @@ static int audio_info_show(struct seq_file *m, void *v)
 		return len;
 
 	len += seq_printf(m ,"The version of audio driver is %s\n", AUDIO_DRIVER_VERSION);
+	len += seq_printf(m ,"The pointer updates are driven by %s, timer ticks %llu, timer polls %llu\n",
+			dma_period_irq ? "dma period irqs" : "hrtimer", endpoints->timer_ticks, endpoints->timer_polls);
 	/*len += seq_printf(m ,"=== The info of audio replay ===\n");*/
 	switch(ao->pipe_state){
 		case SND_DSP_STATE_CLOSE:
@@ -3005,6 +2793,11 @@ static int audio_info_show(struct seq_file *m, void *v)
 		len += seq_printf(m ,"The dma paddr of replay 0x%08x\n", ao->paddr);
 		len += seq_printf(m ,"The dma tracer of replay %d\n", ao->dma_tracer);
 		len += seq_printf(m ,"The io tracer of replay %d\n", ao->io_tracer);
+		len += seq_printf(m ,"The dma period irqs of replay %llu, jitter avg %lluus max %lluus\n",
+				ao->period_irqs, div64_u64(ao->jitter_sum_ns, (max_t(u64, ao->period_irqs, 2) - 1) * NSEC_PER_USEC),
+				div_u64(ao->jitter_max_ns, NSEC_PER_USEC));
+		len += seq_printf(m ,"The xruns of replay %llu, the io fragment plays in %lldus\n",
+				ao->xrun.count, snd_io_latency_us(ao, true));
 	}
 	ai = endpoints->in_endpoint;
 	if(ai == NULL)
@@ -3044,6 +2837,11 @@ static int audio_info_show(struct seq_file *m, void *v)
 		len += seq_printf(m ,"The dma paddr of record 0x%08x\n", ai->paddr);
 		len += seq_printf(m ,"The dma tracer of record %d\n", ai->dma_tracer);
 		len += seq_printf(m ,"The io tracer of record %d\n", ai->io_tracer);
+		len += seq_printf(m ,"The dma period irqs of record %llu, jitter avg %lluus max %lluus\n",
+				ai->period_irqs, div64_u64(ai->jitter_sum_ns, (max_t(u64, ai->period_irqs, 2) - 1) * NSEC_PER_USEC),
+				div_u64(ai->jitter_max_ns, NSEC_PER_USEC));
+		len += seq_printf(m ,"The xruns of record %llu, the io fragment was recorded %lldus ago\n",
+				ai->xrun.count, snd_io_latency_us(ai, false));
 		len += seq_printf(m ,"The aec state is %s\n", ai->aec_enable ? "enable" : "disable");
 	}
 
@@ -3107,6 +2905,7 @@ int xb_snd_dsp_probe(struct snd_dev_data *ddata)
 			ret = init_dmic_pipe(dp->dp_dmic, g_mic_dev->dev);
 			if (ret)
 				goto error3;
+			dp->dp_dmic->dsp = endpoints;
 		}
 #endif
 	}
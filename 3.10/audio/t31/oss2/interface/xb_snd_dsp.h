@@ -22,6 +22,7 @@
 #include <linux/hrtimer.h>
 #include <linux/workqueue.h>
 #include <linux/soundcard.h>
+#include <audio_ring.h>
 
 /*####################################################*\
  * sound pipe and command used for dsp device
@@ -316,6 +317,7 @@ struct dsp_route_attr {
 #define SND_DSP_DMA_FRAGMENT_MIN_CNT 20		// The min time is 200ms.
 #define SND_DSP_PIPE_OBJECT_CNT 16
 #define SND_DSP_PIPE_DAM2IO_CNT 5
+#define SND_DSP_FRAGMENT_FRAMES(rate) ((rate) / 100)	// The fragments of the devices hold 10ms.
 struct dsp_pipe {
 	dsp_state_t pipe_state;
 	struct dsp_endpoints *dsp;
@@ -377,6 +379,8 @@ struct dsp_pipe {
 	 * return covert data size
 	 */
 	int (*filter)(void *buff, int *cnt, int needed_size);        /* define by device */
+	/* same conversion as filter, reading from src and writing to dst */
+	int (*filter_copy)(void *dst, const void *src, int *cnt, int needed_size);	/* define by device */
 	/* lock */
 	spinlock_t          pipe_lock;
 	struct snd_dev_data *	pddata;
@@ -389,6 +393,20 @@ struct dsp_pipe {
 	volatile unsigned char dmic_aec_enable;
 
 	struct dsp_pipe *dp_aec;
+
+	/* dma period interrupts */
+	unsigned long long period_irqs;
+	unsigned long long period_irqs_seen;	/* period_irqs at the last hrtimer tick */
+	u64 period_last_ns;
+	u64 period_avg_ns;
+	u64 jitter_sum_ns;
+	u64 jitter_max_ns;
+
+	/* dma position */
+	u64 fragment_ns;
+	unsigned int dma_seen;		/* fragment the dma was last seen in */
+	u64 dma_seen_ns;			/* when the dma started it */
+	struct audio_ring_xrun xrun;
 };
 
 struct dsp_endpoints {
@@ -397,6 +415,8 @@ struct dsp_endpoints {
 	ktime_t expires;
 	atomic_t	timer_stopped;
 	struct work_struct workqueue;
+	unsigned long long timer_ticks;
+	unsigned long long timer_polls;		/* ticks that had to schedule the work */
 
 	struct mutex        mutex;
     struct dsp_pipe *out_endpoint;
@@ -417,6 +437,12 @@ int convert_8bits_stereo2mono_signed2unsigned(void *buff, int *data_len,int need
 int convert_16bits_stereo2mono(void *buff, int *data_len,int needed_size);
 int convert_16bits_stereo2mono_inno(void *buff, int *data_len,int needed_size);
 int convert_16bits_stereomix2mono(void *buff, int *data_len,int needed_size);
+int convert_8bits_signed2unsigned_copy(void *dst, const void *src, int *counter, int needed_size);
+int convert_8bits_stereo2mono_copy(void *dst, const void *src, int *data_len, int needed_size);
+int convert_8bits_stereo2mono_signed2unsigned_copy(void *dst, const void *src, int *data_len, int needed_size);
+int convert_16bits_stereo2mono_copy(void *dst, const void *src, int *data_len, int needed_size);
+int convert_16bits_stereo2mono_inno_copy(void *dst, const void *src, int *data_len, int needed_size);
+int convert_16bits_stereomix2mono_copy(void *dst, const void *src, int *data_len, int needed_size);
 int convert_32bits_stereo2_16bits_mono(void *buff, int *data_len, int needed_size);
 int convert_32bits_2_20bits_tri_mode(void *buff, int *data_len, int needed_size);
 
@@ -0,0 +1,299 @@
+/*
+ * The per-sample converters xb_snd_dsp.c carried before they moved to
+ * interface/xb_snd_convert.c, kept verbatim apart from the ref_ prefix
+ * as the reference convert_test checks the new routines against.
+ */
+#include <linux/kernel.h>
+
+/********************************************************\
+ * filter
+\********************************************************/
+/*
+ * Convert signed byte to unsiged byte
+ *
+ * Mapping:
+ * 	signed		unsigned
+ *	0x00 (0)	0x80 (128)
+ *	0x01 (1)	0x81 (129)
+ *	......		......
+ *	0x7f (127)	0xff (255)
+ *	0x80 (-128)	0x00 (0)
+ *	0x81 (-127)	0x01 (1)
+ *	......		......
+ *	0xff (-1)	0x7f (127)
+ */
+int ref_convert_8bits_signed2unsigned(void *buffer, int *counter,int needed_size)
+{
+	int i;
+	int counter_8align = 0;
+	unsigned char *ucsrc	= buffer;
+	unsigned char *ucdst	= buffer;
+
+	if (needed_size < (*counter)) {
+		*counter = needed_size;
+	}
+	counter_8align = (*counter) & ~0x7;
+
+	for (i = 0; i < counter_8align; i+=8) {
+		*(ucdst + i + 0) = *(ucsrc + i + 0) + 0x80;
+		*(ucdst + i + 1) = *(ucsrc + i + 1) + 0x80;
+		*(ucdst + i + 2) = *(ucsrc + i + 2) + 0x80;
+		*(ucdst + i + 3) = *(ucsrc + i + 3) + 0x80;
+		*(ucdst + i + 4) = *(ucsrc + i + 4) + 0x80;
+		*(ucdst + i + 5) = *(ucsrc + i + 5) + 0x80;
+		*(ucdst + i + 6) = *(ucsrc + i + 6) + 0x80;
+		*(ucdst + i + 7) = *(ucsrc + i + 7) + 0x80;
+	}
+
+	BUG_ON(i != counter_8align);
+
+	for (i = counter_8align; i < *counter; i++) {
+		*(ucdst + i) = *(ucsrc + i) + 0x80;
+	}
+
+	return *counter;
+}
+
+/*
+ * Convert stereo data to mono data, data width: 8 bits/channel
+ *
+ * buff:	buffer address
+ * data_len:	data length in kernel space, the length of stereo data
+ *		calculated by "node->end - node->start"
+ */
+int ref_convert_8bits_stereo2mono(void *buff, int *data_len,int needed_size)
+{
+	/* stride = 16 bytes = 2 channels * 1 byte * 8 pipelines */
+	int data_len_16aligned = 0;
+	int mono_cur, stereo_cur;
+	unsigned char *uc_buff = buff;
+
+	if ((*data_len) > needed_size*2)
+		*data_len = needed_size*2;
+
+	*data_len = (*data_len) & (~0x1);
+
+	data_len_16aligned = (*data_len)& ~0xf;
+
+	/* copy 8 times each loop */
+	for (stereo_cur = mono_cur = 0;
+	     stereo_cur < data_len_16aligned;
+	     stereo_cur += 16, mono_cur += 8) {
+
+		uc_buff[mono_cur + 0] = uc_buff[stereo_cur + 0];
+		uc_buff[mono_cur + 1] = uc_buff[stereo_cur + 2];
+		uc_buff[mono_cur + 2] = uc_buff[stereo_cur + 4];
+		uc_buff[mono_cur + 3] = uc_buff[stereo_cur + 6];
+		uc_buff[mono_cur + 4] = uc_buff[stereo_cur + 8];
+		uc_buff[mono_cur + 5] = uc_buff[stereo_cur + 10];
+		uc_buff[mono_cur + 6] = uc_buff[stereo_cur + 12];
+		uc_buff[mono_cur + 7] = uc_buff[stereo_cur + 14];
+	}
+
+	BUG_ON(stereo_cur != data_len_16aligned);
+
+	/* remaining data */
+	for (; stereo_cur < (*data_len); stereo_cur += 2, mono_cur++) {
+		uc_buff[mono_cur] = uc_buff[stereo_cur];
+	}
+
+	return ((*data_len) >> 1);
+}
+
+/*
+ * Convert stereo data to mono data, and convert signed byte to unsigned byte.
+ *
+ * data width: 8 bits/channel
+ *
+ * buff:	buffer address
+ * data_len:	data length in kernel space, the length of stereo data
+ *		calculated by "node->end - node->start"
+ */
+int ref_convert_8bits_stereo2mono_signed2unsigned(void *buff, int *data_len,int needed_size)
+{
+	/* stride = 16 bytes = 2 channels * 1 byte * 8 pipelines */
+	int data_len_16aligned = 0;
+	int mono_cur, stereo_cur;
+	unsigned char *uc_buff = buff;
+
+	if ((*data_len) > needed_size*2)
+		*data_len = needed_size*2;
+
+	*data_len = (*data_len) & (~0x1);
+
+	data_len_16aligned = (*data_len) & ~0xf;
+
+	/* copy 8 times each loop */
+	for (stereo_cur = mono_cur = 0;
+	     stereo_cur < data_len_16aligned;
+	     stereo_cur += 16, mono_cur += 8) {
+
+		uc_buff[mono_cur + 0] = uc_buff[stereo_cur + 0] + 0x80;
+		uc_buff[mono_cur + 1] = uc_buff[stereo_cur + 2] + 0x80;
+		uc_buff[mono_cur + 2] = uc_buff[stereo_cur + 4] + 0x80;
+		uc_buff[mono_cur + 3] = uc_buff[stereo_cur + 6] + 0x80;
+		uc_buff[mono_cur + 4] = uc_buff[stereo_cur + 8] + 0x80;
+		uc_buff[mono_cur + 5] = uc_buff[stereo_cur + 10] + 0x80;
+		uc_buff[mono_cur + 6] = uc_buff[stereo_cur + 12] + 0x80;
+		uc_buff[mono_cur + 7] = uc_buff[stereo_cur + 14] + 0x80;
+	}
+
+	BUG_ON(stereo_cur != data_len_16aligned);
+
+	/* remaining data */
+	for (; stereo_cur < (*data_len); stereo_cur += 2, mono_cur++) {
+		uc_buff[mono_cur] = uc_buff[stereo_cur] + 0x80;
+	}
+
+	return ((*data_len) >> 1);
+}
+
+/*
+ * Convert stereo data to mono data, data width: 16 bits/channel
+ *
+ * buff:	buffer address
+ * data_len:	data length in kernel space, the length of stereo data
+ *		calculated by "node->end - node->start"
+ */
+int ref_convert_16bits_stereo2mono(void *buff, int *data_len, int needed_size)
+{
+	/* stride = 32 bytes = 2 channels * 2 byte * 8 pipelines */
+	int data_len_32aligned = 0;
+	int data_cnt_ushort = 0;
+	int mono_cur, stereo_cur;
+	unsigned short *ushort_buff = (unsigned short *)buff;
+
+	if ((*data_len) > needed_size*2)
+		*data_len = needed_size*2;
+
+	/*when 16bit format one sample has four bytes
+	 *so we can not operat the singular byte*/
+	*data_len = (*data_len) & (~0x3);
+
+	data_len_32aligned = (*data_len) & ~0x1f;
+	data_cnt_ushort = data_len_32aligned >> 1;
+
+	/* copy 8 times each loop */
+	for (stereo_cur = mono_cur = 0;
+	     stereo_cur < data_cnt_ushort;
+	     stereo_cur += 16, mono_cur += 8) {
+
+		ushort_buff[mono_cur + 0] = ushort_buff[stereo_cur + 0];
+		ushort_buff[mono_cur + 1] = ushort_buff[stereo_cur + 2];
+		ushort_buff[mono_cur + 2] = ushort_buff[stereo_cur + 4];
+		ushort_buff[mono_cur + 3] = ushort_buff[stereo_cur + 6];
+		ushort_buff[mono_cur + 4] = ushort_buff[stereo_cur + 8];
+		ushort_buff[mono_cur + 5] = ushort_buff[stereo_cur + 10];
+		ushort_buff[mono_cur + 6] = ushort_buff[stereo_cur + 12];
+		ushort_buff[mono_cur + 7] = ushort_buff[stereo_cur + 14];
+	}
+
+	BUG_ON(stereo_cur != data_cnt_ushort);
+
+	/* remaining data */
+	for (; stereo_cur < ((*data_len) >> 1); stereo_cur += 2, mono_cur++) {
+		ushort_buff[mono_cur] = ushort_buff[stereo_cur];
+	}
+
+	return ((*data_len) >> 1);
+}
+
+int ref_convert_16bits_stereo2mono_inno(void *buff, int *data_len, int needed_size)
+{
+	/* stride = 32 bytes = 2 channels * 2 byte * 8 pipelines */
+	int data_len_32aligned = 0;
+	int data_cnt_ushort = 0;
+	int mono_cur, stereo_cur;
+	unsigned short *ushort_buff = (unsigned short *)buff;
+
+	if ((*data_len) > needed_size*2)
+		*data_len = needed_size*2;
+
+	/*when 16bit format one sample has four bytes
+	 *so we can not operat the singular byte*/
+	*data_len = (*data_len) & (~0x3);
+
+	data_len_32aligned = (*data_len) & ~0x1f;
+	data_cnt_ushort = data_len_32aligned >> 1;
+
+	/* copy 8 times each loop */
+	for (stereo_cur = mono_cur = 0;
+	     stereo_cur < data_cnt_ushort;
+	     stereo_cur += 16, mono_cur += 8) {
+
+ 		 ushort_buff[mono_cur + 0] = ushort_buff[stereo_cur + 0] + ushort_buff[stereo_cur + 1];
+		 ushort_buff[mono_cur + 1] = ushort_buff[stereo_cur + 2] + ushort_buff[stereo_cur + 3];
+		 ushort_buff[mono_cur + 2] = ushort_buff[stereo_cur + 4] + ushort_buff[stereo_cur + 5];
+		 ushort_buff[mono_cur + 3] = ushort_buff[stereo_cur + 6] + ushort_buff[stereo_cur + 7];
+		 ushort_buff[mono_cur + 4] = ushort_buff[stereo_cur + 8] + ushort_buff[stereo_cur + 9];
+		 ushort_buff[mono_cur + 5] = ushort_buff[stereo_cur + 10] + ushort_buff[stereo_cur + 11];
+		 ushort_buff[mono_cur + 6] = ushort_buff[stereo_cur + 12] + ushort_buff[stereo_cur + 13];
+		 ushort_buff[mono_cur + 7] = ushort_buff[stereo_cur + 14] + ushort_buff[stereo_cur + 15];
+	}
+
+	BUG_ON(stereo_cur != data_cnt_ushort);
+
+	/* remaining data */
+	for (; stereo_cur < ((*data_len) >> 1); stereo_cur += 2, mono_cur++) {
+		ushort_buff[mono_cur] = ushort_buff[stereo_cur] + ushort_buff[stereo_cur +1];
+	}
+
+	return ((*data_len) >> 1);
+}
+
+/*
+ * convert normal 16bit stereo data to mono data
+ *
+ * buff:	buffer address
+ * data_len:	data length in kernel space, the length of stereo data
+ *
+ */
+int ref_convert_16bits_stereomix2mono(void *buff, int *data_len,int needed_size)
+{
+	/* stride = 32 bytes = 2 channels * 2 byte * 8 pipelines */
+	int data_len_32aligned = 0;
+	int data_cnt_ushort = 0;
+	int left_cur, right_cur, mono_cur;
+	short *ushort_buff = (short *)buff;
+	/*init*/
+	left_cur = 0;
+	right_cur = left_cur + 1;
+	mono_cur = 0;
+
+
+	if ( (*data_len) > needed_size*2)
+		*data_len = needed_size*2;
+
+	/*when 16bit format one sample has four bytes
+	 *so we can not operat the singular byte*/
+	*data_len = (*data_len) & (~0x3);
+
+	data_len_32aligned = (*data_len) & (~0x1f);
+	data_cnt_ushort = data_len_32aligned >> 1;
+
+	/*because the buff's size is always 4096 bytes,so it will not lost data*/
+	while (left_cur < data_cnt_ushort)
+	{
+		ushort_buff[mono_cur + 0] = ((ushort_buff[left_cur + 0]) + (ushort_buff[right_cur + 0]));
+		ushort_buff[mono_cur + 1] = ((ushort_buff[left_cur + 2]) + (ushort_buff[right_cur + 2]));
+		ushort_buff[mono_cur + 2] = ((ushort_buff[left_cur + 4]) + (ushort_buff[right_cur + 4]));
+		ushort_buff[mono_cur + 3] = ((ushort_buff[left_cur + 6]) + (ushort_buff[right_cur + 6]));
+		ushort_buff[mono_cur + 4] = ((ushort_buff[left_cur + 8]) + (ushort_buff[right_cur + 8]));
+		ushort_buff[mono_cur + 5] = ((ushort_buff[left_cur + 10]) + (ushort_buff[right_cur + 10]));
+		ushort_buff[mono_cur + 6] = ((ushort_buff[left_cur + 12]) + (ushort_buff[right_cur + 12]));
+		ushort_buff[mono_cur + 7] = ((ushort_buff[left_cur + 14]) + (ushort_buff[right_cur + 14]));
+
+		left_cur += 16;
+		right_cur += 16;
+		mono_cur += 8;
+	}
+
+	BUG_ON(left_cur != data_cnt_ushort);
+
+	/* remaining data */
+	for (;right_cur < ((*data_len) >> 1); left_cur += 2, right_cur += 2)
+		ushort_buff[mono_cur++] = ushort_buff[left_cur] + ushort_buff[right_cur];
+
+	return ((*data_len) >> 1);
+}
+
@@ -0,0 +1,172 @@
+/*
+ * Host test and benchmark of interface/xb_snd_convert.c.
+ *
+ * Every converter is run in place and in its fused _copy form on random
+ * data, lengths, needed sizes and buffer offsets, and checked bit for bit
+ * against the per-sample routine it replaced (convert_ref.c): same return
+ * value, same clipped length, same output and nothing written past it.
+ * The benchmark then times the former capture step, convert in place and
+ * memcpy, against the fused copy on 20 ms fragments.
+ *
+ *   make && ./convert_test [trials]
+ *   make CC=mips-linux-gnu-gcc   # to time it on the board
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef int (*inplace_fn)(void *buff, int *len, int needed_size);
+typedef int (*copy_fn)(void *dst, const void *src, int *len, int needed_size);
+
+#define DECLARE(name) \
+	int name(void *, int *, int); \
+	int ref_##name(void *, int *, int); \
+	int name##_copy(void *, const void *, int *, int)
+
+DECLARE(convert_8bits_signed2unsigned);
+DECLARE(convert_8bits_stereo2mono);
+DECLARE(convert_8bits_stereo2mono_signed2unsigned);
+DECLARE(convert_16bits_stereo2mono);
+DECLARE(convert_16bits_stereo2mono_inno);
+DECLARE(convert_16bits_stereomix2mono);
+
+struct converter {
+	const char *name;
+	inplace_fn ref;
+	inplace_fn inplace;
+	copy_fn copy;
+	int align;			/* sample alignment the driver guarantees */
+};
+
+#define CONVERTER(name, align) { #name, ref_##name, name, name##_copy, align }
+
+static const struct converter converters[] = {
+	CONVERTER(convert_8bits_signed2unsigned, 1),
+	CONVERTER(convert_8bits_stereo2mono, 1),
+	CONVERTER(convert_8bits_stereo2mono_signed2unsigned, 1),
+	CONVERTER(convert_16bits_stereo2mono, 2),
+	CONVERTER(convert_16bits_stereo2mono_inno, 2),
+	CONVERTER(convert_16bits_stereomix2mono, 2),
+};
+
+#define NCONV		(sizeof(converters) / sizeof(converters[0]))
+#define MAX_LEN		4096
+#define SLACK		64
+#define GUARD		0xa5
+
+static unsigned char src[MAX_LEN + SLACK];
+static unsigned char ref[MAX_LEN + SLACK];
+static unsigned char out[MAX_LEN + SLACK];
+
+static int check(const struct converter *c, int len, int needed, int soff, int doff)
+{
+	int rlen = len, ilen = len, clen = len;
+	int rret, iret, cret, i;
+
+	for (i = 0; i < MAX_LEN + SLACK; i++)
+		src[i] = rand();
+
+	/* former routine, in place */
+	memcpy(ref, src, sizeof(ref));
+	rret = c->ref(ref + soff, &rlen, needed);
+
+	/* new routine, in place: the whole buffer must match */
+	memcpy(out, src, sizeof(out));
+	iret = c->inplace(out + soff, &ilen, needed);
+	if (iret != rret || ilen != rlen || memcmp(out, ref, sizeof(out))) {
+		printf("%s in place: len %d needed %d off %d: ret %d/%d len %d/%d\n",
+		       c->name, len, needed, soff, iret, rret, ilen, rlen);
+		return -1;
+	}
+
+	/* fused copy: the converted bytes, and nothing past them */
+	memset(out, GUARD, sizeof(out));
+	cret = c->copy(out + doff, src + soff, &clen, needed);
+	if (cret != rret || clen != rlen || memcmp(out + doff, ref + soff, cret)) {
+		printf("%s copy: len %d needed %d off %d/%d: ret %d/%d len %d/%d\n",
+		       c->name, len, needed, soff, doff, cret, rret, clen, rlen);
+		return -1;
+	}
+	for (i = 0; i < MAX_LEN + SLACK; i++) {
+		if ((i < doff || i >= doff + cret) && out[i] != GUARD) {
+			printf("%s copy: len %d needed %d off %d/%d: wrote byte %d\n",
+			       c->name, len, needed, soff, doff, i);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* one 20 ms 48 kHz stereo fragment, converted to half its size */
+static void bench(const struct converter *c)
+{
+	enum { FRAG = 48000 / 50 * 2 * 2, LOOPS = 20000 };
+	static unsigned char frag[FRAG], task[FRAG];
+	double t0, old_ns, new_ns;
+	int i, len;
+
+	for (i = 0; i < FRAG; i++)
+		frag[i] = rand();
+
+	t0 = now_ns();
+	for (i = 0; i < LOOPS; i++) {
+		len = FRAG;
+		c->ref(frag, &len, FRAG / 2);
+		memcpy(task, frag, FRAG / 2);
+	}
+	old_ns = (now_ns() - t0) / LOOPS;
+
+	t0 = now_ns();
+	for (i = 0; i < LOOPS; i++) {
+		len = FRAG;
+		c->copy(task, frag, &len, FRAG / 2);
+	}
+	new_ns = (now_ns() - t0) / LOOPS;
+
+	printf("%-44s %8.0f ns -> %8.0f ns per fragment (x%.2f)\n",
+	       c->name, old_ns, new_ns, new_ns > 0 ? old_ns / new_ns : 0);
+}
+
+int main(int argc, char **argv)
+{
+	int trials = argc > 1 ? atoi(argv[1]) : 20000;
+	int t, i, len, needed, soff, doff, fails = 0;
+	unsigned int k;
+
+	srand(1);
+	for (k = 0; k < NCONV; k++) {
+		const struct converter *c = &converters[k];
+
+		for (t = 0; t < trials && fails < 10; t++) {
+			len = rand() % (MAX_LEN + 1);
+			/* mostly the full fragment, sometimes a clipped one */
+			needed = (rand() & 3) ? len : rand() % (MAX_LEN + 1);
+			soff = (rand() % 8) & ~(c->align - 1);
+			doff = (rand() % 8) & ~(c->align - 1);
+			if (check(c, len, needed, soff, doff))
+				fails++;
+		}
+		/* the edges the random walk may miss */
+		for (i = 0; i <= 40 && fails < 10; i++)
+			for (soff = 0; soff < 4; soff += c->align)
+				fails += check(c, i, i, soff, 4 - soff) ? 1 : 0;
+		printf("%-44s %s\n", c->name, fails ? "FAIL" : "ok");
+	}
+	if (fails)
+		return 1;
+
+	for (k = 0; k < NCONV; k++)
+		bench(&converters[k]);
+
+	return 0;
+}
@@ -0,0 +1,10 @@
+/* just enough of the kernel headers to build the converters on the host */
+#ifndef _SHIM_LINUX_KERNEL_H
+#define _SHIM_LINUX_KERNEL_H
+
+#include <assert.h>
+#include <linux/types.h>
+
+#define BUG_ON(x)	assert(!(x))
+
+#endif
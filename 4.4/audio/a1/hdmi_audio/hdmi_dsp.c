@@ -22,6 +22,7 @@
 #include <linux/hrtimer.h>
 #include <dt-bindings/dma/ingenic-pdma.h>
 #include <linux/of.h>
+#include <audio_ring.h>
 #include "hdmi_dsp.h"
 #include "hdmi_aic.h"
 #include "hdmi_audio_debug.h"
@@ -57,7 +58,6 @@ static void dsp_workqueue_handle(struct work_struct *work)
 	unsigned int dma_tracer = 0;
 	unsigned int io_tracer = 0;
 	unsigned long lock_flags;
-	unsigned int io_late = 0;
 	unsigned int cnt = 0;
 	unsigned int index = 0;
 	spin_lock_irqsave(&dsp->slock, lock_flags);
@@ -66,54 +66,31 @@ static void dsp_workqueue_handle(struct work_struct *work)
 
 	mutex_lock(&ao_route->mlock);
 	if(ao_route->state == AUDIO_BUSY_STATE){
-		io_late = 0;
+		io_tracer = ao_route->manage.io_tracer;
+		if(audio_ring_resync(ao_route->manage.dma_tracer, ao_new_tracer, &io_tracer,
+					AUDIO_IO_LEADING_DMA, ao_route->manage.fragment_cnt)){
+			ao_route->manage.io_tracer = io_tracer;
+			audio_ring_xrun(&ao_route->xrun, false);
+		}
 		dma_tracer = ao_route->manage.dma_tracer;
-		if(ao_new_tracer < ao_route->manage.fragment_cnt && ao_new_tracer >= 0){
-			while(dma_tracer != ao_new_tracer){
-				if(dma_tracer == ao_route->manage.io_tracer){
-					//				printk("%d: audio spk io late!\n", __LINE__);
-					io_late = 1;
-				}
-				memset(ao_route->manage.fragments[dma_tracer].vaddr, 0, ao_route->manage.fragment_size);
-				dma_cache_sync(NULL, ao_route->manage.fragments[dma_tracer].vaddr,
-						ao_route->manage.fragment_size, DMA_TO_DEVICE);
-				ao_route->manage.fragments[dma_tracer].state = false;
-				dma_tracer = (dma_tracer + 1) % ao_route->manage.fragment_cnt;
-			}
-			ao_route->manage.dma_tracer = dma_tracer;
-			/* clear dma prepare-buffer and sync io_tracer */
-			for(cnt = 0; cnt <= AUDIO_IO_LEADING_DMA; cnt++){
-				index = (ao_new_tracer + cnt) % ao_route->manage.fragment_cnt;
-				if(ao_route->manage.fragments[index].state){
-					ao_route->manage.fragments[index].state = false;
-				}
-				if(index == ao_route->manage.io_tracer)
-					io_late = 1;
-			}
-			if(io_late){
-				ao_route->manage.io_tracer = (index + 1) % ao_route->manage.fragment_cnt;
-			}
-		}else{
-			printk("%d: audio spk dma transfer error!\n", __LINE__);
+		while(dma_tracer != ao_new_tracer){
 			memset(ao_route->manage.fragments[dma_tracer].vaddr, 0, ao_route->manage.fragment_size);
 			dma_cache_sync(NULL, ao_route->manage.fragments[dma_tracer].vaddr,
 					ao_route->manage.fragment_size, DMA_TO_DEVICE);
-			memset(ao_route->manage.fragments[dma_tracer+1].vaddr, 0, ao_route->manage.fragment_size);
-			dma_cache_sync(NULL, ao_route->manage.fragments[dma_tracer + 1].vaddr,
-					ao_route->manage.fragment_size, DMA_TO_DEVICE);
-			dma_tracer = (dma_tracer + 2) % ao_route->manage.fragment_cnt;
-			ao_route->manage.dma_tracer = dma_tracer;
+			ao_route->manage.fragments[dma_tracer].state = false;
+			dma_tracer = audio_ring_next(dma_tracer, ao_route->manage.fragment_cnt);
+		}
+		ao_route->manage.dma_tracer = dma_tracer;
+		/* clear dma prepare-buffer */
+		for(cnt = 0; cnt <= AUDIO_IO_LEADING_DMA; cnt++){
+			index = audio_ring_add(ao_new_tracer, cnt, ao_route->manage.fragment_cnt);
+			ao_route->manage.fragments[index].state = false;
 		}
 	}
 	/* wait second copy space */
 	if(ao_route->wait_flag){
-		cnt = 0;
-		dma_tracer = ao_route->manage.dma_tracer;
-		io_tracer  = ao_route->manage.io_tracer;
-		while(io_tracer != dma_tracer){
-			cnt++;
-			io_tracer = (io_tracer + 1) % ao_route->manage.fragment_cnt;
-		}
+		cnt = audio_ring_distance(ao_route->manage.io_tracer, ao_route->manage.dma_tracer,
+				ao_route->manage.fragment_cnt);
 		if(cnt >= ao_route->wait_cnt){
 			ao_route->wait_flag = false;
 			complete(&ao_route->done_completion);
@@ -129,6 +106,7 @@ static enum hrtimer_restart hdmi_audio_hrtimer_callback(struct hrtimer *hr_timer
 	struct audio_route *route = &dsp->spk_route;
 	dma_addr_t dma_currentaddr = 0;
 	unsigned int index = 0;
+	unsigned int offset = 0;
 	unsigned long lock_flags;
 
 	if (atomic_read(&dsp->timer_stopped))
@@ -139,11 +117,14 @@ static enum hrtimer_restart hdmi_audio_hrtimer_callback(struct hrtimer *hr_timer
 		/* sync all routes dma */
 		dma_currentaddr = route->dma_chan->device->get_current_trans_addr(route->dma_chan, NULL, NULL,
 				route->dma_config.direction);
-		index = (dma_currentaddr - route->paddr) / route->manage.fragment_size;
-		route->manage.new_dma_tracer = index;
-		//printk("dma_currentaddr=0x%08x\n",dma_currentaddr);
-		//printk("route->manage.fragment_size=%d\n",route->manage.fragment_size);
-		//printk("index=%d\n",index);
+		index = audio_ring_fragment(dma_currentaddr, route->paddr, route->manage.fragment_size,
+				route->manage.fragment_cnt, &offset);
+		/* outside the ring: keep the last position */
+		if(index < route->manage.fragment_cnt){
+			route->manage.new_dma_tracer = index;
+			route->dma_tstamp_ns = audio_ring_tstamp(ktime_get_ns(), offset,
+					route->manage.fragment_size, route->fragment_ns);
+		}
 	}
 	spin_unlock_irqrestore(&dsp->slock, lock_flags);
 	schedule_work(&dsp->workqueue);
@@ -188,6 +169,9 @@ static int dsp_init_dma_chan(struct audio_route *route)
 
 	if (manage->fragment_cnt >= total_fragment_cnt)
 		manage->fragment_cnt = total_fragment_cnt;
+	route->fragment_ns = audio_ring_fragment_ns(manage->fragment_size / manage->sample_size, route->rate);
+	route->dma_tstamp_ns = ktime_get_ns();
+	audio_ring_xrun_reset(&route->xrun);
 
 	/* init fragments manage */
 	for(index = 0; index < manage->fragment_cnt; index++){
@@ -434,7 +418,6 @@ int hdmi_dsp_sync_stream(void)
 	unsigned int dma_tracer = 0;
 	unsigned int io_tracer = 0;
 	unsigned int wait_cnt = 0;
-	unsigned int cnt_flag = 0;
 	struct hdmi_dsp_device *dsp = g_hdmi_dspdev;
 	struct audio_route *route = &dsp->spk_route;
 
@@ -450,14 +433,10 @@ int hdmi_dsp_sync_stream(void)
 
 	dma_tracer = route->manage.dma_tracer;
 	io_tracer = route->manage.io_tracer;
-	while(dma_tracer != io_tracer){
-		if(dma_tracer == new_dma_tracer){
-			cnt_flag = 1;
-		}
-		if(cnt_flag)
-			wait_cnt++;
-		dma_tracer = (dma_tracer + 1) % route->manage.fragment_cnt;
-	}
+	/* what is queued from the fragment playing now on */
+	if(audio_ring_distance(dma_tracer, new_dma_tracer, route->manage.fragment_cnt)
+			< audio_ring_distance(dma_tracer, io_tracer, route->manage.fragment_cnt))
+		wait_cnt = audio_ring_distance(new_dma_tracer, io_tracer, route->manage.fragment_cnt);
 out:
 	mutex_unlock(&route->mlock);
 	if(wait_cnt){
@@ -474,7 +453,6 @@ int hdmi_dsp_clear_stream(void)
 	unsigned int new_dma_tracer = 0;
 	unsigned int dma_tracer = 0;
 	unsigned int io_tracer = 0;
-	unsigned int cnt_flag = 0;
 	struct audio_route *route = &dsp->spk_route;
 
 	mutex_lock(&route->mlock);
@@ -486,19 +464,18 @@ int hdmi_dsp_clear_stream(void)
 	new_dma_tracer = route->manage.new_dma_tracer;
 	dma_tracer = route->manage.dma_tracer;
 	io_tracer  = route->manage.io_tracer;
-	while(dma_tracer != io_tracer){
-		if(dma_tracer == new_dma_tracer){
-			cnt_flag = 1;
-		}
-		if(cnt_flag){
+	/* silence what is queued from the fragment playing now on */
+	if(audio_ring_distance(dma_tracer, new_dma_tracer, route->manage.fragment_cnt)
+			< audio_ring_distance(dma_tracer, io_tracer, route->manage.fragment_cnt)){
+		for(dma_tracer = new_dma_tracer; dma_tracer != io_tracer;
+				dma_tracer = audio_ring_next(dma_tracer, route->manage.fragment_cnt)){
 			memset(route->manage.fragments[dma_tracer].vaddr, 0, route->manage.fragment_size);
 			dma_cache_sync(NULL, route->manage.fragments[dma_tracer].vaddr,
 					route->manage.fragment_size, DMA_TO_DEVICE);
 		}
-		dma_tracer = (dma_tracer + 1) % route->manage.fragment_cnt;
 	}
 	spin_lock_irqsave(&dsp->slock, lock_flags);
-	route->manage.io_tracer = (route->manage.new_dma_tracer + AUDIO_IO_LEADING_DMA) % route->manage.fragment_cnt;
+	route->manage.io_tracer = audio_ring_add(route->manage.new_dma_tracer, AUDIO_IO_LEADING_DMA, route->manage.fragment_cnt);
 	spin_unlock_irqrestore(&dsp->slock, lock_flags);
 out:
 	mutex_unlock(&route->mlock);
@@ -553,11 +530,11 @@ int hdmi_dsp_set_stream(unsigned long arg)
 		dma_tracer = manage->dma_tracer;
 		io_tracer  = manage->io_tracer;
 		while(i < cnt){
-			if(io_tracer+1 == dma_tracer || (dma_tracer==0 && io_tracer==route->manage.fragment_cnt-1)){
+			if(audio_ring_next(io_tracer, manage->fragment_cnt) == dma_tracer){
 				break;
 			}
 			i++;
-			io_tracer = (io_tracer + 1) % manage->fragment_cnt;
+			io_tracer = audio_ring_next(io_tracer, manage->fragment_cnt);
 		}
 
 		if(i != cnt){
@@ -573,6 +550,8 @@ int hdmi_dsp_set_stream(unsigned long arg)
 		}
 	}
 
+	/* the application keeps up again, an xrun episode ends here */
+	audio_ring_xrun_transfer(&route->xrun);
 again:
 	if(route->state != AUDIO_BUSY_STATE)
 		goto out;
@@ -584,7 +563,7 @@ again:
 		set_fs(KERNEL_DS);
 	}
 	while(i < cnt){
-		if(io_tracer+1 == dma_tracer || (dma_tracer==0 && io_tracer==route->manage.fragment_cnt-1))
+		if(audio_ring_next(io_tracer, manage->fragment_cnt) == dma_tracer)
 			break;
 		fragment = &(manage->fragments[io_tracer]);
 		if(fragment->state == false){
@@ -597,7 +576,7 @@ again:
 			}
 		}
 		i++;
-		io_tracer = (io_tracer + 1) % manage->fragment_cnt;
+		io_tracer = audio_ring_next(io_tracer, manage->fragment_cnt);
 	}
 	manage->io_tracer = io_tracer;
 	if(route->save_debugdata){
@@ -822,6 +801,12 @@ static int audio_aic_show(struct seq_file *m, void *v)
 		seq_printf(m, "The living channel of replay : %d\n", spk_route->channel);
 		seq_printf(m, "The living format of replay : %d\n", spk_route->format);
 		seq_printf(m, "The reservesize is %uBytes\n", spk_route->reservesize);
+		seq_printf(m, "The xruns of replay : %llu\n", spk_route->xrun.count);
+		if(spk_route->manage.fragment_cnt)
+			seq_printf(m, "The io fragment plays in : %lldus\n",
+					div_s64((s64)(audio_ring_tstamp_ahead(spk_route->dma_tstamp_ns, spk_route->manage.new_dma_tracer,
+								spk_route->manage.io_tracer, spk_route->fragment_ns,
+								spk_route->manage.fragment_cnt) - ktime_get_ns()), NSEC_PER_USEC));
 	}else{
 		seq_printf(m, "HDMI audio is disabled!\n");
 	}
@@ -5,6 +5,7 @@
 #include <linux/seq_file.h>
 #include <linux/proc_fs.h>
 #include <jz_proc.h>
+#include <audio_ring.h>
 #define MONO   1
 #define STEREO 2
 
@@ -110,6 +111,11 @@ struct audio_route {
 	bool wait_flag;
 	struct completion done_completion;
 
+	/* dma position */
+	u64 fragment_ns;
+	u64 dma_tstamp_ns;			/* when the dma started fragment new_dma_tracer */
+	struct audio_ring_xrun xrun;
+
 	/* debug parameters */
 	struct file *proc_savefd;
 	bool	save_debugdata;
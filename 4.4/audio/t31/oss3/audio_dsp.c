@@ -16,6 +16,10 @@
 #include <linux/list.h>
 #include <linux/slab.h>
 #include <linux/delay.h>
+#include <linux/math64.h>
+#include <linux/mm.h>
+#include <linux/poll.h>
+#include <audio_ring.h>
 
 #include "include/audio_dsp.h"
 #include "include/audio_debug.h"
@@ -32,12 +36,172 @@ static int aic_enable = 1; // disable aic
 module_param(aic_enable, int, S_IRUGO);
 MODULE_PARM_DESC(aic_enable, "Enable or disable aic");
 
+static int dma_period_irq = 1;
+module_param(dma_period_irq, int, S_IRUGO);
+MODULE_PARM_DESC(dma_period_irq, "advance pointers from dma period interrupts, 0 polls with the hrtimer");
+
+static int standby_ms = 3000;
+module_param(standby_ms, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(standby_ms, "keep the hardware of a stopped route powered this long, 0 powers it down at once");
+
 #define AUDIO_IO_LEADING_DMA (2)
+#define AUDIO_STALL_FRAGMENTS (2)	/* missed period irqs before the timer reads the position */
 
 #define AUDIO_DRIVER_VERSION "H20200813a"
 static struct audio_dsp_device* globe_dspdev = NULL;
 
 
+/*
+ * Called with dsp->slock held each time the dma position is sampled.
+ * Fragments the dma finished get the CLOCK_MONOTONIC time of their first
+ * sample, interpolated back from @now, and their position in the stream.
+ * The position lives in the route, the ctrl page only gets a copy of it.
+ * Returns the number of fragments the dma finished.
+ */
+static unsigned int dsp_update_hw_position(struct audio_route *route, unsigned int new_tracer,
+		unsigned int offset, u64 now)
+{
+	struct dsp_data_manage *manage = &route->manage;
+	struct audio_mmap_ctrl *ctrl = route->ctrl;
+	unsigned int frames = 0;
+	unsigned int done = 0;
+	unsigned int index = 0;
+
+	if(!manage->fragment_cnt || !manage->sample_size || new_tracer >= manage->fragment_cnt)
+		return 0;
+
+	/* the dma is offset bytes into new_tracer */
+	route->dma_tstamp_ns = audio_ring_tstamp(now, offset, manage->fragment_size, route->fragment_ns);
+
+	frames = manage->fragment_size / manage->sample_size;
+	index = route->hw_ptr;
+	while(index != new_tracer){
+		manage->fragments[index].tstamp_ns = audio_ring_tstamp_done(route->dma_tstamp_ns, new_tracer, index,
+				route->fragment_ns, manage->fragment_cnt);
+		manage->fragments[index].frame_pos = route->hw_frames;
+		route->hw_frames += frames;
+		index = audio_ring_next(index, manage->fragment_cnt);
+		done++;
+	}
+	route->hw_ptr = new_tracer;
+	route->hw_count += done;
+	if(!ctrl)
+		return done;
+	ctrl->hw_ptr = route->hw_ptr;
+	ctrl->hw_tstamp_ns = route->dma_tstamp_ns;
+	ctrl->hw_frames = route->hw_frames;
+	if(!done)
+		return 0;
+	/* the fragments are complete before mmap clients see hw_count move */
+	smp_wmb();
+	ctrl->hw_count = route->hw_count;
+	return done;
+}
+
+/* timing of a fragment the dma has not reached yet, called with dsp->slock held */
+static void dsp_predict_fragment(struct audio_route *route, unsigned int index,
+		u64 *tstamp_ns, u64 *frame_pos)
+{
+	struct dsp_data_manage *manage = &route->manage;
+	unsigned int ahead = audio_ring_distance(route->hw_ptr, index, manage->fragment_cnt);
+
+	*tstamp_ns = audio_ring_tstamp_ahead(route->dma_tstamp_ns, route->hw_ptr, index,
+			route->fragment_ns, manage->fragment_cnt);
+	*frame_pos = route->hw_frames + (u64)ahead * (manage->fragment_size / manage->sample_size);
+}
+
+/*
+ * The capture ring overflowed or the playback ring ran dry, called with
+ * route->mlock held. Clients that negotiated their period get told about
+ * it on their next transfer.
+ */
+static void dsp_route_xrun(struct audio_route *route)
+{
+	/* io_tracer was resynced, a partial read() or write() starts over */
+	route->rw_offset = 0;
+	audio_ring_xrun(&route->xrun, route->period_us);
+}
+
+/* fragments waiting for the application, called with route->mlock held */
+static void dsp_route_update_fill(struct audio_route *route)
+{
+	struct dsp_data_manage *manage = &route->manage;
+	unsigned int fill = 0;
+
+	if(route->state != AUDIO_BUSY_STATE || !manage->fragment_cnt)
+		return;
+	if(route->index == AUDIO_ROUTE_SPK_ID)
+		fill = audio_ring_distance(manage->dma_tracer, manage->io_tracer, manage->fragment_cnt);
+	else
+		fill = audio_ring_distance(manage->io_tracer, manage->dma_tracer, manage->fragment_cnt);
+	route->fill = fill;
+	if(fill > route->fill_max)
+		route->fill_max = fill;
+	if(fill < route->fill_min)
+		route->fill_min = fill;
+}
+
+/*
+ * The optional processing stage, called with route->mlock held on a
+ * capture fragment the dma completed or a playback fragment about to be
+ * queued. Capture fragments are processed through the cache and written
+ * back, so readers, stream ioctls and uncached mmap clients all see the
+ * result; mmap clients polling hw_count may get a fragment before the
+ * workqueue reached it.
+ */
+static void dsp_route_process(struct audio_route *route, struct dsp_data_fragment *fragment)
+{
+	struct dsp_data_manage *manage = &route->manage;
+	struct audio_process_state *process = &route->process;
+	bool capture = route->index != AUDIO_ROUTE_SPK_ID;
+	u64 start = 0;
+
+	if(route->format != 16 || !fragment->state || !audio_process_active(process))
+		return;
+
+	start = ktime_get_ns();
+	if(capture)
+		dma_sync_single_for_device(NULL, fragment->paddr, manage->fragment_size, DMA_FROM_DEVICE);
+	audio_process_fragment(process, fragment->vaddr,
+			manage->fragment_size / (sizeof(s16) * route->channel), route->channel);
+	if(capture)
+		dma_sync_single_for_device(NULL, fragment->paddr, manage->fragment_size, DMA_TO_DEVICE);
+	audio_process_account(process, ktime_get_ns() - start);
+
+	if(route->ctrl && (process->param.flags & AUDIO_PROCESS_METER)){
+		route->ctrl->meter_peak = process->peak;
+		route->ctrl->meter_rms = process->rms;
+	}
+}
+
+/*
+ * Fragments a reader can still find behind dma_tracer, the ones ahead of
+ * it are being refilled.
+ */
+static inline unsigned int dsp_reader_window(struct dsp_data_manage *manage)
+{
+	return manage->fragment_cnt - AUDIO_IO_LEADING_DMA - 1;
+}
+
+/*
+ * The workqueue handed the fragment before dma_tracer to the readers,
+ * called with route->mlock held. Readers never write the capture ring, so
+ * the fragment entering the refill window is invalidated here instead of
+ * by each of them.
+ */
+static void dsp_route_publish(struct audio_route *route, unsigned int dma_tracer)
+{
+	struct dsp_data_manage *manage = &route->manage;
+	struct dsp_data_fragment *fragment = NULL;
+
+	dsp_route_process(route, &(manage->fragments[audio_ring_add(dma_tracer, manage->fragment_cnt - 1, manage->fragment_cnt)]));
+	route->published++;
+	if(list_empty(&route->readers))
+		return;
+	fragment = &(manage->fragments[audio_ring_add(dma_tracer, AUDIO_IO_LEADING_DMA, manage->fragment_cnt)]);
+	dma_sync_single_for_device(NULL, fragment->paddr, manage->fragment_size, DMA_FROM_DEVICE);
+}
+
 static unsigned work_cnt = 0;
 static void dsp_workqueue_handle(struct work_struct *work)
 {
@@ -55,7 +219,6 @@ static void dsp_workqueue_handle(struct work_struct *work)
 	unsigned int aec_tracer = 0;
 	unsigned int io_tracer = 0;
 	unsigned long lock_flags;
-	unsigned int io_late = 0;
 	unsigned int cnt = 0;
 	unsigned int index = 0;
 
@@ -88,43 +251,38 @@ static void dsp_workqueue_handle(struct work_struct *work)
 	if(amic_route && aec_route){
 		mutex_lock(&amic_route->mlock);
 		if(amic_route->state == AUDIO_BUSY_STATE){
-			io_late = 0;
 			dma_tracer = amic_route->manage.dma_tracer;
 			aec_tracer = amic_route->manage.aec_dma_tracer;
 
 			while(dma_tracer != amic_new_tracer && aec_tracer != aec_new_tracer){
 				amic_route->manage.fragments[dma_tracer].priv = &(aec_route->manage.fragments[aec_tracer]);
 				amic_route->manage.fragments[dma_tracer].state = true;
-				if(dma_tracer == amic_route->manage.io_tracer)
-					io_late = 1;
-				dma_tracer = (dma_tracer + 1) % amic_route->manage.fragment_cnt;
-				aec_tracer = (aec_tracer + 1) % aec_route->manage.fragment_cnt;
+				dma_tracer = audio_ring_next(dma_tracer, amic_route->manage.fragment_cnt);
+				aec_tracer = audio_ring_next(aec_tracer, aec_route->manage.fragment_cnt);
+				dsp_route_publish(amic_route, dma_tracer);
+			}
+			io_tracer = amic_route->manage.io_tracer;
+			if(audio_ring_resync(amic_route->manage.dma_tracer, amic_new_tracer, &io_tracer,
+						AUDIO_IO_LEADING_DMA, amic_route->manage.fragment_cnt)){
+				amic_route->manage.io_tracer = io_tracer;
+				dsp_route_xrun(amic_route);
 			}
 			amic_route->manage.dma_tracer = dma_tracer;
 			amic_route->manage.aec_dma_tracer = aec_tracer;
 
 			for(cnt = 1; cnt <= AUDIO_IO_LEADING_DMA; cnt++){
-				index = (amic_new_tracer + cnt) % amic_route->manage.fragment_cnt;
+				index = audio_ring_add(amic_new_tracer, cnt, amic_route->manage.fragment_cnt);
 				if(amic_route->manage.fragments[index].state){
 					amic_route->manage.fragments[index].state = false;
 					amic_route->manage.fragments[index].priv = NULL;
 				}
-				if(index == amic_route->manage.io_tracer)
-					io_late = 1;
-			}
-			if(io_late){
-				amic_route->manage.io_tracer = (index + 1) % amic_route->manage.fragment_cnt;
 			}
+			dsp_route_update_fill(amic_route);
 		}
 		/* wait second copy data */
 		if(amic_route->wait_flag){
-			cnt = 0;
-			dma_tracer = amic_route->manage.dma_tracer;
-			io_tracer = amic_route->manage.io_tracer;
-			while(io_tracer != dma_tracer){
-				cnt++;
-				io_tracer = (io_tracer + 1) % amic_route->manage.fragment_cnt;
-			}
+			cnt = audio_ring_distance(amic_route->manage.io_tracer, amic_route->manage.dma_tracer,
+					amic_route->manage.fragment_cnt);
 			if(cnt >= amic_route->wait_cnt){
 				amic_route->wait_flag = false;
 				complete(&amic_route->done_completion);
@@ -137,7 +295,12 @@ static void dsp_workqueue_handle(struct work_struct *work)
 	if(dmic_route->pipe){
 		mutex_lock(&dmic_route->mlock);
 		if(dmic_route->state == AUDIO_BUSY_STATE){
-			io_late = 0;
+			io_tracer = dmic_route->manage.io_tracer;
+			if(audio_ring_resync(dmic_route->manage.dma_tracer, dmic_new_tracer, &io_tracer,
+						AUDIO_IO_LEADING_DMA, dmic_route->manage.fragment_cnt)){
+				dmic_route->manage.io_tracer = io_tracer;
+				dsp_route_xrun(dmic_route);
+			}
 			if(dsp->dmic_aec && aec_route){
 				/* dmic enable aec */
 				dma_tracer = dmic_route->manage.dma_tracer;
@@ -145,10 +308,9 @@ static void dsp_workqueue_handle(struct work_struct *work)
 				while(dma_tracer != dmic_new_tracer && aec_tracer != aec_new_tracer){
 					dmic_route->manage.fragments[dma_tracer].priv = &(aec_route->manage.fragments[aec_tracer]);
 					dmic_route->manage.fragments[dma_tracer].state = true;
-					if(dma_tracer == dmic_route->manage.io_tracer)
-						io_late = 1;
-					dma_tracer = (dma_tracer + 1) % dmic_route->manage.fragment_cnt;
-					aec_tracer = (aec_tracer + 1) % aec_route->manage.fragment_cnt;
+					dma_tracer = audio_ring_next(dma_tracer, dmic_route->manage.fragment_cnt);
+					aec_tracer = audio_ring_next(aec_tracer, aec_route->manage.fragment_cnt);
+					dsp_route_publish(dmic_route, dma_tracer);
 				}
 				dmic_route->manage.dma_tracer = dma_tracer;
 				dmic_route->manage.aec_dma_tracer = aec_tracer;
@@ -159,38 +321,25 @@ static void dsp_workqueue_handle(struct work_struct *work)
 				while(dma_tracer != dmic_new_tracer){
 					dmic_route->manage.fragments[dma_tracer].priv = NULL;
 					dmic_route->manage.fragments[dma_tracer].state = true;
-					if(dma_tracer == dmic_route->manage.io_tracer)
-						io_late = 1;
-					dma_tracer = (dma_tracer + 1) % dmic_route->manage.fragment_cnt;
-					if(unlikely(dmic_new_tracer >= dmic_route->manage.fragment_cnt))
-						printk("%s: dmic_new_tracer wrong!:%d, fcnt:%d\n",
-							__func__, dmic_new_tracer, dmic_route->manage.fragment_cnt);
+					dma_tracer = audio_ring_next(dma_tracer, dmic_route->manage.fragment_cnt);
+					dsp_route_publish(dmic_route, dma_tracer);
 				}
 				dmic_route->manage.dma_tracer = dma_tracer;
 			}
 			/* clear dma prepare-buffer and sync io_tracer */
 			for(cnt = 1; cnt <= AUDIO_IO_LEADING_DMA; cnt++){
-				index = (dmic_new_tracer + cnt) % dmic_route->manage.fragment_cnt;
+				index = audio_ring_add(dmic_new_tracer, cnt, dmic_route->manage.fragment_cnt);
 				if(dmic_route->manage.fragments[index].state){
 					dmic_route->manage.fragments[index].state = false;
 					dmic_route->manage.fragments[index].priv = NULL;
 				}
-				if(index == dmic_route->manage.io_tracer)
-					io_late = 1;
-			}
-			if(io_late){
-				dmic_route->manage.io_tracer = (index + 1) % dmic_route->manage.fragment_cnt;
 			}
+			dsp_route_update_fill(dmic_route);
 		}
 		/* wait second copy data */
 		if(dmic_route->wait_flag){
-			cnt = 0;
-			dma_tracer = dmic_route->manage.dma_tracer;
-			io_tracer = dmic_route->manage.io_tracer;
-			while(io_tracer != dma_tracer){
-				cnt++;
-				io_tracer = (io_tracer + 1) % dmic_route->manage.fragment_cnt;
-			}
+			cnt = audio_ring_distance(dmic_route->manage.io_tracer, dmic_route->manage.dma_tracer,
+					dmic_route->manage.fragment_cnt);
 			if(cnt >= dmic_route->wait_cnt){
 				dmic_route->wait_flag = false;
 				complete(&dmic_route->done_completion);
@@ -202,58 +351,33 @@ static void dsp_workqueue_handle(struct work_struct *work)
 	if(ao_route){
 		mutex_lock(&ao_route->mlock);
 		if(ao_route->state == AUDIO_BUSY_STATE){
-			io_late = 0;
+			io_tracer = ao_route->manage.io_tracer;
+			if(audio_ring_resync(ao_route->manage.dma_tracer, ao_new_tracer, &io_tracer,
+						AUDIO_IO_LEADING_DMA, ao_route->manage.fragment_cnt)){
+				ao_route->manage.io_tracer = io_tracer;
+				dsp_route_xrun(ao_route);
+			}
+			/* played fragments go silent in case the application stops feeding */
 			dma_tracer = ao_route->manage.dma_tracer;
-
-			if(ao_new_tracer < ao_route->manage.fragment_cnt && ao_new_tracer >= 0){
-				while(dma_tracer != ao_new_tracer){
-					if(dma_tracer == ao_route->manage.io_tracer){
-						printk("%d: audio spk io late!\n", __LINE__);
-						io_late = 1;
-					}
-					memset(ao_route->manage.fragments[dma_tracer].vaddr, 0, ao_route->manage.fragment_size);
-					dma_sync_single_for_device(NULL, ao_route->manage.fragments[dma_tracer].paddr,
-							ao_route->manage.fragment_size, DMA_TO_DEVICE);
-					ao_route->manage.fragments[dma_tracer].state = false;
-					dma_tracer = (dma_tracer + 1) % ao_route->manage.fragment_cnt;
-					if (unlikely(ao_new_tracer >= ao_route->manage.fragment_cnt))
-						printk("%s: ao_new_tracer wrong!:%d, fcnt:%d\n",
-						       __func__, ao_new_tracer, ao_route->manage.fragment_cnt);
-				}
-				ao_route->manage.dma_tracer = dma_tracer;
-				/* clear dma prepare-buffer and sync io_tracer */
-				for(cnt = 0; cnt <= AUDIO_IO_LEADING_DMA; cnt++){
-					index = (ao_new_tracer + cnt) % ao_route->manage.fragment_cnt;
-					if(ao_route->manage.fragments[index].state){
-						ao_route->manage.fragments[index].state = false;
-					}
-					if(index == ao_route->manage.io_tracer)
-						io_late = 1;
-				}
-				if(io_late){
-					ao_route->manage.io_tracer = (index + 1) % ao_route->manage.fragment_cnt;
-				}
-			}else{
-				printk("%d: audio spk dma transfer error!\n", __LINE__);
+			while(dma_tracer != ao_new_tracer){
 				memset(ao_route->manage.fragments[dma_tracer].vaddr, 0, ao_route->manage.fragment_size);
 				dma_sync_single_for_device(NULL, ao_route->manage.fragments[dma_tracer].paddr,
 						ao_route->manage.fragment_size, DMA_TO_DEVICE);
-				memset(ao_route->manage.fragments[dma_tracer+1].vaddr, 0, ao_route->manage.fragment_size);
-				dma_sync_single_for_device(NULL, ao_route->manage.fragments[dma_tracer+1].paddr,
-						ao_route->manage.fragment_size, DMA_TO_DEVICE);
-				dma_tracer = (dma_tracer + 2) % ao_route->manage.fragment_cnt;
-				ao_route->manage.dma_tracer = dma_tracer;
-                        }
+				ao_route->manage.fragments[dma_tracer].state = false;
+				dma_tracer = audio_ring_next(dma_tracer, ao_route->manage.fragment_cnt);
+			}
+			ao_route->manage.dma_tracer = dma_tracer;
+			/* clear dma prepare-buffer */
+			for(cnt = 0; cnt <= AUDIO_IO_LEADING_DMA; cnt++){
+				index = audio_ring_add(ao_new_tracer, cnt, ao_route->manage.fragment_cnt);
+				ao_route->manage.fragments[index].state = false;
+			}
+			dsp_route_update_fill(ao_route);
 		}
 		/* wait second copy space */
 		if(ao_route->wait_flag){
-			cnt = 0;
-			dma_tracer = ao_route->manage.dma_tracer;
-			io_tracer = ao_route->manage.io_tracer;
-			while(io_tracer != dma_tracer){
-				cnt++;
-				io_tracer = (io_tracer + 1) % ao_route->manage.fragment_cnt;
-			}
+			cnt = audio_ring_distance(ao_route->manage.io_tracer, ao_route->manage.dma_tracer,
+					ao_route->manage.fragment_cnt);
 			if(cnt >= ao_route->wait_cnt){
 				ao_route->wait_flag = false;
 				complete(&ao_route->done_completion);
@@ -271,19 +395,142 @@ static void dsp_workqueue_handle(struct work_struct *work)
 		mutex_unlock(&aec_route->mlock);
 	}
 
+	/* readers of the capture rings, pollers of every ring */
+	if(amic_route)
+		wake_up_interruptible(&amic_route->read_wait);
+	if(dmic_route)
+		wake_up_interruptible(&dmic_route->read_wait);
+	wake_up_interruptible(&dsp->poll_wait);
 	return;
 }
 
+/* read back where the dma of a busy route is, called with dsp->slock held */
+static unsigned int dsp_sample_position(struct audio_route *route)
+{
+	struct audio_pipe *pipe = route->pipe;
+	dma_addr_t dma_currentaddr = 0;
+	unsigned int offset = 0;
+	unsigned int index = 0;
+	u64 now = 0;
+
+	dma_currentaddr = pipe->dma_chan->device->get_current_trans_addr(pipe->dma_chan, NULL, NULL,
+			pipe->dma_config.direction);
+	now = ktime_get_ns();
+	index = audio_ring_fragment(dma_currentaddr, pipe->paddr, route->manage.fragment_size,
+			route->manage.fragment_cnt, &offset);
+	/* the dma did not report a position in the ring, it has not moved as far as we know */
+	if(unlikely(index >= route->manage.fragment_cnt))
+		return 0;
+	route->manage.new_dma_tracer = index;
+	return dsp_update_hw_position(route, index, offset, now);
+}
+
+/* called by the dma driver each time the route finished a fragment */
+static void dsp_dma_period_callback(void *param)
+{
+	struct audio_route *route = param;
+	struct audio_dsp_device *dsp = route->priv;
+	unsigned long lock_flags;
+	unsigned int moved = 0;
+	u64 now = ktime_get_ns();
+	u64 delta = 0;
+	u64 jitter = 0;
+
+	spin_lock_irqsave(&dsp->slock, lock_flags);
+	if(route->state == AUDIO_BUSY_STATE){
+		if(route->period_irqs){
+			delta = now - route->period_last_ns;
+			jitter = delta > route->fragment_ns ? delta - route->fragment_ns : route->fragment_ns - delta;
+			route->jitter_sum_ns += jitter;
+			if(jitter > route->jitter_max_ns)
+				route->jitter_max_ns = jitter;
+		}
+		route->period_last_ns = now;
+		route->period_irqs++;
+		if(route->stall_watch)
+			hrtimer_start(&route->stall_timer, ns_to_ktime(AUDIO_STALL_FRAGMENTS * route->fragment_ns),
+					HRTIMER_MODE_REL);
+		moved = dsp_sample_position(route);
+		/* more than one fragment per interrupt: we got to it late */
+		if(moved > 1)
+			route->late_wakeups++;
+	}
+	spin_unlock_irqrestore(&dsp->slock, lock_flags);
+
+	if(moved){
+		wake_up_interruptible(&dsp->poll_wait);
+		schedule_work(&dsp->workqueue);
+	}
+}
+
+/*
+ * With period interrupts each running route has a watchdog that every
+ * interrupt pushes back. It only fires when they stop coming, and then
+ * reads the position back once per fragment until they resume.
+ */
+static enum hrtimer_restart dsp_route_stall_callback(struct hrtimer *timer)
+{
+	struct audio_route *route = container_of(timer, struct audio_route, stall_timer);
+	struct audio_dsp_device *dsp = route->priv;
+	unsigned long lock_flags;
+	unsigned int moved = 0;
+
+	spin_lock_irqsave(&dsp->slock, lock_flags);
+	if(!route->stall_watch){
+		spin_unlock_irqrestore(&dsp->slock, lock_flags);
+		return HRTIMER_NORESTART;
+	}
+	if(route->state == AUDIO_BUSY_STATE){
+		route->timer_polls++;
+		moved = dsp_sample_position(route);
+	}
+	hrtimer_forward_now(timer, ns_to_ktime(route->fragment_ns));
+	spin_unlock_irqrestore(&dsp->slock, lock_flags);
+
+	if(moved){
+		wake_up_interruptible(&dsp->poll_wait);
+		schedule_work(&dsp->workqueue);
+	}
+	return HRTIMER_RESTART;
+}
+
+/* called once the cyclic dma of the route is submitted */
+static void dsp_route_stall_watch(struct audio_route *route)
+{
+	struct audio_dsp_device *dsp = route->priv;
+	unsigned long lock_flags;
+
+	if(!dma_period_irq)
+		return;
+	spin_lock_irqsave(&dsp->slock, lock_flags);
+	route->stall_watch = true;
+	hrtimer_start(&route->stall_timer, ns_to_ktime(AUDIO_STALL_FRAGMENTS * route->fragment_ns),
+			HRTIMER_MODE_REL);
+	spin_unlock_irqrestore(&dsp->slock, lock_flags);
+}
+
+/* called before the dma of the route is stopped */
+static void dsp_route_stall_stop(struct audio_route *route)
+{
+	struct audio_dsp_device *dsp = route->priv;
+	unsigned long lock_flags;
+
+	spin_lock_irqsave(&dsp->slock, lock_flags);
+	route->stall_watch = false;
+	spin_unlock_irqrestore(&dsp->slock, lock_flags);
+	hrtimer_cancel(&route->stall_timer);
+}
+
+/* polls every busy route, only without period interrupts */
 static unsigned hrtimer_callback_cnt = 0;
 static enum hrtimer_restart jz_audio_hrtimer_callback(struct hrtimer *hr_timer) {
 	struct audio_dsp_device *dsp = container_of(hr_timer,
 			struct audio_dsp_device, hr_timer);
 	struct audio_route *route = NULL;
-	struct audio_pipe *pipe = NULL;
-	dma_addr_t dma_currentaddr = 0;
-	unsigned int index = 0;
 	unsigned int id = 0;
 	unsigned long lock_flags;
+	bool polled = false;
+	bool moved = false;
 
 	hrtimer_callback_cnt++;
 	if (atomic_read(&dsp->timer_stopped))
@@ -296,19 +543,19 @@ static enum hrtimer_restart jz_audio_hrtimer_callback(struct hrtimer *hr_timer)
 	for(id = 0; id < AUDIO_ROUTE_MAX_ID; id++){
 		route = &(dsp->routes[id]);
 		if(route && route->state == AUDIO_BUSY_STATE){
-			pipe = route->pipe;
-			dma_currentaddr = pipe->dma_chan->device->get_current_trans_addr(pipe->dma_chan, NULL, NULL,
-					pipe->dma_config.direction);
-			index = (dma_currentaddr - pipe->paddr) / route->manage.fragment_size;
-			if(unlikely(index >= route->manage.fragment_cnt))
-				index %= route->manage.fragment_cnt;
-			route->manage.new_dma_tracer = index;
+			route->timer_polls++;
+			polled = true;
+			moved |= dsp_sample_position(route) != 0;
 		}
 	}
 
 	spin_unlock_irqrestore(&dsp->slock, lock_flags);
 
-	schedule_work(&dsp->workqueue);
+	if(moved)
+		wake_up_interruptible(&dsp->poll_wait);
+
+	if(polled)
+		schedule_work(&dsp->workqueue);
 out:
 	return HRTIMER_NORESTART;
 }
@@ -388,6 +635,110 @@ out:
 }
 
 
+/*
+ * Route state machine. Starting a route powers its aic and codec path up
+ * (AUDIO_CMD_ENABLE_STREAM) and starts the dma; stopping it only stops the
+ * dma and leaves the hardware running in standby for standby_ms. A start
+ * with the same parameters within that time skips the codec power
+ * sequencing, which takes hundreds of ms and pops. The standby work, a
+ * parameter change, the last close and system suspend power it down.
+ *
+ * The aec route is always switched together with amic, under amic's mlock.
+ */
+static struct mutex *dsp_route_mlock(struct audio_route *route)
+{
+	if(route->index == AUDIO_ROUTE_AEC_ID && route->parent)
+		return &route->parent->mlock;
+	return &route->mlock;
+}
+
+static long dsp_route_hw_on(struct audio_route *route)
+{
+	long ret = AUDIO_SUCCESS;
+
+	if(route->hw_on)
+		return AUDIO_SUCCESS;
+	ret = route->pipe->ioctl(route->pipe, AUDIO_CMD_ENABLE_STREAM, NULL);
+	if(ret == AUDIO_SUCCESS){
+		route->hw_on = true;
+		route->hw_rate = route->rate;
+		route->hw_format = route->format;
+		route->hw_channel = route->channel;
+	}
+	return ret;
+}
+
+static long dsp_route_hw_off(struct audio_route *route)
+{
+	if(!route->hw_on)
+		return AUDIO_SUCCESS;
+	route->hw_on = false;
+	return route->pipe->ioctl(route->pipe, AUDIO_CMD_DISABLE_STREAM, NULL);
+}
+
+/* the dma of the route stopped, called with its mlock held */
+static long dsp_route_hw_stop(struct audio_route *route)
+{
+	struct audio_dsp_device *dsp = route->priv;
+
+	if(standby_ms <= 0)
+		return dsp_route_hw_off(route);
+	route->standby_expires = jiffies + msecs_to_jiffies(standby_ms);
+	mod_delayed_work(system_wq, &dsp->standby_work, msecs_to_jiffies(standby_ms));
+	return AUDIO_SUCCESS;
+}
+
+/*
+ * New parameters for a route in standby, called without its mlock. The
+ * hardware keeps running if they match, otherwise it is powered down and
+ * configured from scratch.
+ */
+static bool dsp_route_hw_keeps(struct audio_route *route, struct audio_parameter *param, unsigned int channel)
+{
+	struct mutex *mlock = dsp_route_mlock(route);
+	bool keep = false;
+
+	mutex_lock(mlock);
+	if(route->hw_on){
+		keep = route->hw_rate == param->rate && route->hw_format == param->format
+			&& route->hw_channel == channel;
+		if(!keep)
+			dsp_route_hw_off(route);
+	}
+	mutex_unlock(mlock);
+	return keep;
+}
+
+static void dsp_standby_work_handle(struct work_struct *work)
+{
+	struct audio_dsp_device *dsp = container_of(to_delayed_work(work),
+			struct audio_dsp_device, standby_work);
+	struct audio_route *route = NULL;
+	struct mutex *mlock = NULL;
+	unsigned long next = 0;
+	bool pending = false;
+	int index = 0;
+
+	for(index = 0; index < AUDIO_ROUTE_MAX_ID; index++){
+		route = &(dsp->routes[index]);
+		if(!route->pipe)
+			continue;
+		mlock = dsp_route_mlock(route);
+		mutex_lock(mlock);
+		if(route->hw_on && route->state != AUDIO_BUSY_STATE){
+			if(time_after_eq(jiffies, route->standby_expires))
+				dsp_route_hw_off(route);
+			else if(!pending || time_before(route->standby_expires, next)){
+				next = route->standby_expires;
+				pending = true;
+			}
+		}
+		mutex_unlock(mlock);
+	}
+	if(pending)
+		schedule_delayed_work(&dsp->standby_work, next - jiffies);
+}
+
 static long dsp_config_route_param(struct audio_dsp_device *dsp, enum auido_route_index index,
 						unsigned int cmd, struct audio_parameter *param)
 {
@@ -407,7 +758,10 @@ static long dsp_config_route_param(struct audio_dsp_device *dsp, enum auido_rout
 		goto out;
 	}
 
-	ret = route->pipe->ioctl(route->pipe, cmd, param);
+	if(dsp_route_hw_keeps(route, param, param->channel))
+		ret = AUDIO_SUCCESS;
+	else
+		ret = route->pipe->ioctl(route->pipe, cmd, param);
 	if(ret == AUDIO_SUCCESS){
 		route->rate = param->rate;
 		route->format = param->format;
@@ -443,7 +797,10 @@ static long dsp_config_aec_route_param(struct audio_dsp_device *dsp, unsigned in
 		goto out;
 	}
 
-	ret = route->pipe->ioctl(route->pipe, cmd, param);
+	if(dsp_route_hw_keeps(route, param, 1))
+		ret = AUDIO_SUCCESS;
+	else
+		ret = route->pipe->ioctl(route->pipe, cmd, param);
 	if(ret == AUDIO_SUCCESS){
 		route->rate = param->rate;
 		route->format = param->format;
@@ -464,6 +821,27 @@ static inline unsigned int format_to_bytes(unsigned int format)
 		return 4;
 }
 
+/*
+ * Fragment size and count for the route's current parameters. A
+ * negotiated period is rounded up to AUDIO_PERIOD_FRAMES_ALIGN frames so
+ * the amic and aec rings keep the same fragment duration.
+ */
+static void dsp_route_geometry(struct audio_route *route, unsigned int sample_size,
+		unsigned int period_us, unsigned int *fragment_size, unsigned int *fragment_cnt)
+{
+	unsigned int frames = 0;
+
+	if(period_us){
+		frames = div_u64((u64)route->rate * period_us, USEC_PER_SEC);
+		frames = ALIGN(max_t(unsigned int, frames, 1), AUDIO_PERIOD_FRAMES_ALIGN);
+	}else
+		frames = (route->rate / 100) * fragment_time;
+	*fragment_size = frames * sample_size;
+	*fragment_cnt = *fragment_size ? route->pipe->reservesize / *fragment_size : 0;
+	if (*fragment_cnt >= CACHED_FRAGMENT)
+		*fragment_cnt = CACHED_FRAGMENT;
+}
+
 static long dsp_create_dma_chan(struct audio_route *route)
 {
 	struct dsp_data_manage *manage = NULL;
@@ -497,14 +875,14 @@ static long dsp_create_dma_chan(struct audio_route *route)
 	}else{
 		manage->sample_size = route->channel*format_to_bytes(route->format);
 	}
-	manage->fragment_size = (route->rate / 100) * manage->sample_size * fragment_time;
 	if(route->index == AUDIO_ROUTE_AEC_ID){
 		parent = route->parent;
+		route->period_us = parent->period_us;
+	}
+	dsp_route_geometry(route, manage->sample_size, route->period_us,
+			&manage->fragment_size, &manage->fragment_cnt);
+	if(route->index == AUDIO_ROUTE_AEC_ID)
 		manage->fragment_cnt = parent->manage.fragment_cnt;
-	}else
-		manage->fragment_cnt = pipe->reservesize / manage->fragment_size;
-	if (manage->fragment_cnt >= CACHED_FRAGMENT)
-		manage->fragment_cnt = CACHED_FRAGMENT;
 	manage->fragments = pr_kzalloc(sizeof(struct dsp_data_fragment) * manage->fragment_cnt);
 	if(manage->fragments == NULL){
 		audio_warn_print("%d, Can't malloc manage!\n",__LINE__);
@@ -525,10 +903,11 @@ static long dsp_create_dma_chan(struct audio_route *route)
 
 	dmaengine_slave_config(pipe->dma_chan, &pipe->dma_config);
 
+	/* one period per fragment, so the dma driver calls back at each fragment */
 	desc = pipe->dma_chan->device->device_prep_dma_cyclic(pipe->dma_chan,
 			pipe->paddr,
 			manage->buffersize,
-			manage->buffersize,
+			dma_period_irq ? manage->fragment_size : manage->buffersize,
 			pipe->dma_config.direction,
 			flags);
 
@@ -537,7 +916,40 @@ static long dsp_create_dma_chan(struct audio_route *route)
 		ret = -EINVAL;
 		goto out;
 	}
+	if(dma_period_irq){
+		desc->callback = dsp_dma_period_callback;
+		desc->callback_param = route;
+	}
 	dmaengine_submit(desc);
+
+	route->fragment_ns = audio_ring_fragment_ns(manage->fragment_size / manage->sample_size, route->rate);
+	route->dma_tstamp_ns = ktime_get_ns();
+	memset(&route->tstamp, 0, sizeof(route->tstamp));
+	route->period_irqs = 0;
+	route->timer_polls = 0;
+	route->jitter_sum_ns = 0;
+	route->jitter_max_ns = 0;
+	audio_ring_xrun_reset(&route->xrun);
+	route->rw_offset = 0;
+	audio_process_reset(&route->process);
+	route->fill = 0;
+	route->fill_min = UINT_MAX;
+	route->fill_max = 0;
+	route->hw_ptr = 0;
+	route->hw_count = 0;
+	route->hw_frames = 0;
+	if(route->ctrl){
+		route->ctrl->fragment_size = manage->fragment_size;
+		route->ctrl->fragment_cnt = manage->fragment_cnt;
+		route->ctrl->fragment_ns = route->fragment_ns;
+		route->ctrl->hw_ptr = 0;
+		route->ctrl->hw_count = 0;
+		route->ctrl->hw_tstamp_ns = route->dma_tstamp_ns;
+		route->ctrl->hw_frames = 0;
+	}
+	if(route->appl)
+		route->appl->appl_count = 0;
+	dsp_route_stall_watch(route);
 out:
 	return ret;
 }
@@ -548,6 +960,7 @@ static int dsp_destroy_dma_chan(struct audio_route *route)
 	struct audio_pipe *pipe = NULL;
 	long ret = AUDIO_SUCCESS;
 
+	dsp_route_stall_stop(route);
 	if(route->state != AUDIO_BUSY_STATE)
 		goto out;
 	/* deinit fragments manage and dma channel */
@@ -567,11 +980,126 @@ out:
 	return ret;
 }
 
+static void dsp_route_account_start(struct audio_route *route, u64 start_ns, bool warm)
+{
+	u64 latency = ktime_get_ns() - start_ns;
+
+	route->start_last_ns = latency;
+	if(warm){
+		route->warm_starts++;
+		if(latency > route->start_warm_max_ns)
+			route->start_warm_max_ns = latency;
+	}else{
+		route->cold_starts++;
+		if(latency > route->start_cold_max_ns)
+			route->start_cold_max_ns = latency;
+	}
+}
+
+/*
+ * Ramp the playback ring down to silence ahead of the dma and let it play
+ * out, called with route->mlock held before the dma is stopped, so the
+ * output does not step from the last sample to nothing.
+ */
+static void dsp_route_fade_out(struct audio_route *route)
+{
+	struct audio_dsp_device *dsp = route->priv;
+	struct dsp_data_manage *manage = &route->manage;
+	struct dsp_data_fragment *fragment = NULL;
+	unsigned long lock_flags;
+	unsigned int index = 0;
+	unsigned int frames = 0;
+	unsigned int cnt = 0;
+	unsigned int i = 0;
+	s16 *sample = NULL;
+
+	if(route->state != AUDIO_BUSY_STATE || !manage->fragments || manage->fragment_cnt < 2)
+		return;
+
+	spin_lock_irqsave(&dsp->slock, lock_flags);
+	dsp_sample_position(route);
+	index = manage->new_dma_tracer;
+	spin_unlock_irqrestore(&dsp->slock, lock_flags);
+
+	/* the fragment after the playing one fades out, the rest goes silent */
+	frames = manage->fragment_size / manage->sample_size;
+	for(cnt = 1; cnt < manage->fragment_cnt; cnt++){
+		fragment = &(manage->fragments[(index + cnt) % manage->fragment_cnt]);
+		if(cnt == 1 && route->format == 16 && fragment->state){
+			sample = fragment->vaddr;
+			for(i = 0; i < frames * route->channel; i++)
+				sample[i] = sample[i] * (s32)(frames - i / route->channel) / (s32)frames;
+		}else
+			memset(fragment->vaddr, 0, manage->fragment_size);
+		fragment->state = false;
+		dma_sync_single_for_device(NULL, fragment->paddr, manage->fragment_size, DMA_TO_DEVICE);
+	}
+	msleep(DIV_ROUND_UP((unsigned long)div_u64(2 * route->fragment_ns, NSEC_PER_USEC), USEC_PER_MSEC));
+}
+
+/*
+ * Bring a route that was running back after system sleep, called with
+ * its mlock held. The aic and codec are programmed again from the
+ * route's parameters; what was queued or captured across the sleep is
+ * lost and reported as an xrun.
+ */
+static long dsp_route_restart(struct audio_route *route)
+{
+	struct audio_dsp_device *dsp = route->priv;
+	struct dsp_data_manage *manage = &route->manage;
+	struct audio_parameter param;
+	unsigned long lock_flags;
+	long ret = AUDIO_SUCCESS;
+
+	param.rate = route->rate;
+	param.format = route->format;
+	param.channel = route->channel;
+	ret = route->pipe->ioctl(route->pipe, AUDIO_CMD_CONFIG_PARAM, &param);
+	if(ret != AUDIO_SUCCESS)
+		return ret;
+
+	spin_lock_irqsave(&dsp->slock, lock_flags);
+	route->state = AUDIO_CONFIG_STATE;
+	spin_unlock_irqrestore(&dsp->slock, lock_flags);
+	ret = dsp_create_dma_chan(route);
+	if(ret != AUDIO_SUCCESS)
+		return ret;
+
+	/* capture dma runs before the stream is enabled, playback after, as in the enable paths */
+	if(route->index != AUDIO_ROUTE_SPK_ID)
+		dma_async_issue_pending(route->pipe->dma_chan);
+	ret = dsp_route_hw_on(route);
+	if(ret != AUDIO_SUCCESS){
+		dsp_route_stall_stop(route);
+		dmaengine_terminate_all(route->pipe->dma_chan);
+		return ret;
+	}
+	if(route->index == AUDIO_ROUTE_SPK_ID)
+		dma_async_issue_pending(route->pipe->dma_chan);
+
+	spin_lock_irqsave(&dsp->slock, lock_flags);
+	route->state = AUDIO_BUSY_STATE;
+	route->aec_sample_offset = 0;
+	manage->dma_tracer = 0;
+	manage->new_dma_tracer = 0;
+	manage->aec_dma_tracer = 0;
+	if(route->index == AUDIO_ROUTE_SPK_ID)
+		manage->io_tracer = AUDIO_IO_LEADING_DMA;
+	else
+		manage->io_tracer = manage->fragment_cnt - AUDIO_IO_LEADING_DMA;
+	spin_unlock_irqrestore(&dsp->slock, lock_flags);
+	dsp_route_xrun(route);
+
+	return ret;
+}
+
 static long dsp_enable_amic_ai_and_aec(struct audio_dsp_device *dsp)
 {
 	unsigned long lock_flags;
 	struct audio_route *ai_route = NULL;
 	struct audio_route *aec_route = NULL;
+	u64 start = 0;
+	bool warm = false;
 	long ret = AUDIO_SUCCESS;
 
 	ai_route = &(dsp->routes[AUDIO_ROUTE_AMIC_ID]);
@@ -582,11 +1110,15 @@ static long dsp_enable_amic_ai_and_aec(struct audio_dsp_device *dsp)
 		return ret;
 	}
 
+	mutex_lock(&ai_route->mlock);
 	if(ai_route->state == AUDIO_BUSY_STATE){
 		ai_route->refcnt++;
 		aec_route->refcnt++;
+		mutex_unlock(&ai_route->mlock);
 		return AUDIO_SUCCESS;
 	}
+	start = ktime_get_ns();
+	warm = ai_route->hw_on && aec_route->hw_on;
 
 	/* config the dma channels of  ai and aec */
 	ret = dsp_create_dma_chan(ai_route);
@@ -603,16 +1135,15 @@ static long dsp_enable_amic_ai_and_aec(struct audio_dsp_device *dsp)
 	dma_async_issue_pending(ai_route->pipe->dma_chan);
 	dma_async_issue_pending(aec_route->pipe->dma_chan);
 
-	/* enable hardware */
-	ret = ai_route->pipe->ioctl(ai_route->pipe, AUDIO_CMD_ENABLE_STREAM, NULL);//here delay very long,be careful
+	/* enable hardware, a cold start delays very long */
+	ret = dsp_route_hw_on(ai_route);
 	if(ret != AUDIO_SUCCESS){
 		goto out_cmd;
 	}
-	ret = aec_route->pipe->ioctl(aec_route->pipe, AUDIO_CMD_ENABLE_STREAM, NULL);
+	ret = dsp_route_hw_on(aec_route);
 	if(ret != AUDIO_SUCCESS){
 		goto out_cmd;
 	}
-	mutex_unlock(&ai_route->mlock);
 	spin_lock_irqsave(&dsp->slock, lock_flags);
 	ai_route->state = AUDIO_BUSY_STATE;
 	aec_route->state = AUDIO_BUSY_STATE;
@@ -631,6 +1162,7 @@ static long dsp_enable_amic_ai_and_aec(struct audio_dsp_device *dsp)
 	aec_route->refcnt++;
 	init_completion(&(ai_route->done_completion));
 	spin_unlock_irqrestore(&dsp->slock, lock_flags);
+	dsp_route_account_start(ai_route, start, warm);
 	mutex_unlock(&ai_route->mlock);
 	return ret;
 out_cmd:
@@ -673,11 +1205,11 @@ static long dsp_disable_amic_ai_and_aec(struct audio_dsp_device *dsp)
 	}
 
 	/* disable hardware */
-	ret = ai_route->pipe->ioctl(ai_route->pipe, AUDIO_CMD_DISABLE_STREAM, NULL);
+	ret = dsp_route_hw_stop(ai_route);
 	if(ret != AUDIO_SUCCESS){
 		goto out_cmd;
 	}
-	ret = aec_route->pipe->ioctl(aec_route->pipe, AUDIO_CMD_DISABLE_STREAM, NULL);
+	ret = dsp_route_hw_stop(aec_route);
 	if(ret != AUDIO_SUCCESS){
 		goto out_cmd;
 	}
@@ -726,6 +1258,8 @@ static long dsp_enable_dmic_ai(struct audio_dsp_device *dsp)
 {
 	unsigned long lock_flags;
 	struct audio_route *ai_route = NULL;
+	u64 start = 0;
+	bool warm = false;
 	long ret = AUDIO_SUCCESS;
 
 	ai_route = &(dsp->routes[AUDIO_ROUTE_DMIC_ID]);
@@ -741,6 +1275,8 @@ static long dsp_enable_dmic_ai(struct audio_dsp_device *dsp)
 		mutex_unlock(&ai_route->mlock);
 		return AUDIO_SUCCESS;
 	}
+	start = ktime_get_ns();
+	warm = ai_route->hw_on;
 	/* config the dma channels of  ai and aec */
 	ret = dsp_create_dma_chan(ai_route);
 	if(ret != AUDIO_SUCCESS){
@@ -751,7 +1287,7 @@ static long dsp_enable_dmic_ai(struct audio_dsp_device *dsp)
 	dma_async_issue_pending(ai_route->pipe->dma_chan);
 
 	/* enable hardware */
-	ret = ai_route->pipe->ioctl(ai_route->pipe, AUDIO_CMD_ENABLE_STREAM, NULL);
+	ret = dsp_route_hw_on(ai_route);
 	if(ret != AUDIO_SUCCESS){
 		goto out_cmd;
 	}
@@ -765,6 +1301,7 @@ static long dsp_enable_dmic_ai(struct audio_dsp_device *dsp)
 	ai_route->refcnt++;
 	init_completion(&(ai_route->done_completion));
 	spin_unlock_irqrestore(&dsp->slock, lock_flags);
+	dsp_route_account_start(ai_route, start, warm);
 
 	mutex_unlock(&ai_route->mlock);
 	return ret;
@@ -888,6 +1425,8 @@ static long dsp_enable_amic_ao(struct audio_dsp_device *dsp)
 {
 	unsigned long lock_flags;
 	struct audio_route *ao_route = NULL;
+	u64 start = 0;
+	bool warm = false;
 	long ret = AUDIO_SUCCESS;
 
 	ao_route = &(dsp->routes[AUDIO_ROUTE_SPK_ID]);
@@ -904,6 +1443,8 @@ static long dsp_enable_amic_ao(struct audio_dsp_device *dsp)
 		audio_warn_print("The route of amic speaker is busy now!\n");
 		return AUDIO_SUCCESS;
 	}
+	start = ktime_get_ns();
+	warm = ao_route->hw_on;
 
 	/* config the dma channels of  ai and aec */
 	ret = dsp_create_dma_chan(ao_route);
@@ -913,7 +1454,7 @@ static long dsp_enable_amic_ao(struct audio_dsp_device *dsp)
 	}
 
 	/* enable hardware */
-	ret = ao_route->pipe->ioctl(ao_route->pipe, AUDIO_CMD_ENABLE_STREAM, NULL);
+	ret = dsp_route_hw_on(ao_route);
 	if(ret != AUDIO_SUCCESS){
 		printk("IOCTL Enable ao stream error.\n");
 		goto out_cmd;
@@ -930,6 +1471,7 @@ static long dsp_enable_amic_ao(struct audio_dsp_device *dsp)
 	ao_route->refcnt++;
 	init_completion(&(ao_route->done_completion));
 	spin_unlock_irqrestore(&dsp->slock, lock_flags);
+	dsp_route_account_start(ao_route, start, warm);
 	mutex_unlock(&ao_route->mlock);
 	return ret;
 out_cmd:
@@ -965,7 +1507,8 @@ static long dsp_disable_amic_ao(struct audio_dsp_device *dsp)
 	}
 
 	/* disable hardware */
-	ret = ao_route->pipe->ioctl(ao_route->pipe, AUDIO_CMD_DISABLE_STREAM, NULL);
+	dsp_route_fade_out(ao_route);
+	ret = dsp_route_hw_stop(ao_route);
 	if(ret != AUDIO_SUCCESS){
 		goto out_cmd;
 	}
@@ -1113,7 +1656,7 @@ static long dsp_disable_dmic_ai(struct audio_dsp_device *dsp)
 	}
 
 	/* disable hardware */
-	ret = ai_route->pipe->ioctl(ai_route->pipe, AUDIO_CMD_DISABLE_STREAM, NULL);
+	ret = dsp_route_hw_stop(ai_route);
 	if(ret != AUDIO_SUCCESS){
 		goto out_cmd;
 	}
@@ -1152,6 +1695,17 @@ exit:
 	return ret;
 }
 
+/*
+ * How long a transfer may wait for the dma. Negotiated routes get a few
+ * periods beyond what they wait for, so a stalled dma shows up quickly.
+ */
+static unsigned long dsp_route_wait_timeout(struct audio_route *route)
+{
+	if(!route->period_us)
+		return msecs_to_jiffies(800);
+	return usecs_to_jiffies((route->wait_cnt + AUDIO_PERIOD_MIN_CNT) * route->period_us) + 1;
+}
+
 static long dsp_get_mic_stream(struct audio_dsp_device *dsp, enum auido_route_index index, unsigned long arg)
 {
 	struct audio_route *ai_route = NULL;
@@ -1200,6 +1754,10 @@ static long dsp_get_mic_stream(struct audio_dsp_device *dsp, enum auido_route_in
 		ret = -EPERM;
 		goto out;
 	}
+	if(audio_ring_xrun_transfer(&ai_route->xrun)){
+		ret = -EPIPE;
+		goto out;
+	}
 	manage = &(ai_route->manage);
 	cnt = stream.size / manage->fragment_size;
 	if(dsp->amic_aec && (stream.aec != NULL)){
@@ -1219,9 +1777,16 @@ again:
 	io_tracer = manage->io_tracer;
 	/* first copy */
 	while(i < cnt){
-		if(io_tracer+1 == dma_tracer || (dma_tracer==0 && io_tracer==ai_route->manage.fragment_cnt-1))
+		if(audio_ring_next(io_tracer, manage->fragment_cnt) == dma_tracer)
 			break;
 		fragment = &(manage->fragments[io_tracer]);
+		if(i == 0){
+			ai_route->tstamp.tstamp_ns = fragment->tstamp_ns;
+			ai_route->tstamp.frame_pos = fragment->frame_pos;
+			aec_fragment = fragment->priv;
+			ai_route->tstamp.aec_tstamp_ns = aec_fragment ? aec_fragment->tstamp_ns : 0;
+			ai_route->tstamp.aec_frame_pos = aec_fragment ? aec_fragment->frame_pos : 0;
+		}
 		if(fragment->state){
 			copy_to_user((stream.data + i * manage->fragment_size), fragment->vaddr, manage->fragment_size);
 			dma_sync_single_for_device(NULL, fragment->paddr, manage->fragment_size, DMA_FROM_DEVICE);
@@ -1243,7 +1808,7 @@ again:
 		}
 		fragment->priv = NULL;
 		i++;
-		io_tracer = (io_tracer + 1) % manage->fragment_cnt;
+		io_tracer = audio_ring_next(io_tracer, manage->fragment_cnt);
 	}
 	manage->io_tracer = io_tracer;
 	/* second copy */
@@ -1251,7 +1816,7 @@ again:
 		ai_route->wait_flag = true;
 		ai_route->wait_cnt = cnt - i - 1;
 		mutex_unlock(&ai_route->mlock);
-		time = wait_for_completion_timeout(&ai_route->done_completion, msecs_to_jiffies(800));
+		time = wait_for_completion_timeout(&ai_route->done_completion, dsp_route_wait_timeout(ai_route));
 		if(!time){
 			audio_err_print("get mic timeout!\n");
 			ret = -ETIMEDOUT;
@@ -1276,6 +1841,7 @@ static long dsp_set_spk_stream(struct audio_dsp_device *dsp, unsigned long arg)
 	struct audio_input_stream stream;
 	struct dsp_data_manage *manage = NULL;
 	struct dsp_data_fragment *fragment = NULL;
+	unsigned long lock_flags;
 	unsigned long time = 0;
 	long ret = AUDIO_SUCCESS;
 
@@ -1312,6 +1878,10 @@ static long dsp_set_spk_stream(struct audio_dsp_device *dsp, unsigned long arg)
 		ret = -EPERM;
 		goto out;
 	}
+	if(audio_ring_xrun_transfer(&ao_route->xrun)){
+		ret = -EPIPE;
+		goto out;
+	}
 	manage = &(ao_route->manage);
 	cnt = stream.size / manage->fragment_size;
 again:
@@ -1321,16 +1891,23 @@ again:
 	io_tracer = manage->io_tracer;
 	/* first copy */
 	while(i < cnt){
-		if(io_tracer+1 == dma_tracer || (dma_tracer==0 && io_tracer==ao_route->manage.fragment_cnt-1))
+		if(audio_ring_next(io_tracer, manage->fragment_cnt) == dma_tracer)
 			break;
 		fragment = &(manage->fragments[io_tracer]);
+		if(i == 0){
+			spin_lock_irqsave(&dsp->slock, lock_flags);
+			dsp_predict_fragment(ao_route, io_tracer, &ao_route->tstamp.tstamp_ns,
+					&ao_route->tstamp.frame_pos);
+			spin_unlock_irqrestore(&dsp->slock, lock_flags);
+		}
 		if(fragment->state == false){
 			copy_from_user(fragment->vaddr, (stream.data + i * manage->fragment_size), manage->fragment_size);
-			dma_sync_single_for_device(NULL, fragment->paddr, manage->fragment_size, DMA_TO_DEVICE);
 			fragment->state = true;
+			dsp_route_process(ao_route, fragment);
+			dma_sync_single_for_device(NULL, fragment->paddr, manage->fragment_size, DMA_TO_DEVICE);
 		}
 		i++;
-		io_tracer = (io_tracer + 1) % manage->fragment_cnt;
+		io_tracer = audio_ring_next(io_tracer, manage->fragment_cnt);
 	}
 	manage->io_tracer = io_tracer;
 	/* second copy */
@@ -1338,7 +1915,7 @@ again:
 		ao_route->wait_flag = true;
 		ao_route->wait_cnt = cnt - i - 1;
 		mutex_unlock(&ao_route->mlock);
-		time = wait_for_completion_timeout(&ao_route->done_completion, msecs_to_jiffies(800));
+		time = wait_for_completion_timeout(&ao_route->done_completion, dsp_route_wait_timeout(ao_route));
 		if(!time){
 			audio_err_print("set spk timeout!\n");
 			ret = -ETIMEDOUT;
@@ -1354,29 +1931,154 @@ exit:
 	return ret;
 }
 
-static int disable_route_stream(struct audio_route *route)
+/*
+ * Negotiate the fragment duration and the minimum ring length of a route
+ * before its stream is enabled. The request is rounded up, the granted
+ * values are written back. A route with a negotiated period reports xruns
+ * with -EPIPE instead of resyncing silently.
+ */
+static long dsp_set_route_period(struct audio_dsp_device *dsp, enum auido_route_index index, unsigned long arg)
 {
-	int ret = AUDIO_SUCCESS;
-	if(route == NULL)
-		return AUDIO_SUCCESS;
+	struct audio_route *route = &(dsp->routes[index]);
+	struct audio_route *aec_route = &(dsp->routes[AUDIO_ROUTE_AEC_ID]);
+	struct audio_period period;
+	unsigned int sample_size = 0;
+	unsigned int fragment_size = 0;
+	unsigned int fragment_cnt = 0;
+	long ret = AUDIO_SUCCESS;
 
-	switch(route->index){
-		case AUDIO_ROUTE_AEC_ID:
-			ret = dsp_disable_amic_aec(route->priv);
-			ret = dsp_disable_dmic_aec(route->priv);
-			break;
-		case AUDIO_ROUTE_AMIC_ID:
-			ret = dsp_disable_amic_ai_and_aec(route->priv);
-			break;
-		case AUDIO_ROUTE_DMIC_ID:
-			ret = dsp_disable_dmic_ai(route->priv);
-			break;
-		case AUDIO_ROUTE_SPK_ID:
-			ret = dsp_disable_amic_ao(route->priv);
-			break;
-		default:
-			break;
-	}
+	if(copy_from_user(&period, (__user void*)arg, sizeof(period)))
+		return -EFAULT;
+	if(period.period_us && period.period_us < AUDIO_PERIOD_MIN_US)
+		period.period_us = AUDIO_PERIOD_MIN_US;
+	if(period.period_us > AUDIO_PERIOD_MAX_US)
+		return -EINVAL;
+
+	mutex_lock(&route->mlock);
+	if(!route->pipe || route->state == AUDIO_IDLE_STATE || !route->rate){
+		audio_warn_print("%d; please set the parameters of route%d firstly\n", __LINE__, index);
+		ret = -EPERM;
+		goto out;
+	}
+	if(route->state == AUDIO_BUSY_STATE){
+		ret = -EBUSY;
+		goto out;
+	}
+
+	sample_size = route->channel * format_to_bytes(route->format);
+	dsp_route_geometry(route, sample_size, period.period_us, &fragment_size, &fragment_cnt);
+	if(fragment_cnt < max_t(unsigned int, period.periods, AUDIO_PERIOD_MIN_CNT)){
+		audio_warn_print("%d; route%d can't hold %u periods of %uus\n", __LINE__,
+				index, period.periods, period.period_us);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	route->period_us = period.period_us;
+	if(index == AUDIO_ROUTE_AMIC_ID && aec_route->pipe)
+		aec_route->period_us = period.period_us;
+	period.period_us = div_u64((u64)(fragment_size / sample_size) * USEC_PER_SEC, route->rate);
+	period.periods = fragment_cnt;
+out:
+	mutex_unlock(&route->mlock);
+	if(ret == AUDIO_SUCCESS && copy_to_user((__user void*)arg, &period, sizeof(period)))
+		ret = -EFAULT;
+	return ret;
+}
+
+/* timing of the first fragment moved by the last GET_STREAM or SET_STREAM */
+static long dsp_get_stream_tstamp(struct audio_dsp_device *dsp, enum auido_route_index index, unsigned long arg)
+{
+	struct audio_route *route = &(dsp->routes[index]);
+	struct audio_stream_tstamp tstamp;
+
+	mutex_lock(&route->mlock);
+	if(route->state != AUDIO_BUSY_STATE){
+		mutex_unlock(&route->mlock);
+		return -EPERM;
+	}
+	tstamp = route->tstamp;
+	mutex_unlock(&route->mlock);
+
+	if(copy_to_user((__user void*)arg, &tstamp, sizeof(tstamp)))
+		return -EFAULT;
+	return AUDIO_SUCCESS;
+}
+
+/* routes the processing stage runs on */
+static struct audio_route *dsp_process_route(struct audio_dsp_device *dsp, int index)
+{
+	if(index != AUDIO_ROUTE_AMIC_ID && index != AUDIO_ROUTE_DMIC_ID && index != AUDIO_ROUTE_SPK_ID)
+		return NULL;
+	if(!dsp->routes[index].pipe)
+		return NULL;
+	return &(dsp->routes[index]);
+}
+
+static long dsp_set_route_process(struct audio_dsp_device *dsp, unsigned long arg)
+{
+	struct audio_process param;
+	struct audio_route *route = NULL;
+	long ret = AUDIO_SUCCESS;
+
+	if(copy_from_user(&param, (__user void*)arg, sizeof(param)))
+		return -EFAULT;
+	route = dsp_process_route(dsp, param.route);
+	if(!route)
+		return -EINVAL;
+
+	mutex_lock(&route->mlock);
+	ret = audio_process_config(&route->process, &param,
+			route->rate ? route->rate : AUDIO_RW_DEFAULT_RATE);
+	mutex_unlock(&route->mlock);
+	return ret;
+}
+
+static long dsp_get_route_meter(struct audio_dsp_device *dsp, unsigned long arg)
+{
+	struct audio_meter meter;
+	struct audio_route *route = NULL;
+
+	if(copy_from_user(&meter, (__user void*)arg, sizeof(meter)))
+		return -EFAULT;
+	route = dsp_process_route(dsp, meter.route);
+	if(!route)
+		return -EINVAL;
+
+	mutex_lock(&route->mlock);
+	meter.peak = route->process.peak;
+	meter.rms = route->process.rms;
+	meter.fragments = route->process.fragments;
+	mutex_unlock(&route->mlock);
+
+	if(copy_to_user((__user void*)arg, &meter, sizeof(meter)))
+		return -EFAULT;
+	return AUDIO_SUCCESS;
+}
+
+static int disable_route_stream(struct audio_route *route)
+{
+	int ret = AUDIO_SUCCESS;
+	if(route == NULL)
+		return AUDIO_SUCCESS;
+
+	switch(route->index){
+		case AUDIO_ROUTE_AEC_ID:
+			ret = dsp_disable_amic_aec(route->priv);
+			ret = dsp_disable_dmic_aec(route->priv);
+			break;
+		case AUDIO_ROUTE_AMIC_ID:
+			ret = dsp_disable_amic_ai_and_aec(route->priv);
+			break;
+		case AUDIO_ROUTE_DMIC_ID:
+			ret = dsp_disable_dmic_ai(route->priv);
+			break;
+		case AUDIO_ROUTE_SPK_ID:
+			ret = dsp_disable_amic_ao(route->priv);
+			break;
+		default:
+			break;
+	}
 	return ret;
 }
 
@@ -1385,13 +2087,21 @@ static int dsp_open(struct inode *inode, struct file *file)
 {
 	struct miscdevice *dev = file->private_data;
 	struct audio_dsp_device *dsp = misc_get_audiodsp(dev);
+	struct audio_dsp_file *dfile = NULL;
 	struct audio_route *route = NULL;
 	int index = 0;
 	int ret = AUDIO_SUCCESS;
 
+	dfile = kzalloc(sizeof(*dfile), GFP_KERNEL);
+	if(!dfile)
+		return -ENOMEM;
+	dfile->dsp = dsp;
+	dfile->read_route = (aic_enable || !dmic_enable) ? AUDIO_ROUTE_AMIC_ID : AUDIO_ROUTE_DMIC_ID;
+
 	mutex_lock(&dsp->mlock);
 	if(dsp->state != AUDIO_IDLE_STATE){
 		dsp->refcnt++;
+		file->private_data = dfile;
 		mutex_unlock(&dsp->mlock);
 		return 0;
 	}
@@ -1414,13 +2124,15 @@ static int dsp_open(struct inode *inode, struct file *file)
 		}
 	}
 
-	/* enable hrtimer */
+	/* enable hrtimer, period interrupts need none */
 	if(atomic_read(&dsp->timer_stopped)){
 		atomic_set(&dsp->timer_stopped, 0);
-		hrtimer_start(&dsp->hr_timer, dsp->expires , HRTIMER_MODE_REL);
+		if(!dma_period_irq)
+			hrtimer_start(&dsp->hr_timer, dsp->expires , HRTIMER_MODE_REL);
 		dsp->refcnt++;
 	}
 	dsp->state = AUDIO_OPEN_STATE;
+	file->private_data = dfile;
 	mutex_unlock(&dsp->mlock);
 	return 0;
 error:
@@ -1434,16 +2146,103 @@ error:
 	}
 
 	mutex_unlock(&dsp->mlock);
+	kfree(dfile);
 	return -EPERM;
 }
 
+/* the fragment at io_tracer may be read or written, same rule as the stream ioctls */
+static inline bool dsp_io_ready(struct dsp_data_manage *manage)
+{
+	return audio_ring_next(manage->io_tracer, manage->fragment_cnt) != manage->dma_tracer;
+}
+
+/*
+ * read() and write() work without the stream ioctls: a route nobody
+ * configured gets AUDIO_RW_DEFAULT_RATE, 16 bits mono, and is enabled on
+ * first use. The file holds one reference on it until it is released.
+ */
+static long dsp_rw_start(struct audio_dsp_file *dfile, enum auido_route_index index)
+{
+	struct audio_dsp_device *dsp = dfile->dsp;
+	struct audio_route *route = &(dsp->routes[index]);
+	struct audio_parameter param;
+	long ret = AUDIO_SUCCESS;
+
+	if(!route->pipe)
+		return -ENODEV;
+
+	mutex_lock(&dsp->mlock);
+	if(test_bit(index, &dfile->started) && route->state == AUDIO_BUSY_STATE)
+		goto out;
+	/* the route was disabled behind our back, that dropped our reference */
+	clear_bit(index, &dfile->started);
+
+	if(route->state != AUDIO_BUSY_STATE && !route->rate){
+		param.rate = AUDIO_RW_DEFAULT_RATE;
+		param.format = 16;
+		param.channel = 1;
+		ret = dsp_config_route_param(dsp, index, AUDIO_CMD_CONFIG_PARAM, &param);
+		if(ret == AUDIO_SUCCESS && index == AUDIO_ROUTE_AMIC_ID)
+			ret = dsp_config_aec_route_param(dsp, AUDIO_CMD_CONFIG_PARAM, &param);
+		if(ret != AUDIO_SUCCESS)
+			goto out;
+	}
+
+	switch(index){
+		case AUDIO_ROUTE_AMIC_ID:
+			ret = dsp_enable_amic_ai_and_aec(dsp);
+			break;
+		case AUDIO_ROUTE_DMIC_ID:
+			ret = dsp_enable_dmic_ai(dsp);
+			break;
+		case AUDIO_ROUTE_SPK_ID:
+			ret = dsp_enable_amic_ao(dsp);
+			break;
+		default:
+			ret = -EINVAL;
+			break;
+	}
+	if(ret == AUDIO_SUCCESS)
+		set_bit(index, &dfile->started);
+out:
+	mutex_unlock(&dsp->mlock);
+	return ret;
+}
+
+/* drop the references dsp_rw_start() took for this file */
+static void dsp_rw_stop(struct audio_dsp_file *dfile)
+{
+	struct audio_dsp_device *dsp = dfile->dsp;
+
+	if(test_and_clear_bit(AUDIO_ROUTE_AMIC_ID, &dfile->started))
+		dsp_disable_amic_ai_and_aec(dsp);
+	if(test_and_clear_bit(AUDIO_ROUTE_DMIC_ID, &dfile->started))
+		dsp_disable_dmic_ai(dsp);
+	if(test_and_clear_bit(AUDIO_ROUTE_SPK_ID, &dfile->started))
+		dsp_disable_amic_ao(dsp);
+}
+
+static void dsp_reader_detach(struct audio_dsp_reader *reader)
+{
+	struct audio_route *route = reader->route;
+
+	if(!route)
+		return;
+	mutex_lock(&route->mlock);
+	list_del(&reader->list);
+	reader->route = NULL;
+	mutex_unlock(&route->mlock);
+}
+
 static int dsp_release(struct inode *inode, struct file *file)
 {
-	struct miscdevice *dev = file->private_data;
-	struct audio_dsp_device *dsp = misc_get_audiodsp(dev);
+	struct audio_dsp_device *dsp = file_get_audiodsp(file);
 	struct audio_route *route = NULL;
 	int index = 0;
 
+	dsp_reader_detach(&((struct audio_dsp_file *)file->private_data)->reader);
+	dsp_rw_stop(file->private_data);
+
 	mutex_lock(&dsp->mlock);
 	if(dsp->refcnt == 0)
 		goto out;
@@ -1457,6 +2256,9 @@ static int dsp_release(struct inode *inode, struct file *file)
 				route = &(dsp->routes[index]);
 				if(route && route->state != AUDIO_IDLE_STATE){
 					disable_route_stream(route);
+					mutex_lock(dsp_route_mlock(route));
+					dsp_route_hw_off(route);
+					mutex_unlock(dsp_route_mlock(route));
 					if(route->pipe && route->pipe->deinit)
 						route->pipe->deinit(route);
 					route->state = AUDIO_IDLE_STATE;
@@ -1466,19 +2268,332 @@ static int dsp_release(struct inode *inode, struct file *file)
 	}
 out:
 	mutex_unlock(&dsp->mlock);
+	kfree(file->private_data);
 	return 0;
 }
 
+/* wait until the dma moved, called and returns with route->mlock held */
+static long dsp_rw_wait(struct file *file, struct audio_route *route)
+{
+	long time = 0;
+
+	if(file->f_flags & O_NONBLOCK)
+		return -EAGAIN;
+
+	/* io_tracer needs to trail dma_tracer by two fragments to move on */
+	route->wait_flag = true;
+	route->wait_cnt = 2;
+	reinit_completion(&route->done_completion);
+	mutex_unlock(&route->mlock);
+	time = wait_for_completion_interruptible_timeout(&route->done_completion,
+			dsp_route_wait_timeout(route));
+	mutex_lock(&route->mlock);
+	if(time > 0)
+		return AUDIO_SUCCESS;
+	route->wait_flag = false;
+	return time ? time : -ETIMEDOUT;
+}
+
+/*
+ * Every file reading a capture route has its own position in the ring the
+ * dma fills once. A reader that falls more than a window behind loses
+ * what was overwritten and restarts at the newest fragment; the others
+ * and the dma never wait for it.
+ */
+static void dsp_reader_attach(struct audio_route *route, struct audio_dsp_reader *reader)
+{
+	struct dsp_data_manage *manage = &route->manage;
+	struct dsp_data_fragment *fragment = NULL;
+	unsigned int i;
+
+	mutex_lock(&route->mlock);
+	/*
+	 * dsp_route_publish() skipped the invalidate while nobody read, so
+	 * the fragments the dma fills before the next publish may still have
+	 * stale lines in the cache.
+	 */
+	if(list_empty(&route->readers)){
+		for(i = 0; i <= AUDIO_IO_LEADING_DMA; i++){
+			fragment = &(manage->fragments[audio_ring_add(manage->dma_tracer, i, manage->fragment_cnt)]);
+			dma_sync_single_for_device(NULL, fragment->paddr, manage->fragment_size, DMA_FROM_DEVICE);
+		}
+	}
+	reader->route = route;
+	reader->count = route->published;
+	reader->offset = 0;
+	reader->overrun_pending = false;
+	list_add_tail(&reader->list, &route->readers);
+	mutex_unlock(&route->mlock);
+}
+
+/* fragments the reader has not read yet, called with route->mlock held */
+static unsigned int dsp_reader_avail(struct audio_route *route, struct audio_dsp_reader *reader)
+{
+	unsigned int avail = route->published - reader->count;
+
+	if(avail > dsp_reader_window(&route->manage)){
+		reader->count = route->published;
+		reader->offset = 0;
+		reader->overruns++;
+		reader->overrun_pending = true;
+		avail = 0;
+	}
+	return avail;
+}
+
+/* start the file's read route and follow it, for read() and AUDIO_START_READ */
+static long dsp_reader_start(struct audio_dsp_file *dfile)
+{
+	struct audio_route *route = &(dfile->dsp->routes[dfile->read_route]);
+	long ret = AUDIO_SUCCESS;
+
+	ret = dsp_rw_start(dfile, route->index);
+	if(ret != AUDIO_SUCCESS)
+		return ret;
+	if(dfile->reader.route != route){
+		dsp_reader_detach(&dfile->reader);
+		dsp_reader_attach(route, &dfile->reader);
+	}
+	return AUDIO_SUCCESS;
+}
+
 static ssize_t dsp_read(struct file *file, char __user * buffer, size_t count, loff_t * ppos)
 {
-	return 0;
+	struct audio_dsp_file *dfile = file->private_data;
+	struct audio_dsp_device *dsp = dfile->dsp;
+	struct audio_dsp_reader *reader = &dfile->reader;
+	struct audio_route *route = &(dsp->routes[dfile->read_route]);
+	struct dsp_data_manage *manage = &(route->manage);
+	struct dsp_data_fragment *fragment = NULL;
+	unsigned int avail = 0;
+	unsigned int published = 0;
+	unsigned int len = 0;
+	size_t done = 0;
+	long ret = AUDIO_SUCCESS;
+
+	if(!(file->f_mode & FMODE_READ))
+		return -EBADF;
+	ret = dsp_reader_start(dfile);
+	if(ret != AUDIO_SUCCESS)
+		return ret;
+
+	mutex_lock(&route->mlock);
+	while(done < count){
+		if(route->state != AUDIO_BUSY_STATE){
+			ret = -EPERM;
+			break;
+		}
+		avail = dsp_reader_avail(route, reader);
+		if(reader->overrun_pending){
+			if(done)
+				break;
+			reader->overrun_pending = false;
+			ret = -EPIPE;
+			break;
+		}
+		if(!avail){
+			if(done)
+				break;
+			if(file->f_flags & O_NONBLOCK){
+				ret = -EAGAIN;
+				break;
+			}
+			published = route->published;
+			mutex_unlock(&route->mlock);
+			ret = wait_event_interruptible_timeout(route->read_wait,
+					route->published != published || route->state != AUDIO_BUSY_STATE,
+					dsp_route_wait_timeout(route));
+			mutex_lock(&route->mlock);
+			if(ret < 0)
+				break;
+			if(ret == 0){
+				ret = -ETIMEDOUT;
+				break;
+			}
+			continue;
+		}
+
+		/* a fragment the dma skipped reads as silence */
+		fragment = &(manage->fragments[audio_ring_add(manage->dma_tracer, manage->fragment_cnt - avail, manage->fragment_cnt)]);
+		len = min_t(size_t, count - done, manage->fragment_size - reader->offset);
+		if(fragment->state)
+			ret = copy_to_user(buffer + done, fragment->vaddr + reader->offset, len);
+		else
+			ret = clear_user(buffer + done, len);
+		if(ret){
+			ret = -EFAULT;
+			break;
+		}
+		done += len;
+		reader->offset += len;
+		if(reader->offset == manage->fragment_size){
+			reader->count++;
+			reader->offset = 0;
+		}
+	}
+	mutex_unlock(&route->mlock);
+
+	return done ? done : ret;
 }
 
 static ssize_t dsp_write(struct file *file, const char __user * buffer, size_t count, loff_t * ppos)
 {
+	struct audio_dsp_file *dfile = file->private_data;
+	struct audio_dsp_device *dsp = dfile->dsp;
+	struct audio_route *route = &(dsp->routes[AUDIO_ROUTE_SPK_ID]);
+	struct dsp_data_manage *manage = &(route->manage);
+	struct dsp_data_fragment *fragment = NULL;
+	unsigned int len = 0;
+	size_t done = 0;
+	long ret = AUDIO_SUCCESS;
+
+	if(!(file->f_mode & FMODE_WRITE))
+		return -EBADF;
+	ret = dsp_rw_start(dfile, AUDIO_ROUTE_SPK_ID);
+	if(ret != AUDIO_SUCCESS)
+		return ret;
+
+	mutex_lock(&route->stream_mlock);
+	mutex_lock(&route->mlock);
+	while(done < count){
+		if(route->state != AUDIO_BUSY_STATE){
+			ret = -EPERM;
+			break;
+		}
+		if(audio_ring_xrun_transfer(&route->xrun)){
+			ret = -EPIPE;
+			break;
+		}
+		if(!dsp_io_ready(manage)){
+			if(done && (file->f_flags & O_NONBLOCK))
+				break;
+			ret = dsp_rw_wait(file, route);
+			if(ret != AUDIO_SUCCESS)
+				break;
+			continue;
+		}
+
+		/* a partial fragment is queued once it is full */
+		fragment = &(manage->fragments[manage->io_tracer]);
+		len = min_t(size_t, count - done, manage->fragment_size - route->rw_offset);
+		if(copy_from_user(fragment->vaddr + route->rw_offset, buffer + done, len)){
+			ret = -EFAULT;
+			break;
+		}
+		done += len;
+		route->rw_offset += len;
+		if(route->rw_offset == manage->fragment_size){
+			fragment->state = true;
+			dsp_route_process(route, fragment);
+			dma_sync_single_for_device(NULL, fragment->paddr, manage->fragment_size, DMA_TO_DEVICE);
+			manage->io_tracer = audio_ring_next(manage->io_tracer, manage->fragment_cnt);
+			route->rw_offset = 0;
+		}
+	}
+	mutex_unlock(&route->mlock);
+	mutex_unlock(&route->stream_mlock);
+
+	return done ? done : ret;
+}
+
+
+/*
+ * Zero-copy access to a route: the ring is the dma buffer itself. The
+ * pipes allocate it noncoherent and the driver syncs around every cpu
+ * access, userspace gets an uncached view instead so neither side has to.
+ * The ctrl page only ever goes out read-only, the driver trusts nothing
+ * userspace can write but appl_count.
+ */
+static int dsp_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct audio_dsp_file *dfile = file->private_data;
+	struct audio_dsp_device *dsp = dfile->dsp;
+	unsigned long offset = vma->vm_pgoff << PAGE_SHIFT;
+	unsigned long size = vma->vm_end - vma->vm_start;
+	unsigned int index = offset >> AUDIO_MMAP_ROUTE_SHIFT;
+	struct audio_route *route = NULL;
+	unsigned long pfn = 0;
+
+	if(index >= AUDIO_ROUTE_MAX_ID)
+		return -EINVAL;
+	route = &(dsp->routes[index]);
+	if(!route->pipe || !route->ctrl || !route->appl)
+		return -ENODEV;
+
+	offset -= AUDIO_MMAP_ROUTE_OFFSET(index);
+	if(offset == AUDIO_MMAP_CTRL_OFFSET(0)){
+		if(size != PAGE_SIZE)
+			return -EINVAL;
+		if(vma->vm_flags & VM_WRITE)
+			return -EPERM;
+		vma->vm_flags &= ~VM_MAYWRITE;
+		pfn = virt_to_phys(route->ctrl) >> PAGE_SHIFT;
+	}else if(offset == AUDIO_MMAP_APPL_OFFSET(0)){
+		if(size != PAGE_SIZE)
+			return -EINVAL;
+		pfn = virt_to_phys(route->appl) >> PAGE_SHIFT;
+	}else if(offset == AUDIO_MMAP_DATA_OFFSET(0)){
+		if(size > route->pipe->reservesize)
+			return -EINVAL;
+		pfn = route->pipe->paddr >> PAGE_SHIFT;
+		vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+	}else
+		return -EINVAL;
+
+	vma->vm_flags |= VM_IO | VM_DONTEXPAND | VM_DONTDUMP;
+	if(remap_pfn_range(vma, vma->vm_start, pfn, size, vma->vm_page_prot))
+		return -EAGAIN;
+
+	set_bit(index, &dfile->mapped);
 	return 0;
 }
 
+/*
+ * Readable when a mapped capture route has fragments the application has
+ * not consumed, writable when the mapped playback ring has room ahead of
+ * the dma. Routes used through read() and write() follow io_tracer.
+ */
+static unsigned int dsp_poll(struct file *file, poll_table *wait)
+{
+	struct audio_dsp_file *dfile = file->private_data;
+	struct audio_dsp_device *dsp = dfile->dsp;
+	struct audio_route *route = NULL;
+	unsigned int mask = 0;
+	unsigned int queued = 0;
+	int index = 0;
+
+	poll_wait(file, &dsp->poll_wait, wait);
+
+	for_each_set_bit(index, &dfile->mapped, AUDIO_ROUTE_MAX_ID){
+		route = &(dsp->routes[index]);
+		if(route->state != AUDIO_BUSY_STATE)
+			continue;
+		/* appl_count is the application's, only compared against */
+		queued = ACCESS_ONCE(route->appl->appl_count) - ACCESS_ONCE(route->hw_count);
+		if(index == AUDIO_ROUTE_SPK_ID){
+			if((int)queued < (int)(route->manage.fragment_cnt - AUDIO_IO_LEADING_DMA))
+				mask |= POLLOUT | POLLWRNORM;
+		}else if(queued != 0){
+			mask |= POLLIN | POLLRDNORM;
+		}
+	}
+
+	/* poll never starts the hardware, the first read() or AUDIO_START_READ does */
+	route = dfile->reader.route;
+	if(route){
+		mutex_lock(&route->mlock);
+		if(route->state == AUDIO_BUSY_STATE &&
+				(dsp_reader_avail(route, &dfile->reader) || dfile->reader.overrun_pending))
+			mask |= POLLIN | POLLRDNORM;
+		mutex_unlock(&route->mlock);
+	}
+	route = &(dsp->routes[AUDIO_ROUTE_SPK_ID]);
+	if((file->f_mode & FMODE_WRITE) && !test_bit(AUDIO_ROUTE_SPK_ID, &dfile->mapped) &&
+			route->state == AUDIO_BUSY_STATE && dsp_io_ready(&route->manage))
+		mask |= POLLOUT | POLLWRNORM;
+
+	return mask;
+}
 
 static long dsp_route_ioctl(struct audio_dsp_device *dsp, enum auido_route_index index,
 						unsigned int cmd, void *arg)
@@ -1508,8 +2623,7 @@ out:
 
 static long dsp_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
-	struct miscdevice *dev = file->private_data;
-	struct audio_dsp_device *dsp = misc_get_audiodsp(dev);
+	struct audio_dsp_device *dsp = file_get_audiodsp(file);
 	struct audio_route *route = NULL;
 	struct audio_parameter param;
 	struct volume vol;
@@ -1520,8 +2634,13 @@ static long dsp_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	int channel = 0;
 	long ret = -EINVAL;
 
-	/* O_RDWR mode operation, do not allowed */
-	if ((file->f_mode & FMODE_READ) && (file->f_mode & FMODE_WRITE))
+	/*
+	 * O_RDWR mode operation, do not allowed. An mmap client is the one
+	 * exception: the mapping needs a readable fd and a playback client
+	 * also writes appl_count, so it maps its routes first.
+	 */
+	if ((file->f_mode & FMODE_READ) && (file->f_mode & FMODE_WRITE) &&
+			!((struct audio_dsp_file *)file->private_data)->mapped)
 		return -EPERM;
 
 	if(dsp->state == AUDIO_IDLE_STATE){
@@ -1628,6 +2747,50 @@ static long dsp_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		case AMIC_AO_SET_STREAM:
 			ret = dsp_set_spk_stream(dsp, arg);
 			break;
+		case AMIC_AI_GET_TSTAMP:
+			ret = dsp_get_stream_tstamp(dsp, AUDIO_ROUTE_AMIC_ID, arg);
+			break;
+		case DMIC_AI_GET_TSTAMP:
+			ret = dsp_get_stream_tstamp(dsp, AUDIO_ROUTE_DMIC_ID, arg);
+			break;
+		case AMIC_AO_GET_TSTAMP:
+			ret = dsp_get_stream_tstamp(dsp, AUDIO_ROUTE_SPK_ID, arg);
+			break;
+		case AUDIO_SET_READ_ROUTE:
+			if (get_user(channel, (int*)arg)){
+				ret = -EFAULT;
+				goto EXIT_IOCTRL;
+			}
+			if(channel != AUDIO_ROUTE_AMIC_ID && channel != AUDIO_ROUTE_DMIC_ID){
+				ret = -EINVAL;
+				goto EXIT_IOCTRL;
+			}
+			((struct audio_dsp_file *)file->private_data)->read_route = channel;
+			ret = AUDIO_SUCCESS;
+			break;
+		case AUDIO_START_READ:
+			/* the explicit trigger for poll() users, read() does the same */
+			if(!(file->f_mode & FMODE_READ)){
+				ret = -EBADF;
+				goto EXIT_IOCTRL;
+			}
+			ret = dsp_reader_start(file->private_data);
+			break;
+		case AUDIO_SET_PROCESS:
+			ret = dsp_set_route_process(dsp, arg);
+			break;
+		case AUDIO_GET_METER:
+			ret = dsp_get_route_meter(dsp, arg);
+			break;
+		case AMIC_AI_SET_PERIOD:
+			ret = dsp_set_route_period(dsp, AUDIO_ROUTE_AMIC_ID, arg);
+			break;
+		case DMIC_AI_SET_PERIOD:
+			ret = dsp_set_route_period(dsp, AUDIO_ROUTE_DMIC_ID, arg);
+			break;
+		case AMIC_AO_SET_PERIOD:
+			ret = dsp_set_route_period(dsp, AUDIO_ROUTE_SPK_ID, arg);
+			break;
 		case AMIC_AI_HPF_ENABLE:
 			if (get_user(channel, (int*)arg)){
 				ret = -EFAULT;
@@ -1729,6 +2892,8 @@ const struct file_operations audio_dsp_fops = {
 	.write = dsp_write,
 	.open = dsp_open,
 	.unlocked_ioctl = dsp_ioctl,
+	.mmap = dsp_mmap,
+	.poll = dsp_poll,
 	.release = dsp_release,
 };
 
@@ -1744,6 +2909,17 @@ int register_audio_pipe(struct audio_pipe *pipe, enum auido_route_index index)
 		mutex_unlock(&dsp->mlock);
 		return -AUDIO_EPERM;
 	};
+	dsp->routes[index].ctrl = (struct audio_mmap_ctrl *)get_zeroed_page(GFP_KERNEL);
+	dsp->routes[index].appl = (struct audio_mmap_appl *)get_zeroed_page(GFP_KERNEL);
+	if(!dsp->routes[index].ctrl || !dsp->routes[index].appl){
+		free_page((unsigned long)dsp->routes[index].ctrl);
+		free_page((unsigned long)dsp->routes[index].appl);
+		dsp->routes[index].ctrl = NULL;
+		dsp->routes[index].appl = NULL;
+		mutex_unlock(&dsp->mlock);
+		return -ENOMEM;
+	}
+	dsp->routes[index].ctrl->route = index;
 	dsp->routes[index].pipe = pipe;
 	dsp->routes[index].index = index;
 	dsp->routes[index].state = AUDIO_IDLE_STATE;
@@ -1752,6 +2928,11 @@ int register_audio_pipe(struct audio_pipe *pipe, enum auido_route_index index)
 	mutex_init(&(dsp->routes[index].mlock));
 	mutex_init(&(dsp->routes[index].stream_mlock));
 	init_completion(&(dsp->routes[index].done_completion));
+	INIT_LIST_HEAD(&(dsp->routes[index].readers));
+	audio_process_init(&(dsp->routes[index].process));
+	init_waitqueue_head(&(dsp->routes[index].read_wait));
+	hrtimer_init(&(dsp->routes[index].stall_timer), CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	dsp->routes[index].stall_timer.function = dsp_route_stall_callback;
 	if(index == AUDIO_ROUTE_AEC_ID)
 		dsp->routes[index].parent = &(dsp->routes[AUDIO_ROUTE_AMIC_ID]);
 	else
@@ -1773,8 +2954,11 @@ int release_audio_pipe(struct audio_pipe *pipe)
 		}
 	if(route && route->state > AUDIO_IDLE_STATE)
 		disable_route_stream(route);
-	if(route)
+	if(route){
+		free_page((unsigned long)route->ctrl);
+		free_page((unsigned long)route->appl);
 		memset(route, 0, sizeof(*route));
+	}
 
 	mutex_unlock(&dsp->mlock);
 	return AUDIO_SUCCESS;
@@ -1791,6 +2975,59 @@ int register_audio_debug_ops(char *name, struct file_operations *debug_ops, void
 	return AUDIO_SUCCESS;
 }
 
+static int audio_dsp_info_show(struct seq_file *m, void *v)
+{
+	struct audio_dsp_device *dsp = m->private;
+	struct audio_route *route = NULL;
+	struct audio_dsp_reader *reader = NULL;
+	unsigned int reader_id = 0;
+	int id = 0;
+
+	for(id = 0; id < AUDIO_ROUTE_MAX_ID; id++){
+		route = &(dsp->routes[id]);
+		if(!route->pipe)
+			continue;
+		mutex_lock(&route->mlock);
+		reader_id = 0;
+		seq_printf(m, "route%d: state %d, period %uus%s, fragment %u x %u bytes\n",
+				id, route->state, route->period_us ? route->period_us : fragment_time * 10000,
+				route->period_us ? "" : " (default)",
+				route->manage.fragment_cnt, route->manage.fragment_size);
+		seq_printf(m, "\tfill %u (min %u, max %u), xruns %llu, late wakeups %llu\n",
+				route->fill, route->fill_min == UINT_MAX ? 0 : route->fill_min, route->fill_max,
+				route->xrun.count, route->late_wakeups);
+		seq_printf(m, "\thardware %s, starts cold %llu (max %lluus) warm %llu (max %lluus), last %lluus\n",
+				route->hw_on ? (route->state == AUDIO_BUSY_STATE ? "on" : "standby") : "off",
+				route->cold_starts, div_u64(route->start_cold_max_ns, NSEC_PER_USEC),
+				route->warm_starts, div_u64(route->start_warm_max_ns, NSEC_PER_USEC),
+				div_u64(route->start_last_ns, NSEC_PER_USEC));
+		if(route->process.processed)
+			seq_printf(m, "\tprocess flags 0x%x, %llu fragments, cost last %uus max %uus avg %lluus, max %llu%% of a period\n",
+					route->process.param.flags, route->process.processed,
+					route->process.cost_last_ns / NSEC_PER_USEC, route->process.cost_max_ns / NSEC_PER_USEC,
+					div64_u64(route->process.cost_sum_ns, route->process.processed * NSEC_PER_USEC),
+					route->fragment_ns ? div64_u64((u64)route->process.cost_max_ns * 100, route->fragment_ns) : 0);
+		list_for_each_entry(reader, &route->readers, list)
+			seq_printf(m, "\treader %u: %u fragments behind, overruns %llu\n",
+					reader_id++, route->published - reader->count, reader->overruns);
+		mutex_unlock(&route->mlock);
+	}
+
+	return 0;
+}
+
+static int audio_dsp_info_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, audio_dsp_info_show, PDE_DATA(inode));
+}
+
+static struct file_operations audio_dsp_info_fops = {
+	.read = seq_read,
+	.open = audio_dsp_info_open,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 extern struct platform_driver audio_aic_driver;
 extern struct platform_driver audio_dmic_driver;
 
@@ -1832,8 +3069,11 @@ static int audio_dsp_probe(struct platform_device *pdev)
 	dspdev->hr_timer.function = jz_audio_hrtimer_callback;
 	dspdev->expires = ns_to_ktime(1000*1000*fragment_time*10*2);	// the time section is default 40ms.
 	INIT_WORK(&dspdev->workqueue, dsp_workqueue_handle);
+	INIT_DELAYED_WORK(&dspdev->standby_work, dsp_standby_work_handle);
+	init_waitqueue_head(&dspdev->poll_wait);
 
 	globe_dspdev = dspdev;
+	register_audio_debug_ops("audio_dsp_info", &audio_dsp_info_fops, dspdev);
 	/* register subdev,AIC & DMIC*/
 	subdevs = pdev->dev.platform_data;
 	if(aic_enable){
@@ -1883,6 +3123,7 @@ static int __exit audio_dsp_remove(struct platform_device *pdev)
 
 	hrtimer_cancel(&dspdev->hr_timer);
 	cancel_work_sync(&dspdev->workqueue);
+	cancel_delayed_work_sync(&dspdev->standby_work);
 	platform_set_drvdata(pdev, NULL);
 
 	kfree(dspdev);
@@ -1891,13 +3132,84 @@ static int __exit audio_dsp_remove(struct platform_device *pdev)
 }
 
 #ifdef CONFIG_PM
+/*
+ * Running routes fade out and stop, every route's hardware is powered
+ * down and its analog gain saved; resume programs the hardware again and
+ * restarts what was running.
+ */
 static int audio_dsp_suspend(struct device *dev)
 {
+	struct audio_dsp_device *dsp = dev_get_drvdata(dev);
+	struct audio_route *route = NULL;
+	struct mutex *mlock = NULL;
+	int index = 0;
+
+	if(!dsp)
+		return 0;
+
+	/* nothing may move the tracers of a stopped ring */
+	hrtimer_cancel(&dsp->hr_timer);
+	cancel_work_sync(&dsp->workqueue);
+	cancel_delayed_work_sync(&dsp->standby_work);
+
+	/* playback first, it is the one that can be heard */
+	for(index = AUDIO_ROUTE_MAX_ID - 1; index >= 0; index--){
+		route = &(dsp->routes[index]);
+		if(!route->pipe)
+			continue;
+		mlock = dsp_route_mlock(route);
+		mutex_lock(mlock);
+		if(route->state == AUDIO_BUSY_STATE){
+			if(index == AUDIO_ROUTE_SPK_ID)
+				dsp_route_fade_out(route);
+			dsp_route_stall_stop(route);
+			dmaengine_terminate_all(route->pipe->dma_chan);
+			route->suspended = true;
+		}
+		memset(&route->saved_gain, 0, sizeof(route->saved_gain));
+		route->gain_saved = route->pipe->ioctl(route->pipe, AUDIO_CMD_GET_GAIN, &route->saved_gain) == AUDIO_SUCCESS;
+		dsp_route_hw_off(route);
+		mutex_unlock(mlock);
+	}
+
 	return 0;
 }
 
 static int audio_dsp_resume(struct device *dev)
 {
+	struct audio_dsp_device *dsp = dev_get_drvdata(dev);
+	struct audio_route *route = NULL;
+	struct mutex *mlock = NULL;
+	int index = 0;
+	long ret = AUDIO_SUCCESS;
+
+	if(!dsp)
+		return 0;
+
+	for(index = 0; index < AUDIO_ROUTE_MAX_ID; index++){
+		route = &(dsp->routes[index]);
+		if(!route->pipe)
+			continue;
+		mlock = dsp_route_mlock(route);
+		mutex_lock(mlock);
+		if(route->suspended){
+			route->suspended = false;
+			ret = dsp_route_restart(route);
+			if(ret != AUDIO_SUCCESS)
+				audio_err_print("%d; Failed to restart route%d after resume: %ld\n", __LINE__, index, ret);
+		}
+		if(route->gain_saved){
+			/* the host only reports the first channel */
+			route->saved_gain.channel = route->channel > 1 ? 3 : 1;
+			route->saved_gain.gain[1] = route->saved_gain.gain[0];
+			route->pipe->ioctl(route->pipe, AUDIO_CMD_SET_GAIN, &route->saved_gain);
+			route->gain_saved = false;
+		}
+		mutex_unlock(mlock);
+	}
+
+	if(!atomic_read(&dsp->timer_stopped) && !dma_period_irq)
+		hrtimer_start(&dsp->hr_timer, dsp->expires, HRTIMER_MODE_REL);
 	return 0;
 }
 
@@ -1923,12 +3235,28 @@ ssize_t audio_dsp_cnt_read(struct file *f, char __user *b, size_t l, loff_t *o){
 	if(*o > 0)
 		return 0;
 
-	char str[256] = {0};
-	sprintf(str, "hrtimer_callback_cnt:%u, work_cnt:%u.\n",
-		hrtimer_callback_cnt, work_cnt);
+	struct audio_dsp_device *dsp = globe_dspdev;
+	struct audio_route *route = NULL;
+	char str[1024] = {0};
+	int len = 0;
+	int id = 0;
+
+	len = scnprintf(str, sizeof(str), "hrtimer_callback_cnt:%u, work_cnt:%u, dma_period_irq:%d.\n",
+		hrtimer_callback_cnt, work_cnt, dma_period_irq);
+	for(id = 0; dsp && id < AUDIO_ROUTE_MAX_ID; id++){
+		route = &(dsp->routes[id]);
+		if(!route->pipe)
+			continue;
+		len += scnprintf(str + len, sizeof(str) - len,
+			"route%d: period_irqs:%llu, timer_polls:%llu, jitter avg:%lluus max:%lluus.\n",
+			id, route->period_irqs, route->timer_polls,
+			div64_u64(route->jitter_sum_ns, (max_t(u64, route->period_irqs, 2) - 1) * NSEC_PER_USEC),
+			div_u64(route->jitter_max_ns, NSEC_PER_USEC));
+	}
 
-	int len = strlen(str);
-	copy_to_user(b, str, len);
+	len = min_t(int, len, l);
+	if(copy_to_user(b, str, len))
+		return -EFAULT;
 	*o = len;
 	return len;
 }
@@ -0,0 +1,155 @@
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/math64.h>
+#include "include/audio_process.h"
+
+/* -------------------fixed point fragment processing------------------- */
+#define BIQUAD_Y_SHIFT		8
+#define BIQUAD_Y_MAX		(32767 << BIQUAD_Y_SHIFT)
+#define BIQUAD_Y_MIN		(-32768 * (1 << BIQUAD_Y_SHIFT))
+#define GAIN_RAMP_UNITY		(AUDIO_PROCESS_GAIN_UNITY << AUDIO_PROCESS_RAMP_SHIFT)
+
+static inline s32 sat16(s32 v)
+{
+	return clamp_t(s32, v, -32768, 32767);
+}
+
+/*
+ * Direct form I. The feedback path keeps BIQUAD_Y_SHIFT fractional bits so
+ * a low cut-off high-pass does not idle on truncation noise; products are
+ * accumulated in 64 bits, Q(28 + BIQUAD_Y_SHIFT). What the rounding drops
+ * is fed into the next sample, otherwise a pole this close to 1 stalls
+ * a few LSB away from zero on DC.
+ */
+static inline s32 biquad(struct audio_process_state *st, int ch, s32 x)
+{
+	const struct audio_process *p = &st->param;
+	s64 acc;
+	s32 y;
+
+	acc = ((s64)p->b0 * x + (s64)p->b1 * st->x1[ch] + (s64)p->b2 * st->x2[ch]) << BIQUAD_Y_SHIFT;
+	acc -= (s64)p->a1 * st->y1[ch] + (s64)p->a2 * st->y2[ch];
+	acc += st->e1[ch];
+	y = clamp_t(s64, acc >> AUDIO_PROCESS_COEF_SHIFT, BIQUAD_Y_MIN, BIQUAD_Y_MAX);
+	/* a clipped sample has nothing worth carrying */
+	st->e1[ch] = y == BIQUAD_Y_MIN || y == BIQUAD_Y_MAX ? 0 : (s32)(acc - ((s64)y << AUDIO_PROCESS_COEF_SHIFT));
+
+	st->x2[ch] = st->x1[ch];
+	st->x1[ch] = x;
+	st->y2[ch] = st->y1[ch];
+	st->y1[ch] = y;
+
+	return (y + (1 << (BIQUAD_Y_SHIFT - 1))) >> BIQUAD_Y_SHIFT;
+}
+
+void audio_process_init(struct audio_process_state *st)
+{
+	memset(st, 0, sizeof(*st));
+	st->gain = GAIN_RAMP_UNITY;
+	st->gain_target = GAIN_RAMP_UNITY;
+}
+
+/* a new stream: no history, no ramp, the meter restarts */
+void audio_process_reset(struct audio_process_state *st)
+{
+	memset(st->x1, 0, sizeof(st->x1));
+	memset(st->x2, 0, sizeof(st->x2));
+	memset(st->y1, 0, sizeof(st->y1));
+	memset(st->y2, 0, sizeof(st->y2));
+	memset(st->e1, 0, sizeof(st->e1));
+	st->gain = st->gain_target;
+	st->gain_frames = 0;
+	st->peak = 0;
+	st->rms = 0;
+	st->fragments = 0;
+}
+
+int audio_process_config(struct audio_process_state *st, const struct audio_process *param, unsigned int rate)
+{
+	unsigned int frames = 0;
+	s32 target = GAIN_RAMP_UNITY;
+
+	if(param->flags & ~AUDIO_PROCESS_ALL)
+		return -EINVAL;
+	if(param->gain > AUDIO_PROCESS_GAIN_MAX || param->ramp_ms > AUDIO_PROCESS_RAMP_MAX_MS)
+		return -EINVAL;
+
+	/* a filter switched on starts from silence, a retuned one keeps its history */
+	if((param->flags & AUDIO_PROCESS_BIQUAD) && !(st->param.flags & AUDIO_PROCESS_BIQUAD)){
+		memset(st->x1, 0, sizeof(st->x1));
+		memset(st->x2, 0, sizeof(st->x2));
+		memset(st->y1, 0, sizeof(st->y1));
+		memset(st->y2, 0, sizeof(st->y2));
+	memset(st->e1, 0, sizeof(st->e1));
+	}
+	st->param = *param;
+
+	if(param->flags & AUDIO_PROCESS_GAIN)
+		target = param->gain << AUDIO_PROCESS_RAMP_SHIFT;
+	frames = rate * param->ramp_ms / 1000;
+	st->gain_target = target;
+	if(frames){
+		st->gain_step = (target - st->gain) / (s32)frames;
+		st->gain_frames = frames;
+	}else{
+		st->gain = target;
+		st->gain_frames = 0;
+	}
+
+	return 0;
+}
+
+/* in place on interleaved 16 bits samples, at most AUDIO_PROCESS_CHANNELS */
+void audio_process_fragment(struct audio_process_state *st, s16 *buf, unsigned int frames, unsigned int channels)
+{
+	bool filter = st->param.flags & AUDIO_PROCESS_BIQUAD;
+	bool meter = st->param.flags & AUDIO_PROCESS_METER;
+	unsigned int peak = 0;
+	u64 energy = 0;
+	unsigned int i = 0;
+	unsigned int ch = 0;
+	s32 gain = 0;
+	s32 s = 0;
+
+	if(!frames || !channels || channels > AUDIO_PROCESS_CHANNELS)
+		return;
+
+	for(i = 0; i < frames; i++){
+		if(st->gain_frames){
+			st->gain += st->gain_step;
+			if(--st->gain_frames == 0)
+				st->gain = st->gain_target;
+		}
+		gain = st->gain >> AUDIO_PROCESS_RAMP_SHIFT;
+
+		for(ch = 0; ch < channels; ch++, buf++){
+			s = *buf;
+			if(filter)
+				s = sat16(biquad(st, ch, s));
+			if(gain != AUDIO_PROCESS_GAIN_UNITY)
+				s = sat16((s * gain + (1 << (AUDIO_PROCESS_GAIN_SHIFT - 1))) >> AUDIO_PROCESS_GAIN_SHIFT);
+			*buf = s;
+			if(meter){
+				s = abs(s);
+				if(s > peak)
+					peak = s;
+				energy += (u32)(s * s);
+			}
+		}
+	}
+
+	if(meter){
+		st->peak = peak;
+		st->rms = int_sqrt((unsigned long)div_u64(energy, frames * channels));
+		st->fragments++;
+	}
+}
+
+void audio_process_account(struct audio_process_state *st, u64 cost_ns)
+{
+	st->processed++;
+	st->cost_sum_ns += cost_ns;
+	st->cost_last_ns = cost_ns;
+	if(cost_ns > st->cost_max_ns)
+		st->cost_max_ns = cost_ns;
+}
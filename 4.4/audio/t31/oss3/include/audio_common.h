@@ -52,6 +52,8 @@ struct dsp_data_fragment {
 	void 				*vaddr;
 	dma_addr_t          paddr;
 	void *priv;			/* when enable aec function, it points aec fragment */
+	u64 tstamp_ns;		/* CLOCK_MONOTONIC of the first sample */
+	u64 frame_pos;		/* frames before this fragment since the stream was enabled */
 };
 
 #define DSP_NEXT_FRAGMENT(x) ((x)==NULL ? NULL : container_of((x)->list.next, struct dsp_data_fragment, list))
@@ -11,10 +11,14 @@
 #include <jz_proc.h>
 #include <linux/hrtimer.h>
 #include <linux/workqueue.h>
+#include <linux/list.h>
+#include <linux/wait.h>
 #include <linux/soundcard.h>
 #include <asm/irq.h>
 #include <asm/io.h>
+#include <audio_ring.h>
 #include "audio_common.h"
+#include "audio_process.h"
 
 struct audio_ouput_stream {
 	void __user * data;
@@ -28,6 +32,31 @@ struct audio_input_stream {
 	unsigned int aec_size;
 };
 
+/*
+ * Timing of the first fragment of the last GET_STREAM/SET_STREAM call.
+ * Times are CLOCK_MONOTONIC, interpolated from the dma position: for
+ * capture when its first sample was written to memory, for playback when
+ * its first sample will be read out. Positions count frames since the
+ * stream was enabled.
+ */
+struct audio_stream_tstamp {
+	__u64 tstamp_ns;
+	__u64 frame_pos;
+	__u64 aec_tstamp_ns;		/* the matching aec reference, capture only */
+	__u64 aec_frame_pos;
+};
+
+/* period negotiation, see dsp_set_route_period() */
+#define AUDIO_PERIOD_MIN_US			2000
+#define AUDIO_PERIOD_MAX_US			100000
+#define AUDIO_PERIOD_FRAMES_ALIGN	16
+#define AUDIO_PERIOD_MIN_CNT		4
+
+struct audio_period {
+	unsigned int period_us;		/* in: wanted, 0 restores the default; out: granted */
+	unsigned int periods;		/* in: minimum ring length; out: granted */
+};
+
 struct audio_parameter {
 	unsigned int rate;
 	unsigned short format;
@@ -75,6 +104,49 @@ struct audio_parameter {
 #define AMIC_SPK_SET_MUTE	    	_SIOR ('P', 77, struct channel_mute)
 #define AMIC_AI_SET_ALC_GAIN	    	_SIOR ('P', 76, struct alc_gain)
 #define AMIC_AI_GET_ALC_GAIN	    	_SIOR ('P', 75, struct alc_gain)
+#define AMIC_AI_GET_TSTAMP			_SIOR ('P', 74, struct audio_stream_tstamp)
+#define DMIC_AI_GET_TSTAMP			_SIOR ('P', 73, struct audio_stream_tstamp)
+#define AMIC_AO_GET_TSTAMP			_SIOR ('P', 72, struct audio_stream_tstamp)
+#define AMIC_AI_SET_PERIOD			_SIOR ('P', 71, struct audio_period)
+#define DMIC_AI_SET_PERIOD			_SIOR ('P', 70, struct audio_period)
+#define AMIC_AO_SET_PERIOD			_SIOR ('P', 69, struct audio_period)
+#define AUDIO_SET_READ_ROUTE		_SIOR ('P', 68, int)	/* AUDIO_ROUTE_AMIC_ID or AUDIO_ROUTE_DMIC_ID */
+#define AUDIO_SET_PROCESS			_SIOR ('P', 67, struct audio_process)
+#define AUDIO_GET_METER				_SIOR ('P', 66, struct audio_meter)
+#define AUDIO_START_READ			_SIOR ('P', 65, int)	/* starts the read route, poll() does not */
+
+/* parameters of a route first used through read() or write() */
+#define AUDIO_RW_DEFAULT_RATE		16000
+
+/*
+ * mmap layout: every route owns a window at AUDIO_MMAP_ROUTE_OFFSET(index).
+ * The first page is a struct audio_mmap_ctrl the driver writes, it can
+ * only be mapped read-only. The second page is a struct audio_mmap_appl
+ * the application writes. The dma ring follows them, mapped uncached.
+ */
+#define AUDIO_MMAP_ROUTE_SHIFT		24
+#define AUDIO_MMAP_ROUTE_OFFSET(index)	((unsigned long)(index) << AUDIO_MMAP_ROUTE_SHIFT)
+#define AUDIO_MMAP_CTRL_OFFSET(index)	AUDIO_MMAP_ROUTE_OFFSET(index)
+#define AUDIO_MMAP_APPL_OFFSET(index)	(AUDIO_MMAP_ROUTE_OFFSET(index) + PAGE_SIZE)
+#define AUDIO_MMAP_DATA_OFFSET(index)	(AUDIO_MMAP_ROUTE_OFFSET(index) + 2 * PAGE_SIZE)
+
+struct audio_mmap_ctrl {
+	__u32 route;				/* enum auido_route_index */
+	__u32 fragment_size;		/* bytes, valid once the stream is enabled */
+	__u32 fragment_cnt;
+	__u32 hw_ptr;				/* fragment the dma is working on */
+	__u32 hw_count;				/* fragments the dma finished since the stream was enabled */
+	__u32 fragment_ns;			/* duration of one fragment */
+	__u64 hw_tstamp_ns;			/* CLOCK_MONOTONIC of the first sample of fragment hw_ptr */
+	__u64 hw_frames;			/* frames before fragment hw_ptr since the stream was enabled */
+	/* with AUDIO_PROCESS_METER */
+	__u32 meter_peak;			/* of the last processed fragment */
+	__u32 meter_rms;
+};
+
+struct audio_mmap_appl {
+	__u32 appl_count;			/* fragments consumed (capture) or queued (playback) */
+};
 
 struct audio_route {
 	enum auido_route_index index;
@@ -98,6 +170,50 @@ struct audio_route {
 	unsigned int wait_cnt;
 	bool wait_flag;
 	struct completion done_completion;
+	struct audio_mmap_ctrl *ctrl;		/* mapped read-only by userspace */
+	struct audio_mmap_appl *appl;		/* mapped writable by userspace */
+	u64 fragment_ns;
+	u64 dma_tstamp_ns;					/* first sample of fragment hw_ptr */
+	/* dma position, copied to the ctrl page but never read back from it */
+	unsigned int hw_ptr;					/* fragment the dma is working on */
+	unsigned int hw_count;					/* fragments the dma finished */
+	u64 hw_frames;							/* frames before fragment hw_ptr */
+	struct audio_stream_tstamp tstamp;
+	unsigned int period_us;					/* negotiated fragment duration, 0 uses fragment_time */
+	unsigned int rw_offset;					/* bytes write() moved in the io_tracer fragment */
+	struct audio_process_state process;		/* optional, see dsp_route_process() */
+	/* hardware state, see dsp_route_hw_stop() */
+	bool hw_on;								/* AUDIO_CMD_ENABLE_STREAM issued and not disabled */
+	bool suspended;							/* busy when the system went to sleep */
+	bool gain_saved;
+	struct volume saved_gain;				/* replayed on resume */
+	unsigned int hw_rate;					/* parameters the hardware runs with */
+	unsigned int hw_format;
+	unsigned int hw_channel;
+	unsigned long standby_expires;			/* jiffies, powered down after it */
+	unsigned long long cold_starts;			/* start latency */
+	unsigned long long warm_starts;
+	u64 start_last_ns;
+	u64 start_cold_max_ns;
+	u64 start_warm_max_ns;
+	/* capture fan-out, see dsp_reader_attach() */
+	unsigned int published;					/* fragments handed to readers, wraps */
+	struct list_head readers;
+	wait_queue_head_t read_wait;
+	/* xrun accounting, reported to a negotiated route */
+	struct audio_ring_xrun xrun;
+	unsigned long long late_wakeups;		/* period irqs that found more than one fragment done */
+	unsigned int fill;						/* fragments waiting for the application */
+	unsigned int fill_min;
+	unsigned int fill_max;
+	/* pointer update statistics */
+	unsigned long long period_irqs;
+	unsigned long long timer_polls;			/* positions a timer had to read back */
+	struct hrtimer stall_timer;				/* fires when period irqs stop, see dsp_route_stall_watch() */
+	bool stall_watch;
+	u64 period_last_ns;
+	u64 jitter_sum_ns;						/* distance of period irqs from fragment_ns */
+	u64 jitter_max_ns;
 	struct audio_pipe *pipe;
 	void *parent;
 	void *priv;
@@ -118,7 +234,8 @@ struct audio_dsp_device {
 	ktime_t expires;
 	atomic_t	timer_stopped;
 	struct work_struct workqueue;
-
+	struct delayed_work standby_work;	/* powers down routes left in standby */
+	wait_queue_head_t poll_wait;		/* woken when the dma finished fragments */
 
 	struct audio_route routes[AUDIO_ROUTE_MAX_ID];
 	bool amic_aec;
@@ -128,7 +245,27 @@ struct audio_dsp_device {
 	void *priv;
 };
 
+/* a file reading a capture route through read() */
+struct audio_dsp_reader {
+	struct list_head list;				/* on route->readers */
+	struct audio_route *route;			/* NULL until the first read() */
+	unsigned int count;					/* next fragment, in route->published */
+	unsigned int offset;				/* bytes already read from it */
+	bool overrun_pending;				/* report -EPIPE on the next read() */
+	unsigned long long overruns;
+};
+
+/* per open file state */
+struct audio_dsp_file {
+	struct audio_dsp_device *dsp;
+	unsigned long mapped;				/* routes mmapped through this file */
+	enum auido_route_index read_route;	/* capture route behind read() */
+	unsigned long started;				/* routes read() or write() enabled */
+	struct audio_dsp_reader reader;
+};
+
 #define misc_get_audiodsp(x) (container_of((x), struct audio_dsp_device, miscdev))
+#define file_get_audiodsp(f) (((struct audio_dsp_file *)(f)->private_data)->dsp)
 
 int register_audio_pipe(struct audio_pipe *pipe, enum auido_route_index index);
 int release_audio_pipe(struct audio_pipe *pipe);
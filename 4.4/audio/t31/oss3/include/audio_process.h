@@ -0,0 +1,73 @@
+#ifndef _JZ_AUDIO_PROCESS_H_
+#define _JZ_AUDIO_PROCESS_H_
+#include <linux/types.h>
+
+/*
+ * Optional processing of 16 bits fragments, applied to a capture fragment
+ * when the dma completed it and to a playback fragment when it is queued.
+ */
+#define AUDIO_PROCESS_BIQUAD		(1 << 0)
+#define AUDIO_PROCESS_GAIN			(1 << 1)
+#define AUDIO_PROCESS_METER			(1 << 2)
+#define AUDIO_PROCESS_ALL			(AUDIO_PROCESS_BIQUAD | AUDIO_PROCESS_GAIN | AUDIO_PROCESS_METER)
+
+#define AUDIO_PROCESS_COEF_SHIFT	28		/* biquad coefficients are Q3.28 */
+#define AUDIO_PROCESS_GAIN_SHIFT	12		/* gain is Q3.12, 0x1000 is 0dB */
+#define AUDIO_PROCESS_GAIN_UNITY	(1 << AUDIO_PROCESS_GAIN_SHIFT)
+#define AUDIO_PROCESS_GAIN_MAX		0x7fff
+#define AUDIO_PROCESS_RAMP_SHIFT	12		/* the ramp keeps 12 more fractional bits */
+#define AUDIO_PROCESS_RAMP_MAX_MS	10000
+#define AUDIO_PROCESS_CHANNELS		2
+
+struct audio_process {
+	int route;					/* enum auido_route_index */
+	unsigned int flags;			/* AUDIO_PROCESS_* */
+	/* y = b0*x + b1*x1 + b2*x2 - a1*y1 - a2*y2, a0 normalized to 1 */
+	int b0, b1, b2;
+	int a1, a2;
+	unsigned int gain;			/* reached linearly in ramp_ms, 0dB without AUDIO_PROCESS_GAIN */
+	unsigned int ramp_ms;
+};
+
+struct audio_meter {
+	int route;					/* enum auido_route_index, set by the caller */
+	unsigned int peak;			/* of the last processed fragment, full scale is 32768 */
+	unsigned int rms;
+	unsigned int fragments;		/* metered since the stream was enabled */
+};
+
+struct audio_process_state {
+	struct audio_process param;
+	/* biquad history, x in samples, y with 8 more fractional bits */
+	s32 x1[AUDIO_PROCESS_CHANNELS], x2[AUDIO_PROCESS_CHANNELS];
+	s32 y1[AUDIO_PROCESS_CHANNELS], y2[AUDIO_PROCESS_CHANNELS];
+	s32 e1[AUDIO_PROCESS_CHANNELS];		/* rounding error carried to the next sample */
+	/* gain ramp, the gain << AUDIO_PROCESS_RAMP_SHIFT */
+	s32 gain;
+	s32 gain_target;
+	s32 gain_step;
+	unsigned int gain_frames;	/* left in the ramp */
+	/* meter */
+	unsigned int peak;
+	unsigned int rms;
+	unsigned int fragments;
+	/* cost per fragment */
+	unsigned long long processed;
+	u64 cost_sum_ns;
+	u32 cost_last_ns;
+	u32 cost_max_ns;
+};
+
+static inline bool audio_process_active(struct audio_process_state *st)
+{
+	/* disabling the gain still ramps back to 0dB */
+	return st->param.flags || st->gain != (AUDIO_PROCESS_GAIN_UNITY << AUDIO_PROCESS_RAMP_SHIFT);
+}
+
+void audio_process_init(struct audio_process_state *st);
+void audio_process_reset(struct audio_process_state *st);
+int audio_process_config(struct audio_process_state *st, const struct audio_process *param, unsigned int rate);
+void audio_process_fragment(struct audio_process_state *st, s16 *buf, unsigned int frames, unsigned int channels);
+void audio_process_account(struct audio_process_state *st, u64 cost_ns);
+
+#endif /* _JZ_AUDIO_PROCESS_H_ */
@@ -0,0 +1,150 @@
+/*
+ * Loopback test of read() and write() on the dsp node.
+ *
+ * Plays a tone through write() on the speaker route and records the
+ * amic through read() at the same time, both with the defaults a plain
+ * read()/write() client gets (16 kHz, 16 bit, mono) and with transfer
+ * sizes that never line up with a fragment. The speaker output has to
+ * reach the microphone, acoustically or through a loopback cable. The
+ * recording then has to be dominated by the tone: the Goertzel power at
+ * its frequency must be the given share of the total power, and its level
+ * must be above a floor so silence does not pass.
+ *
+ *   ./audio_loopback_test [freq_hz] [seconds] [min_share_%]
+ *   ./audio_loopback_test 1000 3 50
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#define RATE		16000
+#define AMPLITUDE	12000
+#define MIN_RMS		200.0
+#define SETTLE_MS	500
+
+static int freq = 1000;
+static int seconds = 3;
+
+/* transfer sizes that straddle fragments, in samples */
+static int chunk(int i)
+{
+	static const int sizes[] = { 1, 77, 160, 317, 640, 1001 };
+
+	return sizes[i % (sizeof(sizes) / sizeof(sizes[0]))];
+}
+
+static void *play_tone(void *arg)
+{
+	int fd = *(int *)arg;
+	int total = RATE * (seconds + 1);
+	short buf[1001];
+	int done = 0, n, i, k = 0;
+	ssize_t ret;
+
+	while(done < total){
+		n = chunk(k++);
+		if(n > total - done)
+			n = total - done;
+		for(i = 0; i < n; i++)
+			buf[i] = AMPLITUDE * sin(2 * M_PI * freq * (double)(done + i) / RATE);
+		ret = write(fd, buf, n * sizeof(short));
+		if(ret < 0 && errno != EPIPE){
+			perror("write");
+			break;
+		}
+		if(ret > 0)
+			done += ret / sizeof(short);
+	}
+	return NULL;
+}
+
+/* share of the power of @s at @f, by a Goertzel filter */
+static double tone_share(const short *s, int n, int f, double *rms)
+{
+	double coeff = 2 * cos(2 * M_PI * f / RATE);
+	double q0, q1 = 0, q2 = 0, total = 0, tone;
+	int i;
+
+	for(i = 0; i < n; i++){
+		q0 = coeff * q1 - q2 + s[i];
+		q2 = q1;
+		q1 = q0;
+		total += (double)s[i] * s[i];
+	}
+	tone = q1 * q1 + q2 * q2 - coeff * q1 * q2;
+	*rms = sqrt(total / n);
+	/* a full-length sine puts n/2 times its power in the bin */
+	return total > 0 ? tone / (total * n / 2) : 0;
+}
+
+int main(int argc, const char *argv[])
+{
+	int min_share = argc > 3 ? atoi(argv[3]) : 50;
+	int wfd, rfd, total, got = 0, skip, k = 0;
+	pthread_t player;
+	double share, rms;
+	short *rec;
+	ssize_t ret;
+
+	if(argc > 1)
+		freq = atoi(argv[1]);
+	if(argc > 2)
+		seconds = atoi(argv[2]);
+	if(freq <= 0 || freq >= RATE / 2 || seconds <= 0){
+		printf("Please input: ./audio_loopback_test [freq_hz] [seconds] [min_share_%%]\n");
+		return 1;
+	}
+
+	/* one direction per fd, the ioctl path refuses O_RDWR */
+	wfd = open("/dev/dsp", O_WRONLY);
+	rfd = open("/dev/dsp", O_RDONLY);
+	if(wfd < 0 || rfd < 0){
+		perror("open /dev/dsp");
+		return 1;
+	}
+
+	total = RATE * seconds;
+	rec = malloc(total * sizeof(short));
+	pthread_create(&player, NULL, play_tone, &wfd);
+	while(got < total){
+		int n = chunk(k++);
+
+		if(n > total - got)
+			n = total - got;
+		ret = read(rfd, rec + got, n * sizeof(short));
+		if(ret < 0){
+			if(errno == EPIPE){
+				printf("capture overrun at sample %d\n", got);
+				continue;
+			}
+			perror("read");
+			return 1;
+		}
+		got += ret / sizeof(short);
+	}
+	pthread_join(player, NULL);
+	close(rfd);
+	close(wfd);
+
+	/* leave out the start, the speaker and the codecs settle */
+	skip = RATE * SETTLE_MS / 1000;
+	if(skip >= total)
+		skip = 0;
+	share = tone_share(rec + skip, total - skip, freq, &rms);
+	printf("%d Hz: %.1f%% of the power, rms %.0f\n", freq, share * 100, rms);
+	free(rec);
+
+	if(rms < MIN_RMS || share * 100 < min_share){
+		printf("FAIL\n");
+		return 1;
+	}
+	printf("PASS\n");
+	return 0;
+}
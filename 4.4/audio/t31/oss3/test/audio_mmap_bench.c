@@ -0,0 +1,245 @@
+/*
+ * CPU cost of amic capture through the AMIC_AI_GET_STREAM ioctl, read()
+ * and the mmapped ring with poll(). Each mode captures for the given time
+ * at the given rate and sums the samples, so every mode touches the data
+ * once. Reported are the process cpu time and the busy time of the whole
+ * system, which includes the driver's workqueue.
+ *
+ *   ./audio_mmap_bench <ioctl|read|mmap> <rate> <seconds>
+ *   for r in 16000 48000; do for m in ioctl read mmap; do
+ *           ./audio_mmap_bench $m $r 30; done; done
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <time.h>
+#include <linux/soundcard.h>
+#include <sys/ioctl.h>
+#include <stdio.h>
+#include <string.h>
+
+#define AMIC_AI_SET_PARAM			_SIOR ('P', 113, struct audio_parameter)
+#define AMIC_AI_GET_STREAM        	_SIOR ('P', 98, struct audio_input_stream)
+#define AMIC_AI_DISABLE_STREAM		_SIOR ('P', 97, int)
+#define AMIC_AI_ENABLE_STREAM		_SIOR ('P', 96, int)
+
+/* mmap layout of include/audio_dsp.h, route 0 is the amic */
+#define AUDIO_MMAP_CTRL_OFFSET		0
+#define AUDIO_MMAP_APPL_OFFSET		(page)
+#define AUDIO_MMAP_DATA_OFFSET		(2 * page)
+
+struct audio_parameter {
+	unsigned int rate;
+	unsigned short format;
+	unsigned short channel;
+};
+
+struct audio_input_stream {
+	void *data;
+	unsigned int size;
+	void *aec;
+	unsigned int aec_size;
+};
+
+struct audio_mmap_ctrl {
+	unsigned int route;
+	unsigned int fragment_size;
+	unsigned int fragment_cnt;
+	unsigned int hw_ptr;
+	unsigned int hw_count;
+	unsigned int fragment_ns;
+	unsigned long long hw_tstamp_ns;
+	unsigned long long hw_frames;
+	unsigned int meter_peak;
+	unsigned int meter_rms;
+};
+
+struct audio_mmap_appl {
+	unsigned int appl_count;
+};
+
+static long page;
+static unsigned int sum;
+
+static void touch(const short *s, unsigned int bytes)
+{
+	unsigned int i;
+
+	for(i = 0; i < bytes / 2; i++)
+		sum += s[i];
+}
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* busy and total jiffies of all cpus */
+static void sys_jiffies(unsigned long long *busy, unsigned long long *total)
+{
+	unsigned long long v[8] = {0};
+	FILE *f = fopen("/proc/stat", "r");
+
+	*busy = *total = 0;
+	if(!f)
+		return;
+	if(fscanf(f, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+				&v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) == 8){
+		*total = v[0] + v[1] + v[2] + v[3] + v[4] + v[5] + v[6] + v[7];
+		*busy = *total - v[3] - v[4];
+	}
+	fclose(f);
+}
+
+static int run_ioctl(int fd, unsigned int bytes, double secs)
+{
+	struct audio_input_stream stream;
+	char *buf = malloc(bytes);
+	double end = now_s() + secs;
+
+	memset(&stream, 0, sizeof(stream));
+	stream.data = buf;
+	stream.size = bytes;
+	while(now_s() < end){
+		if(ioctl(fd, AMIC_AI_GET_STREAM, &stream) < 0 && errno != EPIPE){
+			perror("AMIC_AI_GET_STREAM");
+			return -1;
+		}
+		touch((short *)buf, bytes);
+	}
+	free(buf);
+	return 0;
+}
+
+static int run_read(int fd, unsigned int bytes, double secs)
+{
+	char *buf = malloc(bytes);
+	double end = now_s() + secs;
+	ssize_t n;
+
+	while(now_s() < end){
+		n = read(fd, buf, bytes);
+		if(n < 0 && errno != EPIPE){
+			perror("read");
+			return -1;
+		}
+		if(n > 0)
+			touch((short *)buf, n);
+	}
+	free(buf);
+	return 0;
+}
+
+static int run_mmap(int fd, volatile struct audio_mmap_ctrl *ctrl,
+		volatile struct audio_mmap_appl *appl, const char *ring, double secs)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	double end = now_s() + secs;
+	unsigned int index;
+
+	appl->appl_count = ctrl->hw_count;
+	while(now_s() < end){
+		if(poll(&pfd, 1, 1000) < 0){
+			perror("poll");
+			return -1;
+		}
+		/* an overrun leaves only the newest fragments */
+		if(ctrl->hw_count - appl->appl_count >= ctrl->fragment_cnt)
+			appl->appl_count = ctrl->hw_count - 1;
+		while(appl->appl_count != ctrl->hw_count){
+			index = appl->appl_count % ctrl->fragment_cnt;
+			touch((const short *)(ring + index * ctrl->fragment_size), ctrl->fragment_size);
+			appl->appl_count++;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, const char *argv[])
+{
+	struct audio_parameter param;
+	struct rusage ru0, ru1;
+	unsigned long long busy0, total0, busy1, total1;
+	volatile struct audio_mmap_ctrl *ctrl = NULL;
+	volatile struct audio_mmap_appl *appl = NULL;
+	char *ring = NULL;
+	unsigned int bytes;
+	double secs, t0, t1, cpu;
+	int fd, ret, mmap_mode;
+
+	if(argc != 4){
+		printf("Please input: ./audio_mmap_bench <ioctl|read|mmap> <rate> <seconds>\n");
+		return 1;
+	}
+	page = sysconf(_SC_PAGESIZE);
+	param.rate = atoi(argv[2]);
+	param.format = 16;
+	param.channel = 1;
+	secs = atof(argv[3]);
+	/* the 20 ms of the default fragment_time */
+	bytes = param.rate / 50 * 2;
+	mmap_mode = !strcmp(argv[1], "mmap");
+
+	/* an mmap client writes appl_count, it needs a read-write fd */
+	fd = open("/dev/dsp", mmap_mode ? O_RDWR : O_RDONLY);
+	if(fd < 0){
+		perror("open /dev/dsp");
+		return 1;
+	}
+	if(mmap_mode){
+		ctrl = mmap(NULL, page, PROT_READ, MAP_SHARED, fd, AUDIO_MMAP_CTRL_OFFSET);
+		appl = mmap(NULL, page, PROT_READ | PROT_WRITE, MAP_SHARED, fd, AUDIO_MMAP_APPL_OFFSET);
+		if(ctrl == MAP_FAILED || appl == MAP_FAILED){
+			perror("mmap");
+			return 1;
+		}
+	}
+	if(ioctl(fd, AMIC_AI_SET_PARAM, &param) < 0 || ioctl(fd, AMIC_AI_ENABLE_STREAM, 1) < 0){
+		perror("amic setup");
+		return 1;
+	}
+	if(mmap_mode){
+		ring = mmap(NULL, ctrl->fragment_size * ctrl->fragment_cnt, PROT_READ,
+				MAP_SHARED, fd, AUDIO_MMAP_DATA_OFFSET);
+		if(ring == MAP_FAILED){
+			perror("mmap ring");
+			return 1;
+		}
+	}
+
+	getrusage(RUSAGE_SELF, &ru0);
+	sys_jiffies(&busy0, &total0);
+	t0 = now_s();
+	if(mmap_mode)
+		ret = run_mmap(fd, ctrl, appl, ring, secs);
+	else if(!strcmp(argv[1], "read"))
+		ret = run_read(fd, bytes, secs);
+	else
+		ret = run_ioctl(fd, bytes, secs);
+	t1 = now_s();
+	sys_jiffies(&busy1, &total1);
+	getrusage(RUSAGE_SELF, &ru1);
+
+	ioctl(fd, AMIC_AI_DISABLE_STREAM, 0);
+	close(fd);
+	if(ret)
+		return 1;
+
+	cpu = (ru1.ru_utime.tv_sec - ru0.ru_utime.tv_sec) + (ru1.ru_utime.tv_usec - ru0.ru_utime.tv_usec) / 1e6 +
+		(ru1.ru_stime.tv_sec - ru0.ru_stime.tv_sec) + (ru1.ru_stime.tv_usec - ru0.ru_stime.tv_usec) / 1e6;
+	printf("%s %u Hz: process %.2f%% cpu, system %.2f%% busy over %.1f s (sum %08x)\n",
+			argv[1], param.rate, cpu * 100 / (t1 - t0),
+			total1 > total0 ? (busy1 - busy0) * 100.0 / (total1 - total0) : 0.0,
+			t1 - t0, sum);
+	return 0;
+}
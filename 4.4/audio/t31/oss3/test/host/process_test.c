@@ -0,0 +1,368 @@
+/*
+ * Host test and cycle budget of audio_process.c.
+ *
+ * The biquad is run against the same difference equation in double with
+ * the quantized coefficients, and must also settle to silence on DC and
+ * remove a notched tone. The gain ramp must reach its target in exactly
+ * ramp_ms, move by at most one step per frame, and give the same output
+ * however the stream is cut into fragments. The meter is checked on
+ * signals with a known peak and rms. The benchmark then times one 20 ms
+ * fragment with every stage on and reports the share of the period.
+ *
+ *   make run
+ *   make CC=mips-linux-gnu-gcc   # to time it on the board
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "../../include/audio_process.h"
+
+#define RATE		16000
+#define FRAGMENT	(RATE / 50)		/* the default 20 ms fragment_time */
+#define COEF_ONE	(1 << AUDIO_PROCESS_COEF_SHIFT)
+
+static int failures;
+
+#define CHECK(cond, ...) do {						\
+	if(!(cond)){							\
+		failures++;						\
+		printf("FAIL %s:%d: ", __func__, __LINE__);		\
+		printf(__VA_ARGS__);					\
+		printf("\n");						\
+	}								\
+} while(0)
+
+static int quant(double c)
+{
+	return (int)lround(c * COEF_ONE);
+}
+
+/* RBJ cookbook, normalized to a0 */
+static void design(struct audio_process *p, int notch, double fc, double q)
+{
+	double w = 2 * M_PI * fc / RATE;
+	double alpha = sin(w) / (2 * q);
+	double a0 = 1 + alpha;
+	double b0, b1, b2;
+
+	if(notch){
+		b0 = 1;
+		b1 = -2 * cos(w);
+		b2 = 1;
+	}else{
+		b0 = (1 + cos(w)) / 2;
+		b1 = -(1 + cos(w));
+		b2 = (1 + cos(w)) / 2;
+	}
+	memset(p, 0, sizeof(*p));
+	p->flags = AUDIO_PROCESS_BIQUAD;
+	p->b0 = quant(b0 / a0);
+	p->b1 = quant(b1 / a0);
+	p->b2 = quant(b2 / a0);
+	p->a1 = quant(-2 * cos(w) / a0);
+	p->a2 = quant((1 - alpha) / a0);
+}
+
+static double rms_of(const s16 *buf, unsigned int n)
+{
+	double e = 0;
+	unsigned int i;
+
+	for(i = 0; i < n; i++)
+		e += (double)buf[i] * buf[i];
+	return sqrt(e / n);
+}
+
+static void tone(s16 *buf, unsigned int frames, unsigned int channels, double f, double amp, double dc)
+{
+	unsigned int i, ch;
+
+	for(i = 0; i < frames; i++)
+		for(ch = 0; ch < channels; ch++)
+			buf[i * channels + ch] = (s16)lround(dc + amp * sin(2 * M_PI * f * i / RATE + ch));
+}
+
+static void test_biquad_reference(void)
+{
+	struct audio_process_state st;
+	struct audio_process p;
+	double x1[2] = {0}, x2[2] = {0}, y1[2] = {0}, y2[2] = {0};
+	double b0, b1, b2, a1, a2, x, y;
+	static s16 in[RATE * 2], out[RATE * 2];
+	unsigned int i, ch, frames = RATE;
+	int err, max_err = 0;
+
+	design(&p, 0, 100, M_SQRT1_2);
+	b0 = (double)p.b0 / COEF_ONE;
+	b1 = (double)p.b1 / COEF_ONE;
+	b2 = (double)p.b2 / COEF_ONE;
+	a1 = (double)p.a1 / COEF_ONE;
+	a2 = (double)p.a2 / COEF_ONE;
+
+	srand(1);
+	for(i = 0; i < frames * 2; i++)
+		in[i] = (s16)(3000 + 6000 * sin(2 * M_PI * 440 * (i / 2) / RATE) + (rand() % 8001 - 4000));
+	memcpy(out, in, sizeof(in));
+
+	audio_process_init(&st);
+	CHECK(audio_process_config(&st, &p, RATE) == 0, "config");
+	for(i = 0; i < frames; i += FRAGMENT)
+		audio_process_fragment(&st, out + i * 2, FRAGMENT, 2);
+
+	for(i = 0; i < frames; i++){
+		for(ch = 0; ch < 2; ch++){
+			x = in[i * 2 + ch];
+			y = b0 * x + b1 * x1[ch] + b2 * x2[ch] - a1 * y1[ch] - a2 * y2[ch];
+			x2[ch] = x1[ch];
+			x1[ch] = x;
+			y2[ch] = y1[ch];
+			y1[ch] = y;
+			err = abs(out[i * 2 + ch] - (int)lround(fmax(-32768, fmin(32767, y))));
+			if(err > max_err)
+				max_err = err;
+		}
+	}
+	CHECK(max_err <= 2, "high-pass off the double reference by %d", max_err);
+	printf("biquad: high-pass within %d of the double reference\n", max_err);
+}
+
+static void test_biquad_dc_and_notch(void)
+{
+	struct audio_process_state st;
+	struct audio_process p;
+	static s16 buf[RATE * 2];
+	unsigned int i;
+	int max_tail = 0;
+	double in_rms, out_rms;
+
+	/* two seconds of DC must settle to silence, not to a truncation floor */
+	design(&p, 0, 50, M_SQRT1_2);
+	audio_process_init(&st);
+	audio_process_config(&st, &p, RATE);
+	for(i = 0; i < RATE * 2; i++)
+		buf[i] = 10000;
+	for(i = 0; i < RATE * 2; i += FRAGMENT)
+		audio_process_fragment(&st, buf + i, FRAGMENT, 1);
+	for(i = RATE; i < RATE * 2; i++)
+		if(abs(buf[i]) > max_tail)
+			max_tail = abs(buf[i]);
+	CHECK(max_tail <= 1, "DC leaves %d after a second", max_tail);
+
+	/* a 50 Hz notch takes the hum out of a steady tone */
+	design(&p, 1, 50, 5);
+	audio_process_init(&st);
+	audio_process_config(&st, &p, RATE);
+	tone(buf, RATE * 2, 1, 50, 8000, 0);
+	in_rms = rms_of(buf + RATE, RATE);
+	for(i = 0; i < RATE * 2; i += FRAGMENT)
+		audio_process_fragment(&st, buf + i, FRAGMENT, 1);
+	out_rms = rms_of(buf + RATE, RATE);
+	CHECK(20 * log10(in_rms / (out_rms + 1e-9)) > 30, "notch only %.1f dB", 20 * log10(in_rms / (out_rms + 1e-9)));
+
+	/* and leaves a tone far from it alone */
+	audio_process_init(&st);
+	audio_process_config(&st, &p, RATE);
+	tone(buf, RATE * 2, 1, 1000, 8000, 0);
+	in_rms = rms_of(buf + RATE, RATE);
+	for(i = 0; i < RATE * 2; i += FRAGMENT)
+		audio_process_fragment(&st, buf + i, FRAGMENT, 1);
+	out_rms = rms_of(buf + RATE, RATE);
+	CHECK(fabs(20 * log10(out_rms / in_rms)) < 0.1, "1 kHz moved by %.2f dB", 20 * log10(out_rms / in_rms));
+	printf("biquad: DC tail %d, notch and pass band checked\n", max_tail);
+}
+
+/* runs a constant through a ramp cut into fragments of the given sizes */
+static void ramp(s16 *out, unsigned int frames, const unsigned int *cuts, unsigned int ncuts)
+{
+	struct audio_process_state st;
+	struct audio_process p;
+	unsigned int i, done = 0, len;
+
+	memset(&p, 0, sizeof(p));
+	p.flags = AUDIO_PROCESS_GAIN;
+	p.gain = AUDIO_PROCESS_GAIN_UNITY / 2;
+	p.ramp_ms = 10;
+	audio_process_init(&st);
+	audio_process_config(&st, &p, RATE);
+	for(i = 0; i < frames; i++)
+		out[i] = 16384;
+	for(i = 0; done < frames; i++){
+		len = cuts[i % ncuts];
+		if(len > frames - done)
+			len = frames - done;
+		audio_process_fragment(&st, out + done, len, 1);
+		done += len;
+	}
+}
+
+static void test_gain_ramp(void)
+{
+	static const unsigned int whole[] = { FRAGMENT };
+	static const unsigned int odd[] = { 1, 7, 33, 160, 3 };
+	unsigned int frames = FRAGMENT * 2, ramp_frames = RATE * 10 / 1000;
+	unsigned int max_step = (16384 - 8192) / ramp_frames + 1;
+	s16 a[FRAGMENT * 2], b[FRAGMENT * 2];
+	unsigned int i;
+
+	ramp(a, frames, whole, 1);
+	ramp(b, frames, odd, 5);
+	CHECK(!memcmp(a, b, sizeof(a)), "the ramp depends on the fragment cuts");
+	CHECK(a[0] < 16384 && a[0] >= 16384 - (int)max_step, "first frame %d", a[0]);
+	for(i = 1; i < frames; i++){
+		CHECK(a[i] <= a[i - 1], "ramp goes back up at frame %u", i);
+		CHECK(a[i - 1] - a[i] <= (int)max_step, "step %d at frame %u", a[i - 1] - a[i], i);
+	}
+	CHECK(a[ramp_frames - 1] == 8192, "target not reached in ramp_ms: %d", a[ramp_frames - 1]);
+	CHECK(a[ramp_frames - 2] != 8192, "target reached early");
+	CHECK(a[frames - 1] == 8192, "target not held: %d", a[frames - 1]);
+	printf("gain: -6 dB over %u frames, steps <= %u, same for any fragment cut\n", ramp_frames, max_step);
+}
+
+static void test_gain_saturation(void)
+{
+	struct audio_process_state st;
+	struct audio_process p;
+	s16 buf[4] = { 30000, -30000, 100, -100 };
+
+	memset(&p, 0, sizeof(p));
+	p.flags = AUDIO_PROCESS_GAIN;
+	p.gain = AUDIO_PROCESS_GAIN_MAX;
+	audio_process_init(&st);
+	audio_process_config(&st, &p, RATE);
+	audio_process_fragment(&st, buf, 4, 1);
+	CHECK(buf[0] == 32767 && buf[1] == -32768, "saturation %d %d", buf[0], buf[1]);
+	CHECK(buf[2] == 800 && buf[3] == -800, "gain %d %d", buf[2], buf[3]);
+}
+
+static void test_meter(void)
+{
+	struct audio_process_state st;
+	struct audio_process p;
+	s16 buf[FRAGMENT * 2];
+	unsigned int i;
+
+	memset(&p, 0, sizeof(p));
+	p.flags = AUDIO_PROCESS_METER;
+	audio_process_init(&st);
+	audio_process_config(&st, &p, RATE);
+
+	/* a square wave: peak and rms are its amplitude */
+	for(i = 0; i < FRAGMENT; i++)
+		buf[i] = (i & 8) ? 12000 : -12000;
+	audio_process_fragment(&st, buf, FRAGMENT, 1);
+	CHECK(st.peak == 12000 && st.rms == 12000, "square peak %u rms %u", st.peak, st.rms);
+
+	/* a sine of whole periods, rms A/sqrt(2) */
+	tone(buf, FRAGMENT, 1, 500, 20000, 0);
+	audio_process_fragment(&st, buf, FRAGMENT, 1);
+	CHECK(abs((int)st.rms - (int)lround(20000 * M_SQRT1_2)) <= 1, "sine rms %u", st.rms);
+	CHECK(st.peak >= 19990 && st.peak <= 20000, "sine peak %u", st.peak);
+
+	/* one silent channel halves the energy, full scale reads 32768 */
+	for(i = 0; i < FRAGMENT; i++){
+		buf[i * 2] = -32768;
+		buf[i * 2 + 1] = 0;
+	}
+	audio_process_fragment(&st, buf, FRAGMENT, 2);
+	CHECK(st.peak == 32768, "full scale peak %u", st.peak);
+	CHECK(st.rms == (unsigned int)(32768 * M_SQRT1_2), "stereo rms %u", st.rms);
+	CHECK(st.fragments == 3, "fragments %u", st.fragments);
+
+	/* the meter reads what the other stages left */
+	p.flags = AUDIO_PROCESS_METER | AUDIO_PROCESS_GAIN;
+	p.gain = AUDIO_PROCESS_GAIN_UNITY / 4;
+	audio_process_config(&st, &p, RATE);
+	for(i = 0; i < FRAGMENT; i++)
+		buf[i] = 16000;
+	audio_process_fragment(&st, buf, FRAGMENT, 1);
+	CHECK(st.peak == 4000 && st.rms == 4000, "after gain peak %u rms %u", st.peak, st.rms);
+	printf("meter: square, sine, stereo and post-gain levels checked\n");
+}
+
+static void test_config(void)
+{
+	struct audio_process_state st;
+	struct audio_process p;
+
+	audio_process_init(&st);
+	CHECK(!audio_process_active(&st), "idle state is active");
+	memset(&p, 0, sizeof(p));
+	p.flags = AUDIO_PROCESS_ALL << 1;
+	CHECK(audio_process_config(&st, &p, RATE) == -EINVAL, "unknown flag accepted");
+	p.flags = AUDIO_PROCESS_GAIN;
+	p.gain = AUDIO_PROCESS_GAIN_MAX + 1;
+	CHECK(audio_process_config(&st, &p, RATE) == -EINVAL, "gain accepted");
+	p.gain = AUDIO_PROCESS_GAIN_UNITY;
+	p.ramp_ms = AUDIO_PROCESS_RAMP_MAX_MS + 1;
+	CHECK(audio_process_config(&st, &p, RATE) == -EINVAL, "ramp accepted");
+
+	/* switching the gain off still ramps back to 0 dB before going idle */
+	p.gain = AUDIO_PROCESS_GAIN_UNITY * 2;
+	p.ramp_ms = 0;
+	audio_process_config(&st, &p, RATE);
+	p.flags = 0;
+	p.ramp_ms = 10;
+	audio_process_config(&st, &p, RATE);
+	CHECK(audio_process_active(&st), "idle in the middle of the ramp");
+	{
+		s16 buf[FRAGMENT];
+
+		memset(buf, 0, sizeof(buf));
+		audio_process_fragment(&st, buf, FRAGMENT, 1);
+	}
+	CHECK(!audio_process_active(&st), "still active after the ramp");
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void bench(unsigned int channels, unsigned int loops)
+{
+	struct audio_process_state st;
+	struct audio_process p;
+	static s16 buf[FRAGMENT * AUDIO_PROCESS_CHANNELS];
+	double t0, ns, period_ns = 1e9 * FRAGMENT / RATE;
+	unsigned int i;
+
+	design(&p, 0, 100, M_SQRT1_2);
+	p.flags = AUDIO_PROCESS_ALL;
+	p.gain = AUDIO_PROCESS_GAIN_UNITY * 3 / 4;
+	audio_process_init(&st);
+	audio_process_config(&st, &p, RATE);
+	tone(buf, FRAGMENT, channels, 440, 8000, 0);
+
+	t0 = now_ns();
+	for(i = 0; i < loops; i++)
+		audio_process_fragment(&st, buf, FRAGMENT, channels);
+	ns = (now_ns() - t0) / loops;
+	printf("bench: %u frames x %u ch, all stages: %.0f ns per fragment, %.3f%% of the %.0f ms period\n",
+			FRAGMENT, channels, ns, ns * 100 / period_ns, period_ns / 1e6);
+}
+
+int main(int argc, const char *argv[])
+{
+	unsigned int loops = argc > 1 ? atoi(argv[1]) : 20000;
+
+	test_config();
+	test_biquad_reference();
+	test_biquad_dc_and_notch();
+	test_gain_ramp();
+	test_gain_saturation();
+	test_meter();
+	if(failures){
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	bench(1, loops);
+	bench(2, loops);
+	printf("all passed\n");
+	return 0;
+}
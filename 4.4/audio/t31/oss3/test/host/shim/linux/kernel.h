@@ -0,0 +1,35 @@
+/* just enough of the kernel headers to build audio_process.c on the host */
+#ifndef _SHIM_LINUX_KERNEL_H
+#define _SHIM_LINUX_KERNEL_H
+
+#include <errno.h>
+#include <stdlib.h>
+#include <linux/types.h>
+
+#define clamp_t(type, val, lo, hi) ({			\
+	type __v = (val), __lo = (lo), __hi = (hi);	\
+	__v < __lo ? __lo : (__v > __hi ? __hi : __v); })
+
+/* rounds down like lib/int_sqrt.c */
+static inline unsigned long int_sqrt(unsigned long x)
+{
+	unsigned long b, m, y = 0;
+
+	if(x <= 1)
+		return x;
+	m = 1UL << (sizeof(long) * 8 - 2);
+	while(m > x)
+		m >>= 2;
+	while(m){
+		b = y + m;
+		y >>= 1;
+		if(x >= b){
+			x -= b;
+			y += m;
+		}
+		m >>= 2;
+	}
+	return y;
+}
+
+#endif
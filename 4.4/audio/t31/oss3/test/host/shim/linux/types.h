@@ -0,0 +1,15 @@
+#ifndef _SHIM_LINUX_TYPES_H
+#define _SHIM_LINUX_TYPES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef int64_t s64;
+typedef int32_t s32;
+typedef int16_t s16;
+typedef uint64_t u64;
+typedef uint32_t u32;
+typedef uint16_t u16;
+typedef uint8_t u8;
+
+#endif
@@ -0,0 +1,228 @@
+#include <linux/clk.h>
+#include <linux/debugfs.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+
+#include "avpu_ip.h"
+#include "avpu_dvfs.h"
+
+static int avpu_dvfs = 1;
+module_param(avpu_dvfs, int, S_IRUGO);
+MODULE_PARM_DESC(avpu_dvfs, "scale avpu clock with encoder load");
+static int avpu_dvfs_frames = 15;
+module_param(avpu_dvfs_frames, int, S_IRUGO);
+MODULE_PARM_DESC(avpu_dvfs_frames, "frames per load measurement window");
+
+/* lowest rate that keeps the measured load under the target load */
+static unsigned int avpu_dvfs_pick(struct avpu_dvfs *d, u32 load)
+{
+	unsigned int i;
+
+	for (i = 0; i < AVPU_DVFS_NR_RATES; i++)
+		if ((u64)load * d->rates[d->cur] <=
+		    (u64)AVPU_DVFS_TARGET_LOAD * d->rates[i])
+			return i;
+
+	return AVPU_DVFS_NR_RATES - 1;
+}
+
+static unsigned int avpu_dvfs_floor(struct avpu_dvfs *d)
+{
+	u32 floor = max(d->min_rate, d->chan_min_rate);
+	unsigned int i;
+
+	for (i = 0; i < AVPU_DVFS_NR_RATES; i++)
+		if (d->rates[i] >= floor)
+			return i;
+
+	return AVPU_DVFS_NR_RATES - 1;
+}
+
+static void avpu_dvfs_reset_window(struct avpu_dvfs *d, u64 now)
+{
+	d->win_frames = 0;
+	d->win_busy_ns = 0;
+	d->win_start_ns = now;
+}
+
+void avpu_dvfs_init(struct avpu_codec_desc *codec, unsigned long max_rate)
+{
+	struct avpu_dvfs *d = &codec->dvfs;
+	unsigned int i;
+
+	mutex_init(&d->lock);
+	d->enabled = avpu_dvfs && avpu_dvfs_frames > 0;
+	for (i = 0; i < AVPU_DVFS_NR_RATES; i++)
+		d->rates[i] = max_rate / AVPU_DVFS_NR_RATES * (i + 1);
+	d->cur = AVPU_DVFS_NR_RATES - 1;
+	d->target = d->cur;
+	d->state_since_ns = ktime_to_ns(ktime_get());
+	avpu_dvfs_reset_window(d, d->state_since_ns);
+}
+
+/* called with codec->i_lock held when a channel binds */
+void avpu_dvfs_bind(struct avpu_codec_desc *codec, u64 now)
+{
+	struct avpu_dvfs *d = &codec->dvfs;
+
+	d->chan_min_rate = 0;
+	d->low_windows = 0;
+	avpu_dvfs_reset_window(d, now);
+}
+
+/* called from the irq handler with codec->i_lock held */
+void avpu_dvfs_frame_done(struct avpu_codec_desc *codec, u64 busy, u64 now)
+{
+	struct avpu_dvfs *d = &codec->dvfs;
+	u64 len;
+
+	if (!d->enabled)
+		return;
+
+	d->win_busy_ns += busy;
+	if (++d->win_frames < avpu_dvfs_frames)
+		return;
+
+	len = now - d->win_start_ns;
+	d->load_pct = len ? min_t(u64, div64_u64(d->win_busy_ns * 100, len), 100)
+			  : 100;
+	avpu_dvfs_reset_window(d, now);
+
+	if (d->load_pct > AVPU_DVFS_UP_LOAD) {
+		d->low_windows = 0;
+		d->target = avpu_dvfs_pick(d, d->load_pct);
+	} else if (d->load_pct < AVPU_DVFS_DOWN_LOAD) {
+		if (++d->low_windows >= AVPU_DVFS_DOWN_WINDOWS) {
+			d->low_windows = 0;
+			d->target = avpu_dvfs_pick(d, d->load_pct);
+		}
+	} else {
+		d->low_windows = 0;
+		d->target = d->cur;
+	}
+}
+
+/*
+ * Called before a job is kicked. The rate only changes while no job is in
+ * flight, so a frame always runs at a single rate.
+ */
+void avpu_dvfs_apply(struct avpu_codec_chan *chan)
+{
+	struct avpu_codec_desc *codec = chan->codec;
+	struct avpu_dvfs *d = &codec->dvfs;
+	unsigned long flags;
+	unsigned int next;
+	bool idle;
+	u64 now;
+
+	if (!d->enabled)
+		return;
+
+	mutex_lock(&d->lock);
+
+	spin_lock_irqsave(&codec->i_lock, flags);
+	idle = chan->stats.count == 0;
+	next = max(d->target, avpu_dvfs_floor(d));
+	spin_unlock_irqrestore(&codec->i_lock, flags);
+
+	if (!idle || next == d->cur)
+		goto out;
+
+	if (clk_set_rate(codec->clk, d->rates[next])) {
+		avpu_err("Failed to set clock rate %lu\n", d->rates[next]);
+		goto out;
+	}
+
+	now = ktime_to_ns(ktime_get());
+	spin_lock_irqsave(&codec->i_lock, flags);
+	d->time_in_state_ns[d->cur] += now - d->state_since_ns;
+	d->state_since_ns = now;
+	d->cur = next;
+	d->transitions++;
+	avpu_dvfs_reset_window(d, now);
+	spin_unlock_irqrestore(&codec->i_lock, flags);
+
+out:
+	mutex_unlock(&d->lock);
+}
+
+int avpu_dvfs_set_chan_floor(struct avpu_codec_chan *chan, unsigned long arg)
+{
+	struct avpu_codec_desc *codec = chan->codec;
+	unsigned long flags;
+	__u32 rate;
+
+	if (copy_from_user(&rate, (void *)arg, sizeof(rate)))
+		return -EFAULT;
+
+	spin_lock_irqsave(&codec->i_lock, flags);
+	codec->dvfs.chan_min_rate = rate;
+	spin_unlock_irqrestore(&codec->i_lock, flags);
+
+	avpu_dvfs_apply(chan);
+
+	return 0;
+}
+
+static int avpu_dvfs_show(struct seq_file *m, void *v)
+{
+	struct avpu_codec_desc *codec = m->private;
+	struct avpu_dvfs *d = &codec->dvfs;
+	u64 time_in_state[AVPU_DVFS_NR_RATES];
+	unsigned int cur, target, i;
+	u64 transitions;
+	unsigned long flags;
+	u32 load;
+
+	spin_lock_irqsave(&codec->i_lock, flags);
+	cur = d->cur;
+	target = max(d->target, avpu_dvfs_floor(d));
+	load = d->load_pct;
+	transitions = d->transitions;
+	memcpy(time_in_state, d->time_in_state_ns, sizeof(time_in_state));
+	time_in_state[cur] += ktime_to_ns(ktime_get()) - d->state_since_ns;
+	spin_unlock_irqrestore(&codec->i_lock, flags);
+
+	seq_printf(m, "enabled:       %d\n", d->enabled);
+	seq_printf(m, "cur_rate:      %lu\n", d->rates[cur]);
+	seq_printf(m, "target_rate:   %lu\n", d->rates[target]);
+	seq_printf(m, "load:          %u%%\n", load);
+	seq_printf(m, "min_rate:      %u\n", d->min_rate);
+	seq_printf(m, "chan_min_rate: %u\n", d->chan_min_rate);
+	seq_printf(m, "transitions:   %llu\n", transitions);
+	seq_puts(m, "time_in_state_ms:\n");
+	for (i = 0; i < AVPU_DVFS_NR_RATES; i++)
+		seq_printf(m, "  %10lu %llu\n", d->rates[i],
+			   div64_u64(time_in_state[i], NSEC_PER_MSEC));
+
+	return 0;
+}
+
+static int avpu_dvfs_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, avpu_dvfs_show, inode->i_private);
+}
+
+static const struct file_operations avpu_dvfs_fops = {
+	.owner		= THIS_MODULE,
+	.open		= avpu_dvfs_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+void avpu_dvfs_debugfs_init(struct avpu_codec_desc *codec)
+{
+	if (!codec->debugfs)
+		return;
+
+	debugfs_create_file("dvfs", S_IRUGO, codec->debugfs, codec,
+			    &avpu_dvfs_fops);
+	debugfs_create_u32("min_rate", S_IRUGO | S_IWUSR, codec->debugfs,
+			   &codec->dvfs.min_rate);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <linux/mutex.h>
+#include <linux/types.h>
+
+/* the table is avpu_clk * k / AVPU_DVFS_NR_RATES, k = 1..AVPU_DVFS_NR_RATES */
+#define AVPU_DVFS_NR_RATES 4
+/* load (in % of the current rate) the governor aims for after a switch */
+#define AVPU_DVFS_TARGET_LOAD 70
+#define AVPU_DVFS_UP_LOAD 85
+#define AVPU_DVFS_DOWN_LOAD 50
+/* consecutive low windows needed before stepping down */
+#define AVPU_DVFS_DOWN_WINDOWS 2
+
+struct avpu_codec_desc;
+struct avpu_codec_chan;
+
+struct avpu_dvfs {
+	bool enabled;
+	unsigned long rates[AVPU_DVFS_NR_RATES];
+	unsigned int cur;
+	unsigned int target;
+	unsigned int low_windows;
+	u32 min_rate;           /* system floor, Hz, set through debugfs */
+	u32 chan_min_rate;      /* floor requested by the bound channel */
+
+	/* frame window, updated from the irq handler */
+	unsigned int win_frames;
+	u64 win_start_ns;
+	u64 win_busy_ns;
+	u32 load_pct;
+
+	u64 transitions;
+	u64 time_in_state_ns[AVPU_DVFS_NR_RATES];
+	u64 state_since_ns;
+
+	struct mutex lock;      /* serialises rate changes */
+};
+
+void avpu_dvfs_init(struct avpu_codec_desc *codec, unsigned long max_rate);
+void avpu_dvfs_bind(struct avpu_codec_desc *codec, u64 now);
+void avpu_dvfs_frame_done(struct avpu_codec_desc *codec, u64 busy, u64 now);
+void avpu_dvfs_apply(struct avpu_codec_chan *chan);
+int avpu_dvfs_set_chan_floor(struct avpu_codec_chan *chan, unsigned long arg);
+void avpu_dvfs_debugfs_init(struct avpu_codec_desc *codec);
@@ -9,6 +9,7 @@
 #define GET_DMA_FD		_IOWR('q', 13, struct avpu_dma_info)
 #define GET_DMA_PHY		_IOWR('q', 18, struct avpu_dma_info)
 #define JZ_CMD_FLUSH_CACHE	_IOWR('q', 14, int)
+#define JZ_CMD_SET_MIN_CLK	_IOW('q', 15, __u32)
 
 struct avpu_reg {
 	unsigned int id;
@@ -7,7 +7,10 @@
 #include <linux/interrupt.h>
 #include <linux/io.h>
 #include <linux/kernel.h>
+#include <linux/ktime.h>
 #include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/sched.h>
 #include <linux/slab.h>
 #include <linux/clk.h>
@@ -16,6 +19,10 @@
 
 #include "avpu_ip.h"
 
+static int avpu_eof_irqs = AVPU_IRQ_EOF_DEFAULT;
+module_param(avpu_eof_irqs, int, S_IRUGO);
+MODULE_PARM_DESC(avpu_eof_irqs, "mask of the status bits that end a frame");
+
 int avpu_codec_bind_channel(struct avpu_codec_chan *chan,
 			    struct inode *inode)
 {
@@ -29,10 +36,6 @@ int avpu_codec_bind_channel(struct avpu_codec_chan *chan,
 
 	spin_lock_irqsave(&codec->i_lock, flags);
 
-	clk_enable(codec->clk);
-	clk_enable(codec->ahb1_gate);
-	clk_enable(codec->clk_gate);
-
 	chan->codec = codec;
 	/* No mcu, there is a one for one mapping */
 	if (codec->chan != NULL) {
@@ -48,6 +51,11 @@ int avpu_codec_bind_channel(struct avpu_codec_chan *chan,
 	}
 
 	codec->chan = chan;
+	codec->nr_channels_served++;
+	memset(codec->irq_slot, -1, sizeof(codec->irq_slot));
+	memset(codec->irq_other, 0, sizeof(codec->irq_other));
+	avpu_stats_reset(&chan->stats, ktime_to_ns(ktime_get()));
+	avpu_dvfs_bind(codec, chan->stats.win_start_ns);
 
 unlock:
 	spin_unlock_irqrestore(&codec->i_lock, flags);
@@ -63,10 +71,7 @@ void avpu_codec_unbind_channel(struct avpu_codec_chan *chan)
 	codec = chan->codec;
 	spin_lock_irqsave(&codec->i_lock, flags);
 
-	clk_disable(codec->clk);
-	clk_disable(codec->clk_gate);
-	clk_disable(codec->ahb1_gate);
-
+	avpu_stats_accumulate(&codec->stats_total, &chan->stats);
 	codec->chan = NULL;
 
 	spin_unlock_irqrestore(&codec->i_lock, flags);
@@ -90,15 +95,61 @@ void avpu_codec_write_register(struct avpu_codec_chan *chan,
 			       struct avpu_reg *reg)
 {
 	struct avpu_codec_desc *codec = chan->codec;
+	unsigned long flags;
+	int slot;
 
 	if (!chan->codec->regs) {
 		avpu_err("Registers not mapped\n");
 		return;
 	}
+
+	if (reg->id == AVPU_CMD_START_0 || reg->id == AVPU_CMD_START_1) {
+		slot = reg->id == AVPU_CMD_START_0 ? 0 : 1;
+		avpu_dvfs_apply(chan);
+		spin_lock_irqsave(&codec->i_lock, flags);
+		avpu_stats_submit(&chan->stats, slot, ktime_to_ns(ktime_get()));
+		avpu_wdt_submit(codec);
+		spin_unlock_irqrestore(&codec->i_lock, flags);
+	}
+
 	iowrite32(reg->value, chan->codec->regs + reg->id);
 
 }
 
+/*
+ * Account the job status bit @bit finished, called with i_lock held.
+ * Only the end of frame bits (avpu_eof_irqs) complete a job, any other
+ * bit is only counted. The slot an end of frame bit belongs to is learnt
+ * the first time it fires while a single slot has jobs in flight; until
+ * then it is charged to the slot with the oldest job. A bit firing while
+ * its slot is idle is not a job completion.
+ */
+static bool avpu_irq_complete(struct avpu_codec_desc *codec, int bit, u64 now)
+{
+	struct avpu_stats *s = &codec->chan->stats;
+	int slot = codec->irq_slot[bit];
+	u64 busy;
+
+	if (!(avpu_eof_irqs & (1U << bit))) {
+		codec->irq_other[bit]++;
+		return false;
+	}
+	if (slot < 0) {
+		slot = avpu_stats_oldest_slot(s);
+		if (slot < 0)
+			return false;
+		if (avpu_stats_busy_slots(s) == 1)
+			codec->irq_slot[bit] = slot;
+	}
+	if (!s->slot[slot].count)
+		return false;
+
+	busy = avpu_stats_complete(s, slot, now);
+	avpu_dvfs_frame_done(codec, busy, now);
+
+	return true;
+}
+
 irqreturn_t avpu_hardirq_handler(int irq, void *data)
 {
 	struct avpu_codec_desc *codec = (struct avpu_codec_desc *)data;
@@ -108,7 +159,12 @@ irqreturn_t avpu_hardirq_handler(int irq, void *data)
 	struct r_irq *i_callback;
 	int callback_nb;
 	int i = 0;
-	int avpu_interrupt_nb = 20;
+	u64 now = ktime_to_ns(ktime_get());
+	bool done = false;
+
+	/* shared line, our registers are not clocked while suspended */
+	if (!codec->pm.powered)
+		return IRQ_NONE;
 
 	mask = ioread32(codec->regs + AVPU_INTERRUPT_MASK);
 	unmasked_irq_bitfield = ioread32(codec->regs + AVPU_INTERRUPT);
@@ -120,7 +176,10 @@ irqreturn_t avpu_hardirq_handler(int irq, void *data)
 	iowrite32(unmasked_irq_bitfield, codec->regs + AVPU_INTERRUPT);
 	ioread32(codec->regs + AVPU_INTERRUPT);
 
-	for (i = 0; i < avpu_interrupt_nb; ++i) {
+	if (avpu_wdt_drop_irq(codec))
+		return IRQ_HANDLED;
+
+	for (i = 0; i < AVPU_IRQ_NB; ++i) {
 		callback_nb = 1U << i;
 		if (irq_bitfield & callback_nb) {
 			i_callback = kmem_cache_alloc(codec->cache, GFP_ATOMIC);
@@ -129,6 +188,7 @@ irqreturn_t avpu_hardirq_handler(int irq, void *data)
 				return IRQ_NONE;
 			}
 			i_callback->bitfield = i;
+			i_callback->ts_ns = now;
 			spin_lock_irqsave(&codec->i_lock, flags);
 			list_add_tail(&i_callback->list, &codec->irq_masks);
 			spin_unlock_irqrestore(&codec->i_lock, flags);
@@ -136,8 +196,14 @@ irqreturn_t avpu_hardirq_handler(int irq, void *data)
 	}
 
 	spin_lock_irqsave(&codec->i_lock, flags);
-	if (codec->chan)
+	if (codec->chan) {
+		for (i = 0; i < AVPU_IRQ_NB; ++i)
+			if (irq_bitfield & (1U << i))
+				done |= avpu_irq_complete(codec, i, now);
+		if (done)
+			avpu_wdt_complete(codec);
 		wake_up_interruptible(&codec->chan->irq_queue);
+	}
 	spin_unlock_irqrestore(&codec->i_lock, flags);
 
 	return IRQ_HANDLED;
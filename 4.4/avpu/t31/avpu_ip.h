@@ -10,6 +10,10 @@
 
 #include "avpu_ioctl.h"
 #include "avpu_alloc.h"
+#include "avpu_stats.h"
+#include "avpu_dvfs.h"
+#include "avpu_pm.h"
+#include "avpu_wdt.h"
 
 #define AVPU_NR_DEVS 4
 #define AVPU_BASE_OFFSET 0x8000
@@ -17,6 +21,21 @@
 #define AXI_ADDR_OFFSET_IP (AVPU_BASE_OFFSET + 0x1208)
 #define AVPU_INTERRUPT_MASK (AVPU_BASE_OFFSET + 0x14)
 #define AVPU_INTERRUPT (AVPU_BASE_OFFSET + 0x18)
+/*
+ * Writes to these kick a job on the engine. They are the two register
+ * ids write_reg() has always singled out (0x8084 and 0x8094, the same in
+ * the t40/t41 and 3.10 copies of this driver); each one is a job slot.
+ */
+#define AVPU_CMD_START_0 (AVPU_BASE_OFFSET + 0x84)
+#define AVPU_CMD_START_1 (AVPU_BASE_OFFSET + 0x94)
+/* status bits the handler forwards to userspace */
+#define AVPU_IRQ_NB 20
+/*
+ * The end of encoding bits of the two slots. Without a register map these
+ * are the low bits the encoder library enables per core; the other ones
+ * (slice done, errors) never end a job.
+ */
+#define AVPU_IRQ_EOF_DEFAULT 0x3
 
 #define avpu_writel(val, reg) iowrite32(val, codec->regs + reg)
 #define avpu_readl(reg) ioread32(codec->regs + reg)
@@ -39,6 +58,7 @@ struct dma_buf_info {
 struct r_irq {
 	struct list_head list;
 	u32 bitfield;
+	u64 ts_ns;
 };
 
 struct avpu_codec_desc {
@@ -56,6 +76,16 @@ struct avpu_codec_desc {
 	struct clk          *clk_mux;
 	struct clk          *clk_gate;
 	struct clk          *ahb1_gate;
+	struct dentry *debugfs;
+	struct avpu_stats stats_total;  /* channels already released */
+	unsigned int nr_channels_served;
+	struct avpu_dvfs dvfs;
+	struct avpu_pm pm;
+	struct avpu_wdt wdt;
+	int irq;
+	/* job slot each status bit completes, -1 until seen; under i_lock */
+	s8 irq_slot[AVPU_IRQ_NB];
+	u64 irq_other[AVPU_IRQ_NB];     /* status bits that are not an end of frame */
 };
 
 struct avpu_dma_buf_mmap {
@@ -67,10 +97,12 @@ struct avpu_dma_buf_mmap {
 struct avpu_codec_chan {
 	wait_queue_head_t irq_queue;
 	int unblock;
+	int timed_out;                  /* set by the watchdog, reported once */
 	spinlock_t lock;
 	struct list_head mem;
 	int num_bufs;
 	struct avpu_codec_desc *codec;
+	struct avpu_stats stats;        /* protected by codec->i_lock */
 };
 
 int avpu_codec_bind_channel(struct avpu_codec_chan *chan, struct inode *inode);
@@ -12,6 +12,7 @@
 #include <linux/io.h>
 #include <linux/kernel.h>
 #include <linux/kfifo.h>
+#include <linux/ktime.h>
 #include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/moduleparam.h>
@@ -92,7 +93,7 @@ struct platform_device jz_avpu_irq_device = {					\
 int channel_is_ready(struct avpu_codec_chan *chan)
 {
 	unsigned long flags;
-	int ret = chan->unblock;
+	int ret = chan->unblock || chan->timed_out;
 
 	spin_lock_irqsave(&chan->codec->i_lock, flags);
 	ret = ret || !list_empty(&chan->codec->irq_masks);
@@ -121,6 +122,11 @@ static int avpu_codec_open(struct inode *inode, struct file *filp)
 	/* irq */
 	init_waitqueue_head(&chan->irq_queue);
 
+	ret = avpu_pm_get(container_of(inode->i_cdev, struct avpu_codec_desc,
+				       cdev));
+	if (ret)
+		goto fail_pm;
+
 	ret = avpu_codec_bind_channel(chan, inode);
 	if (ret)
 		goto fail_codec_binding;
@@ -128,6 +134,8 @@ static int avpu_codec_open(struct inode *inode, struct file *filp)
 	return 0;
 
 fail_codec_binding:
+	avpu_pm_put(chan->codec);
+fail_pm:
 //	printk("--------------%s(%d)-----------\n", __func__, __LINE__);
 	kzfree(chan);
 fail:
@@ -142,6 +150,8 @@ static int avpu_codec_release(struct inode *inode, struct file *filp)
 	struct list_head *pos, *n;
 //	printk("--------------%s(%d)-----------\n", __func__, __LINE__);
 	avpu_codec_unbind_channel(chan);
+	avpu_wdt_sync(chan->codec);
+	avpu_pm_put(chan->codec);
 	list_for_each_safe(pos, n, &chan->mem){
 		tmp = list_entry(pos, struct avpu_dma_buf_mmap, list);
 		list_del(pos);
@@ -217,6 +227,7 @@ static int wait_irq(struct avpu_codec_chan *chan, unsigned long arg)
 	int callback;
 	struct r_irq *i_callback;
 	unsigned long flags;
+	u64 ts_ns;
 	int ret;
 
 //	printk("--------------%s(%d)-----------\n", __func__, __LINE__);
@@ -232,11 +243,20 @@ static int wait_irq(struct avpu_codec_chan *chan, unsigned long arg)
 
 //	printk("--------------%s(%d)-----------\n", __func__, __LINE__);
 	spin_lock_irqsave(&codec->i_lock, flags);
+	if (chan->timed_out) {
+		chan->timed_out = 0;
+		spin_unlock_irqrestore(&codec->i_lock, flags);
+		/* let the reset finish before userspace kicks the next job */
+		flush_work(&codec->wdt.reset_work);
+		return -ETIMEDOUT;
+	}
 	i_callback = list_first_entry(&chan->codec->irq_masks,
 				      struct r_irq, list);
 	callback = i_callback->bitfield;
+	ts_ns = i_callback->ts_ns;
 	list_del(&i_callback->list);
 	kmem_cache_free(codec->cache, i_callback);
+	avpu_stats_wakeup(&chan->stats, ktime_to_ns(ktime_get()) - ts_ns);
 	spin_unlock_irqrestore(&codec->i_lock, flags);
 //	printk("--------------%s(%d)-----------\n", __func__, __LINE__);
 
@@ -286,7 +306,7 @@ static int write_reg(struct avpu_codec_chan *chan, unsigned long arg)
 	if (copy_from_user(&reg, (struct avpu_reg *)arg, sizeof(struct avpu_reg)))
 		return -EFAULT;
 		avpu_dbg("Reg write: 0x%.4X: 0x%.8x\n", reg.id, reg.value);
-	if (reg.id == 0x8084 || reg.id == 0x8094)
+	if (reg.id == AVPU_CMD_START_0 || reg.id == AVPU_CMD_START_1)
 		avpu_dbg("Reg write: 0x%.4X: 0x%.8x\n", reg.id, reg.value);
 
 	if (reg.id % 4) {
@@ -343,6 +363,8 @@ static long avpu_codec_ioctl(struct file *filp, unsigned int cmd,
 		return write_reg(chan, arg);
 	case JZ_CMD_FLUSH_CACHE:
 		return jz_cmd_flush_cache(arg);
+	case JZ_CMD_SET_MIN_CLK:
+		return avpu_dvfs_set_chan_floor(chan, arg);
 	default:
 		avpu_err("Unknown ioctl: 0x%.8X\n", cmd);
 		return -EINVAL;
@@ -468,6 +490,7 @@ int avpu_codec_probe(struct platform_device *pdev)
 		avpu_info("No irq requested / Couldn't obtain request irq\n");
 		has_irq = false;
 	}
+	codec->irq = has_irq ? irq : -1;
 
 #ifdef CONFIG_KERNEL_4_4_94
 	codec->ahb1_gate = clk_get(&pdev->dev, "gate_ahb1");
@@ -502,10 +525,6 @@ int avpu_codec_probe(struct platform_device *pdev)
 		goto out_get_vpu_clk_cgu;
 	}
 	clk_set_rate(codec->clk, avpu_clk);
-
-	clk_prepare_enable(codec->ahb1_gate);
-	clk_prepare_enable(codec->clk_gate);
-	clk_prepare_enable(codec->clk);
 #else
 	codec->ahb1_gate = clk_get(&pdev->dev, "ahb1");
 	if (IS_ERR(codec->ahb1_gate)) {
@@ -538,6 +557,9 @@ int avpu_codec_probe(struct platform_device *pdev)
 	if (err)
 		goto out_failed_request_irq;
 
+	avpu_dvfs_init(codec, avpu_clk);
+	avpu_wdt_init(codec);
+
 	if (has_irq) {
 		err = devm_request_irq(codec->device,
 				       irq,
@@ -552,6 +574,11 @@ int avpu_codec_probe(struct platform_device *pdev)
 
 	platform_set_drvdata(pdev, codec);
 
+	/* clocks are enabled on first open and gated again when idle */
+	err = avpu_pm_init(codec);
+	if (err)
+		goto out_failed_request_irq;
+
 #if defined(CONFIG_SOC_T31)
 	if (of_property_read_string(codec->device->of_node, "t31,devicename",
 #elif defined(CONFIG_SOC_C100)
@@ -562,13 +589,21 @@ int avpu_codec_probe(struct platform_device *pdev)
 
 	err = avpu_setup_codec_cdev(codec, current_minor, DEV_NAME);
 	if (err)
-		return err;
+		goto out_pm_exit;
 
 	codec->minor = current_minor;
 	++current_minor;
 
+	if (avpu_stats_debugfs_init(codec))
+		avpu_info("debugfs stats not available\n");
+	avpu_dvfs_debugfs_init(codec);
+	avpu_pm_debugfs_init(codec);
+	avpu_wdt_debugfs_init(codec);
+
 	return 0;
 
+out_pm_exit:
+	avpu_pm_exit(codec);
 out_failed_request_irq:
 out_get_vpu_clk_cgu:
 out_get_clk_gate:
@@ -584,16 +619,14 @@ int avpu_codec_remove(struct platform_device *pdev)
 	struct avpu_codec_desc *codec = platform_get_drvdata(pdev);
 	dev_t dev = MKDEV(avpu_codec_major, codec->minor);
 
-#ifdef CONFIG_SOC_T40
-	clk_disable_unprepare(codec->clk);
-	clk_disable_unprepare(codec->clk_gate);
-	clk_disable_unprepare(codec->ahb1_gate);
-#else
+	/* gates the clocks if they are still on, so only drop the references */
+	avpu_pm_exit(codec);
+
 	clk_put(codec->clk);
 	clk_put(codec->clk_gate);
 	clk_put(codec->ahb1_gate);
-#endif
 
+	avpu_stats_debugfs_exit(codec);
 	device_destroy(module_class, dev);
 	clean_up_avpu_codec_cdev(codec);
 	deinit_codec_desc(codec);
@@ -614,6 +647,7 @@ static struct platform_driver avpu_platform_driver = {
 	.remove			= avpu_codec_remove,
 	.driver			=       {
 		.name		= "avpu",
+		.pm		= &avpu_pm_ops,
 		.of_match_table = of_match_ptr(avpu_codec_of_match),
 	},
 };
@@ -0,0 +1,265 @@
+#include <linux/clk.h>
+#include <linux/debugfs.h>
+#include <linux/interrupt.h>
+#include <linux/io.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/pm_runtime.h>
+#include <linux/seq_file.h>
+
+#include "avpu_ip.h"
+#include "avpu_pm.h"
+
+static int avpu_autosuspend_ms = 1000;
+module_param(avpu_autosuspend_ms, int, S_IRUGO);
+MODULE_PARM_DESC(avpu_autosuspend_ms, "idle time before avpu is powered off");
+
+static const u32 avpu_ctx_regs[AVPU_PM_NR_CTX_REGS] = {
+	AXI_ADDR_OFFSET_IP,
+	AVPU_INTERRUPT_MASK,
+};
+
+static int avpu_pm_clk_on(struct avpu_codec_desc *codec)
+{
+	int ret;
+
+	ret = clk_prepare_enable(codec->ahb1_gate);
+	if (ret)
+		return ret;
+
+	ret = clk_prepare_enable(codec->clk_gate);
+	if (ret)
+		goto out_clk_gate;
+
+	ret = clk_prepare_enable(codec->clk);
+	if (ret)
+		goto out_clk;
+
+	return 0;
+
+out_clk:
+	clk_disable_unprepare(codec->clk_gate);
+out_clk_gate:
+	clk_disable_unprepare(codec->ahb1_gate);
+	return ret;
+}
+
+static void avpu_pm_clk_off(struct avpu_codec_desc *codec)
+{
+	clk_disable_unprepare(codec->clk);
+	clk_disable_unprepare(codec->clk_gate);
+	clk_disable_unprepare(codec->ahb1_gate);
+}
+
+void avpu_pm_save_ctx(struct avpu_codec_desc *codec)
+{
+	int i;
+
+	for (i = 0; i < AVPU_PM_NR_CTX_REGS; i++)
+		codec->pm.ctx[i] = avpu_readl(avpu_ctx_regs[i]);
+	codec->pm.ctx_valid = true;
+}
+
+void avpu_pm_restore_ctx(struct avpu_codec_desc *codec)
+{
+	int i;
+
+	if (!codec->pm.ctx_valid)
+		return;
+
+	for (i = 0; i < AVPU_PM_NR_CTX_REGS; i++)
+		avpu_writel(codec->pm.ctx[i], avpu_ctx_regs[i]);
+}
+
+static int __maybe_unused avpu_runtime_suspend(struct device *dev)
+{
+	struct avpu_codec_desc *codec = dev_get_drvdata(dev);
+	unsigned long flags;
+
+	avpu_pm_save_ctx(codec);
+
+	/* the irq line is shared: stop looking at our registers first */
+	spin_lock_irqsave(&codec->i_lock, flags);
+	codec->pm.powered = false;
+	spin_unlock_irqrestore(&codec->i_lock, flags);
+	if (codec->irq >= 0)
+		synchronize_irq(codec->irq);
+
+	avpu_pm_clk_off(codec);
+	codec->pm.suspends++;
+
+	return 0;
+}
+
+static int __maybe_unused avpu_runtime_resume(struct device *dev)
+{
+	struct avpu_codec_desc *codec = dev_get_drvdata(dev);
+	u64 start = ktime_to_ns(ktime_get());
+	unsigned long flags;
+	u64 latency;
+	int ret;
+
+	ret = avpu_pm_clk_on(codec);
+	if (ret) {
+		avpu_err("Failed to enable clocks: %d\n", ret);
+		return ret;
+	}
+
+	if (codec->pm.ctx_valid)
+		avpu_pm_restore_ctx(codec);
+	else
+		avpu_readl(AVPU_INTERRUPT_MASK);
+
+	latency = ktime_to_ns(ktime_get()) - start;
+	codec->pm.resume_last_ns = latency;
+	if (latency > codec->pm.resume_max_ns)
+		codec->pm.resume_max_ns = latency;
+	codec->pm.resumes++;
+
+	spin_lock_irqsave(&codec->i_lock, flags);
+	codec->pm.powered = true;
+	spin_unlock_irqrestore(&codec->i_lock, flags);
+
+	return 0;
+}
+
+static bool avpu_pm_idle(struct avpu_codec_desc *codec)
+{
+	unsigned long flags;
+	bool idle;
+
+	spin_lock_irqsave(&codec->i_lock, flags);
+	idle = !codec->chan || !codec->chan->stats.count;
+	spin_unlock_irqrestore(&codec->i_lock, flags);
+
+	return idle;
+}
+
+/*
+ * Userspace is frozen, no new job gets kicked. The one running is given
+ * as long as the watchdog would give it, then timed out.
+ */
+static int __maybe_unused avpu_suspend(struct device *dev)
+{
+	struct avpu_codec_desc *codec = dev_get_drvdata(dev);
+	unsigned long flags;
+	u64 ms;
+
+	spin_lock_irqsave(&codec->i_lock, flags);
+	ms = max_t(u64, codec->wdt.last_timeout_ms, AVPU_WDT_MIN_MS);
+	spin_unlock_irqrestore(&codec->i_lock, flags);
+
+	if (!wait_event_timeout(codec->pm.idle_wait, avpu_pm_idle(codec),
+				msecs_to_jiffies(ms))) {
+		avpu_info("Job still running after %llu ms, timing it out\n", ms);
+		avpu_wdt_abort(codec);
+	}
+
+	return pm_runtime_force_suspend(dev);
+}
+
+static int __maybe_unused avpu_resume(struct device *dev)
+{
+	return pm_runtime_force_resume(dev);
+}
+
+const struct dev_pm_ops avpu_pm_ops = {
+	SET_SYSTEM_SLEEP_PM_OPS(avpu_suspend, avpu_resume)
+	SET_RUNTIME_PM_OPS(avpu_runtime_suspend, avpu_runtime_resume, NULL)
+};
+
+int avpu_pm_init(struct avpu_codec_desc *codec)
+{
+	struct device *dev = codec->device;
+
+	init_waitqueue_head(&codec->pm.idle_wait);
+	pm_runtime_set_autosuspend_delay(dev, avpu_autosuspend_ms);
+	pm_runtime_use_autosuspend(dev);
+	pm_runtime_enable(dev);
+
+	/* without runtime PM the block stays powered while the module is loaded */
+	if (!pm_runtime_enabled(dev)) {
+		codec->pm.powered = avpu_pm_clk_on(codec) == 0;
+		if (!codec->pm.powered) {
+			pm_runtime_dont_use_autosuspend(dev);
+			pm_runtime_disable(dev);
+			return -EIO;
+		}
+	}
+
+	return 0;
+}
+
+void avpu_pm_exit(struct avpu_codec_desc *codec)
+{
+	struct device *dev = codec->device;
+
+	pm_runtime_dont_use_autosuspend(dev);
+	pm_runtime_disable(dev);
+
+	if (codec->pm.powered) {
+		codec->pm.powered = false;
+		if (codec->irq >= 0)
+			synchronize_irq(codec->irq);
+		avpu_pm_clk_off(codec);
+	}
+}
+
+int avpu_pm_get(struct avpu_codec_desc *codec)
+{
+	int ret = pm_runtime_get_sync(codec->device);
+
+	if (ret < 0) {
+		pm_runtime_put_noidle(codec->device);
+		return ret;
+	}
+
+	return 0;
+}
+
+void avpu_pm_put(struct avpu_codec_desc *codec)
+{
+	pm_runtime_mark_last_busy(codec->device);
+	pm_runtime_put_autosuspend(codec->device);
+}
+
+static int avpu_pm_show(struct seq_file *m, void *v)
+{
+	struct avpu_codec_desc *codec = m->private;
+
+	seq_printf(m, "powered:          %d\n", codec->pm.powered);
+	seq_printf(m, "autosuspend_ms:   %d\n", avpu_autosuspend_ms);
+	seq_printf(m, "suspends:         %llu\n", codec->pm.suspends);
+	seq_printf(m, "resumes:          %llu\n", codec->pm.resumes);
+	seq_printf(m, "resume_last_us:   %llu\n",
+		   div64_u64(codec->pm.resume_last_ns, NSEC_PER_USEC));
+	seq_printf(m, "resume_max_us:    %llu\n",
+		   div64_u64(codec->pm.resume_max_ns, NSEC_PER_USEC));
+
+	return 0;
+}
+
+static int avpu_pm_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, avpu_pm_show, inode->i_private);
+}
+
+static const struct file_operations avpu_pm_fops = {
+	.owner		= THIS_MODULE,
+	.open		= avpu_pm_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+void avpu_pm_debugfs_init(struct avpu_codec_desc *codec)
+{
+	if (!codec->debugfs)
+		return;
+
+	debugfs_create_file("pm", S_IRUGO, codec->debugfs, codec,
+			    &avpu_pm_fops);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <linux/pm.h>
+#include <linux/types.h>
+#include <linux/wait.h>
+
+/* registers userspace programs once per session, kept across power off */
+#define AVPU_PM_NR_CTX_REGS 2
+
+struct avpu_codec_desc;
+
+struct avpu_pm {
+	bool powered;           /* clocks on, registers accessible */
+	u32 ctx[AVPU_PM_NR_CTX_REGS];
+	bool ctx_valid;
+	wait_queue_head_t idle_wait;    /* woken when the last job in flight is done */
+
+	u64 suspends;
+	u64 resumes;
+	u64 resume_last_ns;     /* resume entry -> first register access */
+	u64 resume_max_ns;
+};
+
+extern const struct dev_pm_ops avpu_pm_ops;
+
+void avpu_pm_save_ctx(struct avpu_codec_desc *codec);
+void avpu_pm_restore_ctx(struct avpu_codec_desc *codec);
+int avpu_pm_init(struct avpu_codec_desc *codec);
+void avpu_pm_exit(struct avpu_codec_desc *codec);
+int avpu_pm_get(struct avpu_codec_desc *codec);
+void avpu_pm_put(struct avpu_codec_desc *codec);
+void avpu_pm_debugfs_init(struct avpu_codec_desc *codec);
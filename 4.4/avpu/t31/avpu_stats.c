@@ -0,0 +1,220 @@
+#include <linux/debugfs.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/seq_file.h>
+
+#include "avpu_ip.h"
+#include "avpu_stats.h"
+
+void avpu_stats_reset(struct avpu_stats *s, u64 now)
+{
+	memset(s, 0, sizeof(*s));
+	s->win_start_ns = now;
+}
+
+void avpu_stats_roll(struct avpu_stats *s, u64 now)
+{
+	u64 len = now - s->win_start_ns;
+
+	if (len < AVPU_STATS_WINDOW_NS)
+		return;
+
+	s->util_pct = min_t(u64, div64_u64(s->win_busy_ns * 100, len), 100);
+	s->win_start_ns = now;
+	s->win_busy_ns = 0;
+}
+
+void avpu_stats_submit(struct avpu_stats *s, int slot, u64 now)
+{
+	struct avpu_stats_slot *q = &s->slot[slot];
+
+	if (q->count == AVPU_STATS_MAX_INFLIGHT) {
+		s->lost_submits++;
+		return;
+	}
+
+	q->submit_ns[(q->head + q->count) % AVPU_STATS_MAX_INFLIGHT] = now;
+	q->count++;
+	s->count++;
+}
+
+u64 avpu_stats_complete(struct avpu_stats *s, int slot, u64 now)
+{
+	struct avpu_stats_slot *q = &s->slot[slot];
+	u64 submit, start, busy;
+
+	if (!q->count)
+		return 0;
+
+	submit = q->submit_ns[q->head];
+	q->head = (q->head + 1) % AVPU_STATS_MAX_INFLIGHT;
+	q->count--;
+	s->count--;
+
+	/* a queued job only starts once the previous one of its slot is done */
+	start = max(submit, q->last_done_ns);
+	if (start - submit > s->queue_wait_max_ns)
+		s->queue_wait_max_ns = start - submit;
+
+	busy = now - start;
+	s->busy_ns += busy;
+	s->win_busy_ns += busy;
+	q->last_done_ns = now;
+	q->frames++;
+	s->frames++;
+
+	avpu_stats_roll(s, now);
+
+	return busy;
+}
+
+/* slot holding the oldest job in flight, -1 when idle */
+int avpu_stats_oldest_slot(const struct avpu_stats *s)
+{
+	const struct avpu_stats_slot *q;
+	int i, oldest = -1;
+
+	for (i = 0; i < AVPU_STATS_SLOTS; i++) {
+		q = &s->slot[i];
+		if (!q->count)
+			continue;
+		if (oldest < 0 || q->submit_ns[q->head] <
+		    s->slot[oldest].submit_ns[s->slot[oldest].head])
+			oldest = i;
+	}
+
+	return oldest;
+}
+
+int avpu_stats_busy_slots(const struct avpu_stats *s)
+{
+	int i, busy = 0;
+
+	for (i = 0; i < AVPU_STATS_SLOTS; i++)
+		if (s->slot[i].count)
+			busy++;
+
+	return busy;
+}
+
+/* the jobs in flight were lost to a core reset */
+void avpu_stats_drop_inflight(struct avpu_stats *s)
+{
+	int i;
+
+	for (i = 0; i < AVPU_STATS_SLOTS; i++)
+		s->slot[i].count = 0;
+	s->count = 0;
+}
+
+void avpu_stats_wakeup(struct avpu_stats *s, u64 latency)
+{
+	s->wakeups++;
+	s->wakeup_ns += latency;
+	if (latency > s->wakeup_max_ns)
+		s->wakeup_max_ns = latency;
+}
+
+void avpu_stats_accumulate(struct avpu_stats *total,
+			   const struct avpu_stats *s)
+{
+	total->frames += s->frames;
+	total->busy_ns += s->busy_ns;
+	total->wakeup_ns += s->wakeup_ns;
+	total->wakeups += s->wakeups;
+	total->wakeup_max_ns = max(total->wakeup_max_ns, s->wakeup_max_ns);
+	total->queue_wait_max_ns = max(total->queue_wait_max_ns,
+				       s->queue_wait_max_ns);
+	total->lost_submits += s->lost_submits;
+	total->timeouts += s->timeouts;
+}
+
+static void avpu_stats_print(struct seq_file *m, const char *name,
+			     const struct avpu_stats *s)
+{
+	u64 wakeup_avg = s->wakeups ? div64_u64(s->wakeup_ns, s->wakeups) : 0;
+	u64 busy_avg = s->frames ? div64_u64(s->busy_ns, s->frames) : 0;
+
+	seq_printf(m, "[%s]\n", name);
+	seq_printf(m, "frames:            %llu\n", s->frames);
+	seq_printf(m, "busy_us:           %llu\n", div64_u64(s->busy_ns, NSEC_PER_USEC));
+	seq_printf(m, "busy_avg_us:       %llu\n", div64_u64(busy_avg, NSEC_PER_USEC));
+	seq_printf(m, "wakeup_avg_us:     %llu\n", div64_u64(wakeup_avg, NSEC_PER_USEC));
+	seq_printf(m, "wakeup_max_us:     %llu\n", div64_u64(s->wakeup_max_ns, NSEC_PER_USEC));
+	seq_printf(m, "queue_wait_max_us: %llu\n", div64_u64(s->queue_wait_max_ns, NSEC_PER_USEC));
+	seq_printf(m, "lost_submits:      %llu\n", s->lost_submits);
+	seq_printf(m, "timeouts:          %llu\n", s->timeouts);
+}
+
+static int avpu_stats_show(struct seq_file *m, void *v)
+{
+	struct avpu_codec_desc *codec = m->private;
+	struct avpu_stats chan, total;
+	u64 irq_other[AVPU_IRQ_NB];
+	unsigned long flags;
+	bool active;
+	int i;
+
+	spin_lock_irqsave(&codec->i_lock, flags);
+	active = codec->chan != NULL;
+	if (active) {
+		avpu_stats_roll(&codec->chan->stats, ktime_to_ns(ktime_get()));
+		chan = codec->chan->stats;
+	}
+	total = codec->stats_total;
+	memcpy(irq_other, codec->irq_other, sizeof(irq_other));
+	spin_unlock_irqrestore(&codec->i_lock, flags);
+
+	seq_printf(m, "channels_served:   %u\n", codec->nr_channels_served);
+	if (active) {
+		avpu_stats_print(m, "channel", &chan);
+		seq_printf(m, "inflight:          %u\n", chan.count);
+		for (i = 0; i < AVPU_STATS_SLOTS; i++)
+			seq_printf(m, "slot%d:             %llu frames, %u inflight\n",
+				   i, chan.slot[i].frames, chan.slot[i].count);
+		seq_printf(m, "utilisation:       %u%%\n", chan.util_pct);
+		for (i = 0; i < AVPU_IRQ_NB; i++)
+			if (irq_other[i])
+				seq_printf(m, "irq%d:              %llu, not an end of frame\n",
+					   i, irq_other[i]);
+		avpu_stats_accumulate(&total, &chan);
+	}
+	avpu_stats_print(m, "total", &total);
+
+	return 0;
+}
+
+static int avpu_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, avpu_stats_show, inode->i_private);
+}
+
+static const struct file_operations avpu_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= avpu_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+int avpu_stats_debugfs_init(struct avpu_codec_desc *codec)
+{
+	codec->debugfs = debugfs_create_dir(dev_name(codec->device), NULL);
+	if (IS_ERR_OR_NULL(codec->debugfs)) {
+		codec->debugfs = NULL;
+		return -ENODEV;
+	}
+
+	debugfs_create_file("stats", S_IRUGO, codec->debugfs, codec,
+			    &avpu_stats_fops);
+
+	return 0;
+}
+
+void avpu_stats_debugfs_exit(struct avpu_codec_desc *codec)
+{
+	debugfs_remove_recursive(codec->debugfs);
+	codec->debugfs = NULL;
+}
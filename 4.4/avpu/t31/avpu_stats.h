@@ -0,0 +1,55 @@
+#pragma once
+
+#include <linux/time.h>
+#include <linux/types.h>
+
+/* jobs userspace may kick before the first one completes */
+#define AVPU_STATS_MAX_INFLIGHT 8
+/* utilisation is computed over rolling windows of this length */
+#define AVPU_STATS_WINDOW_NS (1000ULL * NSEC_PER_MSEC)
+/* one per job kick register, AVPU_CMD_START_0/1 */
+#define AVPU_STATS_SLOTS 2
+
+struct avpu_codec_desc;
+
+struct avpu_stats_slot {
+	/* submit timestamps of jobs not yet completed */
+	u64 submit_ns[AVPU_STATS_MAX_INFLIGHT];
+	unsigned int head;
+	unsigned int count;
+	u64 last_done_ns;
+	u64 frames;
+};
+
+struct avpu_stats {
+	u64 frames;
+	u64 busy_ns;
+	u64 wakeup_ns;          /* sum of irq -> waiter latencies */
+	u64 wakeups;
+	u64 wakeup_max_ns;
+	u64 queue_wait_max_ns;  /* kick -> engine free, worst case */
+	u64 lost_submits;       /* kicks beyond AVPU_STATS_MAX_INFLIGHT */
+	u64 timeouts;           /* jobs abandoned by the watchdog */
+
+	/* rolling utilisation window */
+	u64 win_start_ns;
+	u64 win_busy_ns;
+	u32 util_pct;
+
+	struct avpu_stats_slot slot[AVPU_STATS_SLOTS];
+	unsigned int count;     /* jobs in flight, all slots */
+};
+
+void avpu_stats_reset(struct avpu_stats *s, u64 now);
+void avpu_stats_submit(struct avpu_stats *s, int slot, u64 now);
+u64 avpu_stats_complete(struct avpu_stats *s, int slot, u64 now);
+int avpu_stats_oldest_slot(const struct avpu_stats *s);
+int avpu_stats_busy_slots(const struct avpu_stats *s);
+void avpu_stats_drop_inflight(struct avpu_stats *s);
+void avpu_stats_wakeup(struct avpu_stats *s, u64 latency);
+void avpu_stats_roll(struct avpu_stats *s, u64 now);
+void avpu_stats_accumulate(struct avpu_stats *total,
+			   const struct avpu_stats *s);
+
+int avpu_stats_debugfs_init(struct avpu_codec_desc *codec);
+void avpu_stats_debugfs_exit(struct avpu_codec_desc *codec);
@@ -0,0 +1,196 @@
+#include <linux/clk.h>
+#include <linux/debugfs.h>
+#include <linux/delay.h>
+#include <linux/interrupt.h>
+#include <linux/io.h>
+#include <linux/jiffies.h>
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/seq_file.h>
+
+#include "avpu_ip.h"
+#include "avpu_wdt.h"
+
+static int avpu_wdt_mult = 10;
+module_param(avpu_wdt_mult, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(avpu_wdt_mult, "job timeout in average frame times, 0 disables the watchdog");
+
+/* called with codec->i_lock held */
+static unsigned long avpu_wdt_timeout(struct avpu_codec_desc *codec,
+				      struct avpu_codec_chan *chan)
+{
+	struct avpu_stats *s = &chan->stats;
+	u64 ms = AVPU_WDT_MIN_MS;
+
+	if (s->frames)
+		ms = max(ms, div64_u64(s->busy_ns * avpu_wdt_mult,
+				       s->frames * NSEC_PER_MSEC));
+	codec->wdt.last_timeout_ms = ms;
+
+	return jiffies + msecs_to_jiffies(ms);
+}
+
+/* called with codec->i_lock held after a job was kicked */
+void avpu_wdt_submit(struct avpu_codec_desc *codec)
+{
+	if (avpu_wdt_mult <= 0 || !codec->chan)
+		return;
+
+	if (!timer_pending(&codec->wdt.timer))
+		mod_timer(&codec->wdt.timer, avpu_wdt_timeout(codec, codec->chan));
+}
+
+/* called with codec->i_lock held after a job completed */
+void avpu_wdt_complete(struct avpu_codec_desc *codec)
+{
+	if (codec->chan && codec->chan->stats.count && avpu_wdt_mult > 0)
+		mod_timer(&codec->wdt.timer, avpu_wdt_timeout(codec, codec->chan));
+	else
+		del_timer(&codec->wdt.timer);
+	if (!codec->chan || !codec->chan->stats.count)
+		wake_up(&codec->pm.idle_wait);
+}
+
+/* fault injection: pretend the completion irq never arrived */
+bool avpu_wdt_drop_irq(struct avpu_codec_desc *codec)
+{
+	unsigned long flags;
+	bool drop;
+
+	spin_lock_irqsave(&codec->i_lock, flags);
+	drop = codec->wdt.inject_lost_irq > 0;
+	if (drop)
+		codec->wdt.inject_lost_irq--;
+	spin_unlock_irqrestore(&codec->i_lock, flags);
+
+	return drop;
+}
+
+static void avpu_wdt_expired(unsigned long data)
+{
+	struct avpu_codec_desc *codec = (struct avpu_codec_desc *)data;
+	struct avpu_codec_chan *chan;
+	struct list_head *pos, *n;
+	struct r_irq *tmp;
+	unsigned long flags;
+
+	spin_lock_irqsave(&codec->i_lock, flags);
+	chan = codec->chan;
+	if (!chan || !chan->stats.count) {
+		spin_unlock_irqrestore(&codec->i_lock, flags);
+		return;
+	}
+
+	/* the jobs in flight are lost, so are interrupts nobody waited for */
+	avpu_stats_drop_inflight(&chan->stats);
+	chan->stats.timeouts++;
+	chan->timed_out = 1;
+	codec->wdt.timeouts++;
+	list_for_each_safe(pos, n, &codec->irq_masks) {
+		tmp = list_entry(pos, struct r_irq, list);
+		list_del(pos);
+		kmem_cache_free(codec->cache, tmp);
+	}
+	schedule_work(&codec->wdt.reset_work);
+	wake_up_interruptible(&chan->irq_queue);
+	wake_up(&codec->pm.idle_wait);
+	spin_unlock_irqrestore(&codec->i_lock, flags);
+
+	avpu_err("Job timed out after %llu ms, resetting\n",
+		 codec->wdt.last_timeout_ms);
+}
+
+/*
+ * There is no soft reset control for the core, cycling its clock gates is
+ * the closest we have. Registers userspace programs once per session are
+ * restored afterwards.
+ */
+static void avpu_wdt_reset(struct work_struct *work)
+{
+	struct avpu_codec_desc *codec =
+		container_of(work, struct avpu_codec_desc, wdt.reset_work);
+	unsigned long flags;
+
+	avpu_pm_save_ctx(codec);
+	avpu_writel(0, AVPU_INTERRUPT_MASK);
+
+	spin_lock_irqsave(&codec->i_lock, flags);
+	codec->pm.powered = false;
+	spin_unlock_irqrestore(&codec->i_lock, flags);
+	if (codec->irq >= 0)
+		synchronize_irq(codec->irq);
+
+	clk_disable(codec->clk_gate);
+	clk_disable(codec->clk);
+	udelay(10);
+	clk_enable(codec->clk);
+	clk_enable(codec->clk_gate);
+
+	avpu_writel(avpu_readl(AVPU_INTERRUPT), AVPU_INTERRUPT);
+	avpu_pm_restore_ctx(codec);
+
+	spin_lock_irqsave(&codec->i_lock, flags);
+	codec->pm.powered = true;
+	codec->wdt.resets++;
+	spin_unlock_irqrestore(&codec->i_lock, flags);
+}
+
+/* called when a channel is released, before the block may power off */
+void avpu_wdt_sync(struct avpu_codec_desc *codec)
+{
+	del_timer_sync(&codec->wdt.timer);
+	flush_work(&codec->wdt.reset_work);
+}
+
+/* give up on the jobs in flight now, as the watchdog would, and reset */
+void avpu_wdt_abort(struct avpu_codec_desc *codec)
+{
+	del_timer_sync(&codec->wdt.timer);
+	avpu_wdt_expired((unsigned long)codec);
+	flush_work(&codec->wdt.reset_work);
+}
+
+void avpu_wdt_init(struct avpu_codec_desc *codec)
+{
+	setup_timer(&codec->wdt.timer, avpu_wdt_expired, (unsigned long)codec);
+	INIT_WORK(&codec->wdt.reset_work, avpu_wdt_reset);
+}
+
+static int avpu_wdt_show(struct seq_file *m, void *v)
+{
+	struct avpu_codec_desc *codec = m->private;
+
+	seq_printf(m, "mult:            %d\n", avpu_wdt_mult);
+	seq_printf(m, "last_timeout_ms: %llu\n", codec->wdt.last_timeout_ms);
+	seq_printf(m, "timeouts:        %llu\n", codec->wdt.timeouts);
+	seq_printf(m, "resets:          %llu\n", codec->wdt.resets);
+	seq_printf(m, "inject_lost_irq: %u\n", codec->wdt.inject_lost_irq);
+
+	return 0;
+}
+
+static int avpu_wdt_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, avpu_wdt_show, inode->i_private);
+}
+
+static const struct file_operations avpu_wdt_fops = {
+	.owner		= THIS_MODULE,
+	.open		= avpu_wdt_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+void avpu_wdt_debugfs_init(struct avpu_codec_desc *codec)
+{
+	if (!codec->debugfs)
+		return;
+
+	debugfs_create_file("watchdog", S_IRUGO, codec->debugfs, codec,
+			    &avpu_wdt_fops);
+	debugfs_create_u32("inject_lost_irq", S_IRUGO | S_IWUSR,
+			   codec->debugfs, &codec->wdt.inject_lost_irq);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <linux/timer.h>
+#include <linux/types.h>
+#include <linux/workqueue.h>
+
+/* timeout floor, used until the channel has a frame time history */
+#define AVPU_WDT_MIN_MS 100
+
+struct avpu_codec_desc;
+struct avpu_codec_chan;
+
+struct avpu_wdt {
+	struct timer_list timer;
+	struct work_struct reset_work;
+	u32 inject_lost_irq;    /* completion irqs to drop, set through debugfs */
+	u64 timeouts;
+	u64 resets;
+	u64 last_timeout_ms;
+};
+
+void avpu_wdt_init(struct avpu_codec_desc *codec);
+void avpu_wdt_submit(struct avpu_codec_desc *codec);
+void avpu_wdt_complete(struct avpu_codec_desc *codec);
+bool avpu_wdt_drop_irq(struct avpu_codec_desc *codec);
+void avpu_wdt_sync(struct avpu_codec_desc *codec);
+void avpu_wdt_abort(struct avpu_codec_desc *codec);
+void avpu_wdt_debugfs_init(struct avpu_codec_desc *codec);
@@ -1,6 +1,8 @@
 #include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/slab.h>
 #include <linux/dma-mapping.h>
+#include <linux/genalloc.h>
 
 #include "avpu_alloc.h"
 
@@ -10,6 +12,100 @@ MODULE_AUTHOR("Sebastien Alaiwan");
 MODULE_AUTHOR("Antoine Gruzelle");
 MODULE_DESCRIPTION("JZ Common");
 
+/*
+ * The encoder takes one bus address per buffer and there is no IOMMU, so
+ * every buffer must be physically contiguous. Large reference frame sets
+ * become hard to allocate once CMA is fragmented, so a pool can be
+ * reserved at probe time, while memory is still unfragmented, and frame
+ * sized buffers are carved from it before falling back to
+ * dma_alloc_coherent().
+ */
+static int avpu_pool_kb;
+module_param(avpu_pool_kb, int, S_IRUGO);
+MODULE_PARM_DESC(avpu_pool_kb, "contiguous memory reserved at probe for encoder buffers (KiB)");
+
+/* smaller buffers would only fragment the pool, they come from dma_alloc_coherent() */
+static int avpu_pool_min_kb = 256;
+module_param(avpu_pool_min_kb, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(avpu_pool_min_kb, "smallest buffer served from the pool (KiB), frame sized ones are");
+
+static struct gen_pool *avpu_pool;
+static void *avpu_pool_cpu;
+static dma_addr_t avpu_pool_dma;
+static size_t avpu_pool_size;
+
+int avpu_pool_init(struct device *dev)
+{
+	if (avpu_pool_kb <= 0)
+		return 0;
+
+	avpu_pool_size = PAGE_ALIGN((size_t)avpu_pool_kb * 1024);
+	avpu_pool_cpu = dma_alloc_coherent(dev, avpu_pool_size, &avpu_pool_dma,
+					   GFP_KERNEL | GFP_DMA);
+	if (!avpu_pool_cpu) {
+		dev_err(dev, "Can't reserve %zu bytes for the buffer pool\n",
+			avpu_pool_size);
+		return -ENOMEM;
+	}
+
+	avpu_pool = gen_pool_create(PAGE_SHIFT, -1);
+	if (!avpu_pool)
+		goto fail_pool;
+
+	gen_pool_set_algo(avpu_pool, gen_pool_best_fit, NULL);
+	if (gen_pool_add_virt(avpu_pool, (unsigned long)avpu_pool_cpu,
+			      avpu_pool_dma, avpu_pool_size, -1))
+		goto fail_add;
+
+	dev_info(dev, "reserved %zu bytes for the buffer pool\n",
+		 avpu_pool_size);
+
+	return 0;
+
+fail_add:
+	gen_pool_destroy(avpu_pool);
+	avpu_pool = NULL;
+fail_pool:
+	dma_free_coherent(dev, avpu_pool_size, avpu_pool_cpu, avpu_pool_dma);
+	avpu_pool_cpu = NULL;
+	return -ENOMEM;
+}
+
+void avpu_pool_deinit(struct device *dev)
+{
+	if (!avpu_pool)
+		return;
+
+	/* dma-bufs handed out from the pool may outlive the device */
+	if (gen_pool_avail(avpu_pool) != gen_pool_size(avpu_pool)) {
+		dev_warn(dev, "buffer pool still in use, leaking it\n");
+		return;
+	}
+
+	gen_pool_destroy(avpu_pool);
+	dma_free_coherent(dev, avpu_pool_size, avpu_pool_cpu, avpu_pool_dma);
+	avpu_pool = NULL;
+	avpu_pool_cpu = NULL;
+}
+
+static bool avpu_pool_alloc(struct avpu_dma_buffer *buf)
+{
+	unsigned long vaddr;
+
+	if (!avpu_pool || buf->size < (size_t)avpu_pool_min_kb * 1024)
+		return false;
+
+	vaddr = gen_pool_alloc(avpu_pool, PAGE_ALIGN(buf->size));
+	if (!vaddr)
+		return false;
+
+	buf->cpu_handle = (void *)vaddr;
+	buf->dma_handle = gen_pool_virt_to_phys(avpu_pool, vaddr);
+	buf->from_pool = true;
+
+	return true;
+}
+
 struct avpu_dma_buffer *avpu_alloc_dma(struct device *dev, size_t size)
 {
 	struct avpu_dma_buffer *buf =
@@ -20,6 +116,11 @@ struct avpu_dma_buffer *avpu_alloc_dma(struct device *dev, size_t size)
 		return NULL;
 
 	buf->size = size;
+	buf->from_pool = false;
+
+	if (avpu_pool_alloc(buf))
+		return buf;
+
 	buf->cpu_handle = dma_alloc_coherent(dev, buf->size,
 					     &buf->dma_handle,
 					     GFP_KERNEL | GFP_DMA);
@@ -34,10 +135,11 @@ struct avpu_dma_buffer *avpu_alloc_dma(struct device *dev, size_t size)
 
 void avpu_free_dma(struct device *dev, struct avpu_dma_buffer *buf)
 {
-	if (buf)
+	if (buf && buf->from_pool)
+		gen_pool_free(avpu_pool, (unsigned long)buf->cpu_handle,
+			      PAGE_ALIGN(buf->size));
+	else if (buf)
 		dma_free_coherent(dev, buf->size, buf->cpu_handle,
 				  buf->dma_handle);
 	kfree(buf);
 }
-
-
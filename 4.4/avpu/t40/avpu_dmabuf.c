@@ -440,11 +440,9 @@ static void avpu_dmabuf_release(struct dma_buf *buf)
 	}
 
 
-	dma_free_coherent(dinfo->dev, buffer->size, buffer->cpu_handle,
-			  buffer->dma_handle);
+	avpu_free_dma(dinfo->dev, buffer);
 
 	put_device(dinfo->dev);
-	kzfree(buffer);
 	kfree(dinfo);
 }
 
@@ -601,8 +599,11 @@ int avpu_dmabuf_get_address(struct device *dev, u32 fd, u32 *bus_address)
 {
 	struct dma_buf *dbuf;
 	struct dma_buf_attachment *attach;
+	struct scatterlist *sg;
 	struct sg_table *sgt;
+	dma_addr_t next;
 	int err = 0;
+	int i;
 
 	dbuf = dma_buf_get(fd);
 	if (IS_ERR(dbuf))
@@ -618,7 +619,22 @@ int avpu_dmabuf_get_address(struct device *dev, u32 fd, u32 *bus_address)
 		goto fail_map;
 	}
 
-	*bus_address = sg_dma_address(sgt->sgl);
+	/*
+	 * The encoder only takes a base address: an imported buffer made of
+	 * several chunks is usable only if they happen to be adjacent.
+	 */
+	next = sg_dma_address(sgt->sgl);
+	for_each_sg(sgt->sgl, sg, sgt->nents, i) {
+		if (sg_dma_address(sg) != next) {
+			dev_err(dev, "dma-buf %u is not contiguous\n", fd);
+			err = -EINVAL;
+			break;
+		}
+		next += sg_dma_len(sg);
+	}
+
+	if (!err)
+		*bus_address = sg_dma_address(sgt->sgl);
 
 	dma_buf_unmap_attachment(attach, sgt, DMA_BIDIRECTIONAL);
 fail_map:
@@ -581,19 +581,25 @@ int avpu_codec_probe(struct platform_device *pdev)
 
 	platform_set_drvdata(pdev, codec);
 
+	err = avpu_pool_init(codec->device);
+	if (err)
+		goto out_failed_request_irq;
+
 	if (of_property_read_string(codec->device->of_node, "t31,devicename",
 				    (const char **)&device_name) != 0)
 		device_name = NULL;
 
 	err = avpu_setup_codec_cdev(codec, current_minor, DEV_NAME);
 	if (err)
-		return err;
+		goto out_setup_cdev;
 
 	codec->minor = current_minor;
 	++current_minor;
 
 	return 0;
 
+out_setup_cdev:
+	avpu_pool_deinit(codec->device);
 out_get_vpu_clk_cgu:
 out_get_clk_gate:
 out_get_ahb1_clk_gate:
@@ -627,6 +633,7 @@ int avpu_codec_remove(struct platform_device *pdev)
 	device_destroy(module_class, dev);
 	clean_up_avpu_codec_cdev(codec);
 	deinit_codec_desc(codec);
+	avpu_pool_deinit(codec->device);
 
 	return 0;
 }
@@ -0,0 +1,121 @@
+/*
+ * AVPU buffer fragmentation stress test.
+ *
+ * Replays the buffer churn of encoder sessions restarting at random
+ * resolutions: every round frees a random half of the buffers still held,
+ * allocates bitstream and small side buffers of random sizes, then asks
+ * for a full reference frame set of the largest resolution. The run
+ * reports how many of those large sets could not be allocated.
+ *
+ * Run it once with avpu_pool_kb=0 and once with a pool large enough for
+ * the frame set to compare the two; the t41 driver takes the same ioctl.
+ *
+ *   ./avpu_frag_test [dev] [rounds] [frame_kb] [frames]
+ *   ./avpu_frag_test /dev/avpu 2000 12288 4
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/types.h>
+
+#include "../avpu_ioctl.h"
+
+#define MAX_HELD	256
+#define SIDE_MIN_KB	4
+#define SIDE_MAX_KB	1024
+
+static int held[MAX_HELD];
+static int nheld;
+
+static int alloc_buf(int dev, unsigned int size)
+{
+	struct avpu_dma_info info;
+
+	memset(&info, 0, sizeof(info));
+	info.size = size;
+	if (ioctl(dev, GET_DMA_FD, &info) < 0)
+		return -errno;
+
+	return info.fd;
+}
+
+static void drop_random_half(void)
+{
+	int i;
+
+	for (i = 0; i < nheld; ) {
+		if (rand() & 1) {
+			close(held[i]);
+			held[i] = held[--nheld];
+		} else {
+			i++;
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = argc > 1 ? argv[1] : "/dev/avpu";
+	int rounds = argc > 2 ? atoi(argv[2]) : 2000;
+	unsigned int frame_kb = argc > 3 ? atoi(argv[3]) : 12288;
+	int frames = argc > 4 ? atoi(argv[4]) : 4;
+	int set[16];
+	int dev, r, i, fd, got;
+	int set_fail = 0, side_fail = 0;
+
+	if (frames < 1 || frames > 16 || !frame_kb || rounds < 1) {
+		printf("Please input: ./avpu_frag_test [dev] [rounds] [frame_kb] [frames<=16]\n");
+		return 1;
+	}
+
+	dev = open(path, O_RDWR);
+	if (dev < 0) {
+		printf("open %s failed: %s\n", path, strerror(errno));
+		return 1;
+	}
+	srand(1);
+
+	for (r = 0; r < rounds; r++) {
+		drop_random_half();
+
+		/* bitstream, motion vector and slice buffers of a new session */
+		while (nheld < MAX_HELD / 2) {
+			unsigned int kb = SIDE_MIN_KB + rand() % (SIDE_MAX_KB - SIDE_MIN_KB);
+
+			fd = alloc_buf(dev, kb * 1024);
+			if (fd < 0) {
+				side_fail++;
+				break;
+			}
+			held[nheld++] = fd;
+		}
+
+		/* the reference frame set is what fails on a fragmented system */
+		for (got = 0; got < frames; got++) {
+			set[got] = alloc_buf(dev, frame_kb * 1024);
+			if (set[got] < 0)
+				break;
+		}
+		if (got < frames) {
+			set_fail++;
+			printf("round %d: frame %d of %d (%u KiB) failed: %s\n",
+			       r, got, frames, frame_kb, strerror(-set[got]));
+		}
+		for (i = 0; i < got; i++)
+			close(set[i]);
+	}
+
+	while (nheld)
+		close(held[--nheld]);
+	close(dev);
+
+	printf("%d rounds, frame set %d x %u KiB: %d failed, %d side buffers failed\n",
+	       rounds, frames, frame_kb, set_fail, side_fail);
+
+	return set_fail ? 1 : 0;
+}
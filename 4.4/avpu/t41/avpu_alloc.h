@@ -7,9 +7,12 @@ struct avpu_dma_buffer {
 	u32 size;
 	dma_addr_t dma_handle;
 	void *cpu_handle;
+	bool from_pool;
 };
 
 struct avpu_dma_buffer *avpu_alloc_dma(struct device *dev, size_t size);
 void avpu_free_dma(struct device *dev, struct avpu_dma_buffer *buf);
+int avpu_pool_init(struct device *dev);
+void avpu_pool_deinit(struct device *dev);
 
 #endif /* _AL_ALLOC_H_ */
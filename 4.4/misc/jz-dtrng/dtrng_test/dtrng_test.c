@@ -0,0 +1,197 @@
+/*
+ * Host test of the dtrng health tests, jz-dtrng-health.h.
+ *
+ * The cutoffs are checked at their edges with crafted words, the runs
+ * crossing word boundaries: 5 identical bytes pass the repetition count
+ * test and 6 fail it, 61 copies of a window's first byte pass the adaptive
+ * proportion test and 62 fail it, and a new window starts the count over.
+ * Then whole streams: a good generator must not trip either test over a
+ * few million words, a source with about 2 bits per byte must be caught by
+ * the proportion test and a stuck one by the repetition count.
+ *
+ *   make run
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../jz-dtrng-health.h"
+
+static int failures;
+
+#define CHECK(cond, ...) do {						\
+	if(!(cond)){							\
+		if(failures++ < 20){					\
+			printf("FAIL %s:%d: ", __func__, __LINE__);	\
+			printf(__VA_ARGS__);				\
+			printf("\n");					\
+		}							\
+	}								\
+} while(0)
+
+/* xorshift64*, a stand-in for a healthy source */
+static unsigned long long xs = 88172645463325252ULL;
+
+static unsigned int good_word(void)
+{
+	xs ^= xs >> 12;
+	xs ^= xs << 25;
+	xs ^= xs >> 27;
+	return (xs * 2685821657736338717ULL) >> 32;
+}
+
+static unsigned char good_byte(void)
+{
+	return good_word() & 0xff;
+}
+
+/* feed bytes as little endian words, the order the driver tests them in */
+static int feed(struct dtrng_health *h, const unsigned char *b, unsigned int len)
+{
+	unsigned int i, word;
+	int ok = 1;
+
+	for (i = 0; i + 4 <= len; i += 4) {
+		word = b[i] | b[i + 1] << 8 | b[i + 2] << 16 | (unsigned int)b[i + 3] << 24;
+		if (!dtrng_health_word(h, word))
+			ok = 0;
+	}
+	return ok;
+}
+
+/* no byte equal to its neighbours nor to c, so only the planted ones count */
+static void fill_distinct(unsigned char *b, unsigned int len, unsigned char c)
+{
+	unsigned int i;
+
+	for (i = 0; i < len; i++) {
+		do
+			b[i] = good_byte();
+		while (b[i] == c || (i && b[i] == b[i - 1]));
+	}
+}
+
+static void test_rct(void)
+{
+	struct dtrng_health h;
+	unsigned char b[64];
+	unsigned int start, run;
+
+	for (start = 1; start < 8; start++) {
+		for (run = 2; run <= DTRNG_RCT_CUTOFF + 1; run++) {
+			memset(&h, 0, sizeof(h));
+			fill_distinct(b, sizeof(b), 0x5a);
+			memset(b + start, 0x5a, run);
+			CHECK(feed(&h, b, sizeof(b)) == (run < DTRNG_RCT_CUTOFF),
+					"run of %u from byte %u: %s", run, start,
+					run < DTRNG_RCT_CUTOFF ? "failed" : "passed");
+			CHECK(h.rct_fail == (run >= DTRNG_RCT_CUTOFF), "run of %u counted %lu", run, h.rct_fail);
+			CHECK(!h.apt_fail, "run of %u failed the proportion test", run);
+		}
+	}
+}
+
+static void test_apt(void)
+{
+	struct dtrng_health h;
+	unsigned char b[DTRNG_APT_WINDOW * 2];
+	unsigned int copies, i, pos = 0;
+
+	for (copies = DTRNG_APT_CUTOFF - 2; copies <= DTRNG_APT_CUTOFF; copies++) {
+		memset(&h, 0, sizeof(h));
+		fill_distinct(b, sizeof(b), 0xa5);
+		/* the window's first byte and copies - 1 more, spread out */
+		for (i = 0; i < copies; i++) {
+			pos = i * (DTRNG_APT_WINDOW / DTRNG_APT_CUTOFF);
+			b[pos] = 0xa5;
+		}
+		CHECK(feed(&h, b, DTRNG_APT_WINDOW) == (copies < DTRNG_APT_CUTOFF),
+				"%u copies in a window: %s", copies,
+				copies < DTRNG_APT_CUTOFF ? "failed" : "passed");
+		CHECK(h.apt_fail == (copies >= DTRNG_APT_CUTOFF), "%u copies counted %lu", copies, h.apt_fail);
+		CHECK(!h.rct_fail, "%u copies failed the repetition count", copies);
+	}
+
+	/* cutoff - 1 copies at the end of a window and as many at the start of the next */
+	memset(&h, 0, sizeof(h));
+	fill_distinct(b, sizeof(b), 0xa5);
+	b[0] = 0xa5;
+	for (i = 1; i < DTRNG_APT_CUTOFF - 1; i++)
+		b[DTRNG_APT_WINDOW - 2 * i] = 0xa5;
+	b[DTRNG_APT_WINDOW] = 0xa5;
+	for (i = 1; i < DTRNG_APT_CUTOFF - 1; i++)
+		b[DTRNG_APT_WINDOW + 2 * i] = 0xa5;
+	CHECK(feed(&h, b, sizeof(b)) && !h.apt_fail, "the count went on into the next window");
+
+	/* a reset starts a new window */
+	memset(&h, 0, sizeof(h));
+	fill_distinct(b, sizeof(b), 0xa5);
+	for (i = 0; i < DTRNG_APT_CUTOFF - 1; i++)
+		b[2 * i] = 0xa5;
+	feed(&h, b, 128);
+	dtrng_health_reset(&h);
+	b[128] = 0x11;
+	b[129] = 0xa5;
+	CHECK(feed(&h, b + 128, DTRNG_APT_WINDOW - 128) && !h.apt_fail, "the window went on over a reset");
+}
+
+static void test_good(unsigned int words)
+{
+	struct dtrng_health h;
+	unsigned int i;
+
+	memset(&h, 0, sizeof(h));
+	for (i = 0; i < words; i++)
+		dtrng_health_word(&h, good_word());
+	CHECK(!h.rct_fail && !h.apt_fail, "good source: %lu repetition, %lu proportion failures in %u words",
+			h.rct_fail, h.apt_fail, words);
+	printf("good source:   %u words, %lu + %lu failures\n", words, h.rct_fail, h.apt_fail);
+}
+
+/* a byte is one of 4 values, 2 bits of entropy */
+static void test_biased(unsigned int words)
+{
+	static const unsigned char v[4] = { 0x00, 0x3c, 0xc3, 0xff };
+	struct dtrng_health h;
+	unsigned int i, j, word, first = 0;
+
+	memset(&h, 0, sizeof(h));
+	for (i = 0; i < words; i++) {
+		for (word = 0, j = 0; j < 4; j++)
+			word |= (unsigned int)v[good_word() & 3] << (8 * j);
+		if (!dtrng_health_word(&h, word) && !first)
+			first = i + 1;
+	}
+	CHECK(first && first <= DTRNG_APT_WINDOW / 4, "biased source caught after %u words", first);
+	/* 128 copies expected in a window, the cutoff is hit halfway through every one */
+	CHECK(h.apt_fail >= words / (DTRNG_APT_WINDOW / 4), "biased source: only %lu proportion failures in %u words", h.apt_fail, words);
+	printf("biased source: %u words, %lu + %lu failures, first after %u\n", words, h.rct_fail, h.apt_fail, first);
+}
+
+static void test_stuck(void)
+{
+	struct dtrng_health h;
+	unsigned int i, first = 0;
+
+	memset(&h, 0, sizeof(h));
+	for (i = 0; i < 16 && !first; i++)
+		if (!dtrng_health_word(&h, 0x12121212))
+			first = i + 1;
+	CHECK(first == 2 && h.rct_fail == 1 && !h.apt_fail, "stuck source caught after %u words", first);
+}
+
+int main(int argc, const char *argv[])
+{
+	unsigned int words = argc > 1 ? atoi(argv[1]) : 4000000;
+
+	test_rct();
+	test_apt();
+	test_good(words);
+	test_biased(words / 16);
+	test_stuck();
+	if (failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	printf("all passed\n");
+	return 0;
+}
@@ -0,0 +1,72 @@
+#ifndef __JZ_DTRNG_HEALTH_H__
+#define __JZ_DTRNG_HEALTH_H__
+
+/*
+ * The continuous health tests of SP 800-90B 4.4, run on the bytes of every
+ * word, assuming 4 bits of min-entropy per byte and a false positive rate
+ * of 2^-20: the repetition count test fails on 6 identical bytes in a row,
+ * the adaptive proportion test when the first byte of a 512 bytes window
+ * shows up 62 times in it. Kept free of kernel headers so dtrng_test/
+ * builds it on the host.
+ */
+#define DTRNG_RCT_CUTOFF		6
+#define DTRNG_APT_WINDOW		512
+#define DTRNG_APT_CUTOFF		62
+
+/* the 4 bits per byte the cutoffs assume, in the hwrng quality unit of 1/1024 */
+#define DTRNG_QUALITY			512
+
+struct dtrng_health {
+	unsigned char rct_last;
+	unsigned int rct_count;
+	unsigned char apt_ref;
+	unsigned int apt_count;
+	unsigned int apt_seen;
+	unsigned long rct_fail;
+	unsigned long apt_fail;
+};
+
+/* back to the start of both tests, the failure counts are kept */
+static inline void dtrng_health_reset(struct dtrng_health *h)
+{
+	h->rct_count = 0;
+	h->apt_count = 0;
+	h->apt_seen = 0;
+}
+
+/* 0 and the failure counted when a byte of the word fails a test */
+static inline int dtrng_health_word(struct dtrng_health *h, unsigned int word)
+{
+	unsigned char b = 0;
+	int i = 0;
+
+	for (i = 0; i < 4; i++, word >>= 8) {
+		b = word & 0xff;
+
+		if (h->rct_count && b == h->rct_last) {
+			if (++h->rct_count >= DTRNG_RCT_CUTOFF) {
+				h->rct_fail++;
+				h->rct_count = 0;
+				return 0;
+			}
+		} else {
+			h->rct_last = b;
+			h->rct_count = 1;
+		}
+
+		if (!h->apt_seen) {
+			h->apt_ref = b;
+			h->apt_count = 1;
+		} else if (b == h->apt_ref && ++h->apt_count >= DTRNG_APT_CUTOFF) {
+			h->apt_fail++;
+			h->apt_seen = 0;
+			return 0;
+		}
+		if (++h->apt_seen == DTRNG_APT_WINDOW)
+			h->apt_seen = 0;
+	}
+
+	return 1;
+}
+
+#endif
@@ -10,6 +10,7 @@
  *
  */
 
+#include <linux/capability.h>
 #include <linux/err.h>
 #include <linux/module.h>
 #include <linux/init.h>
@@ -24,6 +25,14 @@
 #include <crypto/scatterwalk.h>
 #include <linux/proc_fs.h>
 #include <linux/miscdevice.h>
+#include <linux/hw_random.h>
+#include <linux/kfifo.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
 #include <soc/base.h>
 #ifdef CONFIG_SOC_T40
 #include <dt-bindings/interrupt-controller/t40-irq.h>
@@ -39,115 +48,179 @@
 #define dtrng_debug(format, ...) do{ } while(0)
 #endif
 
-static int dtrng_release(struct inode *inode, struct file *file)
+static int ring_kb = 4;
+module_param(ring_kb, int, S_IRUGO);
+MODULE_PARM_DESC(ring_kb, "random bytes kept ready, rounded up to a power of two (KiB)");
+
+/*
+ * The dtrng raises an interrupt for every 32 bits word. While it runs, the
+ * handler queues the words in a ring and it is stopped once the ring is
+ * full; a reader that takes the ring below half of it starts it again. All
+ * the consumers, read(), the ioctls and the hwrng core, are served from
+ * the ring, concurrently.
+ *
+ * Every word goes through the continuous health tests, jz-dtrng-health.h.
+ * A failure means the source can no longer be trusted: the generator is
+ * stopped, what the ring held is thrown away and every consumer gets -EIO
+ * until IOCTL_DTRNG_RESET or "2" written to /proc/dtrng/jz_dtrng rearms it.
+ */
+
+/* called with the lock held */
+static void dtrng_start(dtrng_operation_t *dtrng)
 {
-	struct miscdevice *dev = file->private_data;
-	dtrng_operation_t *dtrng = miscdev_to_dtrngops(dev);
-	dtrng->state = 0;
-	return 0;
+	unsigned int reg = 0;
+
+	if (dtrng->running || dtrng->failed)
+		return;
+
+	reg = dtrng_reg_read(dtrng, DTRNG_CFG);
+	reg &= ~(1 << 11);
+	reg |= 8 << 1 | 1 << 0;//div_num = 8, not mask irq, enable dtrng
+	dtrng_reg_write(dtrng, DTRNG_CFG, reg);
+	dtrng->running = true;
+	dtrng->run_start_ns = ktime_get_ns();
 }
 
-static ssize_t dtrng_read(struct file *file, char __user * buffer, size_t count, loff_t * ppos)
+/* called with the lock held */
+static void dtrng_stop(dtrng_operation_t *dtrng)
 {
-	return 0;
+	if (!dtrng->running)
+		return;
+
+	dtrng_bit_set(dtrng, DTRNG_CFG, 11);//mask the interrupt
+	dtrng_bit_clr(dtrng, DTRNG_CFG, 0);//disable dtrng
+	dtrng->running = false;
+	dtrng->run_ns += ktime_get_ns() - dtrng->run_start_ns;
 }
 
-static ssize_t dtrng_write(struct file *file, const char __user * buffer, size_t count, loff_t * ppos)
+/* called with the lock held */
+static void dtrng_fail(dtrng_operation_t *dtrng)
 {
-	return 0;
+	dtrng_stop(dtrng);
+	dtrng->failed = true;
+	kfifo_reset(&dtrng->fifo);
 }
 
-static int dtrng_open(struct inode *inode, struct file *file)
+/* clear a health test failure and start over, the failure counts are kept */
+static void dtrng_rearm(dtrng_operation_t *dtrng)
 {
-	struct miscdevice *dev = file->private_data;
-	dtrng_operation_t *dtrng = miscdev_to_dtrngops(dev);
-	if(dtrng->state){
-		printk("dtrng driver is busy,can't open again!\n");
-		return -EBUSY;
+	unsigned long flags;
+
+	spin_lock_irqsave(&dtrng->lock, flags);
+	if (dtrng->failed) {
+		dtrng->failed = false;
+		dtrng_health_reset(&dtrng->health);
+		dtrng_start(dtrng);
 	}
-	dtrng->state = 1;
-	printk("%s:dtrng open successsful!\n",__func__);
-	return 0;
+	spin_unlock_irqrestore(&dtrng->lock, flags);
+}
 
+/*
+ * Up to len bytes from the ring, waiting for the first ones unless
+ * nonblock; -EAGAIN when there are none and nonblock is set, -EIO while a
+ * health test failure is latched.
+ */
+static int dtrng_get_random(dtrng_operation_t *dtrng, void *buf, unsigned int len, bool nonblock)
+{
+	unsigned long flags;
+	unsigned int n = 0;
+	int ret = 0;
+
+	while (1) {
+		spin_lock_irqsave(&dtrng->lock, flags);
+		if (dtrng->failed) {
+			spin_unlock_irqrestore(&dtrng->lock, flags);
+			return -EIO;
+		}
+		n = kfifo_out(&dtrng->fifo, buf, len);
+		dtrng->read_bytes += n;
+		if (kfifo_len(&dtrng->fifo) < kfifo_size(&dtrng->fifo) / 2)
+			dtrng_start(dtrng);
+		spin_unlock_irqrestore(&dtrng->lock, flags);
+
+		if (n || nonblock)
+			return n ? n : -EAGAIN;
+
+		ret = wait_event_interruptible(dtrng->wait, !kfifo_is_empty(&dtrng->fifo) || dtrng->failed);
+		if (ret)
+			return ret;
+	}
 }
 
-unsigned int cnt = 0;
-unsigned int cnt_t = 0;
-unsigned int random_r = 0;
-int dtrng_cpu_get_random(dtrng_operation_t *dtrng)
+static int dtrng_release(struct inode *inode, struct file *file)
 {
-	static int i=0;
-	unsigned int reg = 0;
+	return 0;
+}
 
-	if(i==0){
-		reg = dtrng_reg_read(dtrng, DTRNG_CFG);
-		reg |= 8 << 1 | 1 << 11 | 1 << 0 | (dtrng->random[0]<<16);//div_num = 8, mask irq, enable dtrng
-		dtrng_reg_write(dtrng, DTRNG_CFG, reg);
+static ssize_t dtrng_read(struct file *file, char __user * buffer, size_t count, loff_t * ppos)
+{
+	struct miscdevice *dev = file->private_data;
+	dtrng_operation_t *dtrng = miscdev_to_dtrngops(dev);
+	unsigned char chunk[64];
+	size_t done = 0;
+	int n = 0;
+
+	while (done < count) {
+		/* block for the first bytes only */
+		n = dtrng_get_random(dtrng, chunk, min(count - done, sizeof(chunk)),
+				done || (file->f_flags & O_NONBLOCK));
+		if (n < 0)
+			break;
+		if (copy_to_user(buffer + done, chunk, n)) {
+			n = -EFAULT;
+			break;
+		}
+		done += n;
+		if (need_resched())
+			cond_resched();
 	}
+	memzero_explicit(chunk, sizeof(chunk));
 
-	while(!(dtrng_reg_read(dtrng, DTRNG_STAT) & 0x1));
+	if (done)
+		return done;
+	return n == -EAGAIN && !(file->f_flags & O_NONBLOCK) ? 0 : n;
+}
 
-	dtrng->random[0] = dtrng_reg_read(dtrng, DTRNG_RANDOMNUM);
+static ssize_t dtrng_write(struct file *file, const char __user * buffer, size_t count, loff_t * ppos)
+{
 	return 0;
 }
 
-int dtrng_irqmode_random(dtrng_operation_t *dtrng)
+static int dtrng_open(struct inode *inode, struct file *file)
 {
-	unsigned int reg = 0;
-	dtrng_bit_clr(dtrng, 0x0, 11);   // no mask
-	reg = dtrng_reg_read(dtrng, DTRNG_CFG);
-	reg |= 8 << 1 | 1 << 0 | (dtrng->random[0]<<16);//div_num = 0, not mask irq, enable dtrng
-	dtrng_reg_write(dtrng, DTRNG_CFG, reg);
 	return 0;
 }
 
+/* one word, the seed the caller passes is not used any more */
 static long dtrng_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct miscdevice *dev = file->private_data;
-    dtrng_operation_t *dtrng = miscdev_to_dtrngops(dev);
+	dtrng_operation_t *dtrng = miscdev_to_dtrngops(dev);
 	void __user *argp  = (void __user *)arg;
+	unsigned int random = 0;
+	unsigned int got = 0;
 	int ret = 0;
 
 	switch(cmd) {
 		case IOCTL_DTRNG_CPU_GET_RANDOM:
-
-			if (copy_from_user(dtrng->random, argp , sizeof(unsigned int)))
-			{
-				printk("copy_from_user is error  : %s,%d\n",__func__,__LINE__);
-				return -EFAULT;
-			}
-			dtrng_debug("data from user is %u\n",dtrng->random[0]);
-			ret = dtrng_cpu_get_random(dtrng);
-			if (ret) {
-				printk("dtrng decrypt error!\n");
-				return -1;
-			}
-			dtrng_debug("data to user is %u\n",dtrng->random[0]);
-			if (copy_to_user(argp, &dtrng->random, sizeof(unsigned int))) {
-				printk("dtrng get copy_to_user error!!!\n");
-				return -EFAULT;
-			}
-			break;
 		case IOCTL_DTRNG_DMA_GET_RANDOM:
-			if (copy_from_user(dtrng->random, argp , sizeof(unsigned int)))
-			{
-				printk("copy_from_user is error  : %s,%d\n",__func__,__LINE__);
-				return -EFAULT;
-			}
-			dtrng_debug("data from user is %u\n",dtrng->random[0]);
-
-			ret = dtrng_irqmode_random(dtrng);
-			if (ret) {
-				printk("dtrng decrypt error!\n");
-				return -1;
+			while (got < sizeof(random)) {
+				ret = dtrng_get_random(dtrng, (unsigned char *)&random + got, sizeof(random) - got, false);
+				if (ret < 0)
+					return ret;
+				got += ret;
 			}
-			wait_for_completion(&dtrng->dtrng_complete);
-
-			dtrng_debug("data to  user is %u\n",dtrng->random[0]);
-			if (copy_to_user(argp, dtrng->random, sizeof(unsigned int))) {
+			dtrng_debug("data to user is %u\n", random);
+			if (copy_to_user(argp, &random, sizeof(unsigned int))) {
 				printk("dtrng get copy_to_user error!!!\n");
 				return -EFAULT;
 			}
+			break;
+		case IOCTL_DTRNG_RESET:
+			if (!capable(CAP_SYS_ADMIN))
+				return -EPERM;
+			dtrng_rearm(dtrng);
+			break;
 		case IOCTL_DTRNG_GET_CNT:
 			/*
 			 *if (copy_to_user(argp, (void *)(&cnt), sizeof(unsigned int))) {
@@ -165,15 +238,34 @@ static long dtrng_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 static irqreturn_t dtrng_ope_irq_handler(int irq, void *data)
 {
 	dtrng_operation_t *dtrng = data;
-	dtrng->random[0] = dtrng_reg_read(dtrng, 0x4);
-	printk("%s   random:	0x%08x\n", __func__,dtrng->random[0]);
-
-	dtrng_bit_set(dtrng, 0x0, 12);//clear interrupt
-	dtrng_bit_clr(dtrng, 0x0, 0);//disable dtrng
-	dtrng_bit_set(dtrng, 0x0, 11);//mask the interrupt
-	dtrng_bit_clr(dtrng, 0x0, 12);//normal work
-	complete(&dtrng->dtrng_complete);
-	return 0;
+	unsigned int random = 0;
+
+	spin_lock(&dtrng->lock);
+	/* the line is shared and stopping masks ours */
+	if (!dtrng->running) {
+		spin_unlock(&dtrng->lock);
+		return IRQ_NONE;
+	}
+	random = dtrng_reg_read(dtrng, DTRNG_RANDOMNUM);
+	dtrng_bit_set(dtrng, DTRNG_CFG, 12);//clear interrupt
+	dtrng_bit_clr(dtrng, DTRNG_CFG, 12);//normal work
+
+	dtrng->gen_bytes += sizeof(random);
+	if (!dtrng_health_word(&dtrng->health, random)) {
+		dtrng_fail(dtrng);
+		dev_err(dtrng->dev, "health test failed (rct %lu, apt %lu), stopped until reset\n",
+				dtrng->health.rct_fail, dtrng->health.apt_fail);
+		spin_unlock(&dtrng->lock);
+		wake_up_interruptible(&dtrng->wait);
+		return IRQ_HANDLED;
+	}
+	kfifo_in(&dtrng->fifo, &random, sizeof(random));
+	if (kfifo_avail(&dtrng->fifo) < sizeof(random))
+		dtrng_stop(dtrng);
+	spin_unlock(&dtrng->lock);
+
+	wake_up_interruptible(&dtrng->wait);
+	return IRQ_HANDLED;
 }
 
 const struct file_operations dtrng_fops = {
@@ -185,6 +277,17 @@ const struct file_operations dtrng_fops = {
 	.release = dtrng_release,
 };
 
+#if IS_ENABLED(CONFIG_HW_RANDOM)
+static int dtrng_hwrng_read(struct hwrng *rng, void *data, size_t max, bool wait)
+{
+	dtrng_operation_t *dtrng = (dtrng_operation_t *)rng->priv;
+	int n = 0;
+
+	n = dtrng_get_random(dtrng, data, max, !wait);
+	return n == -EAGAIN ? 0 : n;
+}
+#endif
+
 dtrng_operation_t *dtrng_g = NULL;
 static ssize_t dtrng_proc_read(struct file *filp, char __user * buff, size_t len, loff_t * offset)
 {
@@ -212,6 +315,10 @@ static ssize_t dtrng_proc_write(struct file *filp, const char __user * buff, siz
 	int control[4] = {0};
 	unsigned char *p = NULL;
 	char *after = NULL;
+	unsigned int random = 0;
+	u64 start = 0, ns = 0;
+	int got = 0, n = 0;
+
 	memset(dtrng_g->sbuff, 0, SBUFF_SIZE);
 	len = len < SBUFF_SIZE ? len : SBUFF_SIZE;
 	if (copy_from_user(dtrng_g->sbuff, buff, len)) {
@@ -232,27 +339,24 @@ static ssize_t dtrng_proc_write(struct file *filp, const char __user * buff, siz
 		printk("control[%d] = 0x%08x\n", i, control[i]);
 	}
 #if 1
-	//echo 0/1 10000 > /proc/dtrng/jz_dtrng
-	if (control[0] == 0) {
-		dtrng_debug("Start IRQ Mode.\n");
+	//echo 2 > /proc/dtrng/jz_dtrng, rearm after a health test failure
+	if (control[0] == 2)
+		dtrng_rearm(dtrng_g);
+	//echo 0/1 10000 > /proc/dtrng/jz_dtrng, both modes read the ring now, 1 prints the words
+	if (control[0] == 0 || control[0] == 1) {
+		start = ktime_get_ns();
 		for (i = 0; i < control[1]; i++) {
-			dtrng_g->random[0] = control[2];
-			dtrng_irqmode_random(dtrng_g);
-			wait_for_completion(&dtrng_g->dtrng_complete);
-			//printk("%s   random:	0x%08x\n", __func__,dtrng_g->random[0]);
-		}
-	}
-
-	if (control[0] == 1) {
-		dtrng_debug("Start CPU Mode.\n");
-		for (i = 0; i < control[1]; i++) {
-			dtrng_g->random[0] = control[2];
-			dtrng_cpu_get_random(dtrng_g);
-			printk("random:	0x%08x\n", dtrng_g->random[0]);
+			for (got = 0; got < sizeof(random); got += n) {
+				n = dtrng_get_random(dtrng_g, (unsigned char *)&random + got, sizeof(random) - got, false);
+				if (n < 0)
+					return n;
+			}
+			if (control[0] == 1)
+				printk("random:	0x%08x\n", random);
 		}
-		dtrng_bit_set(dtrng_g, 0x0, 12);//clear interrupt
-		dtrng_bit_clr(dtrng_g, 0x0, 12);//dtrng normal work
-		dtrng_bit_clr(dtrng_g, 0x0, 0);//diable dirng
+		ns = ktime_get_ns() - start;
+		printk("%d words in %llu us, %llu bytes/s\n", control[1], div_u64(ns, NSEC_PER_USEC),
+				ns ? div64_u64((u64)control[1] * sizeof(random) * NSEC_PER_SEC, ns) : 0);
 	}
 #endif
 #endif
@@ -265,8 +369,54 @@ const struct file_operations dtrng_devices_fileops = {
 	.write		= dtrng_proc_write,
 };
 
+static int dtrng_stat_show(struct seq_file *m, void *v)
+{
+	dtrng_operation_t *dtrng = m->private;
+	unsigned long flags;
+	u64 run_ns = 0, gen = 0, rd = 0;
+	unsigned long rct = 0, apt = 0;
+	unsigned int ready = 0;
+	bool running = false, failed = false;
+
+	spin_lock_irqsave(&dtrng->lock, flags);
+	run_ns = dtrng->run_ns + (dtrng->running ? ktime_get_ns() - dtrng->run_start_ns : 0);
+	gen = dtrng->gen_bytes;
+	rd = dtrng->read_bytes;
+	rct = dtrng->health.rct_fail;
+	apt = dtrng->health.apt_fail;
+	ready = kfifo_len(&dtrng->fifo);
+	running = dtrng->running;
+	failed = dtrng->failed;
+	spin_unlock_irqrestore(&dtrng->lock, flags);
+
+	seq_printf(m, "running:        %d\n", running);
+	seq_printf(m, "failed:         %d\n", failed);
+	seq_printf(m, "ready_bytes:    %u/%u\n", ready, kfifo_size(&dtrng->fifo));
+	seq_printf(m, "gen_bytes:      %llu\n", gen);
+	seq_printf(m, "read_bytes:     %llu\n", rd);
+	seq_printf(m, "bytes_per_s:    %llu\n", run_ns ? div64_u64(gen * NSEC_PER_SEC, run_ns) : 0);
+	seq_printf(m, "rct_failures:   %lu\n", rct);
+	seq_printf(m, "apt_failures:   %lu\n", apt);
+
+	return 0;
+}
+
+static int dtrng_stat_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dtrng_stat_show, PDE_DATA(inode));
+}
+
+const struct file_operations dtrng_stat_fileops = {
+	.owner		= THIS_MODULE,
+	.open		= dtrng_stat_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 static struct proc_dir_entry *proc_dtrng_dir = NULL;
 static struct proc_dir_entry *entry = NULL;
+static struct proc_dir_entry *stat_entry = NULL;
 
 static int jz_dtrng_probe(struct platform_device *pdev)
 {
@@ -277,6 +427,14 @@ static int jz_dtrng_probe(struct platform_device *pdev)
 		return -ENOMEM;
 	}
 	dtrng_g = dtrng_ope;
+	spin_lock_init(&dtrng_ope->lock);
+	init_waitqueue_head(&dtrng_ope->wait);
+	ret = kfifo_alloc(&dtrng_ope->fifo, roundup_pow_of_two(max(ring_kb, 1) * 1024), GFP_KERNEL);
+	if (ret) {
+		dev_err(&pdev->dev, "alloc dtrng ring failed!\n");
+		kfree(dtrng_ope);
+		return ret;
+	}
 	sprintf(dtrng_ope->name, "jz-dtrng");
 	printk("%s %d\n",__func__,__LINE__);
 	dtrng_ope->res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
@@ -366,10 +524,36 @@ static int jz_dtrng_probe(struct platform_device *pdev)
 		ret = -EINVAL;
 		goto failed_create_dtrng;
 	}
+	stat_entry = proc_create_data("stat", 0, proc_dtrng_dir, &dtrng_stat_fileops, dtrng_ope);
+#endif
+
+	/* fill the ring up front */
+	spin_lock_irq(&dtrng_ope->lock);
+	dtrng_start(dtrng_ope);
+	spin_unlock_irq(&dtrng_ope->lock);
+
+#if IS_ENABLED(CONFIG_HW_RANDOM)
+	dtrng_ope->rng.name = dtrng_ope->name;
+	dtrng_ope->rng.read = dtrng_hwrng_read;
+	dtrng_ope->rng.priv = (unsigned long)dtrng_ope;
+	/* what the health tests assume, it lets the core feed the input pool */
+	dtrng_ope->rng.quality = DTRNG_QUALITY;
+	ret = hwrng_register(&dtrng_ope->rng);
+	if (ret) {
+		dev_err(&pdev->dev, "hwrng register failed!\n");
+		goto failed_hwrng;
+	}
 #endif
-	init_completion(&dtrng_ope->dtrng_complete);
 	dtrng_debug("%s: probe() done\n", __func__);
 	return 0;
+#if IS_ENABLED(CONFIG_HW_RANDOM)
+failed_hwrng:
+	spin_lock_irq(&dtrng_ope->lock);
+	dtrng_stop(dtrng_ope);
+	spin_unlock_irq(&dtrng_ope->lock);
+	proc_remove(stat_entry);
+	proc_remove(entry);
+#endif
 failed_create_dtrng:
 	proc_remove(proc_dtrng_dir);
 failed_mkdir_dtrng:
@@ -390,6 +574,7 @@ failed_iomap:
 	release_mem_region(dtrng_ope->res->start, dtrng_ope->res->end - dtrng_ope->res->start + 1);
 failed_req_region:
 failed_get_mem:
+	kfifo_free(&dtrng_ope->fifo);
 	kfree(dtrng_ope);
 	return ret;
 }
@@ -397,8 +582,15 @@ failed_get_mem:
 static int jz_dtrng_remove(struct platform_device *pdev)
 {
 	struct dtrng_operation *dtrng_ope = platform_get_drvdata(pdev);
-	proc_remove(proc_dtrng_dir);
+#if IS_ENABLED(CONFIG_HW_RANDOM)
+	hwrng_unregister(&dtrng_ope->rng);
+#endif
+	spin_lock_irq(&dtrng_ope->lock);
+	dtrng_stop(dtrng_ope);
+	spin_unlock_irq(&dtrng_ope->lock);
+	proc_remove(stat_entry);
 	proc_remove(entry);
+	proc_remove(proc_dtrng_dir);
 #ifdef CONFIG_SOC_T40
 	clk_disable_unprepare(dtrng_ope->clk);
 	devm_clk_put(&pdev->dev, dtrng_ope->clk);
@@ -410,6 +602,7 @@ static int jz_dtrng_remove(struct platform_device *pdev)
 	free_irq(dtrng_ope->irq, dtrng_ope);
 	iounmap(dtrng_ope->iomem);
 	kfree(dtrng_ope->sbuff);
+	kfifo_free(&dtrng_ope->fifo);
 	kfree(dtrng_ope);
 	return 0;
 }
@@ -1,10 +1,13 @@
 #ifndef __JZ_DTRNG_H__
 #define __JZ_DTRNG_H__
 
+#include "jz-dtrng-health.h"
+
 #define JZDTRNG_IOC_MAGIC  'D'
 #define IOCTL_DTRNG_DMA_GET_RANDOM					_IO(JZDTRNG_IOC_MAGIC, 110)
 #define IOCTL_DTRNG_CPU_GET_RANDOM					_IO(JZDTRNG_IOC_MAGIC, 111)
 #define IOCTL_DTRNG_GET_CNT							_IO(JZDTRNG_IOC_MAGIC, 112)
+#define IOCTL_DTRNG_RESET							_IO(JZDTRNG_IOC_MAGIC, 113)//rearm after a health test failure
 
 #define DTRNG_CFG				0x00//dtrng control register
 #define DTRNG_RANDOMNUM			0x04//dtrng random num register
@@ -13,15 +16,27 @@
 typedef struct dtrng_operation {
 	struct miscdevice dtrng_dev;
 	struct resource *res;
-	int state;
 	void __iomem *iomem;
 	struct clk *clk;
 	struct device *dev;
 	int irq;
 	char name[16];
 	unsigned char *sbuff;
-	unsigned int random[1];
-	struct completion dtrng_complete;
+	struct hwrng rng;
+
+	/* the ring of random bytes and the generator, under lock */
+	spinlock_t lock;
+	struct kfifo fifo;
+	wait_queue_head_t wait;
+	bool running;
+	u64 run_start_ns;
+	u64 run_ns;
+	u64 gen_bytes;
+	u64 read_bytes;
+
+	/* continuous health tests, a failure stops everything until a reset */
+	struct dtrng_health health;
+	bool failed;
 }dtrng_operation_t;
 
 #define miscdev_to_dtrngops(mdev) (container_of(mdev, struct dtrng_operation, dtrng_dev))
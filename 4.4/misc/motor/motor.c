@@ -25,8 +25,10 @@
 #include <linux/sched.h>
 #include <linux/delay.h>
 #include <linux/module.h>
+#include <linux/math64.h>
 #include <linux/debugfs.h>
 #include <linux/kthread.h>
+#include <linux/poll.h>
 #include <linux/mfd/core.h>
 #include <linux/mempolicy.h>
 #include <linux/interrupt.h>
@@ -51,9 +53,26 @@
 #include <asm/cacheflush.h>
 #include <soc/gpio.h>
 #include "motor.h"
+#include "motor_ramp.h"
 
 #define JZ_MOTOR_DRIVER_VERSION "H20171206a"
 
+/* output level registers of a gpio port */
+#ifndef GPIO_IOBASE
+#define GPIO_IOBASE			0x10010000
+#endif
+#define MOTOR_GPIO_PORT_OFF	0x1000
+#define MOTOR_GPIO_PXPAT0S	0x44
+#define MOTOR_GPIO_PXPAT0C	0x48
+
+static int gpio_fast = 1;
+module_param(gpio_fast, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(gpio_fast, "step the phase pins through the gpio port registers");
+
+static int isr_timing = 0;
+module_param(isr_timing, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(isr_timing, "account the time spent in the step interrupt, see motor_info");
+
 
 extern int jzgpio_ctrl_pull(enum gpio_port port, int enable_pull,unsigned long pins);
 
@@ -97,6 +116,7 @@ static void motor_set_default(struct motor_device *mdev)
 			gpio_direction_output(motor->pdata->motor_st3_gpio, 0);
 		if (motor->pdata->motor_st4_gpio)
 			gpio_direction_output(motor->pdata->motor_st4_gpio, 0);
+		motor->phase_last = 0;
 	}
 	return;
 }
@@ -112,6 +132,77 @@ static unsigned char step_8[8] = {
 	0x09
 };
 
+static inline bool motor_gpio_valid(unsigned int gpio)
+{
+	return gpio && gpio != -1;
+}
+
+/* called at probe, after the phase pins are requested */
+static void motor_phase_resolve(struct motor_device *mdev, struct motor_driver *motor)
+{
+	unsigned int pins[4] = {
+		motor->pdata->motor_st1_gpio,
+		motor->pdata->motor_st2_gpio,
+		motor->pdata->motor_st3_gpio,
+		motor->pdata->motor_st4_gpio,
+	};
+	int port = -1;
+	int i = 0, v = 0;
+
+	motor->phase_iomem = NULL;
+	for(i = 0; i < 4; i++){
+		if(!motor_gpio_valid(pins[i]))
+			continue;
+		if(port < 0){
+			port = pins[i] / 32;
+		}else if(port != pins[i] / 32){
+			dev_info(mdev->dev, "%s phase pins span ports, stepping through gpiolib\n", motor->pdata->name);
+			return;
+		}
+	}
+	if(port < 0)
+		return;
+
+	for(v = 0; v < 16; v++){
+		motor->phase_port[v] = 0;
+		for(i = 0; i < 4; i++){
+			if(motor_gpio_valid(pins[i]) && (v & (0x8 >> i)))
+				motor->phase_port[v] |= BIT(pins[i] % 32);
+		}
+	}
+	motor->phase_iomem = ioremap(GPIO_IOBASE + port * MOTOR_GPIO_PORT_OFF, MOTOR_GPIO_PORT_OFF);
+	motor->phase_last = 0;
+}
+
+/*
+ * The half step patterns change one pin at a time, so only the set or the
+ * clear register is written, and nothing at all while the motor rests.
+ */
+static void motor_phase_out(struct motor_driver *motor, unsigned char phase)
+{
+	unsigned int val = motor->phase_port[phase];
+	unsigned int set = 0, clr = 0;
+
+	if(motor->phase_iomem && gpio_fast){
+		set = val & ~motor->phase_last;
+		clr = motor->phase_last & ~val;
+		if(set)
+			writel(set, motor->phase_iomem + MOTOR_GPIO_PXPAT0S);
+		if(clr)
+			writel(clr, motor->phase_iomem + MOTOR_GPIO_PXPAT0C);
+	}else{
+		if (motor->pdata->motor_st1_gpio)
+			gpio_direction_output(motor->pdata->motor_st1_gpio, phase & 0x8);
+		if (motor->pdata->motor_st2_gpio)
+			gpio_direction_output(motor->pdata->motor_st2_gpio, phase & 0x4);
+		if (motor->pdata->motor_st3_gpio)
+			gpio_direction_output(motor->pdata->motor_st3_gpio, phase & 0x2);
+		if (motor->pdata->motor_st4_gpio)
+			gpio_direction_output(motor->pdata->motor_st4_gpio, phase & 0x1);
+	}
+	motor->phase_last = val;
+}
+
 static void motor_move_step(struct motor_device *mdev)
 {
 	struct motor_driver *motor = NULL;
@@ -123,23 +214,9 @@ static void motor_move_step(struct motor_device *mdev)
 		if(motor->state != MOTOR_OPS_STOP){
 			step = motor->cur_steps % 8;
 			step = step < 0 ? step + 8 : step;
-			if (motor->pdata->motor_st1_gpio)
-				gpio_direction_output(motor->pdata->motor_st1_gpio, step_8[step] & 0x8);
-			if (motor->pdata->motor_st2_gpio)
-				gpio_direction_output(motor->pdata->motor_st2_gpio, step_8[step] & 0x4);
-			if (motor->pdata->motor_st3_gpio)
-				gpio_direction_output(motor->pdata->motor_st3_gpio, step_8[step] & 0x2);
-			if (motor->pdata->motor_st4_gpio)
-				gpio_direction_output(motor->pdata->motor_st4_gpio, step_8[step] & 0x1);
+			motor_phase_out(motor, step_8[step]);
 		}else{
-			if (motor->pdata->motor_st1_gpio)
-				gpio_direction_output(motor->pdata->motor_st1_gpio, 0);
-			if (motor->pdata->motor_st2_gpio)
-				gpio_direction_output(motor->pdata->motor_st2_gpio, 0);
-			if (motor->pdata->motor_st3_gpio)
-				gpio_direction_output(motor->pdata->motor_st3_gpio, 0);
-			if (motor->pdata->motor_st4_gpio)
-				gpio_direction_output(motor->pdata->motor_st4_gpio, 0);
+			motor_phase_out(motor, 0);
 		}
 		if(motor->state == MOTOR_OPS_RESET){
 			motor->total_steps++;
@@ -149,19 +226,44 @@ static void motor_move_step(struct motor_device *mdev)
 	return;
 }
 
-static irqreturn_t jz_timer_interrupt(int irq, void *dev_id)
+static void motor_set_period(struct motor_device *mdev, unsigned int period)
+{
+	if(period == mdev->tcu_period)
+		return;
+	mdev->tcu_period = period;
+	ingenic_tcu_set_period(mdev->tcu->cib.id, period);
+}
+
+/* called with slock held or from the step interrupt */
+static void motor_start_segment(struct motor_device *mdev, struct motor_segment *seg)
 {
-	struct motor_device *mdev = dev_id;
-	struct motor_move *dst = &mdev->dst_move;
-	struct motor_move *cur = &mdev->cur_move;
 	struct motor_driver *motors = mdev->motors;
-	int flag = 0;
+
+	mdev->plan = seg->plan;
+	mdev->seg_end[HORIZONTAL_MOTOR] = seg->end[HORIZONTAL_MOTOR];
+	mdev->seg_end[VERTICAL_MOTOR] = seg->end[VERTICAL_MOTOR];
+	mdev->dev_state = MOTOR_OPS_NORMAL;
+	motors[HORIZONTAL_MOTOR].state = MOTOR_OPS_NORMAL;
+	motors[HORIZONTAL_MOTOR].move_dir = seg->dir[HORIZONTAL_MOTOR];
+	motors[VERTICAL_MOTOR].state = MOTOR_OPS_NORMAL;
+	motors[VERTICAL_MOTOR].move_dir = seg->dir[VERTICAL_MOTOR];
+	motor_set_period(mdev, mdev->plan.curve != MOTOR_CURVE_NONE ?
+			motor_ramp_period(&mdev->plan) : mdev->plan.cruise_period);
+	mdev->seg_started++;
+}
+
+static void jz_timer_step(struct motor_device *mdev)
+{
+	struct motor_plan *plan = &mdev->plan;
+	struct motor_driver *motors = mdev->motors;
+	struct motor_driver *major = NULL;
+	struct motor_driver *minor = NULL;
 
 	if(motors[HORIZONTAL_MOTOR].state == MOTOR_OPS_STOP
 			&& motors[VERTICAL_MOTOR].state == MOTOR_OPS_STOP){
 		mdev->dev_state = MOTOR_OPS_STOP;
 		motor_move_step(mdev);
-		return IRQ_HANDLED;
+		return;
 	}
 
 	if(mdev->dev_state == MOTOR_OPS_CRUISE){
@@ -169,38 +271,80 @@ static irqreturn_t jz_timer_interrupt(int irq, void *dev_id)
 		motors[VERTICAL_MOTOR].cur_steps += motors[VERTICAL_MOTOR].move_dir;
 		motor_move_step(mdev);
 	}else{
-		while(cur->times < dst->times){
-			if(cur->one.x < dst->one.x && motors[HORIZONTAL_MOTOR].state != MOTOR_OPS_STOP){
-				motors[HORIZONTAL_MOTOR].cur_steps += motors[HORIZONTAL_MOTOR].move_dir;
-				cur->one.x++;
-				flag = 1;
-			}
-			if(cur->one.y < dst->one.y && motors[VERTICAL_MOTOR].state != MOTOR_OPS_STOP){
-				motors[VERTICAL_MOTOR].cur_steps += motors[VERTICAL_MOTOR].move_dir;
-				cur->one.y++;
-				flag = 1;
+		if(plan->done < plan->steps){
+			major = &motors[plan->major];
+			minor = &motors[plan->major == HORIZONTAL_MOTOR ? VERTICAL_MOTOR : HORIZONTAL_MOTOR];
+			if(major->state != MOTOR_OPS_STOP)
+				major->cur_steps += major->move_dir;
+			plan->err += plan->minor_steps;
+			if(plan->err >= plan->steps){
+				plan->err -= plan->steps;
+				if(minor->state != MOTOR_OPS_STOP)
+					minor->cur_steps += minor->move_dir;
 			}
+			plan->done++;
+			motor_move_step(mdev);
+		}
 
-			if(flag){
-				flag = 0;
-				motor_move_step(mdev);
-				break;
+		if(plan->done >= plan->steps){
+			if(mdev->dev_state == MOTOR_OPS_NORMAL){
+				mdev->seg_done++;
+				wake_up_interruptible(&mdev->traj_wait);
+			}
+			/* the next waypoint starts on this tick, without stopping */
+			if(mdev->dev_state == MOTOR_OPS_NORMAL && mdev->q_head != mdev->q_tail){
+				motor_start_segment(mdev, &mdev->queue[mdev->q_head]);
+				mdev->q_head = (mdev->q_head + 1) % MOTOR_QUEUE_LEN;
 			}else{
-				cur->one.x = 0;
-				cur->one.y = 0;
-				cur->times++;
+				motors[HORIZONTAL_MOTOR].state = MOTOR_OPS_STOP;
+				motors[VERTICAL_MOTOR].state = MOTOR_OPS_STOP;
+				motor_set_period(mdev, MOTOR_TCU_RATE / mdev->tcu_speed);
 			}
-		}
+		}else if(plan->curve != MOTOR_CURVE_NONE)
+			motor_set_period(mdev, motor_ramp_period(plan));
+	}
+}
 
-		if(mdev->cur_move.times == mdev->dst_move.times &&
-				mdev->cur_move.one.x == 0 && mdev->cur_move.one.y == 0){
-			motors[HORIZONTAL_MOTOR].state = MOTOR_OPS_STOP;
-			motors[VERTICAL_MOTOR].state = MOTOR_OPS_STOP;
-		}
+static irqreturn_t jz_timer_interrupt(int irq, void *dev_id)
+{
+	struct motor_device *mdev = dev_id;
+	u64 start = 0;
+	u64 ns = 0;
+
+	if(!isr_timing){
+		jz_timer_step(mdev);
+		return IRQ_HANDLED;
 	}
+
+	start = ktime_get_ns();
+	jz_timer_step(mdev);
+	ns = ktime_get_ns() - start;
+	mdev->isr_cnt++;
+	mdev->isr_sum_ns += ns;
+	if(ns > mdev->isr_max_ns)
+		mdev->isr_max_ns = ns;
 	return IRQ_HANDLED;
 }
 
+/*
+ * A limit switch stopped an axis of the running segment. The waypoints
+ * queued after it were planned from where it would have ended, so the path
+ * ends with it, with the axis at pos.
+ */
+static void motor_limit_stop(struct motor_driver *motor, int pos)
+{
+	struct motor_device *mdev = motor->mdev;
+	unsigned long flags;
+
+	spin_lock_irqsave(&mdev->slock, flags);
+	motor->state = MOTOR_OPS_STOP;
+	mdev->q_head = mdev->q_tail;
+	mdev->seg_end[motor - mdev->motors] = pos;
+	mdev->q_x = mdev->seg_end[HORIZONTAL_MOTOR];
+	mdev->q_y = mdev->seg_end[VERTICAL_MOTOR];
+	spin_unlock_irqrestore(&mdev->slock, flags);
+}
+
 static void gpio_keys_min_timer(unsigned long _data)
 {
 	struct motor_driver *motor = (struct motor_driver *)_data;
@@ -222,7 +366,7 @@ static void gpio_keys_min_timer(unsigned long _data)
 			motor->move_dir = MOTOR_MOVE_RIGHT_UP;
 		}else if(motor->state == MOTOR_OPS_NORMAL){
 			if(motor->move_dir == MOTOR_MOVE_LEFT_DOWN){
-				motor->state = MOTOR_OPS_STOP;
+				motor_limit_stop(motor, 0);
 			}
 		}else
 			motor->move_dir = MOTOR_MOVE_RIGHT_UP;
@@ -265,7 +409,7 @@ static void gpio_keys_max_timer(unsigned long _data)
 			motor->move_dir = MOTOR_MOVE_LEFT_DOWN;
 		}else if(motor->state == MOTOR_OPS_NORMAL){
 			if(motor->move_dir == MOTOR_MOVE_RIGHT_UP){
-				motor->state = MOTOR_OPS_STOP;
+				motor_limit_stop(motor, motor->max_steps);
 			}
 		}else
 			motor->move_dir = MOTOR_MOVE_LEFT_DOWN;
@@ -285,26 +429,15 @@ static irqreturn_t motor_max_gpio_interrupt(int irq, void *dev_id)
 }
 
 
-static inline int calc_max_divisor(int a, int b)
-{
-	int r = 0;
-	while(b !=0 ){
-		r = a % b;
-		a = b;
-		b = r;
-	}
-	return a;
-}
-
 static long motor_ops_move(struct motor_device *mdev, int x, int y)
 {
 	struct motor_driver *motors = mdev->motors;
 	unsigned long flags;
 	int x_dir = MOTOR_MOVE_STOP;
 	int y_dir = MOTOR_MOVE_STOP;
+	struct motor_segment seg;
 	int x1 = 0;
 	int y1 = 0;
-	int times = 1;
 	int value = 0;
 
 	/* check x value */
@@ -333,31 +466,24 @@ static long motor_ops_move(struct motor_device *mdev, int x, int y)
 	x1 = x < 0 ? 0 - x : x;
 	y1 = y < 0 ? 0 - y : y;
 
-	if((x1 + y1) == 0){
+	if((x1 + y1) == 0)
 		return 0;
-	}else if(x1 == 0){
-		times = 1;
-	}else if(y1 == 0){
-		times = 1;
-	}else
-		times = calc_max_divisor(x1, y1);
 
 	mutex_lock(&mdev->dev_mutex);
+	motor_ramp_plan(&seg.plan, &mdev->profile, mdev->tcu_speed, x1, y1, 0);
+	seg.dir[HORIZONTAL_MOTOR] = x_dir;
+	seg.dir[VERTICAL_MOTOR] = y_dir;
 	spin_lock_irqsave(&mdev->slock, flags);
-	mdev->dev_state = MOTOR_OPS_NORMAL;
-	mdev->dst_move.one.x = x1 / times;
-	mdev->dst_move.one.y = y1 / times;
-	mdev->dst_move.times = times;
-	mdev->cur_move.one.x = 0;
-	mdev->cur_move.one.y = 0;
-	mdev->cur_move.times = 0;
-	motors[HORIZONTAL_MOTOR].state = MOTOR_OPS_NORMAL;
-	motors[HORIZONTAL_MOTOR].move_dir = x_dir;
-	motors[VERTICAL_MOTOR].state = MOTOR_OPS_NORMAL;
-	motors[VERTICAL_MOTOR].move_dir = y_dir;
+	/* a move replaces whatever was queued */
+	mdev->q_head = mdev->q_tail;
+	mdev->q_x = motors[HORIZONTAL_MOTOR].cur_steps + x;
+	mdev->q_y = motors[VERTICAL_MOTOR].cur_steps + y;
+	seg.end[HORIZONTAL_MOTOR] = mdev->q_x;
+	seg.end[VERTICAL_MOTOR] = mdev->q_y;
+	motor_start_segment(mdev, &seg);
 	spin_unlock_irqrestore(&mdev->slock, flags);
 	mutex_unlock(&mdev->dev_mutex);
-	//printk("%s%d x=%d y=%d t=%d\n",__func__,__LINE__,mdev->dst_move.one.x,mdev->dst_move.one.y,mdev->dst_move.times);
+	//printk("%s%d x=%d y=%d ramp=%d\n",__func__,__LINE__,x1,y1,mdev->plan.ramp_steps);
 	//printk("x_dir=%d,y_dir=%d\n",x_dir,y_dir);
 	ingenic_tcu_counter_begin(mdev->tcu);
 
@@ -372,6 +498,7 @@ static void motor_ops_stop(struct motor_device *mdev)
 	mutex_lock(&mdev->dev_mutex);
 	spin_lock_irqsave(&mdev->slock, flags);
 	mdev->dev_state = MOTOR_OPS_STOP;
+	mdev->q_head = mdev->q_tail;
 	motors[HORIZONTAL_MOTOR].state = MOTOR_OPS_STOP;
 	motors[VERTICAL_MOTOR].state = MOTOR_OPS_STOP;
 	spin_unlock_irqrestore(&mdev->slock, flags);
@@ -380,6 +507,156 @@ static void motor_ops_stop(struct motor_device *mdev)
 	return;
 }
 
+/*
+ * Each waypoint is planned here, relative to the end of the path queued so
+ * far, so that the step interrupt only has to copy the next segment in.
+ */
+static long motor_ops_queue(struct motor_device *mdev, struct motor_waypoints *wps)
+{
+	struct motor_driver *motors = mdev->motors;
+	struct motor_segment *segs = NULL;
+	struct motor_waypoint *wp = NULL;
+	unsigned long flags;
+	unsigned int space = 0;
+	unsigned int i = 0, n = 0;
+	bool replace = wps->flags & MOTOR_WAYPOINT_REPLACE;
+	bool idle = false;
+	bool start = false;
+	int x = 0, y = 0, dx = 0, dy = 0;
+	int max_x = 0, max_y = 0;
+	long ret = 0;
+
+	if((wps->flags & ~MOTOR_WAYPOINT_REPLACE) || wps->num == 0 || wps->num > MOTOR_WAYPOINT_BATCH)
+		return -EINVAL;
+	for(i = 0; i < wps->num; i++){
+		if(wps->points[i].speed && (wps->points[i].speed < MOTOR_RAMP_MIN_SPEED
+					|| wps->points[i].speed > MOTOR_RAMP_MAX_SPEED))
+			return -EINVAL;
+	}
+
+	segs = kmalloc(sizeof(*segs) * wps->num, GFP_KERNEL);
+	if(!segs)
+		return -ENOMEM;
+
+	mutex_lock(&mdev->dev_mutex);
+	spin_lock_irqsave(&mdev->slock, flags);
+	idle = mdev->dev_state != MOTOR_OPS_NORMAL;
+	max_x = motors[HORIZONTAL_MOTOR].max_steps;
+	max_y = motors[VERTICAL_MOTOR].max_steps;
+	if(replace || idle){
+		x = motors[HORIZONTAL_MOTOR].cur_steps;
+		y = motors[VERTICAL_MOTOR].cur_steps;
+		space = MOTOR_QUEUE_LEN - 1;
+	}else{
+		x = mdev->q_x;
+		y = mdev->q_y;
+		space = (mdev->q_head + MOTOR_QUEUE_LEN - mdev->q_tail - 1) % MOTOR_QUEUE_LEN;
+	}
+	spin_unlock_irqrestore(&mdev->slock, flags);
+	for(i = 0; i < wps->num; i++){
+		wp = &wps->points[i];
+		if(wp->x < 0 || wp->x > max_x || wp->y < 0 || wp->y > max_y){
+			ret = -EINVAL;
+			goto unlock;
+		}
+	}
+	if(space < wps->num){
+		ret = -ENOSPC;
+		goto unlock;
+	}
+
+	for(i = 0; i < wps->num; i++){
+		wp = &wps->points[i];
+		dx = wp->x - x;
+		dy = wp->y - y;
+		if(!dx && !dy)
+			continue;
+		motor_ramp_plan(&segs[n].plan, &mdev->profile, mdev->tcu_speed, abs(dx), abs(dy), wp->speed);
+		segs[n].dir[HORIZONTAL_MOTOR] = dx > 0 ? MOTOR_MOVE_RIGHT_UP : (dx < 0 ? MOTOR_MOVE_LEFT_DOWN : MOTOR_MOVE_STOP);
+		segs[n].dir[VERTICAL_MOTOR] = dy > 0 ? MOTOR_MOVE_RIGHT_UP : (dy < 0 ? MOTOR_MOVE_LEFT_DOWN : MOTOR_MOVE_STOP);
+		segs[n].end[HORIZONTAL_MOTOR] = wp->x;
+		segs[n].end[VERTICAL_MOTOR] = wp->y;
+		n++;
+		x = wp->x;
+		y = wp->y;
+	}
+
+	spin_lock_irqsave(&mdev->slock, flags);
+	if(!n){
+		/* nowhere to go, a replacing path stops where the motors are */
+		if(replace){
+			mdev->q_head = mdev->q_tail;
+			motors[HORIZONTAL_MOTOR].state = MOTOR_OPS_STOP;
+			motors[VERTICAL_MOTOR].state = MOTOR_OPS_STOP;
+			mdev->q_x = motors[HORIZONTAL_MOTOR].cur_steps;
+			mdev->q_y = motors[VERTICAL_MOTOR].cur_steps;
+		}
+		spin_unlock_irqrestore(&mdev->slock, flags);
+		goto unlock;
+	}
+	/* the path ran out while it was planned: its end is where the motors are */
+	if(!replace && !idle && mdev->dev_state != MOTOR_OPS_NORMAL)
+		idle = true;
+	start = replace || idle;
+	if(start)
+		mdev->q_head = mdev->q_tail;
+	for(i = 0; i < n; i++){
+		mdev->queue[mdev->q_tail] = segs[i];
+		mdev->q_tail = (mdev->q_tail + 1) % MOTOR_QUEUE_LEN;
+	}
+	mdev->q_x = x;
+	mdev->q_y = y;
+	/* the step interrupt takes it from there */
+	if(start){
+		motor_start_segment(mdev, &mdev->queue[mdev->q_head]);
+		mdev->q_head = (mdev->q_head + 1) % MOTOR_QUEUE_LEN;
+	}
+	spin_unlock_irqrestore(&mdev->slock, flags);
+	if(start)
+		ingenic_tcu_counter_begin(mdev->tcu);
+unlock:
+	mutex_unlock(&mdev->dev_mutex);
+	kfree(segs);
+	return ret;
+}
+
+/* called with slock held */
+static void __motor_get_traj(struct motor_device *mdev, struct motor_traj_status *st)
+{
+	struct motor_driver *motors = mdev->motors;
+
+	st->x = motors[HORIZONTAL_MOTOR].cur_steps;
+	st->y = motors[VERTICAL_MOTOR].cur_steps;
+	st->status = mdev->dev_state == MOTOR_OPS_STOP ? MOTOR_IS_STOP : MOTOR_IS_RUNNING;
+	st->target_x = mdev->q_x;
+	st->target_y = mdev->q_y;
+	st->queued = (mdev->q_tail + MOTOR_QUEUE_LEN - mdev->q_head) % MOTOR_QUEUE_LEN;
+	st->started = mdev->seg_started;
+	st->done = mdev->seg_done;
+}
+
+static void motor_get_traj(struct motor_device *mdev, struct motor_traj_status *st)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&mdev->slock, flags);
+	__motor_get_traj(mdev, st);
+	spin_unlock_irqrestore(&mdev->slock, flags);
+}
+
+/* a segment completed since the last read() on this file */
+static bool motor_traj_pending(struct motor_file *mfile)
+{
+	struct motor_device *mdev = mfile->mdev;
+	unsigned long flags;
+	bool pending = false;
+
+	spin_lock_irqsave(&mdev->slock, flags);
+	pending = mdev->seg_done != mfile->seg_seen;
+	spin_unlock_irqrestore(&mdev->slock, flags);
+	return pending;
+}
+
 static long motor_ops_cruise(struct motor_device *mdev)
 {
 	unsigned long flags;
@@ -387,6 +664,7 @@ static long motor_ops_cruise(struct motor_device *mdev)
 	mutex_lock(&mdev->dev_mutex);
 	spin_lock_irqsave(&mdev->slock, flags);
 	mdev->dev_state = MOTOR_OPS_CRUISE;
+	mdev->q_head = mdev->q_tail;
 	motors[HORIZONTAL_MOTOR].state = MOTOR_OPS_CRUISE;
 	motors[VERTICAL_MOTOR].state = MOTOR_OPS_CRUISE;
 	spin_unlock_irqrestore(&mdev->slock, flags);
@@ -474,12 +752,12 @@ static long motor_ops_reset(struct motor_device *mdev, struct motor_reset_data *
 			mdev->motors[index].reset_max_pos = 0;
 			mdev->motors[index].reset_min_pos = 0;
 		}
-		mdev->dst_move.one.x = 0x0fffffff;
-		mdev->dst_move.one.y = 0x0fffffff;
-		mdev->dst_move.times = 1;
-		mdev->cur_move.one.x = 0;
-		mdev->cur_move.one.y = 0;
-		mdev->cur_move.times = 0;
+		mdev->q_head = mdev->q_tail;
+		memset(&mdev->plan, 0, sizeof(mdev->plan));
+		mdev->plan.major = HORIZONTAL_MOTOR;
+		mdev->plan.steps = 0x0fffffff;
+		mdev->plan.minor_steps = 0x0fffffff;
+		mdev->plan.curve = MOTOR_CURVE_NONE;
 		mdev->dev_state = MOTOR_OPS_RESET;
 		spin_unlock_irqrestore(&mdev->slock, flags);
 		mutex_unlock(&mdev->dev_mutex);
@@ -536,7 +814,34 @@ static int motor_speed(struct motor_device *mdev, int speed)
 	__asm__("ssnop");
 
 	mdev->tcu_speed = speed;
-	ingenic_tcu_set_period(mdev->tcu->cib.id,(24000000 / 64 / mdev->tcu_speed));
+	motor_set_period(mdev, MOTOR_TCU_RATE / mdev->tcu_speed);
+	return 0;
+}
+
+static int motor_ops_set_profile(struct motor_device *mdev, struct motor_profile *prof)
+{
+	struct motor_axis_limits *lim = NULL;
+	int index = 0;
+
+	if(prof->curve < MOTOR_CURVE_NONE || prof->curve > MOTOR_CURVE_SCURVE)
+		return -EINVAL;
+	for(index = 0; index < HAS_MOTOR_CNT; index++){
+		lim = &prof->axis[index];
+		if(lim->start_speed < MOTOR_RAMP_MIN_SPEED || lim->max_speed > MOTOR_RAMP_MAX_SPEED
+				|| lim->start_speed > lim->max_speed){
+			dev_err(mdev->dev, "%s speed(%u, %u) set error\n", mdev->motors[index].pdata->name,
+					lim->start_speed, lim->max_speed);
+			return -EINVAL;
+		}
+		if(lim->accel == 0 || lim->accel > MOTOR_RAMP_MAX_ACCEL){
+			dev_err(mdev->dev, "%s accel(%u) set error\n", mdev->motors[index].pdata->name, lim->accel);
+			return -EINVAL;
+		}
+	}
+
+	mutex_lock(&mdev->dev_mutex);
+	mdev->profile = *prof;
+	mutex_unlock(&mdev->dev_mutex);
 	return 0;
 }
 
@@ -544,30 +849,86 @@ static int motor_open(struct inode *inode, struct file *file)
 {
 	struct miscdevice *dev = file->private_data;
 	struct motor_device *mdev = container_of(dev, struct motor_device, misc_dev);
+	struct motor_file *mfile = NULL;
 	int ret = 0;
 	if(mdev->flag){
 		ret = -EBUSY;
 		dev_err(mdev->dev, "Motor driver busy now!\n");
 	}else{
+		mfile = kzalloc(sizeof(*mfile), GFP_KERNEL);
+		if(!mfile)
+			return -ENOMEM;
+		mfile->mdev = mdev;
+		file->private_data = mfile;
 		mdev->flag = 1;
+		spin_lock_irq(&mdev->slock);
+		mdev->seg_started = 0;
+		mdev->seg_done = 0;
+		spin_unlock_irq(&mdev->slock);
 	}
 
 	return ret;
 }
 
+static ssize_t motor_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+	struct motor_file *mfile = file->private_data;
+	struct motor_device *mdev = mfile->mdev;
+	struct motor_traj_status st;
+	unsigned long flags;
+	int ret = 0;
+
+	if(count < sizeof(st))
+		return -EINVAL;
+
+	/* taken with what it marks as seen, so two threads never both return the same segment */
+	while(1){
+		spin_lock_irqsave(&mdev->slock, flags);
+		if(mdev->seg_done != mfile->seg_seen){
+			__motor_get_traj(mdev, &st);
+			mfile->seg_seen = st.done;
+			spin_unlock_irqrestore(&mdev->slock, flags);
+			break;
+		}
+		spin_unlock_irqrestore(&mdev->slock, flags);
+
+		if(file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		ret = wait_event_interruptible(mdev->traj_wait, motor_traj_pending(mfile));
+		if(ret)
+			return ret;
+	}
+
+	if(copy_to_user(buf, &st, sizeof(st)))
+		return -EFAULT;
+	return sizeof(st);
+}
+
+static unsigned int motor_poll(struct file *file, poll_table *wait)
+{
+	struct motor_file *mfile = file->private_data;
+	struct motor_device *mdev = mfile->mdev;
+
+	poll_wait(file, &mdev->traj_wait, wait);
+	if(motor_traj_pending(mfile))
+		return POLLIN | POLLRDNORM;
+	return 0;
+}
+
 static int motor_release(struct inode *inode, struct file *file)
 {
-	struct miscdevice *dev = file->private_data;
-	struct motor_device *mdev = container_of(dev, struct motor_device, misc_dev);
+	struct motor_file *mfile = file->private_data;
+	struct motor_device *mdev = mfile->mdev;
 	motor_ops_stop(mdev);
 	mdev->flag = 0;
+	kfree(mfile);
 	return 0;
 }
 
 static long motor_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 {
-	struct miscdevice *dev = filp->private_data;
-	struct motor_device *mdev = container_of(dev, struct motor_device, misc_dev);
+	struct motor_file *mfile = filp->private_data;
+	struct motor_device *mdev = mfile->mdev;
 	long ret = 0;
 
 	if(mdev->flag == 0){
@@ -653,6 +1014,52 @@ static long motor_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 			/*printk("MOTOR_CRUISE!!!!!!!!!!!!!!!!!!!!!!!\n");*/
 			ret = motor_ops_cruise(mdev);
 			break;
+		case MOTOR_QUEUE:
+			{
+				struct motor_waypoints wps;
+
+				if (copy_from_user(&wps, (void __user *)arg, sizeof(wps))) {
+					dev_err(mdev->dev, "[%s][%d] copy from user error\n", __func__, __LINE__);
+					return -EFAULT;
+				}
+				ret = motor_ops_queue(mdev, &wps);
+			}
+			break;
+		case MOTOR_GET_TRAJ:
+			{
+				struct motor_traj_status st;
+
+				motor_get_traj(mdev, &st);
+				if (copy_to_user((void __user *)arg, &st, sizeof(st))) {
+					dev_err(mdev->dev, "[%s][%d] copy to user error\n", __func__, __LINE__);
+					return -EFAULT;
+				}
+			}
+			break;
+		case MOTOR_SET_PROFILE:
+			{
+				struct motor_profile prof;
+
+				if (copy_from_user(&prof, (void __user *)arg, sizeof(prof))) {
+					dev_err(mdev->dev, "[%s][%d] copy from user error\n", __func__, __LINE__);
+					return -EFAULT;
+				}
+				ret = motor_ops_set_profile(mdev, &prof);
+			}
+			break;
+		case MOTOR_GET_PROFILE:
+			{
+				struct motor_profile prof;
+
+				mutex_lock(&mdev->dev_mutex);
+				prof = mdev->profile;
+				mutex_unlock(&mdev->dev_mutex);
+				if (copy_to_user((void __user *)arg, &prof, sizeof(prof))) {
+					dev_err(mdev->dev, "[%s][%d] copy to user error\n", __func__, __LINE__);
+					return -EFAULT;
+				}
+			}
+			break;
 		default:
 			return -EINVAL;
 	}
@@ -663,6 +1070,8 @@ static long motor_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 static struct file_operations motor_fops = {
 	.open = motor_open,
 	.release = motor_release,
+	.read = motor_read,
+	.poll = motor_poll,
 	.unlocked_ioctl = motor_ioctl,
 };
 
@@ -680,10 +1089,23 @@ static int motor_info_show(struct seq_file *m, void *v)
 	seq_printf(m ,"The status of motor is %s\n", msg.status?"running":"stop");
 	seq_printf(m ,"The pos of motor is (%d, %d)\n", msg.x, msg.y);
 	seq_printf(m ,"The speed of motor is %d\n", msg.speed);
+	seq_printf(m ,"The profile of moves is %s\n", mdev->profile.curve == MOTOR_CURVE_SCURVE ? "s-curve" :
+			(mdev->profile.curve == MOTOR_CURVE_TRAPEZOID ? "trapezoid" : "constant"));
+	seq_printf(m ,"The step rate now is %u\n", mdev->tcu_period ? MOTOR_TCU_RATE / mdev->tcu_period : 0);
+	seq_printf(m ,"The step interrupt took %llu ns on average and %llu ns at most over %u(%s)\n",
+			mdev->isr_cnt ? div_u64(mdev->isr_sum_ns, mdev->isr_cnt) : 0, mdev->isr_max_ns,
+			mdev->isr_cnt, gpio_fast ? "gpio port" : "gpiolib");
+	seq_printf(m ,"The waypoints queued are %u, segments started %u done %u\n",
+			(mdev->q_tail + MOTOR_QUEUE_LEN - mdev->q_head) % MOTOR_QUEUE_LEN,
+			mdev->seg_started, mdev->seg_done);
 
 	for(index = 0; index < HAS_MOTOR_CNT; index++){
 		seq_printf(m ,"## motor is %s ##\n", mdev->motors[index].pdata->name);
 		seq_printf(m ,"max steps %d\n", mdev->motors[index].max_steps);
+		seq_printf(m ,"phase pins through %s\n", mdev->motors[index].phase_iomem ? "gpio port" : "gpiolib");
+		seq_printf(m ,"speed %u-%u accel %u jerk %u\n", mdev->profile.axis[index].start_speed,
+				mdev->profile.axis[index].max_speed, mdev->profile.axis[index].accel,
+				mdev->profile.axis[index].jerk);
 		seq_printf(m ,"motor direction %d\n", mdev->motors[index].move_dir);
 		seq_printf(m ,"motor state %d(normal; cruise; reset)\n", mdev->motors[index].state);
 		seq_printf(m ,"the irq's counter of max pos is %d\n", mdev->motors[index].max_pos_irq_cnt);
@@ -698,8 +1120,23 @@ static int motor_info_open(struct inode *inode, struct file *file)
 	return single_open_size(file, motor_info_show, PDE_DATA(inode), 1024);
 }
 
+/* any write clears the step interrupt accounting */
+static ssize_t motor_info_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
+{
+	struct motor_device *mdev = ((struct seq_file *)file->private_data)->private;
+	unsigned long flags;
+
+	spin_lock_irqsave(&mdev->slock, flags);
+	mdev->isr_cnt = 0;
+	mdev->isr_sum_ns = 0;
+	mdev->isr_max_ns = 0;
+	spin_unlock_irqrestore(&mdev->slock, flags);
+	return count;
+}
+
 static const struct file_operations motor_info_fops ={
 	.read = seq_read,
+	.write = motor_info_write,
 	.open = motor_info_open,
 	.llseek = seq_lseek,
 	.release = single_release,
@@ -731,22 +1168,28 @@ static int motor_probe(struct platform_device *pdev)
 	mdev->tcu->irq_type = FULL_IRQ_MODE;
 	mdev->tcu->clk_src = TCU_CLKSRC_EXT;
 	mdev->tcu_speed = MOTOR_MAX_SPEED;
+	mdev->tcu_period = MOTOR_TCU_RATE / mdev->tcu_speed;
 	mdev->tcu->is_pwm = 0;
 	mdev->tcu->cib.func = TRACKBALL_FUNC;
 	mdev->tcu->clk_div = TCU_PRESCALE_64;
 	ingenic_tcu_config(mdev->tcu);
-	ingenic_tcu_set_period(mdev->tcu->cib.id,(24000000 / 64 / mdev->tcu_speed));
+	ingenic_tcu_set_period(mdev->tcu->cib.id, mdev->tcu_period);
 	//ingenic_tcu_counter_begin(mdev->tcu);
 	mutex_init(&mdev->dev_mutex);
 	spin_lock_init(&mdev->slock);
+	init_waitqueue_head(&mdev->traj_wait);
 
 	platform_set_drvdata(pdev, mdev);
 
 	for(i = 0; i < HAS_MOTOR_CNT; i++) {
 		motor = &(mdev->motors[i]);
+		motor->mdev = mdev;
 		motor->pdata = &motors_pdata[i];
 		motor->move_dir	= MOTOR_MOVE_STOP;
 		init_completion(&motor->reset_completion);
+		mdev->profile.axis[i].start_speed = MOTOR_MIN_SPEED;
+		mdev->profile.axis[i].max_speed = MOTOR_MAX_SPEED;
+		mdev->profile.axis[i].accel = MOTOR_RAMP_DEF_ACCEL;
 
 		if (motor->pdata->motor_min_gpio != -1) {
 			gpio_request(motor->pdata->motor_min_gpio, "motor_min_gpio");
@@ -796,6 +1239,7 @@ static int motor_probe(struct platform_device *pdev)
 		if (motor->pdata->motor_st4_gpio != -1) {
 			gpio_request(motor->pdata->motor_st4_gpio, "motor_st4_gpio");
 		}
+		motor_phase_resolve(mdev, motor);
 
 		setup_timer(&motor->min_timer,
 			    gpio_keys_min_timer, (unsigned long)motor);
@@ -838,7 +1282,7 @@ static int motor_probe(struct platform_device *pdev)
 	} else {
 		mdev->proc = proc;
 	}
-	proc_create_data("motor_info", S_IRUGO, proc, &motor_info_fops, (void *)mdev);
+	proc_create_data("motor_info", S_IRUGO | S_IWUSR, proc, &motor_info_fops, (void *)mdev);
 
 	motor_set_default(mdev);
 	mdev->flag = 0;
@@ -876,6 +1320,9 @@ error_min_gpio:
 
 		if (motor->pdata->motor_st4_gpio != -1)
 			gpio_free(motor->pdata->motor_st4_gpio);
+		if (motor->phase_iomem)
+			iounmap(motor->phase_iomem);
+		motor->phase_iomem = NULL;
 		motor->pdata = 0;
 		motor->min_pos_irq = 0;
 		motor->max_pos_irq = 0;
@@ -919,6 +1366,9 @@ static int motor_remove(struct platform_device *pdev)
 
 		if (motor->pdata->motor_st4_gpio != -1)
 			gpio_free(motor->pdata->motor_st4_gpio);
+		if (motor->phase_iomem)
+			iounmap(motor->phase_iomem);
+		motor->phase_iomem = NULL;
 		motor->pdata = 0;
 		motor->min_pos_irq = 0;
 		motor->max_pos_irq = 0;
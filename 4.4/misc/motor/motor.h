@@ -67,11 +67,21 @@ enum jz_motor_cnt {
 #define MOTOR_SPEED		0x5
 #define MOTOR_GOBACK	0x6
 #define MOTOR_CRUISE	0x7
+#define MOTOR_SET_PROFILE	0x8
+#define MOTOR_GET_PROFILE	0x9
+#define MOTOR_QUEUE			0xa
+#define MOTOR_GET_TRAJ		0xb
 
 /* motor speed */
 #define MOTOR_MAX_SPEED	900		/**< unit: beats per second */
 #define MOTOR_MIN_SPEED	100
 
+/* limits of a ramped move, see struct motor_profile */
+#define MOTOR_RAMP_MIN_SPEED	10
+#define MOTOR_RAMP_MAX_SPEED	4000
+#define MOTOR_RAMP_MAX_ACCEL	200000	/**< unit: beats per second^2 */
+#define MOTOR_RAMP_DEF_ACCEL	1500
+
 enum motor_status {
 	MOTOR_IS_STOP,
 	MOTOR_IS_RUNNING,
@@ -96,6 +106,72 @@ struct motor_reset_data {
 	unsigned int y_cur_step;
 };
 
+enum motor_curve {
+	MOTOR_CURVE_NONE,		/**< constant speed, set by MOTOR_SPEED */
+	MOTOR_CURVE_TRAPEZOID,	/**< constant acceleration */
+	MOTOR_CURVE_SCURVE,		/**< acceleration rises and falls smoothly, bounded by jerk */
+};
+
+struct motor_axis_limits {
+	unsigned int start_speed;	/**< a move starts and ends at it, beats per second */
+	unsigned int max_speed;
+	unsigned int accel;			/**< beats per second^2 */
+	unsigned int jerk;			/**< beats per second^3, 0 is unbounded; S-curve only */
+};
+
+/*
+ * MOTOR_MOVE and MOTOR_GOBACK ramp from start_speed up to max_speed and back
+ * down when curve is not MOTOR_CURVE_NONE; MOTOR_SPEED then only applies to
+ * cruise and reset. Both axes step on the same timer, so the limits of the
+ * axis with less to travel are scaled onto the other and both arrive together.
+ */
+struct motor_profile {
+	int curve;					/**< enum motor_curve */
+	struct motor_axis_limits axis[HAS_MOTOR_CNT];
+};
+
+/*
+ * MOTOR_QUEUE appends waypoints, absolute positions in steps, to the end of
+ * the path already queued; the driver runs the segments back to back from
+ * the step interrupt. With MOTOR_WAYPOINT_REPLACE the queue and the running
+ * segment are dropped and the first waypoint is headed to from where the
+ * motors are, on the next step. MOTOR_STOP drops everything, and so does a
+ * limit switch, once the running segment is done.
+ *
+ * A waypoint must lie within 0..max_steps of each axis, see MOTOR_RESET;
+ * one where the path already is makes no segment.
+ */
+#define MOTOR_WAYPOINT_BATCH	16
+#define MOTOR_WAYPOINT_REPLACE	(1 << 0)
+
+struct motor_waypoint {
+	int x;
+	int y;
+	unsigned int speed;		/**< of the axis with more steps, 0 is MOTOR_SPEED or the profile */
+};
+
+struct motor_waypoints {
+	unsigned int flags;
+	unsigned int num;
+	struct motor_waypoint points[MOTOR_WAYPOINT_BATCH];
+};
+
+/*
+ * Returned by MOTOR_GET_TRAJ and by read(), which blocks until a segment,
+ * a queued one or a MOTOR_MOVE, completed since the last read of the file;
+ * poll() reports POLLIN then.
+ */
+struct motor_traj_status {
+	int x;
+	int y;
+	enum motor_status status;
+	int target_x;			/**< end of the queued path */
+	int target_y;
+	unsigned int queued;	/**< segments not started yet */
+	unsigned int started;	/**< segments since the device was opened */
+	unsigned int done;
+};
+
 enum motor_direction {
 	MOTOR_MOVE_LEFT_DOWN = -1,
 	MOTOR_MOVE_STOP,
@@ -121,7 +197,10 @@ enum motor_ops_state {
 	MOTOR_OPS_STOP,
 };
 
+struct motor_device;
+
 struct motor_driver {
+	struct motor_device *mdev;
 	struct motor_platform_data *pdata;
 	int max_pos_irq;
 	int min_pos_irq;
@@ -136,14 +215,46 @@ struct motor_driver {
 
 	struct timer_list min_timer;
 	struct timer_list max_timer;
+
+	/*
+	 * When the phase pins share a port, the levels of each step pattern
+	 * as a mask of the port, so a step is one write to its set or clear
+	 * register; phase_iomem is NULL otherwise and gpiolib is used.
+	 */
+	void __iomem *phase_iomem;
+	unsigned int phase_port[16];
+	unsigned int phase_last;
 	/* debug parameters */
 	unsigned int max_pos_irq_cnt;
 	unsigned int min_pos_irq_cnt;
 };
 
-struct motor_move {
-	struct motors_steps one;
-	short times;
+/*
+ * The axis with more steps steps on every timer interrupt, the other one
+ * when the bresenham error overflows. With a ramp, the timer period for the
+ * next step is taken from the speed at the distance to the nearest end of
+ * the move: v^2 = v0^2 + dv^2 * f(k / ramp_steps), f(u) = u for a trapezoid
+ * and 3u^2 - 2u^3 for an S-curve.
+ */
+struct motor_plan {
+	int curve;
+	int major;				/* enum jz_motor_cnt */
+	int steps;				/* of the major axis */
+	int minor_steps;
+	int done;
+	int err;
+	unsigned int v0_sq;		/* speeds squared, 8 fractional bits */
+	unsigned int dv_sq;
+	unsigned int ramp_steps;
+	unsigned int cruise_period;
+};
+
+#define MOTOR_QUEUE_LEN		64
+
+struct motor_segment {
+	struct motor_plan plan;
+	int dir[HAS_MOTOR_CNT];		/* enum motor_direction */
+	int end[HAS_MOTOR_CNT];		/* where it ends, in steps */
 };
 
 struct motor_device {
@@ -154,20 +265,43 @@ struct motor_device {
 	struct motor_driver motors[HAS_MOTOR_CNT];
 	struct ingenic_tcu_chn *tcu;
 	int tcu_speed;
+	unsigned int tcu_period;
+	struct motor_profile profile;
 
 	struct mutex dev_mutex;
 	spinlock_t slock;
 
 	enum motor_ops_state dev_state;
 	struct motor_message msg;
-	struct motor_move dst_move;
-	struct motor_move cur_move;
+	struct motor_plan plan;
+	int seg_end[HAS_MOTOR_CNT];
+
+	/* waypoint queue, under slock and consumed by the step interrupt */
+	struct motor_segment queue[MOTOR_QUEUE_LEN];
+	unsigned int q_head;
+	unsigned int q_tail;
+	int q_x;
+	int q_y;
+	unsigned int seg_started;
+	unsigned int seg_done;
+	wait_queue_head_t traj_wait;
 
 	int run_step_irq;
 	int flag;
 
+	/* step interrupt cost, with the isr_timing parameter */
+	unsigned int isr_cnt;
+	u64 isr_sum_ns;
+	u64 isr_max_ns;
+
 	/* debug parameters */
 	struct proc_dir_entry *proc;
 };
 
+/* an open of the device */
+struct motor_file {
+	struct motor_device *mdev;
+	unsigned int seg_seen;		/* seg_done at the last read(), under slock */
+};
+
 #endif // __MOTOR_H__
@@ -0,0 +1,142 @@
+#ifndef __MOTOR_RAMP_H__
+#define __MOTOR_RAMP_H__
+
+/*
+ * Planning a ramped move and the step periods along it. Needs no more of
+ * the kernel than motor.h and the 64 bit helpers, so motor_test/ builds it
+ * on the host.
+ */
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/string.h>
+#include "motor.h"
+
+/* ticks per second of the step timer */
+#define MOTOR_TCU_RATE		(24000000 / 64)
+#define MOTOR_RAMP_MAX_STEPS	0xffff
+
+/* the timer period before the next step of a ramped move */
+static inline unsigned int motor_ramp_period(const struct motor_plan *plan)
+{
+	unsigned int k = min(plan->done, plan->steps - plan->done - 1);
+	unsigned int u = 0;
+	unsigned int f = 0;
+	unsigned int v = 0;
+
+	if(k >= plan->ramp_steps)
+		return plan->cruise_period;
+
+	/*
+	 * ramp_steps <= MOTOR_RAMP_MAX_STEPS, u is Q16 and below 1, f is Q32:
+	 * in Q16 the 3u^2 at the start of a long S-curve rounds to steps.
+	 */
+	u = (k << 16) / plan->ramp_steps;
+	if(plan->curve == MOTOR_CURVE_SCURVE)
+		f = ((u64)u * u * (3 * 65536 - 2 * u)) >> 16;
+	else
+		f = u << 16;
+	v = int_sqrt(plan->v0_sq + (unsigned int)(((u64)plan->dv_sq * f) >> 32));
+
+	return (MOTOR_TCU_RATE << 4) / v;
+}
+
+/* steps to ramp from v0 up to vmax, both in beats per second */
+static inline unsigned int motor_ramp_steps(int curve, u64 v0, u64 vmax, u64 accel, u64 jerk)
+{
+	u64 dv_sq = vmax * vmax - v0 * v0;
+	u64 n = 0, nj = 0;
+
+	if(curve == MOTOR_CURVE_TRAPEZOID){
+		n = div64_u64(dv_sq + 2 * accel - 1, 2 * accel);
+	}else{
+		/* the slope of 3u^2 - 2u^3 peaks at 1.5 times its mean */
+		n = div64_u64(3 * dv_sq + 4 * accel - 1, 4 * accel);
+		/* and the jerk at 3 * vmax * dv^2 / n^2, at the top of the ramp */
+		if(jerk){
+			nj = div64_u64(3 * vmax * dv_sq, jerk);
+			nj = int_sqrt(min_t(u64, nj, ULONG_MAX)) + 1;
+			n = max(n, nj);
+		}
+	}
+	return min_t(u64, n, UINT_MAX);
+}
+
+/*
+ * Fill in the plan of a move of x1, y1 steps. The limits of each axis are
+ * scaled onto the major one, and when the move is too short to reach the
+ * top speed, the highest one that can be ramped up to and down from in
+ * half of it is used instead. A speed other than 0 caps the major axis,
+ * def_speed is the MOTOR_SPEED one used without a ramp.
+ */
+static inline void motor_ramp_plan(struct motor_plan *plan, const struct motor_profile *prof,
+		unsigned int def_speed, int x1, int y1, unsigned int speed)
+{
+	const struct motor_axis_limits *lim = NULL;
+	int steps[HAS_MOTOR_CNT] = {x1, y1};
+	u64 v0 = U64_MAX, vmax = U64_MAX, accel = U64_MAX, jerk = 0;
+	u64 lo = 0, hi = 0, mid = 0, scaled = 0;
+	unsigned int half = 0;
+	int index = 0;
+
+	memset(plan, 0, sizeof(*plan));
+	plan->major = x1 >= y1 ? HORIZONTAL_MOTOR : VERTICAL_MOTOR;
+	plan->steps = steps[plan->major];
+	plan->minor_steps = plan->major == HORIZONTAL_MOTOR ? y1 : x1;
+	plan->err = plan->steps / 2;
+	plan->curve = prof->curve;
+	plan->cruise_period = MOTOR_TCU_RATE / (speed ? speed : def_speed);
+	/* no axis moves to take the limits from, they would leave a period of 0 */
+	if(!plan->steps)
+		plan->curve = MOTOR_CURVE_NONE;
+	if(plan->curve == MOTOR_CURVE_NONE)
+		return;
+
+	for(index = 0; index < HAS_MOTOR_CNT; index++){
+		if(!steps[index])
+			continue;
+		lim = &prof->axis[index];
+		v0 = min(v0, div_u64((u64)lim->start_speed * plan->steps, steps[index]));
+		vmax = min(vmax, div_u64((u64)lim->max_speed * plan->steps, steps[index]));
+		accel = min(accel, div_u64((u64)lim->accel * plan->steps, steps[index]));
+		if(lim->jerk){
+			scaled = div_u64((u64)lim->jerk * plan->steps, steps[index]);
+			jerk = jerk ? min(jerk, scaled) : scaled;
+		}
+	}
+
+	if(speed){
+		v0 = min_t(u64, v0, speed);
+		vmax = min_t(u64, vmax, speed);
+	}
+
+	half = min(plan->steps / 2, MOTOR_RAMP_MAX_STEPS);
+	if(v0 >= vmax || !half){
+		plan->curve = MOTOR_CURVE_NONE;
+		plan->cruise_period = MOTOR_TCU_RATE / (unsigned int)min(v0, vmax);
+		return;
+	}
+
+	if(motor_ramp_steps(plan->curve, v0, vmax, accel, jerk) > half){
+		lo = v0;
+		hi = vmax;
+		while(lo < hi){
+			mid = lo + (hi - lo + 1) / 2;
+			if(motor_ramp_steps(plan->curve, v0, mid, accel, jerk) <= half)
+				lo = mid;
+			else
+				hi = mid - 1;
+		}
+		vmax = lo;
+	}
+
+	plan->cruise_period = MOTOR_TCU_RATE / (unsigned int)vmax;
+	if(vmax == v0){
+		plan->curve = MOTOR_CURVE_NONE;
+		return;
+	}
+	plan->ramp_steps = motor_ramp_steps(plan->curve, v0, vmax, accel, jerk);
+	plan->v0_sq = (unsigned int)(v0 * v0) << 8;
+	plan->dv_sq = (unsigned int)(vmax * vmax - v0 * v0) << 8;
+}
+
+#endif // __MOTOR_RAMP_H__
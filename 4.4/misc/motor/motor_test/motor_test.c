@@ -0,0 +1,280 @@
+/*
+ * Host test of the motor ramps, motor_ramp.h.
+ *
+ * Moves with random profiles, within what MOTOR_SET_PROFILE accepts, and
+ * random waypoint speeds are planned with motor_ramp_plan() and stepped
+ * through with motor_ramp_period() the way the step interrupt does. Every
+ * period is checked: it fits the timer, it is the one the plan describes
+ * computed in floating point, so an overflow in the fixed point shows up,
+ * the speed falls from neither end of the move towards its middle, the
+ * move is symmetric, no axis goes over its start speed at the ends, its
+ * max speed or the waypoint's one in between, nor gains speed faster than
+ * its accel allows.
+ *
+ *   make run
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "../motor_ramp.h"
+
+/* the longest move walked step by step, longer ones are sampled */
+#define WALK_MAX_STEPS	(1 << 18)
+
+static int failures;
+
+#define CHECK(cond, ...) do {						\
+	if(!(cond)){							\
+		if(failures++ < 20){					\
+			printf("FAIL %s:%d: ", __func__, __LINE__);	\
+			printf(__VA_ARGS__);				\
+			printf("\n");					\
+		}							\
+	}								\
+} while(0)
+
+static unsigned int rnd(unsigned int n)
+{
+	return n ? (unsigned int)(((u64)rand() << 31 | rand()) % n) : 0;
+}
+
+static const char *const curve_name[] = { "none", "trapezoid", "S-curve" };
+
+struct move {
+	struct motor_profile prof;
+	unsigned int def_speed;
+	int steps[HAS_MOTOR_CNT];
+	unsigned int speed;
+	/* the limits of the axes, scaled onto the major one */
+	double v0, vmax, accel;
+};
+
+static void random_move(struct move *mv)
+{
+	struct motor_axis_limits *lim = NULL;
+	int index = 0;
+
+	mv->prof.curve = 1 + rnd(2);
+	for(index = 0; index < HAS_MOTOR_CNT; index++){
+		lim = &mv->prof.axis[index];
+		lim->max_speed = MOTOR_RAMP_MIN_SPEED + rnd(MOTOR_RAMP_MAX_SPEED - MOTOR_RAMP_MIN_SPEED + 1);
+		lim->start_speed = MOTOR_RAMP_MIN_SPEED + rnd(lim->max_speed - MOTOR_RAMP_MIN_SPEED + 1);
+		switch(rnd(4)){
+		case 0:
+			lim->accel = 1 + rnd(100);
+			break;
+		case 1:
+			lim->accel = MOTOR_RAMP_MAX_ACCEL - rnd(1000);
+			break;
+		default:
+			lim->accel = 1 + rnd(20000);
+		}
+		switch(rnd(4)){
+		case 0:
+			lim->jerk = 0;
+			break;
+		case 1:
+			lim->jerk = 1 + rnd(1000);
+			break;
+		case 2:
+			lim->jerk = UINT_MAX - rnd(1000);
+			break;
+		default:
+			lim->jerk = 1 + rnd(10000000);
+		}
+		switch(rnd(4)){
+		case 0:
+			mv->steps[index] = rnd(4);
+			break;
+		case 1:
+			mv->steps[index] = rnd(1 << 30);
+			break;
+		default:
+			mv->steps[index] = rnd(20000);
+		}
+	}
+	if(!mv->steps[HORIZONTAL_MOTOR] && !mv->steps[VERTICAL_MOTOR])
+		mv->steps[rnd(HAS_MOTOR_CNT)] = 1 + rnd(5000);
+	mv->def_speed = MOTOR_MIN_SPEED + rnd(MOTOR_MAX_SPEED - MOTOR_MIN_SPEED + 1);
+	mv->speed = rnd(3) ? 0 : MOTOR_RAMP_MIN_SPEED + rnd(MOTOR_RAMP_MAX_SPEED - MOTOR_RAMP_MIN_SPEED + 1);
+}
+
+/* what the move must stay within, in beats per second of the major axis */
+static void move_limits(struct move *mv, int steps)
+{
+	struct motor_axis_limits *lim = NULL;
+	double scale = 0;
+	int index = 0;
+
+	mv->v0 = mv->vmax = mv->accel = HUGE_VAL;
+	for(index = 0; index < HAS_MOTOR_CNT; index++){
+		if(!mv->steps[index])
+			continue;
+		lim = &mv->prof.axis[index];
+		scale = (double)steps / mv->steps[index];
+		mv->v0 = fmin(mv->v0, lim->start_speed * scale);
+		mv->vmax = fmin(mv->vmax, lim->max_speed * scale);
+		mv->accel = fmin(mv->accel, lim->accel * scale);
+	}
+	if(mv->speed){
+		mv->v0 = fmin(mv->v0, mv->speed);
+		mv->vmax = fmin(mv->vmax, mv->speed);
+	}
+}
+
+/* the period the plan describes at u, and its rounding */
+static double ref_period(const struct motor_plan *plan, double u, double *tol)
+{
+	double f = plan->curve == MOTOR_CURVE_SCURVE ? 3 * u * u - 2 * u * u * u : u;
+	double v16 = sqrt(plan->v0_sq + plan->dv_sq * f);
+
+	/* v rounded down to 1/16, f and the sum to a unit, the period to a tick */
+	*tol = (MOTOR_TCU_RATE << 4) / fmax(v16 - 1.5, 1) - (MOTOR_TCU_RATE << 4) / v16 + 1;
+	return (MOTOR_TCU_RATE << 4) / v16;
+}
+
+/* k steps from the nearest end, with u anywhere between its Q16 truncation and k / ramp_steps */
+static int period_ok(const struct motor_plan *plan, unsigned int k, unsigned int period, double *ref)
+{
+	double tol_lo = 0, tol_hi = 0, slow = 0;
+
+	if(k >= plan->ramp_steps){
+		*ref = plan->cruise_period;
+		return period == plan->cruise_period;
+	}
+	slow = ref_period(plan, (double)((k << 16) / plan->ramp_steps) / 65536, &tol_lo);
+	*ref = ref_period(plan, (double)k / plan->ramp_steps, &tol_hi);
+	return period <= slow + tol_lo && period >= *ref - tol_hi;
+}
+
+struct stats {
+	unsigned int moves, ramped, steps_walked, sampled, short_moves;
+	unsigned int max_period, min_period;
+};
+
+static void check_period(struct move *mv, struct motor_plan *plan, int done, unsigned int period,
+		unsigned int *last, struct stats *st)
+{
+	unsigned int k = min(done, plan->steps - done - 1);
+	double ref = 0, v = 0, vlim = 0;
+
+	CHECK(period && period <= MOTOR_TCU_RATE / MOTOR_RAMP_MIN_SPEED && period <= 0xffff,
+			"%s %d steps, step %d: period %u", curve_name[plan->curve], plan->steps, done, period);
+	if(period < st->min_period)
+		st->min_period = period;
+	if(period > st->max_period)
+		st->max_period = period;
+
+	CHECK(period_ok(plan, k, period, &ref), "%s %d steps, step %d of ramp %u: period %u, should be %.1f",
+			curve_name[plan->curve], plan->steps, done, plan->ramp_steps, period, ref);
+
+	/* slower towards the ends, the two middle steps of an even move are alike */
+	if(*last && done <= (plan->steps - 1) / 2)
+		CHECK(period <= *last, "step %d of %d: period up from %u to %u on the way in",
+				done, plan->steps, *last, period);
+	else if(*last && done > plan->steps / 2)
+		CHECK(period >= *last, "step %d of %d: period down from %u to %u on the way out",
+				done, plan->steps, *last, period);
+	*last = period;
+
+	/* the speed the period gives, it rounds up by at most a tick */
+	v = (double)MOTOR_TCU_RATE / period;
+	vlim = fmin(sqrt(mv->v0 * mv->v0 + 2 * mv->accel * (k + 1)), mv->vmax);
+	CHECK(v <= vlim * (1 + v / MOTOR_TCU_RATE) + 1,
+			"%s %d steps, step %d: %.1f beats/s, the limits allow %.1f (v0 %.1f vmax %.1f accel %.1f)",
+			curve_name[plan->curve], plan->steps, done, v, vlim, mv->v0, mv->vmax, mv->accel);
+}
+
+static void check_move(struct move *mv, struct stats *st)
+{
+	struct motor_plan plan;
+	unsigned int period = 0, last = 0, i = 0;
+	double top = 0;
+	int done = 0;
+
+	motor_ramp_plan(&plan, &mv->prof, mv->def_speed, mv->steps[HORIZONTAL_MOTOR], mv->steps[VERTICAL_MOTOR], mv->speed);
+	move_limits(mv, plan.steps);
+	st->moves++;
+	CHECK(plan.steps == max(mv->steps[HORIZONTAL_MOTOR], mv->steps[VERTICAL_MOTOR]), "major axis has %d steps", plan.steps);
+	CHECK(plan.cruise_period, "%d steps: no cruise period", plan.steps);
+	if(plan.curve == MOTOR_CURVE_NONE){
+		CHECK(plan.steps < 2 || mv->v0 >= mv->vmax - 1 || plan.cruise_period == MOTOR_TCU_RATE / (unsigned int)mv->v0,
+				"%d steps not ramped", plan.steps);
+		if(plan.steps < 2)
+			st->short_moves++;
+		return;
+	}
+	st->ramped++;
+	CHECK(plan.ramp_steps && 2 * plan.ramp_steps <= plan.steps && plan.ramp_steps <= MOTOR_RAMP_MAX_STEPS,
+			"%d steps, ramps of %u", plan.steps, plan.ramp_steps);
+	/* the u32 speeds squared, against the cruise speed they lead to */
+	top = sqrt((double)plan.v0_sq + plan.dv_sq) / 16;
+	CHECK(fabs(top - (double)MOTOR_TCU_RATE / plan.cruise_period) <= top * top / MOTOR_TCU_RATE + 1,
+			"%d steps: top of the ramp %.1f, cruise at %u", plan.steps, top, MOTOR_TCU_RATE / plan.cruise_period);
+
+	if(plan.steps <= WALK_MAX_STEPS){
+		/* the period before every step, as motor_start_segment() and jz_timer_step() set it */
+		for(done = 0; done < plan.steps; done++){
+			plan.done = done;
+			period = motor_ramp_period(&plan);
+			check_period(mv, &plan, done, period, &last, st);
+			if(plan.steps - 1 - done != done && done < plan.steps / 2){
+				plan.done = plan.steps - 1 - done;
+				CHECK(motor_ramp_period(&plan) == period, "step %d of %d not symmetric", done, plan.steps);
+			}
+		}
+		st->steps_walked += plan.steps;
+		return;
+	}
+
+	/* the ramps and a few steps of the cruise */
+	st->sampled++;
+	for(i = 0; i < plan.ramp_steps + 3; i++){
+		plan.done = i;
+		check_period(mv, &plan, i, motor_ramp_period(&plan), &last, st);
+	}
+	last = 0;
+	for(i = plan.ramp_steps + 3; i-- > 0; ){
+		plan.done = plan.steps - 1 - i;
+		check_period(mv, &plan, plan.done, motor_ramp_period(&plan), &last, st);
+	}
+}
+
+/* a waypoint where the path already is, the ioctls skip it but the plan must hold */
+static void test_zero(void)
+{
+	struct motor_plan plan;
+	struct move mv;
+	unsigned int i = 0;
+
+	for(i = 0; i < 100; i++){
+		random_move(&mv);
+		motor_ramp_plan(&plan, &mv.prof, mv.def_speed, 0, 0, mv.speed);
+		CHECK(!plan.steps && plan.curve == MOTOR_CURVE_NONE && plan.cruise_period
+				&& plan.cruise_period <= MOTOR_TCU_RATE / MOTOR_RAMP_MIN_SPEED,
+				"zero steps: curve %d, period %u", plan.curve, plan.cruise_period);
+	}
+}
+
+int main(int argc, const char *argv[])
+{
+	unsigned int moves = argc > 1 ? atoi(argv[1]) : 20000;
+	struct stats st = { .min_period = UINT_MAX };
+	struct move mv;
+	unsigned int i = 0;
+
+	srand(1);
+	test_zero();
+	for(i = 0; i < moves; i++){
+		random_move(&mv);
+		check_move(&mv, &st);
+	}
+	printf("%u moves, %u ramped, %u walked steps, %u long ones sampled, %u too short; periods %u..%u\n",
+			st.moves, st.ramped, st.steps_walked, st.sampled, st.short_moves, st.min_period, st.max_period);
+	if(failures){
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	printf("all passed\n");
+	return 0;
+}
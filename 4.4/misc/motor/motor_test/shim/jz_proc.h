@@ -0,0 +1,8 @@
+/* the rest of what motor.h holds by value, the kernel gets them through its includes */
+#ifndef _SHIM_JZ_PROC_H
+#define _SHIM_JZ_PROC_H
+
+struct timer_list { int dummy; };
+struct miscdevice { int dummy; };
+
+#endif
@@ -0,0 +1,36 @@
+/* just enough of the kernel headers to build motor.h and motor_ramp.h on the host */
+#ifndef _SHIM_LINUX_KERNEL_H
+#define _SHIM_LINUX_KERNEL_H
+
+#include <limits.h>
+#include <linux/types.h>
+
+#define U64_MAX		((u64)~0ULL)
+
+#define min(x, y) ({ typeof(x) __x = (x); typeof(y) __y = (y); (void)(&__x == &__y); __x < __y ? __x : __y; })
+#define max(x, y) ({ typeof(x) __x = (x); typeof(y) __y = (y); (void)(&__x == &__y); __x > __y ? __x : __y; })
+#define min_t(type, x, y) ({ type __x = (x); type __y = (y); __x < __y ? __x : __y; })
+
+/* rounds down like lib/int_sqrt.c */
+static inline unsigned long int_sqrt(unsigned long x)
+{
+	unsigned long b, m, y = 0;
+
+	if(x <= 1)
+		return x;
+	m = 1UL << (sizeof(long) * 8 - 2);
+	while(m > x)
+		m >>= 2;
+	while(m){
+		b = y + m;
+		y >>= 1;
+		if(x >= b){
+			x -= b;
+			y += m;
+		}
+		m >>= 2;
+	}
+	return y;
+}
+
+#endif
@@ -0,0 +1,4 @@
+#ifndef _SHIM_LINUX_PROC_FS_H
+#define _SHIM_LINUX_PROC_FS_H
+
+#endif
@@ -0,0 +1,4 @@
+#ifndef _SHIM_LINUX_SEQ_FILE_H
+#define _SHIM_LINUX_SEQ_FILE_H
+
+#endif
@@ -0,0 +1,7 @@
+#ifndef _SHIM_LINUX_SPINLOCK_H
+#define _SHIM_LINUX_SPINLOCK_H
+
+typedef struct { int dummy; } spinlock_t;
+struct mutex { int dummy; };
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef _SHIM_LINUX_WAIT_H
+#define _SHIM_LINUX_WAIT_H
+
+#include <linux/types.h>
+
+typedef struct { int dummy; } wait_queue_head_t;
+struct completion { int dummy; };
+
+#endif
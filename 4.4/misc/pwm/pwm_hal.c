@@ -22,6 +22,10 @@
 #include <linux/mfd/jz_tcu.h>
 #endif
 #include <linux/spinlock.h>
+#include <linux/slab.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/uaccess.h>
 
 #if defined(CONFIG_SOC_T30) || defined(CONFIG_SOC_T40)
 #define PWM_NUM		8
@@ -32,6 +36,15 @@
 #define PWM_CONFIG_DUTY	0x002
 #define PWM_ENABLE	0x010
 #define PWM_DISABLE 0x100
+#define PWM_CONFIG_BATCH	0x004
+#define PWM_SEQ_START	0x020
+#define PWM_SEQ_STOP	0x200
+
+#define PWM_BATCH_MAX	8
+#define PWM_BATCH_ENABLE	(1 << 0)	/* also enable the channels that are not */
+
+#define PWM_SEQ_MAX		64
+#define PWM_SEQ_PINGPONG	(1 << 0)	/* up the table and back down, for breathing */
 
 struct platform_device pwm_device = {
 	.name = "pwm-jz",
@@ -100,11 +113,50 @@ struct pwm_ioctl_t {
 	int polarity;
 };
 
+/* PWM_CONFIG_BATCH: all channels are checked first, then applied back to back */
+struct pwm_batch_t {
+	int num;
+	int flags;
+	struct pwm_ioctl_t chn[PWM_BATCH_MAX];
+};
+
+/*
+ * PWM_SEQ_START: the channel steps through duty[] (ns, within its period),
+ * one entry every step_ms, repeat passes or forever when 0, and keeps the
+ * last duty when it is done. Any other command on the channel stops it.
+ */
+struct pwm_seq_t {
+	int index;
+	int step_ms;
+	int repeat;
+	int flags;
+	int num;
+	int duty[PWM_SEQ_MAX];
+};
+
+struct pwm_jz_t;
+
+struct pwm_seq_state {
+	struct hrtimer timer;
+	struct pwm_jz_t *gpwm;
+	ktime_t step;
+	int running;
+	int flags;
+	int repeat;
+	int passes;
+	int num;
+	int pos;
+	int dir;
+	int duty[PWM_SEQ_MAX];
+};
+
 struct pwm_device_t {
 	int duty;
 	int period;
 	int polarity;
+	int enabled;
 	struct pwm_device *pwm_device;
+	struct pwm_seq_state seq;
 };
 
 struct pwm_jz_t {
@@ -114,6 +166,223 @@ struct pwm_jz_t {
     spinlock_t pwm_lock;
 };
 
+static struct pwm_device_t *pwm_jz_chn(struct pwm_jz_t *gpwm, int id)
+{
+	if((id >= PWM_NUM) || (id < 0) || (gpwm->pwm_device_t[id] == NULL))
+		return NULL;
+	if((gpwm->pwm_device_t[id]->pwm_device == NULL) || (IS_ERR(gpwm->pwm_device_t[id]->pwm_device)))
+		return NULL;
+	return gpwm->pwm_device_t[id];
+}
+
+static int pwm_jz_check(struct pwm_jz_t *gpwm, struct pwm_ioctl_t *pwm_ioctl)
+{
+	if(pwm_jz_chn(gpwm, pwm_ioctl->index) == NULL) {
+		dev_err(gpwm->dev, "pwm %d could not work !\n", pwm_ioctl->index);
+		return -EINVAL;
+	}
+	if((pwm_ioctl->period > 1000000000) || (pwm_ioctl->period < 200)) {
+		dev_err(gpwm->dev, "period error !\n");
+		return -EINVAL;
+	}
+	if((pwm_ioctl->duty > pwm_ioctl->period) || (pwm_ioctl->duty < 0)) {
+		dev_err(gpwm->dev, "duty error !\n");
+		return -EINVAL;
+	}
+	if((pwm_ioctl->polarity > 1) || (pwm_ioctl->polarity < 0)) {
+		dev_err(gpwm->dev, "polarity error !\n");
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/* the next entry of the table, 0 when the last pass is over */
+static int pwm_jz_seq_advance(struct pwm_seq_state *seq)
+{
+	int next = seq->pos + seq->dir;
+	int wrap = 0;
+
+	if(next >= seq->num) {
+		if(seq->flags & PWM_SEQ_PINGPONG) {
+			seq->dir = -1;
+			next = seq->num > 1 ? seq->num - 2 : 0;
+		} else {
+			next = 0;
+			wrap = 1;
+		}
+	} else if(next < 0) {
+		seq->dir = 1;
+		next = seq->num > 1 ? 1 : 0;
+		wrap = 1;
+	}
+
+	if(wrap && seq->repeat && ++seq->passes >= seq->repeat)
+		return 0;
+	seq->pos = next;
+	return 1;
+}
+
+static enum hrtimer_restart pwm_jz_seq_step(struct hrtimer *timer)
+{
+	struct pwm_seq_state *seq = container_of(timer, struct pwm_seq_state, timer);
+	struct pwm_device_t *chn = container_of(seq, struct pwm_device_t, seq);
+	unsigned long flags;
+	int more = 0;
+
+	spin_lock_irqsave(&seq->gpwm->pwm_lock, flags);
+	if(seq->running) {
+		more = pwm_jz_seq_advance(seq);
+		if(more) {
+			chn->duty = seq->duty[seq->pos];
+			pwm_config(chn->pwm_device, chn->duty, chn->period);
+		} else {
+			seq->running = 0;
+		}
+	}
+	spin_unlock_irqrestore(&seq->gpwm->pwm_lock, flags);
+
+	if(!more)
+		return HRTIMER_NORESTART;
+	hrtimer_forward_now(timer, seq->step);
+	return HRTIMER_RESTART;
+}
+
+/* not with pwm_lock held, the timer callback takes it */
+static void pwm_jz_seq_stop(struct pwm_jz_t *gpwm, struct pwm_device_t *chn)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&gpwm->pwm_lock, flags);
+	chn->seq.running = 0;
+	spin_unlock_irqrestore(&gpwm->pwm_lock, flags);
+	hrtimer_cancel(&chn->seq.timer);
+}
+
+static long pwm_jz_seq_start(struct pwm_jz_t *gpwm, void __user *argp)
+{
+	struct pwm_seq_t *req;
+	struct pwm_device_t *chn;
+	unsigned long flags;
+	int i, ret = 0;
+
+	req = kmalloc(sizeof(*req), GFP_KERNEL);
+	if(req == NULL)
+		return -ENOMEM;
+	if(copy_from_user(req, argp, sizeof(*req))) {
+		dev_err(gpwm->dev, "ioctl error(%d) !\n", __LINE__);
+		ret = -EFAULT;
+		goto out;
+	}
+
+	chn = pwm_jz_chn(gpwm, req->index);
+	if((chn == NULL) || (req->num < 1) || (req->num > PWM_SEQ_MAX) || (req->step_ms < 1)
+			|| (req->repeat < 0) || (req->flags & ~PWM_SEQ_PINGPONG)) {
+		dev_err(gpwm->dev, "ioctl error(%d) !\n", __LINE__);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	pwm_jz_seq_stop(gpwm, chn);
+
+	spin_lock_irqsave(&gpwm->pwm_lock, flags);
+	if(chn->period == -1) {
+		spin_unlock_irqrestore(&gpwm->pwm_lock, flags);
+		dev_err(gpwm->dev, "the parameter of pwm could not init !\n");
+		ret = -EINVAL;
+		goto out;
+	}
+	for(i = 0; i < req->num; i++) {
+		if((req->duty[i] < 0) || (req->duty[i] > chn->period)) {
+			spin_unlock_irqrestore(&gpwm->pwm_lock, flags);
+			dev_err(gpwm->dev, "duty error !\n");
+			ret = -EINVAL;
+			goto out;
+		}
+	}
+	memcpy(chn->seq.duty, req->duty, sizeof(int) * req->num);
+	chn->seq.num = req->num;
+	chn->seq.flags = req->flags;
+	chn->seq.repeat = req->repeat;
+	chn->seq.passes = 0;
+	chn->seq.pos = 0;
+	chn->seq.dir = 1;
+	chn->seq.step = ms_to_ktime(req->step_ms);
+	chn->seq.running = 1;
+	chn->duty = chn->seq.duty[0];
+	pwm_config(chn->pwm_device, chn->duty, chn->period);
+	spin_unlock_irqrestore(&gpwm->pwm_lock, flags);
+
+	hrtimer_start(&chn->seq.timer, chn->seq.step, HRTIMER_MODE_REL);
+out:
+	kfree(req);
+	return ret;
+}
+
+/*
+ * The pwm api takes effect as soon as a channel is written, so the batch is
+ * written with interrupts off, to land within microseconds across channels.
+ */
+static long pwm_jz_config_batch(struct pwm_jz_t *gpwm, void __user *argp)
+{
+	struct pwm_batch_t batch;
+	struct pwm_ioctl_t *c;
+	struct pwm_device_t *chn;
+	unsigned long flags;
+	int i, j, restart;
+
+	if(copy_from_user(&batch, argp, sizeof(batch))) {
+		dev_err(gpwm->dev, "ioctl error(%d) !\n", __LINE__);
+		return -EFAULT;
+	}
+	if((batch.num < 1) || (batch.num > PWM_BATCH_MAX) || (batch.flags & ~PWM_BATCH_ENABLE)) {
+		dev_err(gpwm->dev, "ioctl error(%d) !\n", __LINE__);
+		return -EINVAL;
+	}
+	for(i = 0; i < batch.num; i++) {
+		if(pwm_jz_check(gpwm, &batch.chn[i]))
+			return -EINVAL;
+		for(j = 0; j < i; j++) {
+			if(batch.chn[j].index == batch.chn[i].index) {
+				dev_err(gpwm->dev, "pwm %d set twice !\n", batch.chn[i].index);
+				return -EINVAL;
+			}
+		}
+	}
+
+	for(i = 0; i < batch.num; i++)
+		pwm_jz_seq_stop(gpwm, gpwm->pwm_device_t[batch.chn[i].index]);
+
+	spin_lock_irqsave(&gpwm->pwm_lock, flags);
+	for(i = 0; i < batch.num; i++) {
+		c = &batch.chn[i];
+		chn = gpwm->pwm_device_t[c->index];
+
+		/* the polarity can only change while the channel is off */
+		restart = chn->enabled && (c->polarity != chn->polarity);
+		if(restart) {
+			pwm_disable(chn->pwm_device);
+			chn->enabled = 0;
+		}
+		chn->period = c->period;
+		chn->duty = c->duty;
+		chn->polarity = c->polarity;
+
+		if(!chn->enabled && (restart || (batch.flags & PWM_BATCH_ENABLE))) {
+			if(chn->polarity == 0)
+				pwm_set_polarity(chn->pwm_device, PWM_POLARITY_INVERSED);
+			else
+				pwm_set_polarity(chn->pwm_device, PWM_POLARITY_NORMAL);
+			pwm_enable(chn->pwm_device);
+			chn->enabled = 1;
+		}
+		if(chn->enabled)
+			pwm_config(chn->pwm_device, chn->duty, chn->period);
+	}
+	spin_unlock_irqrestore(&gpwm->pwm_lock, flags);
+
+	return 0;
+}
+
 static int pwm_jz_open(struct inode *inode, struct file *filp)
 {
 	return 0;
@@ -127,20 +396,45 @@ static int pwm_jz_release(struct inode *inode, struct file *filp)
 static long pwm_jz_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 {
 	int id, ret = 0;
+	unsigned long flags;
 	struct pwm_ioctl_t pwm_ioctl;
 	struct miscdevice *dev = filp->private_data;
 	struct pwm_jz_t *gpwm = container_of(dev, struct pwm_jz_t, mdev);
 
-    spin_lock(&gpwm->pwm_lock);
+	/* copy in and stop a running sequence before taking the lock */
 	switch(cmd) {
+		case PWM_CONFIG_BATCH:
+			return pwm_jz_config_batch(gpwm, (void __user *)arg);
+		case PWM_SEQ_START:
+			return pwm_jz_seq_start(gpwm, (void __user *)arg);
+		case PWM_SEQ_STOP:
+			if(pwm_jz_chn(gpwm, (int)arg) == NULL) {
+				dev_err(gpwm->dev, "ioctl error(%d) !\n", __LINE__);
+				return -1;
+			}
+			pwm_jz_seq_stop(gpwm, gpwm->pwm_device_t[(int)arg]);
+			return 0;
 		case PWM_CONFIG:
-			ret = copy_from_user(&pwm_ioctl, (void __user *)arg, sizeof(pwm_ioctl));
-			if(ret){
+		case PWM_CONFIG_DUTY:
+			if(copy_from_user(&pwm_ioctl, (void __user *)arg, sizeof(pwm_ioctl))) {
 				dev_err(gpwm->dev, "ioctl error(%d) !\n", __LINE__);
-				ret = -1;
-				break;
+				return -1;
 			}
+			if(pwm_jz_chn(gpwm, pwm_ioctl.index) == NULL) {
+				dev_err(gpwm->dev, "ioctl error(%d) !\n", __LINE__);
+				return -1;
+			}
+			pwm_jz_seq_stop(gpwm, gpwm->pwm_device_t[pwm_ioctl.index]);
+			break;
+		case PWM_DISABLE:
+			if(pwm_jz_chn(gpwm, (int)arg))
+				pwm_jz_seq_stop(gpwm, gpwm->pwm_device_t[(int)arg]);
+			break;
+	}
 
+	spin_lock_irqsave(&gpwm->pwm_lock, flags);
+	switch(cmd) {
+		case PWM_CONFIG:
 			id = pwm_ioctl.index;
 			if((id >= PWM_NUM) || (id < 0)) {
 				dev_err(gpwm->dev, "ioctl error(%d) !\n", __LINE__);
@@ -172,12 +466,6 @@ static long pwm_jz_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 
 			break;
 		case PWM_CONFIG_DUTY:
-			ret = copy_from_user(&pwm_ioctl, (void __user *)arg, sizeof(pwm_ioctl));
-			if(ret){
-				dev_err(gpwm->dev, "ioctl error(line %d) !\n", __LINE__);
-				ret = -1;
-				break;
-			}
 			if((pwm_ioctl.duty > pwm_ioctl.period) || (pwm_ioctl.duty < 0)) {
 				dev_err(gpwm->dev, "duty error(line %d) !\n",__LINE__);
 				ret = -1;
@@ -215,6 +503,7 @@ static long pwm_jz_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 				pwm_set_polarity(gpwm->pwm_device_t[id]->pwm_device, PWM_POLARITY_NORMAL);
 
 			pwm_enable(gpwm->pwm_device_t[id]->pwm_device);
+			gpwm->pwm_device_t[id]->enabled = 1;
 
 			pwm_config(gpwm->pwm_device_t[id]->pwm_device, gpwm->pwm_device_t[id]->duty, gpwm->pwm_device_t[id]->period);
 			break;
@@ -240,13 +529,14 @@ static long pwm_jz_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 			}
 
 			pwm_disable(gpwm->pwm_device_t[id]->pwm_device);
+			gpwm->pwm_device_t[id]->enabled = 0;
 
 			break;
 		default:
 			dev_err(gpwm->dev, "unsupport cmd !\n");
 			break;
 	}
-    spin_unlock(&gpwm->pwm_lock);
+    spin_unlock_irqrestore(&gpwm->pwm_lock, flags);
 
 	return ret;
 }
@@ -335,6 +625,9 @@ static int jz_pwm_probe(struct platform_device *pdev)
 		gpwm->pwm_device_t[i]->duty = -1;
 		gpwm->pwm_device_t[i]->period = -1;
 		gpwm->pwm_device_t[i]->polarity = -1;
+		hrtimer_init(&gpwm->pwm_device_t[i]->seq.timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+		gpwm->pwm_device_t[i]->seq.timer.function = pwm_jz_seq_step;
+		gpwm->pwm_device_t[i]->seq.gpwm = gpwm;
 	}
 
     spin_lock_init(&gpwm->pwm_lock);
@@ -365,6 +658,11 @@ static int jz_pwm_remove(struct platform_device *pdev)
 		return 0;
 	misc_deregister(&gpwm->mdev);
 
+	for(i = 0; i < PWM_NUM; i++) {
+		if(pwm_jz_chn(gpwm, i))
+			pwm_jz_seq_stop(gpwm, gpwm->pwm_device_t[i]);
+	}
+
 	for(i = 0; i < PWM_NUM; i++) {
 		if(gpwm->pwm_device_t[i]->pwm_device){
 			devm_pwm_put(&pdev->dev, gpwm->pwm_device_t[i]->pwm_device);
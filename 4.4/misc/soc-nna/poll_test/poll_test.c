@@ -0,0 +1,206 @@
+/*
+ * Host test of the job poll timing, soc_nna_poll.h.
+ *
+ * A stream of chains is run through a model of the nna dma: a chain takes
+ * a fixed start cost plus its bytes at the dma's rate, with 3% or 15%
+ * jitter, and the timer fires late by a random wakeup latency. The chains
+ * are polled the way soc_nna_job_timer() does it and, for comparison, at the
+ * old fixed 20 us period. The dma slows down fourfold for a while, as
+ * under ddr contention, and recovers. Counted are the timer wakeups per
+ * chain, how late a finished chain is noticed, which leaves the dma idle
+ * that long, and the wakeups a second at full load, which at the assumed
+ * cost of one wakeup gives the cpu time spent polling.
+ *
+ *   make run
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "../soc_nna_poll.h"
+
+#define POLL_MIN_NS         20000ULL        //job_poll_min_us
+#define POLL_MAX_NS         1000000ULL      //job_poll_us
+#define FIXED_NS            20000ULL        //the old job_poll_us
+#define LATENCY_NS          5000            //plus up to LATENCY_NS * 4
+#define CHAIN_START_NS      3000ULL
+#define WAKEUP_COST_NS      3               //us, assumed: irq, job_lock, two uncached reads, timer rearm
+#define WARMUP_CHAINS       200
+
+#define CHECK(cond, ...) do {						\
+	if(!(cond)){							\
+		if(failures++ < 20){					\
+			printf("FAIL %s:%d: ", __func__, __LINE__);	\
+			printf(__VA_ARGS__);				\
+			printf("\n");					\
+		}							\
+	}								\
+} while(0)
+
+struct stats {
+	unsigned long long  chains;
+	unsigned long long  polls;
+	unsigned long long  busy_ns;    /* the dma ran */
+	unsigned long long  late_ns;    /* finished to noticed */
+	unsigned long long  late_max_ns;
+};
+
+static int failures;
+static unsigned int jitter;     /* percent */
+
+static unsigned int rnd(unsigned int n)
+{
+	return n ? (unsigned int)rand() % n : 0;
+}
+
+static unsigned int chain_bytes(void)
+{
+	switch (rnd(10)) {
+	case 0: case 1: case 2:
+		return 1024 + rnd(15 * 1024);
+	case 3: case 4:
+		return 256 * 1024 + rnd(768 * 1024);
+	default:
+		return 16 * 1024 + rnd(240 * 1024);
+	}
+}
+
+static unsigned long long latency(void)
+{
+	return LATENCY_NS + rnd(LATENCY_NS * 4);
+}
+
+/* how long the dma takes, at ns_kb per KiB */
+static unsigned long long chain_ns(unsigned int bytes, unsigned long long ns_kb)
+{
+	unsigned long long ns = CHAIN_START_NS + ((ns_kb * bytes) >> 10);
+
+	return ns - ns * jitter / 100 + ns * rnd(jitter * 2 + 1) / 100;
+}
+
+static void add(struct stats *s, struct stats *from)
+{
+	s->chains += from->chains;
+	s->polls += from->polls;
+	s->busy_ns += from->busy_ns;
+	s->late_ns += from->late_ns;
+	if (from->late_max_ns > s->late_max_ns)
+		s->late_max_ns = from->late_max_ns;
+}
+
+static void account(struct stats *s, unsigned long long real, unsigned long long t, unsigned int polls)
+{
+	struct stats chain = { 1, polls, real, t - real, t - real };
+
+	add(s, &chain);
+}
+
+/* one chain polled like the driver: first when it is expected done, then backing off */
+static void run_adaptive(struct soc_nna_poll *p, struct stats *s, unsigned int bytes, unsigned long long real)
+{
+	unsigned long long t = 0, next = 0;
+	unsigned int polls = 0;
+
+	soc_nna_poll_start(p, bytes);
+	next = soc_nna_poll_busy(p, 0, POLL_MIN_NS, POLL_MAX_NS);
+	CHECK(next >= POLL_MIN_NS && next <= POLL_MAX_NS, "first wait %llu", next);
+	for (;;) {
+		t += next + latency();
+		polls++;
+		if (t >= real)
+			break;
+		next = soc_nna_poll_busy(p, t, POLL_MIN_NS, POLL_MAX_NS);
+		CHECK(next >= POLL_MIN_NS && next <= POLL_MAX_NS, "wait %llu", next);
+	}
+	soc_nna_poll_done(p);
+	CHECK(p->ns_kb >= SOC_NNA_POLL_NS_KB_MIN && p->ns_kb <= SOC_NNA_POLL_NS_KB_MAX, "estimate %llu ns/KiB", p->ns_kb);
+	CHECK(t - real <= POLL_MAX_NS + LATENCY_NS * 5, "chain of %llu ns noticed %llu ns late", real, t - real);
+	account(s, real, t, polls);
+}
+
+static void run_fixed(struct stats *s, unsigned long long real)
+{
+	unsigned long long t = 0;
+	unsigned int polls = 0;
+
+	while (t < real) {
+		t += FIXED_NS + latency();
+		polls++;
+	}
+	account(s, real, t, polls);
+}
+
+static double idle(struct stats *s)
+{
+	return 100.0 * s->late_ns / (s->busy_ns + s->late_ns);
+}
+
+static void report(const char *name, struct stats *s)
+{
+	unsigned long long per_s = s->polls * 1000000000ULL / (s->busy_ns + s->late_ns);
+
+	printf("%-10s %6.2f wakeups/chain, noticed %4llu us late on average, %4llu us at most, dma idle %4.1f%%,"
+	       " %6llu wakeups/s at full load, %5.2f%% cpu\n",
+	       name, (double)s->polls / s->chains, s->late_ns / s->chains / 1000, s->late_max_ns / 1000,
+	       idle(s), per_s, per_s * WAKEUP_COST_NS / 10000.0);
+}
+
+/* chains at a dma rate of ns_kb, the adaptive stats only counted after the warmup */
+static void phase(const char *name, struct soc_nna_poll *p, unsigned long long ns_kb, unsigned int chains,
+		struct stats *fixed_all, struct stats *adapt_all)
+{
+	struct stats fixed = { 0 }, adapt = { 0 }, warm = { 0 };
+	unsigned long long real = 0;
+	unsigned int bytes = 0, i;
+
+	for (i = 0; i < chains; i++) {
+		bytes = chain_bytes();
+		real = chain_ns(bytes, ns_kb);
+		run_adaptive(p, i < WARMUP_CHAINS ? &warm : &adapt, bytes, real);
+		run_fixed(&fixed, real);
+	}
+	printf("%s, %u chains at %llu ns/KiB, estimate now %llu ns/KiB; %.2f wakeups/chain over the first %u\n",
+	       name, chains, ns_kb, p->ns_kb, (double)warm.polls / warm.chains, WARMUP_CHAINS);
+	report("  fixed", &fixed);
+	report("  adaptive", &adapt);
+
+	CHECK(adapt.polls * 4 < fixed.polls, "%s: %llu wakeups against %llu at a fixed period", name, adapt.polls, fixed.polls);
+	CHECK(idle(&adapt) < idle(&fixed) + 2, "%s: dma idle %.1f%% against %.1f%% at a fixed period",
+	      name, idle(&adapt), idle(&fixed));
+	CHECK(warm.polls < (unsigned long long)WARMUP_CHAINS * 6, "%s: %llu wakeups to settle", name, warm.polls);
+
+	add(fixed_all, &fixed);
+	add(adapt_all, &adapt);
+}
+
+int main(int argc, const char *argv[])
+{
+	unsigned int chains = argc > 1 ? atoi(argv[1]) : 20000;
+	struct stats fixed = { 0 }, adapt = { 0 };
+	struct soc_nna_poll p;
+	unsigned long long next = 0;
+
+	if (chains <= WARMUP_CHAINS)
+		chains = WARMUP_CHAINS + 1;
+	srand(1);
+	for (jitter = 3; jitter <= 15; jitter += 12) {
+		printf("%u%% jitter:\n", jitter);
+		soc_nna_poll_init(&p);
+		phase("dma at 600 MB/s", &p, 1700, chains, &fixed, &adapt);
+		phase("dma slowed down", &p, 6800, chains, &fixed, &adapt);
+		phase("dma recovered", &p, 1700, chains, &fixed, &adapt);
+	}
+
+	/* a chain that moves nothing is looked at after the shortest wait */
+	soc_nna_poll_start(&p, 0);
+	next = soc_nna_poll_busy(&p, 0, POLL_MIN_NS, POLL_MAX_NS);
+	CHECK(next == POLL_MIN_NS, "empty chain waits %llu", next);
+
+	printf("all:\n");
+	report("  fixed", &fixed);
+	report("  adaptive", &adapt);
+	if (failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	printf("all passed\n");
+	return 0;
+}
@@ -0,0 +1,227 @@
+/*
+ * Host test of the job round cutting, soc_nna_round.h.
+ *
+ * Random programs are cut the way soc_nna_job_build() does it, and the
+ * rounds checked: they cover the chains in order and back to back, each
+ * fits the descriptor ram, only a single chain may exceed half of it, and
+ * every chain's ram index points at its own descriptors. Then a queue of
+ * jobs is streamed through a model of the ram with the driver's load and
+ * prefill rules, and each chain's descriptors are checked in the ram when
+ * the dma starts it and again when it finishes, so a prefill that lands
+ * on the running round shows up.
+ *
+ *   make run
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../soc_nna_round.h"
+
+#define DES_RAM_CNT     2048        //SOC_NNA_MAX_DES_CHN_CNT
+#define MAX_CHAINS      600
+#define MAX_JOBS        4
+
+struct job {
+	unsigned long long des[MAX_CHAINS * DES_RAM_CNT / 8];
+	unsigned int des_cnt;
+	struct soc_nna_job_round rounds[MAX_CHAINS];
+	unsigned int round_num;
+	unsigned int chn[MAX_CHAINS * 2];
+	unsigned int chn_len[MAX_CHAINS * 2];
+	unsigned int chn_num;
+	unsigned int seq;
+};
+
+static struct job jobs[MAX_JOBS];
+static unsigned long long ram[DES_RAM_CNT];
+static unsigned int loaded_seq, loaded_round;
+static unsigned int loads, prefills;
+static int failures;
+
+#define CHECK(cond, ...) do {						\
+	if(!(cond)){							\
+		if(failures++ < 20){					\
+			printf("FAIL %s:%d: ", __func__, __LINE__);	\
+			printf(__VA_ARGS__);				\
+			printf("\n");					\
+		}							\
+	}								\
+} while(0)
+
+static unsigned int rnd(unsigned int n)
+{
+	return n ? (unsigned int)rand() % n : 0;
+}
+
+/* a chain: its rd side, then its wr side, each a count descriptor and commands */
+static unsigned int chain_len(void)
+{
+	switch (rnd(8)) {
+	case 0:
+		return 1025 + rnd(DES_RAM_CNT - 1025 + 1);     /* more than half of the ram */
+	case 1:
+		return SOC_NNA_DES_HALF_CNT - rnd(3);          /* right at the edge */
+	default:
+		return 4 + rnd(200);
+	}
+}
+
+static void build(struct job *job, unsigned int seq, unsigned int chains)
+{
+	struct soc_nna_job_round *round = NULL;
+	unsigned int i, j, n, rd, wr;
+
+	memset(job, 0, sizeof(*job));
+	job->seq = seq;
+	for (i = 0; i < chains; i++) {
+		n = chain_len();
+		if (job->des_cnt + n > sizeof(job->des) / sizeof(job->des[0]))
+			break;
+		rd = job->des_cnt;
+		wr = rd + 1 + rnd(n - 2);
+		for (j = 0; j < n; j++)
+			job->des[rd + j] = (unsigned long long)seq << 32 | (rd + j);
+		job->des_cnt += n;
+
+		round = soc_nna_round_add(job->rounds, &job->round_num, rd, n);
+		job->chn[i * 2] = soc_nna_round_index(round, rd);
+		job->chn[i * 2 + 1] = soc_nna_round_index(round, wr);
+		job->chn_len[i * 2] = wr - rd;
+		job->chn_len[i * 2 + 1] = n - (wr - rd);
+		round->chn_end = ++job->chn_num;
+	}
+}
+
+static void check_rounds(const struct job *job)
+{
+	const struct soc_nna_job_round *r = NULL, *prev = NULL;
+	unsigned int i, des = 0, chn = 0, c;
+
+	for (i = 0; i < job->round_num; i++, prev = r) {
+		r = &job->rounds[i];
+		CHECK(r->des_off == des, "round %u starts at %u, not after the last one at %u", i, r->des_off, des);
+		CHECK(r->chn_end > chn, "round %u is empty", i);
+		CHECK(r->base + r->des_cnt <= DES_RAM_CNT, "round %u: %u at %u overflows the ram", i, r->des_cnt, r->base);
+		CHECK(r->base == 0 || r->base == SOC_NNA_DES_HALF_CNT, "round %u at %u", i, r->base);
+		if (r->des_cnt > SOC_NNA_DES_HALF_CNT)
+			CHECK(r->chn_end == chn + 1 && r->base == 0, "round %u: %u descriptors over half of the ram", i, r->des_cnt);
+		/* a round that does not follow a big one goes to the other half */
+		if (prev && prev->des_cnt <= SOC_NNA_DES_HALF_CNT && r->des_cnt <= SOC_NNA_DES_HALF_CNT)
+			CHECK(!soc_nna_round_overlap(prev, r), "rounds %u and %u share a half", i - 1, i);
+		/* the round is as full as it can be */
+		if (i + 1 < job->round_num && r->des_cnt <= SOC_NNA_DES_HALF_CNT)
+			CHECK(r->des_cnt + job->chn_len[r->chn_end * 2] + job->chn_len[r->chn_end * 2 + 1] > SOC_NNA_DES_HALF_CNT,
+					"round %u closed with room for the next chain", i);
+		for (c = chn; c < r->chn_end; c++) {
+			CHECK(job->chn[c * 2] >= r->base && job->chn[c * 2 + 1] + job->chn_len[c * 2 + 1] <= r->base + r->des_cnt,
+					"chain %u outside its round %u", c, i);
+		}
+		des += r->des_cnt;
+		chn = r->chn_end;
+	}
+	CHECK(des == job->des_cnt, "rounds hold %u of %u descriptors", des, job->des_cnt);
+	CHECK(chn == job->chn_num, "rounds hold %u of %u chains", chn, job->chn_num);
+}
+
+static void load(const struct job *job, unsigned int round)
+{
+	const struct soc_nna_job_round *r = &job->rounds[round];
+
+	memcpy(ram + r->base, job->des + r->des_off, r->des_cnt * sizeof(ram[0]));
+	loaded_seq = job->seq;
+	loaded_round = round;
+}
+
+static int is_loaded(const struct job *job, unsigned int round)
+{
+	return loaded_seq == job->seq && loaded_round == round;
+}
+
+/* soc_nna_job_prefill(): the next round of the job, or the first of the next job */
+static void prefill(unsigned int j, unsigned int round, unsigned int njobs)
+{
+	const struct job *job = &jobs[j];
+	const struct soc_nna_job_round *cur = &job->rounds[round];
+
+	if (round + 1 < job->round_num) {
+		round++;
+	} else {
+		if (++j == njobs)
+			return;
+		job = &jobs[j];
+		round = 0;
+	}
+	if (is_loaded(job, round) || soc_nna_round_overlap(cur, &job->rounds[round]))
+		return;
+	load(job, round);
+	prefills++;
+}
+
+/* the dma reads the chain's rd and wr descriptors from the ram */
+static void check_chain(const struct job *job, unsigned int c, const char *when)
+{
+	unsigned int side, k, idx;
+
+	for (side = 0; side < 2; side++) {
+		for (k = 0; k < job->chn_len[c * 2 + side]; k++) {
+			idx = job->chn[c * 2 + side] + k;
+			if (idx >= DES_RAM_CNT || (ram[idx] >> 32) != job->seq) {
+				CHECK(0, "job %u chain %u %s: ram[%u] holds job %llu", job->seq, c, when, idx, ram[idx] >> 32);
+				return;
+			}
+		}
+	}
+	idx = job->chn[c * 2];
+	CHECK(ram[idx] == job->des[ram[idx] & 0xffffffff] && (ram[idx] & 0xffffffff) + job->chn[c * 2 + 1] - idx
+			== (ram[job->chn[c * 2 + 1]] & 0xffffffff), "job %u chain %u %s: wrong descriptors", job->seq, c, when);
+}
+
+static void stream(unsigned int njobs)
+{
+	unsigned int j, round, c;
+
+	memset(ram, 0, sizeof(ram));
+	loaded_seq = 0;
+	for (j = 0; j < njobs; j++) {
+		c = 0;
+		for (round = 0; round < jobs[j].round_num; round++) {
+			/* soc_nna_job_round_start() */
+			if (!is_loaded(&jobs[j], round)) {
+				load(&jobs[j], round);
+				loads++;
+			}
+			for (; c < jobs[j].rounds[round].chn_end; c++) {
+				check_chain(&jobs[j], c, "started");
+				if (c == (round ? jobs[j].rounds[round - 1].chn_end : 0))
+					prefill(j, round, njobs);
+				check_chain(&jobs[j], c, "finished");
+			}
+		}
+	}
+}
+
+int main(int argc, const char *argv[])
+{
+	unsigned int trials = argc > 1 ? atoi(argv[1]) : 300;
+	unsigned int t, j, njobs, rounds = 0, chains = 0;
+
+	srand(1);
+	for (t = 0; t < trials; t++) {
+		njobs = 1 + rnd(MAX_JOBS);
+		for (j = 0; j < njobs; j++) {
+			build(&jobs[j], t * MAX_JOBS + j + 1, 1 + rnd(t % 3 ? 60 : MAX_CHAINS));
+			check_rounds(&jobs[j]);
+			rounds += jobs[j].round_num;
+			chains += jobs[j].chn_num;
+		}
+		stream(njobs);
+	}
+	printf("%u trials: %u chains in %u rounds, %u loaded when due, %u prefilled\n",
+			trials, chains, rounds, loads, prefills);
+	if (failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	printf("all passed\n");
+	return 0;
+}
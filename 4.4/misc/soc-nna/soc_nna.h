@@ -23,6 +23,9 @@
 #define IOCTL_SOC_NNA_RDCH_START    _IOWR(SOC_NNA_MAGIC, 4, int)
 #define IOCTL_SOC_NNA_WRCH_START    _IOWR(SOC_NNA_MAGIC, 5, int)
 #define IOCTL_SOC_NNA_VERSION    	_IOWR(SOC_NNA_MAGIC, 6, int)
+#define IOCTL_SOC_NNA_SUBMIT        _IOWR(SOC_NNA_MAGIC, 7, int)
+#define IOCTL_SOC_NNA_WAIT          _IOWR(SOC_NNA_MAGIC, 8, int)
+#define IOCTL_SOC_NNA_SYNC_VEC      _IOWR(SOC_NNA_MAGIC, 9, int)
 
 /*
  * dir value defined in  enum dma_data_direction in linux/dma-direction.h
@@ -40,6 +43,21 @@ struct soc_nna_buf {
     int         size;
 };
 
+/* a range of a buffer from IOCTL_SOC_NNA_MALLOC, handle is its paddr */
+struct soc_nna_sync_entry {
+    unsigned int    handle;
+    unsigned int    offset;
+    unsigned int    len;
+    unsigned int    dir;        /* as for flush_cache_info */
+};
+
+struct soc_nna_sync_vec {
+    struct soc_nna_sync_entry   *entries;
+    unsigned int                num;        /* SOC_NNA_SYNC_MAX at most */
+    unsigned int                synced;     /* out: ranges synced one by one */
+    unsigned int                full;       /* out: 1 if the whole cache was flushed instead */
+};
+
 typedef struct nna_dma_cmd {
     unsigned int    d_va_st_addr;
     unsigned int    o_va_st_addr;
@@ -66,4 +84,40 @@ typedef struct nna_dma_cmd_set {
     des_gen_result_t    des_rslt;
 } nna_dma_cmd_set_t;
 
+/*
+ * A job is a descriptor program, described as for IOCTL_SOC_NNA_SETUP_DES,
+ * that the driver runs chain after chain on its own once the jobs queued
+ * before it are done. It is not limited to the descriptor ram, the driver
+ * streams it in, so des_rslt comes back finished. in is written back
+ * when the job is submitted, out is invalidated when it is reaped; leave
+ * their len at 0 to skip that. SUBMIT fails with EBUSY while a process
+ * has the dma window (0x12500000, the descriptor ram) mapped.
+ */
+struct soc_nna_job {
+    nna_dma_cmd_set_t   cmd_set;
+    unsigned int        in_addr;
+    unsigned int        in_len;
+    unsigned int        out_addr;
+    unsigned int        out_len;
+    unsigned int        tag;        /* reported back as is */
+    unsigned int        seq;        /* out: fence of the job, never 0 */
+};
+
+/* a finished job, read() returns an array of them */
+struct soc_nna_job_done {
+    unsigned int    seq;
+    unsigned int    tag;
+    int             status;         /* 0, or -ETIMEDOUT if the dma did not finish */
+    unsigned int    queue_us;       /* submitted to started */
+    unsigned int    exec_us;        /* started to finished */
+    unsigned long long  rd_bytes;   /* moved by the rd and wr chains */
+    unsigned long long  wr_bytes;
+};
+
+struct soc_nna_wait {
+    unsigned int            seq;        /* 0 for the oldest job of the fd */
+    int                     timeout_ms; /* < 0 waits forever */
+    struct soc_nna_job_done done;       /* out */
+};
+
 #endif
@@ -5,10 +5,15 @@
 
 #include "soc_nna.h"
 #include "soc_nna_hw.h"
+#include "soc_nna_round.h"
+#include "soc_nna_poll.h"
 
 extern struct platform_device soc_nna_device;
 #define SOC_NNA_MAX_DES_CHN_CNT     2048        //16384 / 8 = 2048
 #define SOC_NNA_ADDR_ALIGN_BIT      6LL
+#define SOC_NNA_JOB_DEPTH           16          //jobs an fd may have outstanding
+#define SOC_NNA_JOB_MAX_DES         (1 << 20)   //8MB of descriptors per job
+#define SOC_NNA_SYNC_MAX            256         //ranges per IOCTL_SOC_NNA_SYNC_VEC
 
 typedef struct nna_dma_des_info {
     unsigned long long int      des_data[SOC_NNA_MAX_DES_CHN_CNT];
@@ -7,6 +7,10 @@
 #define SOC_NNA_DMA_DESRAM_ADDR     0x1250f000
 #define SOC_NNA_DMA_DESRAM_SIZE     0x4000          //16*1024
 
+/* the dma registers up to the end of the descriptor ram, the job queue is off while it is mapped */
+#define SOC_NNA_DMA_WINDOW_ADDR     0x12500000
+#define SOC_NNA_DMA_WINDOW_END      (SOC_NNA_DMA_DESRAM_ADDR + SOC_NNA_DMA_DESRAM_SIZE)
+
 #define NNA_DMA_RCFG            0x0
 #define NNA_DMA_WCFG            0x4
 #define NNA_DMA_RCNT            0x8
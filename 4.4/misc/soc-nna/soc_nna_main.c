@@ -5,11 +5,27 @@
 #include <linux/syscalls.h>
 #include <linux/slab.h>
 #include <linux/dma-mapping.h>
+#include <linux/debugfs.h>
+#include <linux/genalloc.h>
+#include <linux/hashtable.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/poll.h>
+#include <linux/seq_file.h>
+#include <linux/spinlock.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
 
 
 #include <linux/fs.h>
 #include <linux/uaccess.h>
 
+#include <asm/addrspace.h>
+#include <asm/cpu-features.h>
+#include <asm/cpu-info.h>
+#include <asm/io.h>
+
 #include "soc_nna_common.h"
 
 #define CPU_SIMULATOR
@@ -30,6 +46,30 @@ static int nna_clk = 200000000;
 module_param(nna_clk, int, S_IRUGO);
 MODULE_PARM_DESC(nna_clk, "nna clock");
 
+static int job_poll_us = 1000;
+module_param(job_poll_us, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(job_poll_us, "the longest wait between two checks of a running job chain");
+
+static int job_poll_min_us = 20;
+module_param(job_poll_min_us, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(job_poll_min_us, "the shortest wait between two checks of a running job chain");
+
+static int job_timeout_ms = 1000;
+module_param(job_timeout_ms, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(job_timeout_ms, "a job chain the dma has not finished by then is stopped");
+
+static int pool_chunk_kb = 4096;
+module_param(pool_chunk_kb, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(pool_chunk_kb, "the buffer pool grows by this much contiguous memory (KiB)");
+
+static int job_trace = 0;
+module_param(job_trace, int, S_IRUGO);
+MODULE_PARM_DESC(job_trace, "job chains kept in the debugfs trace, 0 for none");
+
+static int sync_full_kb = 0;
+module_param(sync_full_kb, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(sync_full_kb, "a vectored sync of more than this flushes the whole cache (KiB, never below the cache size)");
+
 static uint32_t  num_all = 0;
 struct buf{
 	uint32_t version_buf;
@@ -56,6 +96,37 @@ do {                                \
 	);                              \
 } while(0)
 
+/* what the jobs did, in total and per fd */
+struct soc_nna_prof {
+	unsigned long       jobs;
+	unsigned long       chains;
+	unsigned long       timeouts;
+	u64                 busy_ns;    /* started to finished */
+	u64                 queue_ns;   /* submitted to started */
+	u64                 build_ns;   /* descriptor generation in the submit */
+	u64                 load_ns;    /* descriptor copies the dma had to wait for */
+	unsigned long       loads;      /* rounds copied in when due */
+	unsigned long       prefills;   /* rounds copied in ahead */
+	unsigned long       polls;      /* job timer wakeups while it ran */
+	u64                 rd_bytes;
+	u64                 wr_bytes;
+};
+
+/* a finished job chain */
+struct soc_nna_trace {
+	unsigned int        seq;
+	unsigned int        tag;
+	pid_t               tgid;
+	unsigned int        chain;
+	int                 status;
+	unsigned int        rd_bytes;
+	unsigned int        wr_bytes;
+	unsigned int        rcnt;       /* NNA_DMA_RCNT and WCNT as the chain ended, raw */
+	unsigned int        wcnt;
+	u64                 start_ns;
+	u64                 end_ns;
+};
+
 struct soc_nna {
 	char                name[16];
 	struct miscdevice   mdev;       /* miscdevice */
@@ -68,25 +139,127 @@ struct soc_nna {
 	struct clk          *clk_gate;
 #endif
 	struct mutex        mlock;
-	struct list_head    memory_list;
 	struct kmem_cache   *memory_cache;
 
+	/* buffer pool, under mlock */
+	struct gen_pool     *pool;
+	struct list_head    pool_regions;
+	size_t              pool_size;
+	size_t              pool_used;
+	size_t              pool_peak;
+	unsigned long       pool_allocs;
+	unsigned long       pool_grows;
+	DECLARE_HASHTABLE(buf_hash, 8);     /* buffers by paddr */
+	struct list_head    file_list;
+	struct dentry       *debugfs;
+
+	/* vectored sync, under mlock */
+	unsigned long       sync_calls;
+	unsigned long       sync_entries;
+	unsigned long       sync_full;
+	u64                 sync_ns;
+	u64                 sync_max_ns;
+
+	/* profiling, under job_lock */
+	struct soc_nna_prof prof;
+	u64                 prof_since_ns;
+	struct soc_nna_trace *trace;        /* job_trace entries */
+	unsigned int        trace_size;
+	unsigned long       trace_head;     /* chains traced so far */
+
 	nna_dma_des_info_t  des_info[2];
+
+	/* job queue, under job_lock */
+	spinlock_t          job_lock;
+	struct list_head    job_queue;
+	struct soc_nna_job_ctx *job_running;
+	struct hrtimer      job_timer;
+	bool                job_timer_on;
+	struct soc_nna_poll job_poll;           /* when to look at the running chain */
+	wait_queue_head_t   job_wait;
+	unsigned int        job_seq;
+	unsigned int        job_loaded_seq;     /* the round last copied into the descriptor ram, */
+	unsigned int        job_loaded_round;   /* seq 0 when the ram holds no job round */
+	unsigned int        dma_maps;           /* userspace mappings of the dma window */
 };
 
 struct soc_nna_memory_cache {
-	struct list_head    list;
+	struct list_head    list;       /* on the owner's mem_list */
+	struct hlist_node   node;       /* in buf_hash */
+	struct soc_nna_file *owner;
 	struct soc_nna_buf  buf;
 };
 
+/* a contiguous block the pool carves buffers from */
+struct soc_nna_pool_region {
+	struct list_head    list;
+	void                *vaddr;
+	dma_addr_t          paddr;
+	size_t              size;
+};
+
+/* per open file */
+struct soc_nna_file {
+	struct soc_nna      *pnna;
+	struct list_head    done_list;  /* finished jobs not reaped yet */
+	unsigned int        jobs;       /* queued, running or done, under job_lock */
+
+	/* buffers, under mlock */
+	struct list_head    list;       /* on file_list */
+	pid_t               tgid;
+	struct list_head    mem_list;
+	size_t              mem_size;
+	size_t              mem_peak;
+	unsigned int        mem_bufs;
+
+	struct soc_nna_prof prof;       /* under job_lock */
+};
+
+struct soc_nna_job_ctx {
+	struct list_head        list;       /* on job_queue, then on the owner's done_list */
+	struct soc_nna_file     *owner;
+	struct mm_struct        *mm;
+	unsigned long long int  *des;       /* the whole program, round after round */
+	unsigned int            des_cnt;
+	struct soc_nna_job_round *rounds;
+	unsigned int            round_num;
+	unsigned int            round_idx;  /* the round the dma runs */
+	unsigned int            *chn;       /* rd and wr descriptor ram index of each chain */
+	unsigned int            *chn_bytes; /* rd and wr bytes of each chain */
+	unsigned int            chn_num;
+	unsigned int            chn_idx;    /* the chain the dma runs */
+	unsigned int            out_addr;
+	unsigned int            out_len;
+	u64                     submit_ns;
+	u64                     start_ns;
+	u64                     chain_ns;   /* the running chain was started */
+	u64                     build_ns;
+	u64                     load_ns;
+	unsigned int            loads;
+	unsigned int            prefills;
+	unsigned int            polls;
+	struct soc_nna_job_done done;
+};
+
 int soc_nna_open(struct inode *inode, struct file *file)
 {
 	struct miscdevice *mdev = file->private_data;
 	struct soc_nna *pnna = list_entry(mdev, struct soc_nna, mdev);
+	struct soc_nna_file *pfile = NULL;
 	bool b_first_open = false;
 	unsigned int cp0_status = 0;
 
+	pfile = kzalloc(sizeof(*pfile), GFP_KERNEL);
+	if (!pfile)
+		return -ENOMEM;
+	pfile->pnna = pnna;
+	INIT_LIST_HEAD(&pfile->done_list);
+	INIT_LIST_HEAD(&pfile->mem_list);
+	pfile->tgid = current->tgid;
+	file->private_data = pfile;
+
 	mutex_lock(&pnna->mlock);
+	list_add_tail(&pfile->list, &pnna->file_list);
 #ifdef CONFIG_SOC_T41
 	__asm__ volatile(
 			".set push		\n\t"
@@ -131,29 +304,32 @@ int soc_nna_open(struct inode *inode, struct file *file)
 	return 0;
 }
 
+static void soc_nna_job_release(struct soc_nna_file *pfile);
+static void soc_nna_buf_put(struct soc_nna *pnna, struct soc_nna_memory_cache *pelem);
+static void soc_nna_pool_destroy(struct soc_nna *pnna);
+
 int soc_nna_release(struct inode *inode, struct file *file)
 {
-	struct miscdevice *mdev = file->private_data;
-	struct soc_nna *pnna = list_entry(mdev, struct soc_nna, mdev);
+	struct soc_nna_file *pfile = file->private_data;
+	struct soc_nna *pnna = pfile->pnna;
+	struct soc_nna_memory_cache *pelem = NULL, *n = NULL;
 	bool b_last_release = false;
 
+	soc_nna_job_release(pfile);
+
 	mutex_lock(&pnna->mlock);
+	/* the buffers of the fd, nothing maps them any more once it is released */
+	list_for_each_entry_safe(pelem, n, &pfile->mem_list, list)
+		soc_nna_buf_put(pnna, pelem);
+	list_del(&pfile->list);
 	if ((pnna->refcnt > 0) && (--pnna->refcnt == 0)) {
 		b_last_release = true;
+		soc_nna_pool_destroy(pnna);
 	}
 	mutex_unlock(&pnna->mlock);
+	kfree(pfile);
 
 	if (b_last_release) {
-		struct soc_nna_memory_cache *pelem = NULL;
-		struct list_head *pos = NULL, *n = NULL;
-		mutex_lock(&pnna->mlock);
-		list_for_each_safe(pos, n, &pnna->memory_list) {
-			pelem = list_entry(pos, struct soc_nna_memory_cache, list);
-			list_del(pos);
-			dma_free_coherent(pnna->mdev.this_device, pelem->buf.size, pelem->buf.vaddr, (dma_addr_t)pelem->buf.paddr);
-			kmem_cache_free(pnna->memory_cache, pelem);
-		}
-		mutex_unlock(&pnna->mlock);
 #ifndef CPU_SIMULATOR
 		clk_disable(pnna->clk);
 		clk_disable(pnna->clk_gate);
@@ -171,30 +347,173 @@ static loff_t soc_nna_llseek(struct file *file, loff_t offset, int origin)
 	return 0;
 }
 
-static ssize_t soc_nna_read(struct file *file, char *buf, size_t size, loff_t *offset)
+/*
+ * Buffers are carved from a pool of a few large contiguous regions, best
+ * fit, instead of one dma_alloc_coherent() each: a model with hundreds of
+ * tensors loads without hundreds of CMA allocations and without scattering
+ * them over CMA. The pool grows by pool_chunk_kb, or by the size of a
+ * bigger buffer, and goes back to CMA when the last fd is closed. Every
+ * buffer belongs to the fd that allocated it and is freed when that fd is
+ * released. Everything here is under mlock.
+ */
+static int soc_nna_pool_grow(struct soc_nna *pnna, size_t size)
 {
-	//TODO
+	struct soc_nna_pool_region *region = NULL;
+	void *page = NULL, *endpage = NULL;
+
+	if (!pnna->pool) {
+		pnna->pool = gen_pool_create(PAGE_SHIFT, -1);
+		if (!pnna->pool)
+			return -ENOMEM;
+		gen_pool_set_algo(pnna->pool, gen_pool_best_fit, NULL);
+	}
+
+	region = kzalloc(sizeof(*region), GFP_KERNEL);
+	if (!region)
+		return -ENOMEM;
+
+	region->size = max_t(size_t, size, PAGE_ALIGN((size_t)pool_chunk_kb * 1024));
+	region->vaddr = dma_alloc_coherent(pnna->mdev.this_device, region->size, &region->paddr, GFP_KERNEL);
+	if (!region->vaddr && region->size > size) {
+		/* no room for a whole chunk, just the buffer then */
+		region->size = size;
+		region->vaddr = dma_alloc_coherent(pnna->mdev.this_device, region->size, &region->paddr, GFP_KERNEL);
+	}
+	if (!region->vaddr) {
+		kfree(region);
+		return -ENOMEM;
+	}
+
+	if (gen_pool_add_virt(pnna->pool, (unsigned long)region->vaddr, region->paddr, region->size, -1)) {
+		dma_free_coherent(pnna->mdev.this_device, region->size, region->vaddr, region->paddr);
+		kfree(region);
+		return -ENOMEM;
+	}
+
+	endpage = region->vaddr + region->size;
+	for (page = region->vaddr; page < endpage; page += PAGE_SIZE) {
+		SetPageReserved(virt_to_page(page));
+	}
+
+	list_add_tail(&region->list, &pnna->pool_regions);
+	pnna->pool_size += region->size;
+	pnna->pool_grows++;
+
 	return 0;
 }
 
-static ssize_t soc_nna_write(struct file *file, const char *buf, size_t size, loff_t *offset)
+/* once every buffer is freed */
+static void soc_nna_pool_destroy(struct soc_nna *pnna)
 {
-	//TODO
-	return 0;
+	struct soc_nna_pool_region *region = NULL, *n = NULL;
+	void *page = NULL, *endpage = NULL;
+
+	if (!pnna->pool)
+		return;
+
+	gen_pool_destroy(pnna->pool);
+	pnna->pool = NULL;
+
+	list_for_each_entry_safe(region, n, &pnna->pool_regions, list) {
+		endpage = region->vaddr + region->size;
+		for (page = region->vaddr; page < endpage; page += PAGE_SIZE) {
+			ClearPageReserved(virt_to_page(page));
+		}
+		list_del(&region->list);
+		dma_free_coherent(pnna->mdev.this_device, region->size, region->vaddr, region->paddr);
+		kfree(region);
+	}
+	pnna->pool_size = 0;
 }
 
-static unsigned int soc_nna_poll(struct file *file, struct poll_table_struct *poll_table)
+static struct soc_nna_memory_cache *soc_nna_buf_get(struct soc_nna_file *pfile, size_t size)
 {
-	//TODO
+	struct soc_nna *pnna = pfile->pnna;
+	struct soc_nna_memory_cache *pelem = NULL;
+	unsigned long vaddr = 0;
+
+	pelem = kmem_cache_alloc(pnna->memory_cache, GFP_KERNEL);
+	if (!pelem)
+		return NULL;
+
+	if (pnna->pool)
+		vaddr = gen_pool_alloc(pnna->pool, size);
+	if (!vaddr && !soc_nna_pool_grow(pnna, size))
+		vaddr = gen_pool_alloc(pnna->pool, size);
+	if (!vaddr) {
+		kmem_cache_free(pnna->memory_cache, pelem);
+		return NULL;
+	}
+
+	/* dma_alloc_coherent() handed out zeroed memory, and the last user may have been another process */
+	memset((void *)vaddr, 0, size);
+
+	pelem->buf.vaddr = (void *)vaddr;
+	pelem->buf.paddr = (void *)gen_pool_virt_to_phys(pnna->pool, vaddr);
+	pelem->buf.size = size;
+	pelem->owner = pfile;
+	list_add_tail(&pelem->list, &pfile->mem_list);
+	hash_add(pnna->buf_hash, &pelem->node, (unsigned long)pelem->buf.paddr);
+
+	pfile->mem_size += size;
+	pfile->mem_bufs++;
+	if (pfile->mem_size > pfile->mem_peak)
+		pfile->mem_peak = pfile->mem_size;
+	pnna->pool_used += size;
+	pnna->pool_allocs++;
+	if (pnna->pool_used > pnna->pool_peak)
+		pnna->pool_peak = pnna->pool_used;
+
+	return pelem;
+}
+
+static void soc_nna_buf_put(struct soc_nna *pnna, struct soc_nna_memory_cache *pelem)
+{
+	struct soc_nna_file *pfile = pelem->owner;
+
+	hash_del(&pelem->node);
+	list_del(&pelem->list);
+	gen_pool_free(pnna->pool, (unsigned long)pelem->buf.vaddr, pelem->buf.size);
+
+	pfile->mem_size -= pelem->buf.size;
+	pfile->mem_bufs--;
+	pnna->pool_used -= pelem->buf.size;
+
+	kmem_cache_free(pnna->memory_cache, pelem);
+}
+
+static struct soc_nna_memory_cache *soc_nna_buf_lookup(struct soc_nna *pnna, unsigned long paddr)
+{
+	struct soc_nna_memory_cache *pelem = NULL;
+
+	hash_for_each_possible(pnna->buf_hash, pelem, node, paddr) {
+		if ((unsigned long)pelem->buf.paddr == paddr)
+			return pelem;
+	}
+
+	return NULL;
+}
+
+/* commands from paddr to the end of the fd's buffer holding it, called with mlock held */
+static unsigned int soc_nna_buf_cmds(struct soc_nna_file *pfile, unsigned long paddr)
+{
+	struct soc_nna_memory_cache *pelem = NULL;
+	unsigned long start = 0;
+
+	list_for_each_entry(pelem, &pfile->mem_list, list) {
+		start = (unsigned long)pelem->buf.paddr;
+		if (paddr >= start && paddr - start < pelem->buf.size)
+			return (pelem->buf.size - (paddr - start)) / sizeof(nna_dma_cmd_t);
+	}
+
 	return 0;
 }
 
-static long soc_nna_malloc(struct soc_nna *pnna, long usr_arg)
+static long soc_nna_malloc(struct soc_nna_file *pfile, long usr_arg)
 {
-	long ret = 0;
+	struct soc_nna *pnna = pfile->pnna;
 	struct soc_nna_buf buf;
 	struct soc_nna_memory_cache *pelem = NULL;
-	void *page = NULL, *endpage = NULL;
 	unsigned int cp0_status = 0;
 
 	__asm__ volatile (" li   $t8, 0xffffffff \n"
@@ -210,61 +529,40 @@ static long soc_nna_malloc(struct soc_nna *pnna, long usr_arg)
 
 	if (copy_from_user(&buf, (void *)usr_arg, sizeof(buf))) {
 		dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:copy_from_user failed\n", __func__, __LINE__, current->tgid, current->pid);
-		ret = -EFAULT;
-		goto err_copy_from_user;
-	}
-
-	pelem = kmem_cache_alloc(pnna->memory_cache, GFP_ATOMIC);
-	if (!pelem) {
-		dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:kmem_cache_alloc failed\n", __func__, __LINE__, current->tgid, current->pid);
-		ret = -ENOMEM;
-		goto err_kmem_cache_alloc;
+		return -EFAULT;
 	}
 
+	if (buf.size <= 0)
+		return -EINVAL;
 	buf.size = PAGE_ALIGN(buf.size);
-	buf.vaddr = dma_alloc_coherent(pnna->mdev.this_device, buf.size, (dma_addr_t *)&buf.paddr, GFP_KERNEL);
-	if (!buf.vaddr) {
-		dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:dma_alloc_coherent failed\n", __func__, __LINE__, current->tgid, current->pid);
-		ret = -ENOMEM;
-		goto err_dma_alloc_coherent;
-	}
 
-	endpage = buf.vaddr + buf.size;
-	for (page = buf.vaddr; page < endpage; page += PAGE_SIZE) {
-		SetPageReserved(virt_to_page(page));
+	mutex_lock(&pnna->mlock);
+	pelem = soc_nna_buf_get(pfile, buf.size);
+	if (pelem)
+		memcpy(&buf, &pelem->buf, sizeof(buf));
+	mutex_unlock(&pnna->mlock);
+	if (!pelem) {
+		dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:no pool memory for 0x%x bytes\n", __func__, __LINE__, current->tgid, current->pid, buf.size);
+		return -ENOMEM;
 	}
 
-	memcpy(&pelem->buf, &buf, sizeof(buf));
-
 	if (copy_to_user((void *)usr_arg, &buf, sizeof(buf))) {
 		dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:copy_to_user failed\n", __func__, __LINE__, current->tgid, current->pid);
-		ret = -EFAULT;
-		goto err_copy_to_user;
+		mutex_lock(&pnna->mlock);
+		soc_nna_buf_put(pnna, pelem);
+		mutex_unlock(&pnna->mlock);
+		return -EFAULT;
 	}
 
-	mutex_lock(&pnna->mlock);
-	list_add_tail(&pelem->list, &pnna->memory_list);
-	mutex_unlock(&pnna->mlock);
-
-	dev_info(pnna->mdev.this_device, "%s(%d) [%d:%d]:malloc success, buf.vaddr=%p, buf.paddr=%p, buf.size=0x%x\n", __func__, __LINE__, current->tgid, current->pid, buf.vaddr, buf.paddr, buf.size);
-
 	return 0;
-
-err_copy_to_user:
-	dma_free_coherent(pnna->mdev.this_device, buf.size, buf.vaddr, (dma_addr_t)buf.paddr);
-err_dma_alloc_coherent:
-	kmem_cache_free(pnna->memory_cache, pelem);
-err_kmem_cache_alloc:
-err_copy_from_user:
-	return ret;
 }
 
-static long soc_nna_free(struct soc_nna *pnna, long usr_arg)
+static long soc_nna_free(struct soc_nna_file *pfile, long usr_arg)
 {
 	long ret = -1;
+	struct soc_nna *pnna = pfile->pnna;
 	struct soc_nna_buf buf;
 	struct soc_nna_memory_cache *pelem = NULL;
-	struct list_head *pos = NULL, *n = NULL;
 
 	if (copy_from_user(&buf, (void *)usr_arg, sizeof(buf))) {
 		dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:copy_from_user failed\n", __func__, __LINE__, current->tgid, current->pid);
@@ -272,22 +570,52 @@ static long soc_nna_free(struct soc_nna *pnna, long usr_arg)
 	}
 
 	mutex_lock(&pnna->mlock);
-	list_for_each_safe(pos, n, &pnna->memory_list) {
-		pelem = list_entry(pos, struct soc_nna_memory_cache, list);
-		if ((pelem->buf.vaddr == buf.vaddr) && (pelem->buf.paddr == buf.paddr)) {
-			list_del(pos);
-			dma_free_coherent(pnna->mdev.this_device, pelem->buf.size, pelem->buf.vaddr, (dma_addr_t)pelem->buf.paddr);
-			kmem_cache_free(pnna->memory_cache, pelem);
-			dev_info(pnna->mdev.this_device, "%s(%d) [%d:%d]:free success, buf.vaddr=%p, buf.paddr=%p, buf.size=0x%x\n", __func__, __LINE__, current->tgid, current->pid, buf.vaddr, buf.paddr, buf.size);
-			ret = 0;
-			break;
-		}
+	pelem = soc_nna_buf_lookup(pnna, (unsigned long)buf.paddr);
+	/* only the fd that allocated a buffer frees it */
+	if (pelem && pelem->buf.vaddr == buf.vaddr && pelem->owner == pfile) {
+		soc_nna_buf_put(pnna, pelem);
+		ret = 0;
 	}
 	mutex_unlock(&pnna->mlock);
 
 	return ret;
 }
 
+static int soc_nna_pool_show(struct seq_file *m, void *v)
+{
+	struct soc_nna *pnna = m->private;
+	struct soc_nna_file *pfile = NULL;
+
+	mutex_lock(&pnna->mlock);
+	seq_printf(m, "chunk_kb:   %d\n", pool_chunk_kb);
+	seq_printf(m, "size_kb:    %zu\n", pnna->pool_size >> 10);
+	seq_printf(m, "used_kb:    %zu\n", pnna->pool_used >> 10);
+	seq_printf(m, "peak_kb:    %zu\n", pnna->pool_peak >> 10);
+	seq_printf(m, "allocs:     %lu\n", pnna->pool_allocs);
+	seq_printf(m, "grows:      %lu\n", pnna->pool_grows);
+	seq_printf(m, "%8s %8s %10s %10s\n", "tgid", "bufs", "used_kb", "peak_kb");
+	list_for_each_entry(pfile, &pnna->file_list, list) {
+		seq_printf(m, "%8d %8u %10zu %10zu\n", pfile->tgid, pfile->mem_bufs,
+			   pfile->mem_size >> 10, pfile->mem_peak >> 10);
+	}
+	mutex_unlock(&pnna->mlock);
+
+	return 0;
+}
+
+static int soc_nna_pool_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, soc_nna_pool_show, inode->i_private);
+}
+
+static const struct file_operations soc_nna_pool_fops = {
+	.owner		= THIS_MODULE,
+	.open		= soc_nna_pool_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 long soc_nna_flushcache(struct soc_nna *pnna, long usr_arg)
 {
 	struct flush_cache_info info;
@@ -311,12 +639,55 @@ long soc_nna_flushcache(struct soc_nna *pnna, long usr_arg)
 	return 0;
 }
 
-static void soc_nna_analysis_des(struct soc_nna *pnna, unsigned int st_idx, unsigned int cmd_cnt, nna_dma_cmd_t *d_va_cmd, nna_dma_des_info_t *des_info)
+/* the descriptors moving one command, two per 64KB at most, returns how many */
+static unsigned int soc_nna_cmd_des(nna_dma_cmd_t *pcmd, unsigned long long int *des)
 {
-	int i = 0, j = 0;
-	int c64kcnt = 0;
-	unsigned int remain_bytes = 0, trans_bytes = 0, last_des = 0, cur_trans_bytes = 0, total_bytes = 0;
+	int j = 0;
+	int c64kcnt = ((pcmd->data_bytes - 1) >> 16) + 1;
+	unsigned int remain_bytes = pcmd->data_bytes, trans_bytes = 0, last_des = 0, cur_trans_bytes = 0;
 	unsigned int d_pa_st_addr = 0, o_pa_st_addr = 0, o_pa_mlc_addr = 0, o_pa_mlc_end_addr = 0;
+	unsigned int widx = 0;
+
+	NNADMA_VA_2_PA(pcmd->d_va_st_addr, d_pa_st_addr);
+	NNADMA_VA_2_PA(pcmd->o_va_st_addr, o_pa_st_addr);
+	NNADMA_VA_2_PA(pcmd->o_va_mlc_addr, o_pa_mlc_addr);
+	o_pa_mlc_end_addr = o_pa_mlc_addr + pcmd->o_mlc_bytes;
+
+	for (j = 0; j < c64kcnt; j++) {
+		last_des = (j == (c64kcnt - 1)) ? 1 : 0;
+		trans_bytes = last_des ? remain_bytes : 65536;
+
+		if ((o_pa_st_addr + trans_bytes) <= o_pa_mlc_end_addr) {
+			des[widx++] = ((((last_des && !pcmd->des_link) ? DES_CFG_END : DES_CFG_LINK) << DES_CFG_FLAG) & DES_CFG_FLAG_MASK)
+				| (((((unsigned long long int)trans_bytes >> SOC_NNA_ADDR_ALIGN_BIT) - 1ULL) << DES_DATA_LEN) & DES_DATA_LEN_MASK)
+				| ((((unsigned long long int)o_pa_st_addr >> SOC_NNA_ADDR_ALIGN_BIT) << DES_ORAM_ADDR) & DES_ORAM_ADDR_MASK)
+				| ((((unsigned long long int)d_pa_st_addr >> SOC_NNA_ADDR_ALIGN_BIT) << DES_DDR_ADDR) & DES_DDR_ADDR_MASK);
+			d_pa_st_addr += trans_bytes;
+			o_pa_st_addr += trans_bytes;
+		} else {
+			cur_trans_bytes = o_pa_mlc_end_addr - o_pa_st_addr;
+			des[widx++] = ((DES_CFG_LINK << DES_CFG_FLAG) & DES_CFG_FLAG_MASK)
+				| (((((unsigned long long int)cur_trans_bytes >> SOC_NNA_ADDR_ALIGN_BIT) - 1ULL) << DES_DATA_LEN) & DES_DATA_LEN_MASK)
+				| ((((unsigned long long int)o_pa_st_addr >> SOC_NNA_ADDR_ALIGN_BIT) << DES_ORAM_ADDR) & DES_ORAM_ADDR_MASK)
+				| ((((unsigned long long int)d_pa_st_addr >> SOC_NNA_ADDR_ALIGN_BIT) << DES_DDR_ADDR) & DES_DDR_ADDR_MASK);
+
+			des[widx++] = ((((last_des && !pcmd->des_link) ? DES_CFG_END : DES_CFG_LINK) << DES_CFG_FLAG) & DES_CFG_FLAG_MASK)
+				| (((((unsigned long long int)(trans_bytes - cur_trans_bytes) >> SOC_NNA_ADDR_ALIGN_BIT) - 1ULL) << DES_DATA_LEN) & DES_DATA_LEN_MASK)
+				| ((((unsigned long long int)o_pa_mlc_addr >> SOC_NNA_ADDR_ALIGN_BIT) << DES_ORAM_ADDR) & DES_ORAM_ADDR_MASK)
+				| ((((unsigned long long int)(d_pa_st_addr + cur_trans_bytes) >> SOC_NNA_ADDR_ALIGN_BIT) << DES_DDR_ADDR) & DES_DDR_ADDR_MASK);
+			d_pa_st_addr += trans_bytes;
+			o_pa_st_addr = o_pa_mlc_addr + (trans_bytes - cur_trans_bytes);
+		}
+		remain_bytes -= trans_bytes;
+	}
+
+	return widx;
+}
+
+static void soc_nna_analysis_des(struct soc_nna *pnna, unsigned int st_idx, unsigned int cmd_cnt, nna_dma_cmd_t *d_va_cmd, nna_dma_des_info_t *des_info)
+{
+	int i = 0;
+	unsigned int total_bytes = 0, n = 0;
 	nna_dma_cmd_t *pcmd = NULL;
 	unsigned int widx = 0, des_num = 0, chain_st_idx = st_idx;
 
@@ -324,42 +695,9 @@ static void soc_nna_analysis_des(struct soc_nna *pnna, unsigned int st_idx, unsi
 
 	for (i = st_idx; i < cmd_cnt; i++) {
 		pcmd = d_va_cmd + i;
-		c64kcnt = ((pcmd->data_bytes - 1) >> 16) + 1;
-		remain_bytes = pcmd->data_bytes;
-		NNADMA_VA_2_PA(pcmd->d_va_st_addr, d_pa_st_addr);
-		NNADMA_VA_2_PA(pcmd->o_va_st_addr, o_pa_st_addr);
-		NNADMA_VA_2_PA(pcmd->o_va_mlc_addr, o_pa_mlc_addr);
-		o_pa_mlc_end_addr = o_pa_mlc_addr + pcmd->o_mlc_bytes;
-
-		for (j = 0; j < c64kcnt; j++) {
-			last_des = (j == (c64kcnt - 1)) ? 1 : 0;
-			trans_bytes = last_des ? remain_bytes : 65536;
-
-			if ((o_pa_st_addr + trans_bytes) <= o_pa_mlc_end_addr) {
-				des_info->des_data[widx++] = ((((last_des && !pcmd->des_link) ? DES_CFG_END : DES_CFG_LINK) << DES_CFG_FLAG) & DES_CFG_FLAG_MASK)
-					| (((((unsigned long long int)trans_bytes >> SOC_NNA_ADDR_ALIGN_BIT) - 1ULL) << DES_DATA_LEN) & DES_DATA_LEN_MASK)
-					| ((((unsigned long long int)o_pa_st_addr >> SOC_NNA_ADDR_ALIGN_BIT) << DES_ORAM_ADDR) & DES_ORAM_ADDR_MASK)
-					| ((((unsigned long long int)d_pa_st_addr >> SOC_NNA_ADDR_ALIGN_BIT) << DES_DDR_ADDR) & DES_DDR_ADDR_MASK);
-				d_pa_st_addr += trans_bytes;
-				o_pa_st_addr += trans_bytes;
-				des_num++;
-			} else {
-				cur_trans_bytes = o_pa_mlc_end_addr - o_pa_st_addr;
-				des_info->des_data[widx++] = ((DES_CFG_LINK << DES_CFG_FLAG) & DES_CFG_FLAG_MASK)
-					| (((((unsigned long long int)cur_trans_bytes >> SOC_NNA_ADDR_ALIGN_BIT) - 1ULL) << DES_DATA_LEN) & DES_DATA_LEN_MASK)
-					| ((((unsigned long long int)o_pa_st_addr >> SOC_NNA_ADDR_ALIGN_BIT) << DES_ORAM_ADDR) & DES_ORAM_ADDR_MASK)
-					| ((((unsigned long long int)d_pa_st_addr >> SOC_NNA_ADDR_ALIGN_BIT) << DES_DDR_ADDR) & DES_DDR_ADDR_MASK);
-
-				des_info->des_data[widx++] = ((((last_des && !pcmd->des_link) ? DES_CFG_END : DES_CFG_LINK) << DES_CFG_FLAG) & DES_CFG_FLAG_MASK)
-					| (((((unsigned long long int)(trans_bytes - cur_trans_bytes) >> SOC_NNA_ADDR_ALIGN_BIT) - 1ULL) << DES_DATA_LEN) & DES_DATA_LEN_MASK)
-					| ((((unsigned long long int)o_pa_mlc_addr >> SOC_NNA_ADDR_ALIGN_BIT) << DES_ORAM_ADDR) & DES_ORAM_ADDR_MASK)
-					| ((((unsigned long long int)(d_pa_st_addr + cur_trans_bytes) >> SOC_NNA_ADDR_ALIGN_BIT) << DES_DDR_ADDR) & DES_DDR_ADDR_MASK);
-				d_pa_st_addr += trans_bytes;
-				o_pa_st_addr = o_pa_mlc_addr + (trans_bytes - cur_trans_bytes);
-				des_num += 2;
-			}
-			remain_bytes -= trans_bytes;
-		}
+		n = soc_nna_cmd_des(pcmd, &des_info->des_data[widx]);
+		widx += n;
+		des_num += n;
 
 		total_bytes += pcmd->data_bytes;
 		if (!pcmd->des_link) {
@@ -374,13 +712,13 @@ static void soc_nna_analysis_des(struct soc_nna *pnna, unsigned int st_idx, unsi
 	}
 }
 
-static void soc_nna_update_des(struct soc_nna *pnna, unsigned int *d_va_chn, des_gen_result_t *des_rslt)
+/* lay the analysed chains out in vdma, returns the descriptors used */
+static int soc_nna_update_des(struct soc_nna *pnna, unsigned long long int *vdma, unsigned int *d_va_chn, des_gen_result_t *des_rslt)
 {
 	nna_dma_des_info_t *des_info = pnna->des_info;
 	int des_remain = 2048; //(16 * 1024) / sizeof(unsigned long long int);
 	int chnidx = 0, desidx = 0, destotal_chain = 0, rdidx = 0, wridx = 0;
 	int maxchnnum = des_info[0].chain_num > des_info[1].chain_num ? des_info[0].chain_num : des_info[1].chain_num;
-	unsigned long long int *vdma = (unsigned long long int *)pnna->dmamem;
 	memset(des_rslt, 0, sizeof(des_gen_result_t));
 
 	for (chnidx = 0; chnidx < maxchnnum; chnidx++) {
@@ -390,7 +728,7 @@ static void soc_nna_update_des(struct soc_nna *pnna, unsigned int *d_va_chn, des
 			des_rslt->wcmd_st_idx = des_info[1].chain_st_idx[chnidx];
 			des_rslt->dma_chn_num = chnidx;
 			des_rslt->finish = 0;
-			return;
+			return desidx;
 		}
 
 		/* rd chain */
@@ -414,8 +752,864 @@ static void soc_nna_update_des(struct soc_nna *pnna, unsigned int *d_va_chn, des
 
 	des_rslt->dma_chn_num = maxchnnum;
 	des_rslt->finish = 1;
+	return desidx;
+}
+
+/*
+ * Asynchronous jobs. A job carries its own copy of the descriptor program,
+ * so any number of them can be queued while one runs: when the running job
+ * finishes, the next one is copied into the descriptor ram and started
+ * without a round trip through userspace. The nna dma raises no interrupt
+ * here, so a timer polls the start bits of both channels, which the dma
+ * clears when it reaches the end of a chain, first when the chain is
+ * expected to be done (soc_nna_poll.h); userspace sleeps in poll(),
+ * read() or IOCTL_SOC_NNA_WAIT meanwhile.
+ *
+ * A program is not bounded by the descriptor ram: it is cut into rounds of
+ * chains that fit half of it, and while the dma runs a round from one half
+ * the next round, of the same job or of the next queued one, is copied
+ * into the other half.
+ */
+static inline bool soc_nna_dma_busy(struct soc_nna *pnna)
+{
+	return (soc_nna_readl(pnna, NNA_DMA_RCFG) & (1 << RCFG_START))
+		|| (soc_nna_readl(pnna, NNA_DMA_WCFG) & (1 << WCFG_START));
+}
+
+static void soc_nna_job_chain_start(struct soc_nna *pnna, struct soc_nna_job_ctx *job)
+{
+	unsigned int rd = job->chn[job->chn_idx * 2];
+	unsigned int wr = job->chn[job->chn_idx * 2 + 1];
+
+	soc_nna_poll_start(&pnna->job_poll, job->chn_bytes[job->chn_idx * 2] + job->chn_bytes[job->chn_idx * 2 + 1]);
+	job->chain_ns = ktime_get_ns();
+	soc_nna_writel(pnna, NNA_DMA_RCFG, ((rd << RCFG_DES_ADDR) & RCFG_DES_ADDR_MASK) | (1 << RCFG_START));
+	soc_nna_writel(pnna, NNA_DMA_WCFG, ((wr << WCFG_DES_ADDR) & WCFG_DES_ADDR_MASK) | (1 << WCFG_START));
+}
+
+static bool soc_nna_job_loaded(struct soc_nna *pnna, struct soc_nna_job_ctx *job, unsigned int round)
+{
+	return pnna->job_loaded_seq == job->done.seq && pnna->job_loaded_round == round;
+}
+
+static void soc_nna_job_load(struct soc_nna *pnna, struct soc_nna_job_ctx *job, unsigned int round)
+{
+	struct soc_nna_job_round *r = &job->rounds[round];
+
+	memcpy((unsigned long long int *)pnna->dmamem + r->base, job->des + r->des_off, r->des_cnt * sizeof(unsigned long long int));
+	wmb();
+	pnna->job_loaded_seq = job->done.seq;
+	pnna->job_loaded_round = round;
+}
+
+/* copy the round after the running one in, if it does not overlap it */
+static void soc_nna_job_prefill(struct soc_nna *pnna)
+{
+	struct soc_nna_job_ctx *job = pnna->job_running;
+	struct soc_nna_job_round *cur = NULL, *next = NULL;
+	unsigned int round = 0;
+
+	if (!job)
+		return;
+	cur = &job->rounds[job->round_idx];
+	if (job->round_idx + 1 < job->round_num) {
+		round = job->round_idx + 1;
+	} else {
+		if (list_empty(&pnna->job_queue))
+			return;
+		job = list_first_entry(&pnna->job_queue, struct soc_nna_job_ctx, list);
+		round = 0;
+	}
+	next = &job->rounds[round];
+
+	if (soc_nna_job_loaded(pnna, job, round))
+		return;
+	if (soc_nna_round_overlap(cur, next))
+		return;
+	soc_nna_job_load(pnna, job, round);
+	job->prefills++;
 }
 
+static void soc_nna_job_round_start(struct soc_nna *pnna, struct soc_nna_job_ctx *job, unsigned int round)
+{
+	u64 load_ns = 0;
+
+	if (!soc_nna_job_loaded(pnna, job, round)) {
+		load_ns = ktime_get_ns();
+		soc_nna_job_load(pnna, job, round);
+		job->load_ns += ktime_get_ns() - load_ns;
+		job->loads++;
+	}
+	job->round_idx = round;
+	soc_nna_job_chain_start(pnna, job);
+	soc_nna_job_prefill(pnna);
+}
+
+static void soc_nna_prof_chain(struct soc_nna *pnna, struct soc_nna_job_ctx *job, u64 now)
+{
+	struct soc_nna_trace *t = NULL;
+
+	if (!pnna->trace)
+		return;
+
+	t = &pnna->trace[pnna->trace_head++ % pnna->trace_size];
+	t->seq = job->done.seq;
+	t->tag = job->done.tag;
+	t->tgid = job->owner->tgid;
+	t->chain = job->chn_idx;
+	t->status = job->done.status;
+	t->rd_bytes = job->chn_bytes[job->chn_idx * 2];
+	t->wr_bytes = job->chn_bytes[job->chn_idx * 2 + 1];
+	t->rcnt = soc_nna_readl(pnna, NNA_DMA_RCNT);
+	t->wcnt = soc_nna_readl(pnna, NNA_DMA_WCNT);
+	t->start_ns = job->chain_ns;
+	t->end_ns = now;
+}
+
+static void soc_nna_prof_add(struct soc_nna_prof *prof, struct soc_nna_job_ctx *job, u64 now)
+{
+	prof->jobs++;
+	prof->chains += job->chn_idx + 1;
+	prof->timeouts += job->done.status == -ETIMEDOUT;
+	prof->busy_ns += now - job->start_ns;
+	prof->queue_ns += job->start_ns - job->submit_ns;
+	prof->build_ns += job->build_ns;
+	prof->load_ns += job->load_ns;
+	prof->loads += job->loads;
+	prof->prefills += job->prefills;
+	prof->polls += job->polls;
+	prof->rd_bytes += job->done.rd_bytes;
+	prof->wr_bytes += job->done.wr_bytes;
+}
+
+/* move the queue forward, called with job_lock held */
+static void soc_nna_job_advance(struct soc_nna *pnna)
+{
+	struct soc_nna_job_ctx *job = pnna->job_running;
+	u64 now = ktime_get_ns();
+
+	if (job) {
+		if (soc_nna_dma_busy(pnna)) {
+			if (now - job->chain_ns < (u64)job_timeout_ms * NSEC_PER_MSEC)
+				return;
+			soc_nna_writel(pnna, NNA_DMA_RCFG, 0);
+			soc_nna_writel(pnna, NNA_DMA_WCFG, 0);
+			job->done.status = -ETIMEDOUT;
+		}
+		soc_nna_poll_done(&pnna->job_poll);
+		soc_nna_prof_chain(pnna, job, now);
+		if (!job->done.status && job->chn_idx + 1 < job->chn_num) {
+			if (++job->chn_idx == job->rounds[job->round_idx].chn_end)
+				soc_nna_job_round_start(pnna, job, job->round_idx + 1);
+			else
+				soc_nna_job_chain_start(pnna, job);
+			return;
+		}
+		job->done.exec_us = div_u64(now - job->start_ns, NSEC_PER_USEC);
+		soc_nna_prof_add(&pnna->prof, job, now);
+		soc_nna_prof_add(&job->owner->prof, job, now);
+		list_add_tail(&job->list, &job->owner->done_list);
+		pnna->job_running = NULL;
+		wake_up(&pnna->job_wait);
+	}
+
+	/* the ram is the legacy ioctls' again once the queue runs dry */
+	if (list_empty(&pnna->job_queue)) {
+		pnna->job_loaded_seq = 0;
+		return;
+	}
+	/* a chain started by hand through IOCTL_SOC_NNA_RDCH_START is still running */
+	if (soc_nna_dma_busy(pnna))
+		return;
+
+	job = list_first_entry(&pnna->job_queue, struct soc_nna_job_ctx, list);
+	list_del(&job->list);
+	job->start_ns = ktime_get_ns();
+	job->done.queue_us = div_u64(job->start_ns - job->submit_ns, NSEC_PER_USEC);
+	job->chn_idx = 0;
+	pnna->job_running = job;
+	soc_nna_job_round_start(pnna, job, 0);
+}
+
+/*
+ * The wait until the job timer looks again, called with job_lock held.
+ * The dma raises no interrupt, see soc_nna_poll.h. A queue held up by a
+ * chain started through IOCTL_SOC_NNA_RDCH_START is looked at after the
+ * longest wait.
+ */
+static u64 soc_nna_job_next_poll(struct soc_nna *pnna)
+{
+	struct soc_nna_job_ctx *job = pnna->job_running;
+	u64 max_ns = (u64)max(job_poll_us, 1) * NSEC_PER_USEC;
+	u64 min_ns = min((u64)max(job_poll_min_us, 1) * NSEC_PER_USEC, max_ns);
+
+	if (!job)
+		return max_ns;
+	if (!soc_nna_dma_busy(pnna))
+		return min_ns;
+	return soc_nna_poll_busy(&pnna->job_poll, ktime_get_ns() - job->chain_ns, min_ns, max_ns);
+}
+
+static enum hrtimer_restart soc_nna_job_timer(struct hrtimer *timer)
+{
+	struct soc_nna *pnna = container_of(timer, struct soc_nna, job_timer);
+	unsigned long flags;
+	bool active = false;
+	u64 next_ns = 0;
+
+	spin_lock_irqsave(&pnna->job_lock, flags);
+	if (pnna->job_running)
+		pnna->job_running->polls++;
+	soc_nna_job_advance(pnna);
+	active = pnna->job_running || !list_empty(&pnna->job_queue);
+	pnna->job_timer_on = active;
+	if (active)
+		next_ns = soc_nna_job_next_poll(pnna);
+	spin_unlock_irqrestore(&pnna->job_lock, flags);
+
+	if (!active)
+		return HRTIMER_NORESTART;
+	hrtimer_forward_now(timer, ns_to_ktime(next_ns));
+	return HRTIMER_RESTART;
+}
+
+static bool soc_nna_job_idle(struct soc_nna *pnna)
+{
+	unsigned long flags;
+	bool idle = false;
+
+	spin_lock_irqsave(&pnna->job_lock, flags);
+	idle = !pnna->job_running && list_empty(&pnna->job_queue);
+	spin_unlock_irqrestore(&pnna->job_lock, flags);
+
+	return idle;
+}
+
+static void soc_nna_job_free(struct soc_nna_job_ctx *job)
+{
+	vfree(job->des);
+	vfree(job->rounds);
+	vfree(job->chn);
+	vfree(job->chn_bytes);
+	kfree(job);
+}
+
+/* one side of a chain: its count descriptor, then the commands up to the unlinked one */
+static int soc_nna_job_chain(struct soc_nna_job_ctx *job, nna_dma_cmd_t *cmd, unsigned int *idx, unsigned int end, unsigned int *bytes)
+{
+	unsigned long long int *cnt_des = job->des + job->des_cnt++;
+	unsigned int total_bytes = 0;
+	unsigned int link = 0;
+
+	while (*idx < end) {
+		job->des_cnt += soc_nna_cmd_des(&cmd[*idx], job->des + job->des_cnt);
+		total_bytes += cmd[*idx].data_bytes;
+		link = cmd[(*idx)++].des_link;
+		if (!link)
+			break;
+	}
+	*cnt_des = ((DES_CFG_CNT << DES_CFG_FLAG) & DES_CFG_FLAG_MASK)
+		| ((total_bytes << DES_TOTAL_BYTES) & DES_TOTAL_BYTES_MASK);
+	*bytes = total_bytes;
+
+	/* the last command has to close its chain */
+	return link ? -EINVAL : 0;
+}
+
+/*
+ * Build the program and cut it into rounds, see soc_nna_round_add().
+ * cmd_max is how many commands the buffer d_va_cmd points into holds, the
+ * rd and wr command arrays have to fit in it.
+ */
+static long soc_nna_job_build(struct soc_nna_job_ctx *job, nna_dma_cmd_t *d_va_cmd, unsigned int cmd_max, nna_dma_cmd_set_t *cmd_set)
+{
+	nna_dma_cmd_t *rd_cmd = d_va_cmd, *wr_cmd = d_va_cmd + cmd_set->rd_cmd_cnt;
+	unsigned int ri = cmd_set->rd_cmd_st_idx, wi = cmd_set->wr_cmd_st_idx;
+	unsigned int rd_end = cmd_set->rd_cmd_cnt, wr_end = cmd_set->wr_cmd_cnt;
+	struct soc_nna_job_round *round = NULL;
+	unsigned long long max_des = 0;
+	unsigned int max_chn = 0, i = 0;
+	unsigned int rd = 0, wr = 0, n = 0;
+
+	if (ri > rd_end || wi > wr_end || (unsigned long long)rd_end + wr_end > cmd_max)
+		return -EINVAL;
+
+	/* two descriptors per 64KB at most, and the count descriptors of each chain */
+	for (i = ri; i < rd_end; i++) {
+		if (!rd_cmd[i].data_bytes)
+			return -EINVAL;
+		max_des += (((rd_cmd[i].data_bytes - 1) >> 16) + 1) * 2 + 2;
+	}
+	for (i = wi; i < wr_end; i++) {
+		if (!wr_cmd[i].data_bytes)
+			return -EINVAL;
+		max_des += (((wr_cmd[i].data_bytes - 1) >> 16) + 1) * 2 + 2;
+	}
+	max_chn = max(rd_end - ri, wr_end - wi);
+	if (!max_chn)
+		return -EINVAL;
+	if (max_des > SOC_NNA_JOB_MAX_DES)
+		return -E2BIG;
+
+	job->des = vmalloc(max_des * sizeof(unsigned long long int));
+	job->rounds = vmalloc(max_chn * sizeof(struct soc_nna_job_round));
+	job->chn = vmalloc(max_chn * 2 * sizeof(unsigned int));
+	job->chn_bytes = vmalloc(max_chn * 2 * sizeof(unsigned int));
+	if (!job->des || !job->rounds || !job->chn || !job->chn_bytes)
+		return -ENOMEM;
+
+	while (ri < rd_end || wi < wr_end) {
+		rd = job->des_cnt;
+		if (soc_nna_job_chain(job, rd_cmd, &ri, rd_end, &job->chn_bytes[job->chn_num * 2]))
+			return -EINVAL;
+		wr = job->des_cnt;
+		if (soc_nna_job_chain(job, wr_cmd, &wi, wr_end, &job->chn_bytes[job->chn_num * 2 + 1]))
+			return -EINVAL;
+		job->done.rd_bytes += job->chn_bytes[job->chn_num * 2];
+		job->done.wr_bytes += job->chn_bytes[job->chn_num * 2 + 1];
+		n = job->des_cnt - rd;
+		if (n > SOC_NNA_MAX_DES_CHN_CNT)
+			return -E2BIG;
+
+		round = soc_nna_round_add(job->rounds, &job->round_num, rd, n);
+		job->chn[job->chn_num * 2] = soc_nna_round_index(round, rd);
+		job->chn[job->chn_num * 2 + 1] = soc_nna_round_index(round, wr);
+		round->chn_end = ++job->chn_num;
+	}
+
+	return 0;
+}
+
+static long soc_nna_job_submit(struct soc_nna_file *pfile, long usr_arg)
+{
+	struct soc_nna *pnna = pfile->pnna;
+	struct soc_nna_job_ctx *job = NULL;
+	struct soc_nna_job info;
+	nna_dma_cmd_t *d_va_cmd = NULL, *d_pa_cmd = NULL;
+	unsigned long flags;
+	bool start_timer = false;
+	u64 next_ns = 0;
+	long ret = 0;
+
+	if (copy_from_user(&info, (void *)usr_arg, sizeof(info))) {
+		dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:copy_from_user failed\n", __func__, __LINE__, current->tgid, current->pid);
+		return -EFAULT;
+	}
+
+	job = kzalloc(sizeof(*job), GFP_KERNEL);
+	if (!job)
+		return -ENOMEM;
+
+	NNADMA_VA_2_PA((unsigned long)info.cmd_set.d_va_cmd, d_pa_cmd);     //convert user space vaddr to paddr
+	d_va_cmd = phys_to_virt((unsigned long)d_pa_cmd);                   //map paddr to kernel space vaddr to be used by kernel
+	job->build_ns = ktime_get_ns();
+	/* the commands are read in place, they have to be in one of the fd's buffers */
+	mutex_lock(&pnna->mlock);
+	ret = soc_nna_job_build(job, d_va_cmd, soc_nna_buf_cmds(pfile, (unsigned long)d_pa_cmd), &info.cmd_set);
+	mutex_unlock(&pnna->mlock);
+	if (ret)
+		goto err_free;
+	job->build_ns = ktime_get_ns() - job->build_ns;
+	/* all of it in one go, there is no next round to submit */
+	info.cmd_set.des_rslt.dma_chn_num = job->chn_num;
+	info.cmd_set.des_rslt.finish = 1;
+
+	if (info.in_len)
+		dma_cache_sync(NULL, (void *)info.in_addr, info.in_len, DMA_TO_DEVICE);
+	job->out_addr = info.out_addr;
+	job->out_len = info.out_len;
+	job->mm = current->mm;
+	job->owner = pfile;
+	job->done.tag = info.tag;
+
+	spin_lock_irqsave(&pnna->job_lock, flags);
+	/* a mapping of the dma window could start the dma or rewrite the round that runs */
+	if (pfile->jobs >= SOC_NNA_JOB_DEPTH || pnna->dma_maps) {
+		spin_unlock_irqrestore(&pnna->job_lock, flags);
+		ret = -EBUSY;
+		goto err_free;
+	}
+	if (++pnna->job_seq == 0)
+		pnna->job_seq = 1;
+	job->done.seq = pnna->job_seq;
+	job->submit_ns = ktime_get_ns();
+	pfile->jobs++;
+	list_add_tail(&job->list, &pnna->job_queue);
+	soc_nna_job_advance(pnna);
+	soc_nna_job_prefill(pnna);
+	if (!pnna->job_timer_on) {
+		pnna->job_timer_on = true;
+		start_timer = true;
+		next_ns = soc_nna_job_next_poll(pnna);
+	}
+	spin_unlock_irqrestore(&pnna->job_lock, flags);
+
+	if (start_timer)
+		hrtimer_start(&pnna->job_timer, ns_to_ktime(next_ns), HRTIMER_MODE_REL);
+
+	info.seq = job->done.seq;
+	if (copy_to_user((void *)usr_arg, &info, sizeof(info))) {
+		/* the job is queued already, the caller can still reap it with seq 0 */
+		dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:copy_to_user failed\n", __func__, __LINE__, current->tgid, current->pid);
+		return -EFAULT;
+	}
+
+	return 0;
+
+err_free:
+	soc_nna_job_free(job);
+	return ret;
+}
+
+/* take a finished job of the fd off its done list, seq 0 is the oldest one */
+static struct soc_nna_job_ctx *soc_nna_job_reap(struct soc_nna_file *pfile, unsigned int seq)
+{
+	struct soc_nna *pnna = pfile->pnna;
+	struct soc_nna_job_ctx *job = NULL, *found = NULL;
+	unsigned long flags;
+
+	spin_lock_irqsave(&pnna->job_lock, flags);
+	list_for_each_entry(job, &pfile->done_list, list) {
+		if (!seq || job->done.seq == seq) {
+			list_del(&job->list);
+			pfile->jobs--;
+			found = job;
+			break;
+		}
+	}
+	spin_unlock_irqrestore(&pnna->job_lock, flags);
+
+	return found;
+}
+
+/* seq is queued, running or done and not reaped yet */
+static bool soc_nna_job_pending(struct soc_nna_file *pfile, unsigned int seq)
+{
+	struct soc_nna *pnna = pfile->pnna;
+	struct soc_nna_job_ctx *job = NULL;
+	unsigned long flags;
+	bool pending = false;
+
+	spin_lock_irqsave(&pnna->job_lock, flags);
+	if (!seq) {
+		pending = pfile->jobs != 0;
+		goto out;
+	}
+	if (pnna->job_running && pnna->job_running->owner == pfile && pnna->job_running->done.seq == seq) {
+		pending = true;
+		goto out;
+	}
+	list_for_each_entry(job, &pnna->job_queue, list) {
+		if (job->owner == pfile && job->done.seq == seq) {
+			pending = true;
+			goto out;
+		}
+	}
+	list_for_each_entry(job, &pfile->done_list, list) {
+		if (job->done.seq == seq) {
+			pending = true;
+			goto out;
+		}
+	}
+out:
+	spin_unlock_irqrestore(&pnna->job_lock, flags);
+	return pending;
+}
+
+/* hand the result of a reaped job over and free it, in the reaper's context */
+static void soc_nna_job_finish(struct soc_nna_job_ctx *job, struct soc_nna_job_done *done)
+{
+	if (job->out_len && job->mm == current->mm)
+		dma_cache_sync(NULL, (void *)job->out_addr, job->out_len, DMA_FROM_DEVICE);
+	*done = job->done;
+	soc_nna_job_free(job);
+}
+
+static long soc_nna_job_wait(struct soc_nna_file *pfile, long usr_arg)
+{
+	struct soc_nna *pnna = pfile->pnna;
+	struct soc_nna_job_ctx *job = NULL;
+	struct soc_nna_wait wait;
+	long timeout = 0;
+
+	if (copy_from_user(&wait, (void *)usr_arg, sizeof(wait))) {
+		dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:copy_from_user failed\n", __func__, __LINE__, current->tgid, current->pid);
+		return -EFAULT;
+	}
+
+	if (!soc_nna_job_pending(pfile, wait.seq))
+		return -ENOENT;
+
+	timeout = wait.timeout_ms < 0 ? MAX_SCHEDULE_TIMEOUT : msecs_to_jiffies(wait.timeout_ms);
+	timeout = wait_event_interruptible_timeout(pnna->job_wait,
+			(job = soc_nna_job_reap(pfile, wait.seq)) != NULL, timeout);
+	if (timeout < 0)
+		return timeout;
+	if (!job)
+		return -ETIMEDOUT;
+
+	soc_nna_job_finish(job, &wait.done);
+	if (copy_to_user((void *)usr_arg, &wait, sizeof(wait))) {
+		dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:copy_to_user failed\n", __func__, __LINE__, current->tgid, current->pid);
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
+static bool soc_nna_job_running(struct soc_nna_file *pfile)
+{
+	struct soc_nna *pnna = pfile->pnna;
+	unsigned long flags;
+	bool running = false;
+
+	spin_lock_irqsave(&pnna->job_lock, flags);
+	running = pnna->job_running && pnna->job_running->owner == pfile;
+	spin_unlock_irqrestore(&pnna->job_lock, flags);
+
+	return running;
+}
+
+/* drop every job of a closing fd, waiting for the one the dma runs */
+static void soc_nna_job_release(struct soc_nna_file *pfile)
+{
+	struct soc_nna *pnna = pfile->pnna;
+	struct soc_nna_job_ctx *job = NULL, *n = NULL;
+	unsigned long flags;
+	LIST_HEAD(drop);
+
+	spin_lock_irqsave(&pnna->job_lock, flags);
+	list_for_each_entry_safe(job, n, &pnna->job_queue, list) {
+		if (job->owner == pfile)
+			list_move_tail(&job->list, &drop);
+	}
+	spin_unlock_irqrestore(&pnna->job_lock, flags);
+
+	/* bounded by job_timeout_ms, the timer gives up on a hung dma */
+	wait_event(pnna->job_wait, !soc_nna_job_running(pfile));
+
+	spin_lock_irqsave(&pnna->job_lock, flags);
+	list_splice_init(&pfile->done_list, &drop);
+	pfile->jobs = 0;
+	spin_unlock_irqrestore(&pnna->job_lock, flags);
+
+	list_for_each_entry_safe(job, n, &drop, list) {
+		list_del(&job->list);
+		soc_nna_job_free(job);
+	}
+}
+
+static ssize_t soc_nna_read(struct file *file, char *buf, size_t size, loff_t *offset)
+{
+	struct soc_nna_file *pfile = file->private_data;
+	struct soc_nna *pnna = pfile->pnna;
+	struct soc_nna_job_ctx *job = NULL;
+	struct soc_nna_job_done done;
+	size_t count = 0;
+	int ret = 0;
+
+	if (size < sizeof(done))
+		return -EINVAL;
+
+	while (count + sizeof(done) <= size) {
+		job = soc_nna_job_reap(pfile, 0);
+		if (!job) {
+			/* return what we have, or wait for the first one */
+			if (count)
+				break;
+			if (!soc_nna_job_pending(pfile, 0))
+				return 0;
+			if (file->f_flags & O_NONBLOCK)
+				return -EAGAIN;
+			ret = wait_event_interruptible(pnna->job_wait, (job = soc_nna_job_reap(pfile, 0)) != NULL);
+			if (ret)
+				return ret;
+		}
+		soc_nna_job_finish(job, &done);
+		if (copy_to_user(buf + count, &done, sizeof(done)))
+			return count ? count : -EFAULT;
+		count += sizeof(done);
+	}
+
+	return count;
+}
+
+static ssize_t soc_nna_write(struct file *file, const char *buf, size_t size, loff_t *offset)
+{
+	//TODO
+	return 0;
+}
+
+static unsigned int soc_nna_poll(struct file *file, struct poll_table_struct *poll_table)
+{
+	struct soc_nna_file *pfile = file->private_data;
+	struct soc_nna *pnna = pfile->pnna;
+	unsigned int mask = 0;
+	unsigned long flags;
+
+	poll_wait(file, &pnna->job_wait, poll_table);
+
+	spin_lock_irqsave(&pnna->job_lock, flags);
+	if (!list_empty(&pfile->done_list))
+		mask |= POLLIN | POLLRDNORM;
+	if (pfile->jobs < SOC_NNA_JOB_DEPTH)
+		mask |= POLLOUT | POLLWRNORM;
+	spin_unlock_irqrestore(&pnna->job_lock, flags);
+
+	return mask;
+}
+
+/*
+ * Vectored cache maintenance. One call syncs a list of buffer ranges, all
+ * of them: the buffers are mapped into userspace, so the driver cannot
+ * tell which lines the cpu or the dma touched since the last sync. When
+ * the ranges add up to more than the cache, the whole cache is written
+ * back and invalidated by index instead: asked for a range the size of
+ * the cache, the arch code blasts it rather than walking the range. That
+ * is not possible with a secondary cache the primary ones are not
+ * included in, the ranges are walked then.
+ */
+static unsigned long soc_nna_sync_full_size(void)
+{
+	struct cache_desc *dc = &current_cpu_data.dcache;
+	struct cache_desc *sc = &current_cpu_data.scache;
+
+	if (sc->linesz)
+		return cpu_has_inclusive_pcaches ? sc->sets * sc->ways * sc->linesz : 0;
+
+	return cpu_has_safe_index_cacheops ? dc->sets * dc->ways * dc->linesz : 0;
+}
+
+static long soc_nna_sync_vec(struct soc_nna_file *pfile, long usr_arg)
+{
+	struct soc_nna *pnna = pfile->pnna;
+	struct soc_nna_sync_vec vec;
+	struct soc_nna_sync_entry *ent = NULL;
+	struct soc_nna_memory_cache **bufs = NULL, *pelem = NULL;
+	unsigned long full_size = soc_nna_sync_full_size();
+	unsigned long total = 0;
+	unsigned int i = 0;
+	u64 start = 0, cost = 0;
+	long ret = 0;
+
+	if (copy_from_user(&vec, (void *)usr_arg, sizeof(vec))) {
+		dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:copy_from_user failed\n", __func__, __LINE__, current->tgid, current->pid);
+		return -EFAULT;
+	}
+	if (!vec.num || vec.num > SOC_NNA_SYNC_MAX)
+		return -EINVAL;
+
+	ent = kmalloc_array(vec.num, sizeof(*ent), GFP_KERNEL);
+	bufs = kmalloc_array(vec.num, sizeof(*bufs), GFP_KERNEL);
+	if (!ent || !bufs) {
+		ret = -ENOMEM;
+		goto out_free;
+	}
+	if (copy_from_user(ent, (void *)vec.entries, vec.num * sizeof(*ent))) {
+		dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:copy_from_user failed\n", __func__, __LINE__, current->tgid, current->pid);
+		ret = -EFAULT;
+		goto out_free;
+	}
+
+	start = ktime_get_ns();
+	vec.synced = 0;
+	vec.full = 0;
+
+	mutex_lock(&pnna->mlock);
+	for (i = 0; i < vec.num; i++) {
+		pelem = soc_nna_buf_lookup(pnna, ent[i].handle);
+		if (!pelem || pelem->owner != pfile || ent[i].dir > DMA_FROM_DEVICE || !ent[i].len
+				|| ent[i].offset >= pelem->buf.size || ent[i].len > pelem->buf.size - ent[i].offset) {
+			ret = -EINVAL;
+			goto out_unlock;
+		}
+		bufs[i] = pelem;
+		total += ent[i].len;
+	}
+
+	if (full_size && total >= max_t(unsigned long, full_size, (unsigned long)sync_full_kb * 1024)) {
+		dma_cache_wback_inv(CKSEG0, full_size);
+		vec.full = 1;
+	} else {
+		for (i = 0; i < vec.num; i++) {
+			dma_cache_sync(NULL, phys_to_virt((unsigned long)bufs[i]->buf.paddr + ent[i].offset), ent[i].len, ent[i].dir);
+			vec.synced++;
+		}
+	}
+
+	cost = ktime_get_ns() - start;
+	pnna->sync_calls++;
+	pnna->sync_entries += vec.num;
+	pnna->sync_full += vec.full;
+	pnna->sync_ns += cost;
+	if (cost > pnna->sync_max_ns)
+		pnna->sync_max_ns = cost;
+	mutex_unlock(&pnna->mlock);
+
+	if (copy_to_user((void *)usr_arg, &vec, sizeof(vec))) {
+		dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:copy_to_user failed\n", __func__, __LINE__, current->tgid, current->pid);
+		ret = -EFAULT;
+	}
+	goto out_free;
+
+out_unlock:
+	mutex_unlock(&pnna->mlock);
+out_free:
+	kfree(bufs);
+	kfree(ent);
+	return ret;
+}
+
+static int soc_nna_sync_show(struct seq_file *m, void *v)
+{
+	struct soc_nna *pnna = m->private;
+
+	mutex_lock(&pnna->mlock);
+	seq_printf(m, "calls:      %lu\n", pnna->sync_calls);
+	seq_printf(m, "entries:    %lu\n", pnna->sync_entries);
+	seq_printf(m, "full:       %lu\n", pnna->sync_full);
+	seq_printf(m, "full_kb:    %lu\n", soc_nna_sync_full_size() >> 10);
+	seq_printf(m, "avg_us:     %llu\n", pnna->sync_calls ? div64_u64(pnna->sync_ns, (u64)pnna->sync_calls * NSEC_PER_USEC) : 0);
+	seq_printf(m, "max_us:     %llu\n", div64_u64(pnna->sync_max_ns, NSEC_PER_USEC));
+	mutex_unlock(&pnna->mlock);
+
+	return 0;
+}
+
+static int soc_nna_sync_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, soc_nna_sync_show, inode->i_private);
+}
+
+static const struct file_operations soc_nna_sync_fops = {
+	.owner		= THIS_MODULE,
+	.open		= soc_nna_sync_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void soc_nna_prof_show_row(struct seq_file *m, const char *who, struct soc_nna_prof *prof)
+{
+	seq_printf(m, "%-8s %8lu %8lu %8lu %12llu %12llu %10llu %10llu %8lu %8lu %8lu %12llu %12llu\n", who,
+		   prof->jobs, prof->chains, prof->timeouts,
+		   div_u64(prof->busy_ns, NSEC_PER_USEC), div_u64(prof->queue_ns, NSEC_PER_USEC),
+		   div_u64(prof->build_ns, NSEC_PER_USEC), div_u64(prof->load_ns, NSEC_PER_USEC),
+		   prof->loads, prof->prefills, prof->polls, prof->rd_bytes >> 10, prof->wr_bytes >> 10);
+}
+
+static int soc_nna_jobs_show(struct seq_file *m, void *v)
+{
+	struct soc_nna *pnna = m->private;
+	struct soc_nna_file *pfile = NULL;
+	struct soc_nna_prof prof;
+	unsigned long flags;
+	u64 elapsed = 0;
+	char who[16];
+
+	mutex_lock(&pnna->mlock);
+	spin_lock_irqsave(&pnna->job_lock, flags);
+	prof = pnna->prof;
+	elapsed = ktime_get_ns() - pnna->prof_since_ns;
+	spin_unlock_irqrestore(&pnna->job_lock, flags);
+
+	seq_printf(m, "elapsed_ms: %llu\n", div_u64(elapsed, NSEC_PER_MSEC));
+	seq_printf(m, "busy_ms:    %llu\n", div_u64(prof.busy_ns, NSEC_PER_MSEC));
+	seq_printf(m, "util:       %llu%%\n", elapsed ? div64_u64(prof.busy_ns * 100, elapsed) : 0);
+	seq_printf(m, "%-8s %8s %8s %8s %12s %12s %10s %10s %8s %8s %8s %12s %12s\n", "tgid",
+		   "jobs", "chains", "timeout", "busy_us", "queue_us", "build_us", "load_us",
+		   "loads", "prefill", "polls", "rd_kb", "wr_kb");
+	soc_nna_prof_show_row(m, "all", &prof);
+	list_for_each_entry(pfile, &pnna->file_list, list) {
+		spin_lock_irqsave(&pnna->job_lock, flags);
+		prof = pfile->prof;
+		spin_unlock_irqrestore(&pnna->job_lock, flags);
+		snprintf(who, sizeof(who), "%d", pfile->tgid);
+		soc_nna_prof_show_row(m, who, &prof);
+	}
+	mutex_unlock(&pnna->mlock);
+
+	return 0;
+}
+
+static int soc_nna_jobs_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, soc_nna_jobs_show, inode->i_private);
+}
+
+static const struct file_operations soc_nna_jobs_fops = {
+	.owner		= THIS_MODULE,
+	.open		= soc_nna_jobs_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/* the last job_trace chains, oldest first, tagged as the jobs were submitted */
+static int soc_nna_trace_show(struct seq_file *m, void *v)
+{
+	struct soc_nna *pnna = m->private;
+	struct soc_nna_trace *snap = NULL, *t = NULL;
+	unsigned long flags, head = 0;
+	unsigned int n = 0, i = 0;
+
+	if (!pnna->trace) {
+		seq_puts(m, "off, load with job_trace=<chains>\n");
+		return 0;
+	}
+
+	snap = vmalloc(pnna->trace_size * sizeof(*snap));
+	if (!snap)
+		return -ENOMEM;
+
+	spin_lock_irqsave(&pnna->job_lock, flags);
+	head = pnna->trace_head;
+	n = min_t(unsigned long, head, pnna->trace_size);
+	for (i = 0; i < n; i++)
+		snap[i] = pnna->trace[(head - n + i) % pnna->trace_size];
+	spin_unlock_irqrestore(&pnna->job_lock, flags);
+
+	seq_printf(m, "%8s %10s %8s %6s %6s %14s %10s %10s %10s %10s %10s\n", "seq", "tag", "tgid",
+		   "chain", "status", "start_us", "dur_us", "rd_bytes", "wr_bytes", "rcnt", "wcnt");
+	for (i = 0; i < n; i++) {
+		t = &snap[i];
+		seq_printf(m, "%8u %10u %8d %6u %6d %14llu %10llu %10u %10u %10u %10u\n", t->seq, t->tag, t->tgid,
+			   t->chain, t->status, div_u64(t->start_ns, NSEC_PER_USEC),
+			   div_u64(t->end_ns - t->start_ns, NSEC_PER_USEC),
+			   t->rd_bytes, t->wr_bytes, t->rcnt, t->wcnt);
+	}
+	vfree(snap);
+
+	return 0;
+}
+
+static int soc_nna_trace_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, soc_nna_trace_show, inode->i_private);
+}
+
+/* any write empties the trace */
+static ssize_t soc_nna_trace_write(struct file *file, const char __user *buf, size_t size, loff_t *ppos)
+{
+	struct soc_nna *pnna = ((struct seq_file *)file->private_data)->private;
+	unsigned long flags;
+
+	spin_lock_irqsave(&pnna->job_lock, flags);
+	pnna->trace_head = 0;
+	spin_unlock_irqrestore(&pnna->job_lock, flags);
+
+	return size;
+}
+
+static const struct file_operations soc_nna_trace_fops = {
+	.owner		= THIS_MODULE,
+	.open		= soc_nna_trace_open,
+	.read		= seq_read,
+	.write		= soc_nna_trace_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 long soc_nna_setup_des(struct soc_nna *pnna, long usr_arg)
 {
 	long ret = 0;
@@ -430,6 +1624,10 @@ long soc_nna_setup_des(struct soc_nna *pnna, long usr_arg)
 		goto err_copy_from_user;
 	}
 
+	/* the descriptor ram belongs to the job queue while it runs */
+	if (!soc_nna_job_idle(pnna))
+		return -EBUSY;
+
 	mutex_lock(&pnna->mlock);
 
 	NNADMA_VA_2_PA((unsigned long)cmd_set.d_va_cmd, d_pa_cmd);      //convert user space vaddr to paddr
@@ -441,7 +1639,7 @@ long soc_nna_setup_des(struct soc_nna *pnna, long usr_arg)
 	soc_nna_analysis_des(pnna, cmd_set.rd_cmd_st_idx, cmd_set.rd_cmd_cnt, d_va_cmd, &(pnna->des_info[0]));
 	soc_nna_analysis_des(pnna, cmd_set.wr_cmd_st_idx, cmd_set.wr_cmd_cnt, d_va_cmd + cmd_set.rd_cmd_cnt, &(pnna->des_info[1]));
 
-	soc_nna_update_des(pnna, d_va_chn, &cmd_set.des_rslt);
+	soc_nna_update_des(pnna, (unsigned long long int *)pnna->dmamem, d_va_chn, &cmd_set.des_rslt);
 	mutex_unlock(&pnna->mlock);
 
 	if (copy_to_user((void *)usr_arg, &cmd_set, sizeof(nna_dma_cmd_set_t))) {
@@ -466,6 +1664,9 @@ long soc_nna_rdchn_start(struct soc_nna *pnna, long usr_arg)
 		return -EFAULT;
 	}
 
+	if (!soc_nna_job_idle(pnna))
+		return -EBUSY;
+
 	soc_nna_writel(pnna, NNA_DMA_RCFG, ((dma_addr << RCFG_DES_ADDR) & RCFG_DES_ADDR_MASK) | (1 << RCFG_START));
 
 	return 0;
@@ -480,10 +1681,14 @@ long soc_nna_wrchn_start(struct soc_nna *pnna, long usr_arg)
 		return -EFAULT;
 	}
 
+	if (!soc_nna_job_idle(pnna))
+		return -EBUSY;
+
 	soc_nna_writel(pnna, NNA_DMA_WCFG, ((dma_addr << WCFG_DES_ADDR) & WCFG_DES_ADDR_MASK) | (1 << WCFG_START));
 
 	return 0;
 }
+
 int soc_nna_version(struct soc_nna *pnna, long usr_arg)
 {
 	long ret = 0;
@@ -511,15 +1716,16 @@ int soc_nna_version(struct soc_nna *pnna, long usr_arg)
 static long soc_nna_unlocked_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	long ret = -1;
-	struct miscdevice *mdev = file->private_data;
-	struct soc_nna *pnna = list_entry(mdev, struct soc_nna, mdev);
+	struct soc_nna_file *pfile = file->private_data;
+	struct soc_nna *pnna = pfile->pnna;
+	struct miscdevice *mdev = &pnna->mdev;
 
 	switch (cmd) {
 		case IOCTL_SOC_NNA_MALLOC:
-			ret = soc_nna_malloc(pnna, arg);
+			ret = soc_nna_malloc(pfile, arg);
 			break;
 		case IOCTL_SOC_NNA_FREE:
-			ret = soc_nna_free(pnna, arg);
+			ret = soc_nna_free(pfile, arg);
 			break;
 		case IOCTL_SOC_NNA_FLUSHCACHE:
 			ret = soc_nna_flushcache(pnna, arg);
@@ -536,6 +1742,15 @@ static long soc_nna_unlocked_ioctl(struct file *file, unsigned int cmd, unsigned
 		case IOCTL_SOC_NNA_VERSION:
 			ret = soc_nna_version(pnna, arg);
 			break;
+		case IOCTL_SOC_NNA_SUBMIT:
+			ret = soc_nna_job_submit(pfile, arg);
+			break;
+		case IOCTL_SOC_NNA_WAIT:
+			ret = soc_nna_job_wait(pfile, arg);
+			break;
+		case IOCTL_SOC_NNA_SYNC_VEC:
+			ret = soc_nna_sync_vec(pfile, arg);
+			break;
 		default:
 			dev_err(mdev->this_device, "%s(%d) [%d:%d]: unsupport cmd=0x%x\n", __func__, __LINE__, current->tgid, current->pid, cmd);
 			return -1;
@@ -596,12 +1811,64 @@ static int get_nmem_info(uint32_t * nmem_addr, uint32_t * nmem_size)
 }
 
 #endif
+/*
+ * The job queue streams its rounds through the descriptor ram and starts
+ * the dma itself, so it is not used while a process has the dma window
+ * mapped: SUBMIT fails with -EBUSY until the last such mapping is gone,
+ * and the window cannot be mapped while jobs are queued.
+ */
+static void soc_nna_dma_vm_open(struct vm_area_struct *vma)
+{
+	struct soc_nna *pnna = vma->vm_private_data;
+	unsigned long flags;
+
+	spin_lock_irqsave(&pnna->job_lock, flags);
+	pnna->dma_maps++;
+	spin_unlock_irqrestore(&pnna->job_lock, flags);
+}
+
+static void soc_nna_dma_vm_close(struct vm_area_struct *vma)
+{
+	struct soc_nna *pnna = vma->vm_private_data;
+	unsigned long flags;
+
+	spin_lock_irqsave(&pnna->job_lock, flags);
+	pnna->dma_maps--;
+	spin_unlock_irqrestore(&pnna->job_lock, flags);
+}
+
+static const struct vm_operations_struct soc_nna_dma_vm_ops = {
+	.open           = soc_nna_dma_vm_open,
+	.close          = soc_nna_dma_vm_close,
+};
+
+static int soc_nna_dma_map(struct soc_nna *pnna, struct vm_area_struct *vma, unsigned long paddr_start, unsigned long paddr_end)
+{
+	unsigned long flags;
+
+	if (paddr_start >= SOC_NNA_DMA_WINDOW_END || paddr_end <= SOC_NNA_DMA_WINDOW_ADDR)
+		return 0;
+
+	spin_lock_irqsave(&pnna->job_lock, flags);
+	if (pnna->job_running || !list_empty(&pnna->job_queue)) {
+		spin_unlock_irqrestore(&pnna->job_lock, flags);
+		return -EBUSY;
+	}
+	pnna->dma_maps++;
+	spin_unlock_irqrestore(&pnna->job_lock, flags);
+
+	vma->vm_private_data = pnna;
+	vma->vm_ops = &soc_nna_dma_vm_ops;
+	return 0;
+}
+
 static int soc_nna_mmap(struct file *file, struct vm_area_struct *vma)
 {
 	uint32_t nmem_addr = 0;
 	uint32_t nmem_size = 0;
 	uint32_t n = 0, set_oram_nums = 0;
-	struct miscdevice *mdev = file->private_data;
+	struct soc_nna_file *pfile = file->private_data;
+	struct miscdevice *mdev = &pfile->pnna->mdev;
 	unsigned long paddr_start = vma->vm_pgoff << PAGE_SHIFT;
 	unsigned long paddr_end = paddr_start + vma->vm_end - vma->vm_start;
 #if defined(CONFIG_SOC_T40) || defined(CONFIG_SOC_A1)
@@ -760,7 +2027,7 @@ static int soc_nna_mmap(struct file *file, struct vm_area_struct *vma)
 				}
 			}
 	}
-	return 0;
+	return soc_nna_dma_map(pfile->pnna, vma, paddr_start, paddr_end);
 }
 
 static const struct file_operations soc_nna_fops = {
@@ -803,7 +2070,23 @@ static int soc_nna_probe(struct platform_device *pdev)
 
 	mutex_init(&pnna->mlock);
 
-	INIT_LIST_HEAD(&pnna->memory_list);
+	INIT_LIST_HEAD(&pnna->pool_regions);
+	INIT_LIST_HEAD(&pnna->file_list);
+	hash_init(pnna->buf_hash);
+	spin_lock_init(&pnna->job_lock);
+	INIT_LIST_HEAD(&pnna->job_queue);
+	init_waitqueue_head(&pnna->job_wait);
+	soc_nna_poll_init(&pnna->job_poll);
+	hrtimer_init(&pnna->job_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	pnna->job_timer.function = soc_nna_job_timer;
+	pnna->prof_since_ns = ktime_get_ns();
+	if (job_trace > 0) {
+		pnna->trace = vzalloc(job_trace * sizeof(struct soc_nna_trace));
+		if (pnna->trace)
+			pnna->trace_size = job_trace;
+		else
+			dev_warn(&pdev->dev, "no memory for a %d chains job trace\n", job_trace);
+	}
 	pnna->memory_cache = kmem_cache_create(pnna->name, sizeof(struct soc_nna_memory_cache), 0, SLAB_HWCACHE_ALIGN, NULL);
 	if (!pnna->memory_cache) {
 		printk("%s:kmem_cache_create failed\n", __func__);
@@ -864,6 +2147,14 @@ static int soc_nna_probe(struct platform_device *pdev)
 		goto err_misc_register;
 	}
 
+	pnna->debugfs = debugfs_create_dir(pnna->name, NULL);
+	if (!IS_ERR_OR_NULL(pnna->debugfs)) {
+		debugfs_create_file("pool", S_IRUGO, pnna->debugfs, pnna, &soc_nna_pool_fops);
+		debugfs_create_file("sync", S_IRUGO, pnna->debugfs, pnna, &soc_nna_sync_fops);
+		debugfs_create_file("jobs", S_IRUGO, pnna->debugfs, pnna, &soc_nna_jobs_fops);
+		debugfs_create_file("trace", S_IRUGO | S_IWUSR, pnna->debugfs, pnna, &soc_nna_trace_fops);
+	}
+
 	oram_clk = *(volatile unsigned int*)0xb2200060;
 	*(volatile unsigned int *)0xb2200060 = oram_clk | (1 << 5);
 	printk("@@@@ soc nna probe sucess (Board: %s, Version: %s) @@@\n", SOC_NNA_BORD, SOC_NNA_VERSION);
@@ -885,6 +2176,7 @@ err_ioremap_iomem:
 err_get_iomem_resource:
 	kmem_cache_destroy(pnna->memory_cache);
 err_kmem_cache_create:
+	vfree(pnna->trace);
 err_snprintf_name:
 	kfree(pnna);
 err_kzalloc_soc_nna:
@@ -895,7 +2187,9 @@ static int __exit soc_nna_remove(struct platform_device *pdev)
 {
 	struct soc_nna *pnna = platform_get_drvdata(pdev);
 	if (pnna) {
+		debugfs_remove_recursive(pnna->debugfs);
 		misc_deregister(&pnna->mdev);
+		hrtimer_cancel(&pnna->job_timer);
 #ifndef CPU_SIMULATOR
 		clk_put(pnna->clk_gate);
 		clk_put(pnna->clk);
@@ -903,6 +2197,7 @@ static int __exit soc_nna_remove(struct platform_device *pdev)
 		iounmap((void *)pnna->dmamem);
 		iounmap(pnna->iomem);
 		kmem_cache_destroy(pnna->memory_cache);
+		vfree(pnna->trace);
 		kfree(pnna);
 	}
 
@@ -0,0 +1,68 @@
+#ifndef __SOC_NNA_POLL_H__
+#define __SOC_NNA_POLL_H__
+
+/*
+ * When to look at a running job chain again. The nna dma raises no
+ * interrupt, so the job timer polls it, and instead of a fixed short period
+ * it first looks when the chain is expected to be done: its bytes times the
+ * time a KiB took lately. A chain still running then was underestimated:
+ * the estimate grows and the chain is looked at again after a quarter of
+ * how far it overran, so a chain just late is caught within the shortest
+ * wait and a badly underestimated one in a few growing steps. A chain
+ * found done without having overrun shrinks the estimate by as much, so
+ * the first look lands about on the end of half of the chains. Kept free
+ * of kernel headers so poll_test/ builds it on the host.
+ */
+#define SOC_NNA_POLL_NS_KB_INIT     1024        //about 1 GB/s
+#define SOC_NNA_POLL_NS_KB_MIN      16
+#define SOC_NNA_POLL_NS_KB_MAX      (1024 * 1024)
+
+struct soc_nna_poll {
+	unsigned long long  ns_kb;      /* expected time per KiB read and written */
+	unsigned long long  expect_ns;  /* the running chain's */
+	int                 overran;    /* the running chain ran past expect_ns */
+};
+
+static inline unsigned long long soc_nna_poll_clamp(unsigned long long ns,
+		unsigned long long min_ns, unsigned long long max_ns)
+{
+	return ns < min_ns ? min_ns : ns > max_ns ? max_ns : ns;
+}
+
+static inline void soc_nna_poll_init(struct soc_nna_poll *p)
+{
+	p->ns_kb = SOC_NNA_POLL_NS_KB_INIT;
+	p->expect_ns = 0;
+	p->overran = 0;
+}
+
+/* a chain moving bytes was started */
+static inline void soc_nna_poll_start(struct soc_nna_poll *p, unsigned int bytes)
+{
+	p->expect_ns = (p->ns_kb * bytes) >> 10;
+	p->overran = 0;
+}
+
+/* the chain runs elapsed_ns after its start, return the wait until the next look */
+static inline unsigned long long soc_nna_poll_busy(struct soc_nna_poll *p, unsigned long long elapsed_ns,
+		unsigned long long min_ns, unsigned long long max_ns)
+{
+	if (elapsed_ns < p->expect_ns)
+		return soc_nna_poll_clamp(p->expect_ns - elapsed_ns, min_ns, max_ns);
+
+	if (!p->overran) {
+		p->overran = 1;
+		p->ns_kb = soc_nna_poll_clamp(p->ns_kb + (p->ns_kb >> 5), SOC_NNA_POLL_NS_KB_MIN, SOC_NNA_POLL_NS_KB_MAX);
+	}
+
+	return soc_nna_poll_clamp((elapsed_ns - p->expect_ns) >> 2, min_ns, max_ns);
+}
+
+/* the chain was found done */
+static inline void soc_nna_poll_done(struct soc_nna_poll *p)
+{
+	if (!p->overran)
+		p->ns_kb = soc_nna_poll_clamp(p->ns_kb - (p->ns_kb >> 5), SOC_NNA_POLL_NS_KB_MIN, SOC_NNA_POLL_NS_KB_MAX);
+}
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef __SOC_NNA_ROUND_H__
+#define __SOC_NNA_ROUND_H__
+
+/*
+ * Cutting a job program into rounds, the chains loaded into the descriptor
+ * ram together. Kept free of kernel headers so round_test/ builds it on
+ * the host.
+ */
+#define SOC_NNA_DES_HALF_CNT        1024        //a job round, half of the descriptor ram
+
+/* chains loaded into the descriptor ram together */
+struct soc_nna_job_round {
+	unsigned int            des_off;    /* in the job's descriptors */
+	unsigned int            des_cnt;
+	unsigned int            base;       /* where it goes in the descriptor ram */
+	unsigned int            chn_end;    /* first chain of the next round */
+};
+
+/*
+ * Account the next chain, n descriptors from des_off, and return its round.
+ * Rounds alternate between the halves of the ram. A chain bigger than half
+ * of it makes a round of its own from the start of the ram, which the
+ * round after it overlaps, so nothing is loaded ahead of that one.
+ */
+static inline struct soc_nna_job_round *soc_nna_round_add(struct soc_nna_job_round *rounds,
+		unsigned int *round_num, unsigned int des_off, unsigned int n)
+{
+	struct soc_nna_job_round *round = *round_num ? &rounds[*round_num - 1] : NULL;
+	unsigned int base = 0;
+
+	if (!round || round->des_cnt + n > SOC_NNA_DES_HALF_CNT) {
+		base = (round && !round->base && n <= SOC_NNA_DES_HALF_CNT) ? SOC_NNA_DES_HALF_CNT : 0;
+		round = &rounds[(*round_num)++];
+		round->des_off = des_off;
+		round->des_cnt = 0;
+		round->base = base;
+	}
+	round->des_cnt += n;
+
+	return round;
+}
+
+/* where descriptor des of the job sits in the ram once its round is loaded */
+static inline unsigned int soc_nna_round_index(const struct soc_nna_job_round *round, unsigned int des)
+{
+	return round->base + (des - round->des_off);
+}
+
+/* a round may only be copied in ahead if it leaves the running one alone */
+static inline int soc_nna_round_overlap(const struct soc_nna_job_round *a, const struct soc_nna_job_round *b)
+{
+	return a->base < b->base + b->des_cnt && b->base < a->base + a->des_cnt;
+}
+
+#endif //__SOC_NNA_ROUND_H__
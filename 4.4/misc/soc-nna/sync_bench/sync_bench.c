@@ -0,0 +1,119 @@
+/*
+ * Per-inference cache sync time, one IOCTL_SOC_NNA_FLUSHCACHE per tensor
+ * against one IOCTL_SOC_NNA_SYNC_VEC for all of them.
+ *
+ * An "inference" writes back <in> input tensors and invalidates <out>
+ * output tensors of <kb> KiB each, every tensor its own pool buffer. The
+ * lines are clean, so this is the cost of the calls and of walking the
+ * ranges; the memory traffic of dirty lines comes on top in both cases.
+ * When the ranges add up to the cache size the vectored call flushes the
+ * whole cache instead, which is reported as well.
+ *
+ *   ./sync_bench [in] [out] [kb] [loops]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "../soc_nna.h"
+
+#define DMA_TO_DEVICE       1
+#define DMA_FROM_DEVICE     2
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int in = argc > 1 ? atoi(argv[1]) : 24;
+	unsigned int out = argc > 2 ? atoi(argv[2]) : 8;
+	unsigned int kb = argc > 3 ? atoi(argv[3]) : 16;
+	unsigned int loops = argc > 4 ? atoi(argv[4]) : 1000;
+	unsigned int num = in + out, i, l, full = 0;
+	struct soc_nna_buf *bufs = NULL;
+	struct soc_nna_sync_entry *ent = NULL;
+	struct soc_nna_sync_vec vec;
+	struct flush_cache_info info;
+	double t0, single_us, vec_us;
+	int fd, ret = 1;
+
+	if (!num || num > 256 || !kb) {
+		printf("usage: %s [in] [out] [kb] [loops], in + out <= 256\n", argv[0]);
+		return 1;
+	}
+	fd = open(SOC_NNA_DEVICE_NAME, O_RDWR);
+	if (fd < 0) {
+		perror("open " SOC_NNA_DEVICE_NAME);
+		return 1;
+	}
+	bufs = calloc(num, sizeof(*bufs));
+	ent = calloc(num, sizeof(*ent));
+	if (!bufs || !ent)
+		goto out;
+
+	for (i = 0; i < num; i++) {
+		bufs[i].size = kb * 1024;
+		if (ioctl(fd, IOCTL_SOC_NNA_MALLOC, &bufs[i]) < 0) {
+			perror("IOCTL_SOC_NNA_MALLOC");
+			num = i;
+			goto out;
+		}
+		ent[i].handle = (unsigned int)(unsigned long)bufs[i].paddr;
+		ent[i].offset = 0;
+		ent[i].len = kb * 1024;
+		ent[i].dir = i < in ? DMA_TO_DEVICE : DMA_FROM_DEVICE;
+	}
+
+	/* what the runtime did: a flush per tensor */
+	t0 = now_us();
+	for (l = 0; l < loops; l++) {
+		for (i = 0; i < num; i++) {
+			info.addr = (unsigned int)(unsigned long)bufs[i].vaddr;
+			info.len = ent[i].len;
+			info.dir = ent[i].dir;
+			if (ioctl(fd, IOCTL_SOC_NNA_FLUSHCACHE, &info) < 0) {
+				perror("IOCTL_SOC_NNA_FLUSHCACHE");
+				goto out;
+			}
+		}
+	}
+	single_us = (now_us() - t0) / loops;
+
+	/* all of them in one call */
+	t0 = now_us();
+	for (l = 0; l < loops; l++) {
+		memset(&vec, 0, sizeof(vec));
+		vec.entries = ent;
+		vec.num = num;
+		if (ioctl(fd, IOCTL_SOC_NNA_SYNC_VEC, &vec) < 0) {
+			perror("IOCTL_SOC_NNA_SYNC_VEC");
+			goto out;
+		}
+		full += vec.full;
+	}
+	vec_us = (now_us() - t0) / loops;
+
+	printf("%u in + %u out x %u KiB, %u inferences\n", in, out, kb, loops);
+	printf("  FLUSHCACHE per tensor: %8.1f us per inference\n", single_us);
+	printf("  SYNC_VEC:              %8.1f us per inference%s\n", vec_us,
+			full ? " (whole cache flushed)" : "");
+	printf("  %.2fx\n", vec_us > 0 ? single_us / vec_us : 0);
+	ret = 0;
+
+out:
+	for (i = 0; i < num; i++)
+		ioctl(fd, IOCTL_SOC_NNA_FREE, &bufs[i]);
+	free(ent);
+	free(bufs);
+	close(fd);
+	return ret;
+}
@@ -0,0 +1,145 @@
+#ifndef __AUDIO_RING_H__
+#define __AUDIO_RING_H__
+
+#include <linux/types.h>
+#include <linux/math64.h>
+#include <linux/time.h>
+
+/*
+ * Fragment ring tracking shared by the dsp frontends (oss2, oss3, hdmi).
+ *
+ * The dma loops over cnt fragments. A frontend keeps two indexes into the
+ * ring: dma_tracer, the first fragment the dma has not completed, and
+ * io_tracer, the application's, which has to stay clear of the fragments
+ * the dma is about to fill or play. These helpers do the index
+ * arithmetic, the fragment timestamps and the xrun accounting; locking,
+ * the buffers, cache maintenance and the copies stay with each frontend.
+ */
+
+static inline unsigned int audio_ring_add(unsigned int index, unsigned int n, unsigned int cnt)
+{
+	return (index + n % cnt) % cnt;
+}
+
+static inline unsigned int audio_ring_next(unsigned int index, unsigned int cnt)
+{
+	return audio_ring_add(index, 1, cnt);
+}
+
+/* fragments from 'from' up to, not including, 'to' */
+static inline unsigned int audio_ring_distance(unsigned int from, unsigned int to, unsigned int cnt)
+{
+	return (to + cnt - from) % cnt;
+}
+
+/*
+ * The fragment the dma is in, from the address it reported, and the byte
+ * offset into it. An address outside the ring (a channel not started yet,
+ * or a bogus read) returns cnt and the caller keeps its last position
+ * rather than wrapping it onto a random fragment.
+ */
+static inline unsigned int audio_ring_fragment(dma_addr_t addr, dma_addr_t base,
+		unsigned int fragment_size, unsigned int cnt, unsigned int *offset)
+{
+	unsigned int bytes = 0;
+
+	if(!fragment_size || addr < base || addr - base >= (dma_addr_t)fragment_size * cnt)
+		return cnt;
+	bytes = addr - base;
+	if(offset)
+		*offset = bytes % fragment_size;
+	return bytes / fragment_size;
+}
+
+/*
+ * The dma moved from hw to new_hw. The application is late when io is in
+ * a fragment the dma went through or in one of the lead fragments after
+ * new_hw; then io is moved to the first fragment past them and true is
+ * returned. A move that spans the whole ring always counts as late.
+ */
+static inline bool audio_ring_resync(unsigned int hw, unsigned int new_hw, unsigned int *io,
+		unsigned int lead, unsigned int cnt)
+{
+	unsigned int span = audio_ring_distance(hw, new_hw, cnt) + lead + 1;
+
+	if(span < cnt && audio_ring_distance(hw, *io, cnt) >= span)
+		return false;
+	*io = audio_ring_add(new_hw, lead + 1, cnt);
+	return true;
+}
+
+/* duration of a fragment of frames frames at rate */
+static inline u64 audio_ring_fragment_ns(unsigned int frames, unsigned int rate)
+{
+	if(!rate)
+		return 0;
+	return div_u64((u64)frames * NSEC_PER_SEC, rate);
+}
+
+/* when the dma started the fragment it is offset bytes into */
+static inline u64 audio_ring_tstamp(u64 now, unsigned int offset, unsigned int fragment_size, u64 fragment_ns)
+{
+	if(!fragment_size)
+		return now;
+	return now - div_u64((u64)offset * fragment_ns, fragment_size);
+}
+
+/*
+ * The dma started fragment hw at hw_tstamp. When it started fragment
+ * index, one it already finished, and when it will start index, one it
+ * has not reached yet.
+ */
+static inline u64 audio_ring_tstamp_done(u64 hw_tstamp, unsigned int hw, unsigned int index,
+		u64 fragment_ns, unsigned int cnt)
+{
+	return hw_tstamp - (u64)audio_ring_distance(index, hw, cnt) * fragment_ns;
+}
+
+static inline u64 audio_ring_tstamp_ahead(u64 hw_tstamp, unsigned int hw, unsigned int index,
+		u64 fragment_ns, unsigned int cnt)
+{
+	return hw_tstamp + (u64)audio_ring_distance(hw, index, cnt) * fragment_ns;
+}
+
+/*
+ * Xrun accounting: the capture ring overflowed or the playback ring ran
+ * dry, which audio_ring_resync() reports. An episode is counted once and
+ * lasts until the application's next transfer. With report set, that
+ * transfer is told about it instead of going ahead.
+ */
+struct audio_ring_xrun {
+	bool active;		/* in an xrun the application has not recovered from */
+	bool pending;		/* to be reported to the next transfer */
+	unsigned long long count;
+};
+
+static inline void audio_ring_xrun_reset(struct audio_ring_xrun *xrun)
+{
+	xrun->active = false;
+	xrun->pending = false;
+}
+
+/* true when this starts a new episode */
+static inline bool audio_ring_xrun(struct audio_ring_xrun *xrun, bool report)
+{
+	if(xrun->active)
+		return false;
+	xrun->active = true;
+	xrun->count++;
+	if(report)
+		xrun->pending = true;
+	return true;
+}
+
+/* called as a transfer starts, true when it has to report the xrun instead */
+static inline bool audio_ring_xrun_transfer(struct audio_ring_xrun *xrun)
+{
+	if(xrun->pending){
+		xrun->pending = false;
+		return true;
+	}
+	xrun->active = false;
+	return false;
+}
+
+#endif /* __AUDIO_RING_H__ */
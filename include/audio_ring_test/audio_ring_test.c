@@ -0,0 +1,296 @@
+/*
+ * Host test of include/audio_ring.h with a simulated dma.
+ *
+ * The dma is a byte position moving at a constant rate over a ring of cnt
+ * fragments; the frontend side is a timer reading the dma address and
+ * resyncing a playback application that writes ahead of it. The harness
+ * knows the unwrapped positions, so every tick is checked against the
+ * truth: the fragment and offset decoded from the address, whether the
+ * application really fell into the dma or its lead fragments, where it is
+ * put back, and the fragment start timestamps, of the fragment the dma is
+ * in, the ones it finished and the ones ahead of it. The xrun accounting
+ * is checked on its own. Scenarios: plain wrap with
+ * timer jitter, timers late by up to a ring, a stalled dma, and addresses
+ * outside the ring. Capture uses the same arithmetic with the roles of
+ * writer and reader swapped.
+ *
+ *   make run
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "../audio_ring.h"
+
+#define NS_PER_BYTE	125		/* 16 bits mono at 16 kHz is 2 bytes per 62.5 us */
+#define BASE		0x03f00000
+
+static int failures;
+
+#define CHECK(cond, ...) do {						\
+	if(!(cond)){							\
+		if(failures++ < 20){					\
+			printf("FAIL %s:%d: ", __func__, __LINE__);	\
+			printf(__VA_ARGS__);				\
+			printf("\n");					\
+		}							\
+	}								\
+} while(0)
+
+static unsigned int rnd(unsigned int n)
+{
+	return n ? (unsigned int)rand() % n : 0;
+}
+
+/* the index helpers against plain modular arithmetic */
+static void test_index(void)
+{
+	unsigned int cnt, a, b, n;
+
+	for(cnt = 1; cnt <= 17; cnt++){
+		for(a = 0; a < cnt; a++){
+			CHECK(audio_ring_next(a, cnt) == (a + 1) % cnt, "next %u/%u", a, cnt);
+			for(n = 0; n < 3 * cnt; n++)
+				CHECK(audio_ring_add(a, n, cnt) == (a + n) % cnt, "add %u+%u/%u", a, n, cnt);
+			for(b = 0; b < cnt; b++){
+				CHECK(audio_ring_distance(a, b, cnt) == (b + cnt - a) % cnt, "distance %u..%u/%u", a, b, cnt);
+				CHECK(audio_ring_add(a, audio_ring_distance(a, b, cnt), cnt) == b, "add(distance) %u..%u/%u", a, b, cnt);
+			}
+		}
+	}
+}
+
+/* addresses on, between and outside the fragments */
+static void test_fragment(void)
+{
+	unsigned int cnt = 5, size = 640, offset = 0, index;
+	dma_addr_t addr;
+
+	for(addr = BASE; addr < BASE + cnt * size; addr++){
+		offset = ~0u;
+		index = audio_ring_fragment(addr, BASE, size, cnt, &offset);
+		CHECK(index == (addr - BASE) / size && offset == (addr - BASE) % size, "address 0x%x", addr);
+	}
+	offset = 7;
+	CHECK(audio_ring_fragment(BASE - 1, BASE, size, cnt, &offset) == cnt && offset == 7, "below the ring");
+	CHECK(audio_ring_fragment(BASE + cnt * size, BASE, size, cnt, &offset) == cnt && offset == 7, "past the ring");
+	CHECK(audio_ring_fragment(0, BASE, size, cnt, &offset) == cnt, "channel not started");
+	CHECK(audio_ring_fragment(BASE, BASE, 0, cnt, &offset) == cnt, "no fragment size");
+	CHECK(audio_ring_fragment(BASE + 3, BASE, size, cnt, NULL) == 0, "no offset wanted");
+	CHECK(audio_ring_fragment_ns(320, 16000) == 20000000, "20 ms at 16 kHz");
+	CHECK(audio_ring_fragment_ns(441, 44100) == 10000000, "10 ms at 44.1 kHz");
+	CHECK(audio_ring_fragment_ns(320, 0) == 0, "no rate");
+}
+
+enum scenario {
+	JITTER,			/* ticks every fragment, +-40% */
+	LATE,			/* some ticks up to a ring late */
+	STALL,			/* the dma stops for a while, then resumes */
+	BOGUS,			/* the address register sometimes reads garbage */
+};
+
+static const char *const scenario_name[] = { "jitter", "late timer", "stalled dma", "bogus address" };
+
+struct sim {
+	unsigned int cnt, size, lead;
+	u64 fragment_ns;
+	/* the truth */
+	u64 now;
+	u64 dma_pos;			/* bytes the dma went through */
+	u64 dma_start_ns;		/* when it was at dma_pos = 0 before any stall */
+	u64 app;				/* fragments the application wrote */
+	u64 last_dmaf;			/* dma fragment at the last tick */
+	/* the frontend's view */
+	unsigned int hw, io;
+	u64 last_tstamp;
+	/* what happened */
+	unsigned int ticks, xruns, aliased, stalled, ignored;
+};
+
+/* one timer tick of the frontend, checked against the truth */
+static void tick(struct sim *s, enum scenario sc, bool stalled)
+{
+	unsigned int ring = s->cnt * s->size;
+	dma_addr_t addr = BASE + s->dma_pos % ring;
+	u64 dmaf = s->dma_pos / s->size;
+	unsigned int new_hw, offset = 0;
+	bool late, expect;
+	u64 tstamp;
+
+	if(sc == BOGUS && !rnd(8))
+		addr = rnd(2) ? BASE + ring + rnd(ring) : rnd(BASE);
+	new_hw = audio_ring_fragment(addr, BASE, s->size, s->cnt, &offset);
+	if(new_hw == s->cnt){
+		/* the frontend keeps its last position */
+		CHECK(addr < BASE || addr >= BASE + ring, "address 0x%x rejected", addr);
+		s->ignored++;
+		return;
+	}
+	CHECK(new_hw == dmaf % s->cnt && offset == s->dma_pos % s->size,
+			"decoded %u+%u, dma at %llu+%llu", new_hw, offset,
+			(unsigned long long)(dmaf % s->cnt), (unsigned long long)(s->dma_pos % s->size));
+	s->ticks++;
+
+	/* the harness can only judge a tick that saw less than a ring go by */
+	expect = s->app < dmaf + s->lead + 1;
+	late = audio_ring_resync(s->hw, new_hw, &s->io, s->lead, s->cnt);
+	if(dmaf - s->last_dmaf < s->cnt)
+		CHECK(late == expect, "resync said %s, application %llu dma %llu lead %u",
+				late ? "late" : "in time", (unsigned long long)s->app,
+				(unsigned long long)dmaf, s->lead);
+	if(late){
+		s->xruns++;
+		s->app = dmaf + s->lead + 1;
+	}
+	if(dmaf - s->last_dmaf >= s->cnt){
+		/*
+		 * A whole ring went by between two ticks, the index arithmetic
+		 * sees it modulo cnt. Follow the frontend from here.
+		 */
+		s->aliased++;
+		s->app = dmaf + audio_ring_distance(new_hw, s->io, s->cnt);
+	}
+	s->last_dmaf = dmaf;
+	CHECK(s->io == s->app % s->cnt, "io %u, application at %llu", s->io, (unsigned long long)(s->app % s->cnt));
+	CHECK(audio_ring_distance(new_hw, s->io, s->cnt) > s->lead,
+			"io %u inside the dma %u or its %u lead fragments", s->io, new_hw, s->lead);
+	s->hw = new_hw;
+
+	/* the start of the fragment the dma is in, from the offset it reported */
+	tstamp = audio_ring_tstamp(s->now, offset, s->size, s->fragment_ns);
+	if(!stalled)
+		CHECK(tstamp == s->dma_start_ns + dmaf * s->fragment_ns,
+				"tstamp %llu, fragment started at %llu", (unsigned long long)tstamp,
+				(unsigned long long)(s->dma_start_ns + dmaf * s->fragment_ns));
+	if(!stalled && dmaf){
+		u64 ahead = audio_ring_distance(new_hw, s->io, s->cnt);
+
+		CHECK(audio_ring_tstamp_done(tstamp, new_hw, audio_ring_add(new_hw, s->cnt - 1, s->cnt),
+				s->fragment_ns, s->cnt) == s->dma_start_ns + (dmaf - 1) * s->fragment_ns,
+				"tstamp of the fragment done before %u", new_hw);
+		CHECK(audio_ring_tstamp_ahead(tstamp, new_hw, s->io, s->fragment_ns, s->cnt)
+				== s->dma_start_ns + (dmaf + ahead) * s->fragment_ns,
+				"tstamp of io %u, %llu fragments ahead of %u", s->io, (unsigned long long)ahead, new_hw);
+	}
+	CHECK(tstamp <= s->now, "tstamp in the future");
+	CHECK(tstamp >= s->last_tstamp, "tstamp went back");
+	s->last_tstamp = tstamp;
+}
+
+static void run(enum scenario sc, unsigned int rounds)
+{
+	struct sim s;
+	unsigned int r, i, n;
+	unsigned int ticks = 0, xruns = 0, aliased = 0, stalled_ticks = 0, ignored = 0;
+	u64 dt, stall_until = 0;
+	bool stalled;
+
+	for(r = 0; r < rounds; r++){
+		s = (struct sim){ 0 };
+		s.lead = rnd(3);
+		s.cnt = s.lead + 3 + rnd(14);
+		s.size = 4 * (16 + rnd(1024));
+		s.fragment_ns = (u64)s.size * NS_PER_BYTE;
+		/* the dma starts with the lead fragments queued */
+		s.app = s.lead + 1;
+		s.io = s.app % s.cnt;
+		s.now = s.dma_start_ns = 1000000 + rnd(1000000);
+		stall_until = 0;
+
+		for(i = 0; i < 2000; i++){
+			dt = s.fragment_ns * (60 + rnd(81)) / 100;
+			if(sc == LATE && !rnd(10))
+				dt = s.fragment_ns * (1 + rnd(s.cnt - 1)) + rnd(s.fragment_ns);
+			if(sc == STALL && !stall_until && !rnd(50))
+				stall_until = s.now + s.fragment_ns * (1 + rnd(3 * s.cnt));
+			/* whole bytes, so the reported offset is exact */
+			dt = dt / NS_PER_BYTE * NS_PER_BYTE;
+			stalled = stall_until && s.now < stall_until;
+			s.now += dt;
+			if(stalled){
+				/* a stalled dma keeps its address, time goes on */
+				s.dma_start_ns += dt;
+				s.stalled++;
+			}else{
+				s.dma_pos = (s.now - s.dma_start_ns) / NS_PER_BYTE;
+				if(stall_until && s.now >= stall_until)
+					stall_until = 0;
+			}
+			tick(&s, sc, stalled);
+
+			/* the application writes what fits, sometimes less, sometimes nothing */
+			n = rnd(4) ? s.cnt : rnd(2);
+			while(n-- && audio_ring_next(s.io, s.cnt) != s.hw){
+				s.io = audio_ring_next(s.io, s.cnt);
+				s.app++;
+			}
+		}
+		ticks += s.ticks;
+		xruns += s.xruns;
+		aliased += s.aliased;
+		stalled_ticks += s.stalled;
+		ignored += s.ignored;
+	}
+	printf("%-14s %u rings: %u ticks, %u xruns, %u stalled, %u a ring late, %u addresses ignored\n",
+			scenario_name[sc], rounds, ticks, xruns, stalled_ticks, aliased, ignored);
+}
+
+static void test_xrun(void)
+{
+	struct audio_ring_xrun xrun = { 0 };
+
+	/* an episode counts once, however many resyncs it spans */
+	CHECK(audio_ring_xrun(&xrun, false) && xrun.count == 1, "first xrun");
+	CHECK(!audio_ring_xrun(&xrun, false) && xrun.count == 1, "same episode counted again");
+	CHECK(!audio_ring_xrun_transfer(&xrun) && !xrun.active, "unreported xrun held a transfer back");
+	CHECK(audio_ring_xrun(&xrun, false) && xrun.count == 2, "episode after a transfer");
+
+	/* a reported one stops the next transfer only, the one after clears it */
+	audio_ring_xrun_reset(&xrun);
+	CHECK(audio_ring_xrun(&xrun, true) && xrun.pending, "reported xrun not pending");
+	CHECK(audio_ring_xrun_transfer(&xrun), "reported xrun not returned");
+	CHECK(!audio_ring_xrun(&xrun, true) && xrun.count == 3, "episode over before the next transfer");
+	CHECK(!audio_ring_xrun_transfer(&xrun) && !xrun.active, "xrun returned twice");
+
+	/* reset ends an episode and drops the report, not the count */
+	CHECK(audio_ring_xrun(&xrun, true) && xrun.count == 4, "episode after recovery");
+	audio_ring_xrun_reset(&xrun);
+	CHECK(!xrun.active && !xrun.pending && xrun.count == 4, "reset");
+}
+
+/* a ring and more: the ring alone cannot tell, the io still ends up clear */
+static void test_aliasing(void)
+{
+	unsigned int cnt, lead, hw, io, moved, new_hw;
+
+	for(cnt = 3; cnt <= 12; cnt++)
+		for(lead = 0; lead + 2 < cnt; lead++)
+			for(hw = 0; hw < cnt; hw++)
+				for(io = 0; io < cnt; io++)
+					for(moved = 0; moved < 3 * cnt; moved++){
+						unsigned int new_io = io;
+
+						new_hw = audio_ring_add(hw, moved, cnt);
+						audio_ring_resync(hw, new_hw, &new_io, lead, cnt);
+						CHECK(audio_ring_distance(new_hw, new_io, cnt) > lead,
+								"cnt %u lead %u: io %u left in the dma window", cnt, lead, new_io);
+					}
+}
+
+int main(int argc, const char *argv[])
+{
+	unsigned int rounds = argc > 1 ? atoi(argv[1]) : 200;
+	int sc;
+
+	srand(1);
+	test_index();
+	test_fragment();
+	test_xrun();
+	test_aliasing();
+	for(sc = JITTER; sc <= BOGUS; sc++)
+		run(sc, rounds);
+	if(failures){
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	printf("all passed\n");
+	return 0;
+}
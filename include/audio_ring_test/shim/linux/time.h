@@ -0,0 +1,6 @@
+#ifndef _SHIM_LINUX_TIME_H
+#define _SHIM_LINUX_TIME_H
+
+#define NSEC_PER_SEC	1000000000L
+
+#endif
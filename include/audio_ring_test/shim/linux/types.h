@@ -0,0 +1,12 @@
+/* just enough of the kernel headers to build audio_ring.h on the host */
+#ifndef _SHIM_LINUX_TYPES_H
+#define _SHIM_LINUX_TYPES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef uint64_t u64;
+typedef uint32_t u32;
+typedef u32 dma_addr_t;		/* 32 bits on the T31 and A1 */
+
+#endif